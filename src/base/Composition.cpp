@@ -26,6 +26,7 @@
 #include "BasicQuantizer.h"
 #include "NotationQuantizer.h"
 #include "base/AudioLevel.h"
+#include "base/PoolAllocator.h"
 
 #include <algorithm>
 #include <cmath>
@@ -50,7 +51,7 @@ namespace Rosegarden
 const PropertyName Composition::NoAbsoluteTimeProperty("NoAbsoluteTime");
 const PropertyName Composition::BarNumberProperty("BarNumber");
 
-const std::string Composition::TempoEventType("tempo");
+const std::string &Composition::TempoEventType = Event::internType("tempo");
 const PropertyName Composition::TempoProperty("Tempo");
 const PropertyName Composition::TargetTempoProperty("TargetTempo");
 const PropertyName Composition::TempoTimestampProperty("TimestampSec");
@@ -247,6 +248,7 @@ Composition::Composition() :
     m_tempoSegment(TempoEventType),
     m_barPositionsNeedCalculating(true),
     m_tempoTimestampsNeedCalculating(true),
+    m_tempoMapVersion(0),
     m_basicQuantizer(new BasicQuantizer()),
     m_notationQuantizer(new NotationQuantizer()),
     m_position(0),
@@ -717,6 +719,8 @@ void
 Composition::setStartMarker(const timeT &sM)
 {
     m_startMarker = sM;
+    // Bar numbers are counted from the start marker.
+    m_barPositionsNeedCalculating = true;
     updateRefreshStatuses();
 }
 
@@ -727,6 +731,10 @@ Composition::setEndMarker(const timeT &endMarker)
 
     m_endMarker = endMarker;
 
+    // A ramp on the last tempo change ends at the end marker.
+    m_tempoTimestampsNeedCalculating = true;
+    ++m_tempoMapVersion;
+
     clearVoiceCaches();
     updateRefreshStatuses();
     notifyEndMarkerChange(shorten);
@@ -745,7 +753,10 @@ Composition::clear()
 
     m_timeSigSegment.clear();
     m_tempoSegment.clear();
+    m_barPositionsNeedCalculating = true;
+    m_tempoTimestampsNeedCalculating = true;
     m_defaultTempo = getTempoForQpm(120.0);
+    ++m_tempoMapVersion;
     m_minTempo = 0;
     m_maxTempo = 0;
     m_loopMode = LoopOff;
@@ -756,6 +767,9 @@ Composition::clear()
     m_endMarker = getBarRange(defaultNumberOfBars).first;
     m_selectedTrackId = 0;
     updateRefreshStatuses();
+
+    // Hand the Events we just freed back to the shared pools.
+    FixedSizePool::flushThreadCache();
 }
 
 void
@@ -770,6 +784,9 @@ Composition::calculateBarPositions() const
     ReferenceSegment &t = m_timeSigSegment;
     ReferenceSegment::iterator i;
 
+    m_barMap.clear();
+    m_barMap.reserve(t.size());
+
     timeT lastBarNo = 0;
     timeT lastSigTime = 0;
     timeT barDuration = TimeSignature().getBarDuration();
@@ -806,9 +823,13 @@ Composition::calculateBarPositions() const
 
         (*i)->set<Int>(BarNumberProperty, n);
 
+        const TimeSignature timeSig(**i);
+
         lastBarNo = n;
         lastSigTime = myTime;
-        barDuration = TimeSignature(**i).getBarDuration();
+        barDuration = timeSig.getBarDuration();
+
+        m_barMap.push_back(BarMapEntry{myTime, n, barDuration, timeSig});
     }
 
     m_barPositionsNeedCalculating = false;
@@ -833,16 +854,20 @@ int
 Composition::getBarNumber(timeT t) const
 {
     calculateBarPositions();
-    ReferenceSegment::iterator i = m_timeSigSegment.findAtOrBefore(t);
+
+    // Last time signature at or before t.
+    std::vector<BarMapEntry>::const_iterator i = std::upper_bound
+        (m_barMap.begin(), m_barMap.end(), t,
+         [](timeT time, const BarMapEntry &entry)
+             { return time < entry.time; });
     int n;
 
-    if (i == m_timeSigSegment.end()) { // precedes any time signatures
+    if (i == m_barMap.begin()) { // precedes any time signatures
 
         timeT bd = TimeSignature().getBarDuration();
-        if (t < 0) { // see comment in getTimeSignatureAtAux
-            i = m_timeSigSegment.begin();
-            if (i != m_timeSigSegment.end() && (*i)->getAbsoluteTime() <= 0) {
-                bd = TimeSignature(**i).getBarDuration();
+        if (t < 0) { // see comment in getTimeSignatureIndexAt
+            if (!m_barMap.empty() && m_barMap.front().time <= 0) {
+                bd = m_barMap.front().barDuration;
             }
         }
 
@@ -857,9 +882,8 @@ Composition::getBarNumber(timeT t) const
 
     } else {
 
-        n = (*i)->get<Int>(BarNumberProperty);
-        timeT offset = t - (*i)->getAbsoluteTime();
-        n += offset / TimeSignature(**i).getBarDuration();
+        --i;
+        n = i->barNumber + (t - i->time) / i->barDuration;
     }
 
 #ifdef DEBUG_BAR_STUFF
@@ -881,28 +905,26 @@ Composition::getBarRange(int n) const
 {
     calculateBarPositions();
 
-    Event dummy("dummy", 0);
-    dummy.set<Int>(BarNumberProperty, n);
-
-    ReferenceSegment::iterator j = std::lower_bound
-        (m_timeSigSegment.begin(), m_timeSigSegment.end(),
-         &dummy, BarNumberComparator());
-    ReferenceSegment::iterator i = j;
+    // First time signature at or after bar n.
+    std::vector<BarMapEntry>::const_iterator j = std::lower_bound
+        (m_barMap.begin(), m_barMap.end(), n,
+         [](const BarMapEntry &entry, int barNumber)
+             { return entry.barNumber < barNumber; });
+    std::vector<BarMapEntry>::const_iterator i = j;
 
-    if (i == m_timeSigSegment.end() || (*i)->get<Int>(BarNumberProperty) > n) {
-        if (i == m_timeSigSegment.begin()) i = m_timeSigSegment.end();
+    if (i == m_barMap.end() || i->barNumber > n) {
+        if (i == m_barMap.begin()) i = m_barMap.end();
         else --i;
     } else ++j; // j needs to point to following barline
 
     timeT start, finish;
 
-    if (i == m_timeSigSegment.end()) { // precedes any time sig changes
+    if (i == m_barMap.end()) { // precedes any time sig changes
 
         timeT barDuration = TimeSignature().getBarDuration();
-        if (n < 0) { // see comment in getTimeSignatureAtAux
-            i = m_timeSigSegment.begin();
-            if (i != m_timeSigSegment.end() && (*i)->getAbsoluteTime() <= 0) {
-                barDuration = TimeSignature(**i).getBarDuration();
+        if (n < 0) { // see comment in getTimeSignatureIndexAt
+            if (!m_barMap.empty() && m_barMap.front().time <= 0) {
+                barDuration = m_barMap.front().barDuration;
             }
         }
 
@@ -915,10 +937,8 @@ Composition::getBarRange(int n) const
 
     } else {
 
-        timeT barDuration = TimeSignature(**i).getBarDuration();
-        start = (*i)->getAbsoluteTime() +
-            (n - (*i)->get<Int>(BarNumberProperty)) * barDuration;
-        finish = start + barDuration;
+        start = i->time + (n - i->barNumber) * i->barDuration;
+        finish = start + i->barDuration;
 
 #ifdef DEBUG_BAR_STUFF
     RG_DEBUG << "getBarRange(): [2] bar " << n << ": (" << start << " -> " << finish << ")";
@@ -926,8 +946,8 @@ Composition::getBarRange(int n) const
     }
 
     // partial bar
-    if (j != m_timeSigSegment.end() && finish > (*j)->getAbsoluteTime()) {
-        finish = (*j)->getAbsoluteTime();
+    if (j != m_barMap.end() && finish > j->time) {
+        finish = j->time;
 #ifdef DEBUG_BAR_STUFF
     RG_DEBUG << "getBarRange(): [3] bar " << n << ": (" << start << " -> " << finish << ")";
 #endif
@@ -964,14 +984,14 @@ Composition::getTimeSignatureAt(timeT t) const
 timeT
 Composition::getTimeSignatureAt(timeT t, TimeSignature &timeSig) const
 {
-    ReferenceSegment::iterator i = getTimeSignatureAtAux(t);
+    const int i = getTimeSignatureIndexAt(t);
 
-    if (i == m_timeSigSegment.end()) {
+    if (i < 0) {
         timeSig = TimeSignature();
         return 0;
     } else {
-        timeSig = TimeSignature(**i);
-        return (*i)->getAbsoluteTime();
+        timeSig = m_barMap[i].timeSignature;
+        return m_barMap[i].time;
     }
 }
 
@@ -981,18 +1001,24 @@ Composition::getTimeSignatureInBar(int barNo, bool &isNew) const
     isNew = false;
     timeT t = getBarRange(barNo).first;
 
-    ReferenceSegment::iterator i = getTimeSignatureAtAux(t);
+    const int i = getTimeSignatureIndexAt(t);
 
-    if (i == m_timeSigSegment.end()) return TimeSignature();
-    if (t == (*i)->getAbsoluteTime()) isNew = true;
+    if (i < 0) return TimeSignature();
+    if (t == m_barMap[i].time) isNew = true;
 
-    return TimeSignature(**i);
+    return m_barMap[i].timeSignature;
 }
 
-Composition::ReferenceSegment::iterator
-Composition::getTimeSignatureAtAux(timeT t) const
+int
+Composition::getTimeSignatureIndexAt(timeT t) const
 {
-    ReferenceSegment::iterator i = m_timeSigSegment.findAtOrBefore(t);
+    calculateBarPositions();
+
+    // Last time signature at or before t.
+    int i = int(std::upper_bound
+                (m_barMap.begin(), m_barMap.end(), t,
+                 [](timeT time, const BarMapEntry &entry)
+                     { return time < entry.time; }) - m_barMap.begin()) - 1;
 
     // In negative time, if there's no time signature actually defined
     // prior to the point of interest then we use the next time
@@ -1001,10 +1027,9 @@ Composition::getTimeSignatureAtAux(timeT t) const
     // the correct time signature otherwise won't appear until we hit
     // bar zero.
 
-    if (t < 0 && i == m_timeSigSegment.end()) {
-        i = m_timeSigSegment.begin();
-        if (i != m_timeSigSegment.end() && (*i)->getAbsoluteTime() > 0) {
-            i  = m_timeSigSegment.end();
+    if (t < 0 && i < 0) {
+        if (!m_barMap.empty() && m_barMap.front().time <= 0) {
+            i = 0;
         }
     }
 
@@ -1020,17 +1045,16 @@ Composition::getTimeSignatureCount() const
 int
 Composition::getTimeSignatureNumberAt(timeT t) const
 {
-    ReferenceSegment::iterator i = getTimeSignatureAtAux(t);
-    if (i == m_timeSigSegment.end()) return -1;
-    else return std::distance(m_timeSigSegment.begin(), i);
+    return getTimeSignatureIndexAt(t);
 }
 
 std::pair<timeT, TimeSignature>
 Composition::getTimeSignatureChange(int n) const
 {
+    calculateBarPositions();
+
     return std::pair<timeT, TimeSignature>
-        (m_timeSigSegment[n]->getAbsoluteTime(),
-         TimeSignature(*m_timeSigSegment[n]));
+        (m_barMap[n].time, m_barMap[n].timeSignature);
 }
 
 void
@@ -1046,7 +1070,9 @@ Composition::removeTimeSignature(int n)
 tempoT
 Composition::getTempoAtTime(timeT t) const
 {
-    ReferenceSegment::iterator i = m_tempoSegment.findAtOrBefore(t);
+    calculateTempoTimestamps();
+
+    const int i = getTempoMapIndexAt(t);
 
     // In negative time, if there's no tempo event actually defined
     // prior to the point of interest then we use the next one after
@@ -1055,7 +1081,7 @@ Composition::getTempoAtTime(timeT t) const
     // tempo otherwise won't appear until we hit bar zero.  See also
     // getTimeSignatureAt
 
-    if (i == m_tempoSegment.end()) {
+    if (i < 0) {
         if (t < 0) {
 #ifdef DEBUG_TEMPO_STUFF
             RG_DEBUG << "getTempoAtTime(): Negative time " << t << " for tempo, using 0";
@@ -1065,45 +1091,29 @@ Composition::getTempoAtTime(timeT t) const
         else return m_defaultTempo;
     }
 
-    tempoT tempo = (tempoT)((*i)->get<Int>(TempoProperty));
-
-    if ((*i)->has(TargetTempoProperty)) {
-
-        tempoT target = (tempoT)((*i)->get<Int>(TargetTempoProperty));
-        ReferenceSegment::iterator j = i;
-        ++j;
-
-        if (target > 0 || (target == 0 && j != m_tempoSegment.end())) {
+    const TempoMapEntry &entry = m_tempoMap[i];
 
-            timeT t0 = (*i)->getAbsoluteTime();
-            timeT t1 = (j != m_tempoSegment.end() ?
-                        (*j)->getAbsoluteTime() : getEndMarker());
+    if (entry.target > 0  &&  entry.targetTime > entry.time) {
 
-            if (t1 < t0) return tempo;
+        // tempo ramps are linear in 1/tempo
+        double s0 = 1.0 / double(entry.tempo);
+        double s1 = 1.0 / double(entry.target);
+        double s = s0 + (t - entry.time) *
+            ((s1 - s0) / (entry.targetTime - entry.time));
 
-            if (target == 0) {
-                target = (tempoT)((*j)->get<Int>(TempoProperty));
-            }
-
-            // tempo ramps are linear in 1/tempo
-            double s0 = 1.0 / double(tempo);
-            double s1 = 1.0 / double(target);
-            double s = s0 + (t - t0) * ((s1 - s0) / (t1 - t0));
-
-            tempoT result = tempoT((1.0 / s) + 0.01);
+        tempoT result = tempoT((1.0 / s) + 0.01);
 
 #ifdef DEBUG_TEMPO_STUFF
-            RG_DEBUG << "getTempoAtTime(): Calculated tempo " << result << " at " << t;
+        RG_DEBUG << "getTempoAtTime(): Calculated tempo " << result << " at " << t;
 #endif
 
-            return result;
-        }
+        return result;
     }
 
 #ifdef DEBUG_TEMPO_STUFF
-    RG_DEBUG << "getTempoAtTime(): Found tempo " << tempo << " at " << t;
+    RG_DEBUG << "getTempoAtTime(): Found tempo " << entry.tempo << " at " << t;
 #endif
-    return tempo;
+    return entry.tempo;
 }
 
 int
@@ -1154,6 +1164,7 @@ Composition::addTempoAtTime(timeT time, tempoT tempo, tempoT targetTempo)
     }
 
     m_tempoTimestampsNeedCalculating = true;
+    ++m_tempoMapVersion;
     updateRefreshStatuses();
 
 #ifdef DEBUG_TEMPO_STUFF
@@ -1173,17 +1184,15 @@ Composition::getTempoChangeCount() const
 int
 Composition::getTempoChangeNumberAt(timeT t) const
 {
-    ReferenceSegment::iterator i = m_tempoSegment.findAtOrBefore(t);
-    if (i == m_tempoSegment.end()) return -1;
-    else return std::distance(m_tempoSegment.begin(), i);
+    calculateTempoTimestamps();
+    return getTempoMapIndexAt(t);
 }
 
 std::pair<timeT, tempoT>
 Composition::getTempoChange(int n) const
 {
-    return std::pair<timeT, tempoT>
-        (m_tempoSegment[n]->getAbsoluteTime(),
-         tempoT(m_tempoSegment[n]->get<Int>(TempoProperty)));
+    calculateTempoTimestamps();
+    return std::pair<timeT, tempoT>(m_tempoMap[n].time, m_tempoMap[n].tempo);
 }
 
 std::pair<bool, tempoT>
@@ -1219,6 +1228,7 @@ Composition::removeTempoChange(int n)
 
     m_tempoSegment.eraseEvent(m_tempoSegment[n]);
     m_tempoTimestampsNeedCalculating = true;
+    ++m_tempoMapVersion;
 
     if (oldTempo == m_minTempo ||
         oldTempo == m_maxTempo ||
@@ -1294,36 +1304,31 @@ Composition::getElapsedRealTime(timeT t) const
 {
     calculateTempoTimestamps();
 
-    ReferenceSegment::iterator i = m_tempoSegment.findAtOrBefore(t);
-    if (i == m_tempoSegment.end()) {
-        i = m_tempoSegment.begin();
+    int i = getTempoMapIndexAt(t);
+    if (i < 0) {
         if (t >= 0 ||
-            (i == m_tempoSegment.end() || (*i)->getAbsoluteTime() > 0)) {
+            (m_tempoMap.empty() || m_tempoMap.front().time > 0)) {
             return time2RealTime(t, m_defaultTempo);
         }
+        i = 0;
     }
 
+    const TempoMapEntry &entry = m_tempoMap[i];
     RealTime elapsed;
 
-    tempoT target = -1;
-    timeT nextTempoTime = t;
-
-    if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
-
-    if (target > 0) {
-        elapsed = getTempoTimestamp(*i) +
-            time2RealTime(t - (*i)->getAbsoluteTime(),
-                          tempoT((*i)->get<Int>(TempoProperty)),
-                          nextTempoTime - (*i)->getAbsoluteTime(),
-                          target);
+    if (entry.target > 0) {
+        elapsed = entry.realTime +
+            time2RealTime(t - entry.time,
+                          entry.tempo,
+                          entry.targetTime - entry.time,
+                          entry.target);
     } else {
-        elapsed = getTempoTimestamp(*i) +
-            time2RealTime(t - (*i)->getAbsoluteTime(),
-                          tempoT((*i)->get<Int>(TempoProperty)));
+        elapsed = entry.realTime +
+            time2RealTime(t - entry.time, entry.tempo);
     }
 
 #ifdef DEBUG_TEMPO_STUFF
-    RG_DEBUG << "getElapsedRealTime(): " << t << " -> " << elapsed << " (last tempo change at " << (*i)->getAbsoluteTime() << ")";
+    RG_DEBUG << "getElapsedRealTime(): " << t << " -> " << elapsed << " (last tempo change at " << entry.time << ")";
 #endif
 
     return elapsed;
@@ -1342,13 +1347,13 @@ Composition::getElapsedRealTime(timeT t) const
     const RealTime realStart = time2RealTime(start, m_defaultTempo);
 
     // Elapsed time is dependent on tempo changes.  Find the previous one.
-    ReferenceSegment::iterator tempoIter = m_tempoSegment.findAtOrBefore(t);
+    int tempoIndex = getTempoMapIndexAt(t);
     // None found?  We should probably use the default tempo.
-    if (tempoIter == m_tempoSegment.end()) {
+    if (tempoIndex < 0) {
         // Try the first, if any.
         // ??? If present, this will be after t.  So it is useless.
-        // ??? Make this a new firstTempoIter for clarity.
-        tempoIter = m_tempoSegment.begin();
+        // ??? Make this a new firstTempoIndex for clarity.
+        tempoIndex = 0;
 
         // If the tempo segment is empty OR the first tempo change is
         // after the composition start OR t is after the composition start...
@@ -1368,8 +1373,8 @@ Composition::getElapsedRealTime(timeT t) const
         //     If the tempo segment is empty OR the first tempo change
         //     is after the anacrusis OR t is after the anacrusis.
         if (t >= start ||
-            (tempoIter == m_tempoSegment.end() ||  // tempo segment empty?
-                 (*tempoIter)->getAbsoluteTime() > start)) {  // tempo change is after composition start?
+            (m_tempoMap.empty() ||  // tempo segment empty?
+                 m_tempoMap.front().time > start)) {  // tempo change is after composition start?
             // Perform a simple pulses to seconds conversion using the
             // default tempo.
             RealTime rt = time2RealTime(t, m_defaultTempo);
@@ -1408,27 +1413,22 @@ Composition::getElapsedRealTime(timeT t) const
         //     inadvertently became, "is t not within the anacrusis".
     }
 
+    const TempoMapEntry &entry = m_tempoMap[tempoIndex];
     RealTime elapsed;
 
-    tempoT target = -1;
-    timeT nextTempoTime = t;
-
-    if (!getTempoTarget(tempoIter, target, nextTempoTime)) target = -1;
-
-    if (target > 0) {
-        elapsed = getTempoTimestamp(*tempoIter) +
-            time2RealTime(t - (*tempoIter)->getAbsoluteTime(),
-                          tempoT((*tempoIter)->get<Int>(TempoProperty)),
-                          nextTempoTime - (*tempoIter)->getAbsoluteTime(),
-                          target);
+    if (entry.target > 0) {
+        elapsed = entry.realTime +
+            time2RealTime(t - entry.time,
+                          entry.tempo,
+                          entry.targetTime - entry.time,
+                          entry.target);
     } else {
-        elapsed = getTempoTimestamp(*tempoIter) +
-            time2RealTime(t - (*tempoIter)->getAbsoluteTime(),
-                          tempoT((*tempoIter)->get<Int>(TempoProperty)));
+        elapsed = entry.realTime +
+            time2RealTime(t - entry.time, entry.tempo);
     }
 
 #ifdef DEBUG_TEMPO_STUFF
-    RG_DEBUG << "getElapsedRealTime(): " << t << " -> " << elapsed << " (last tempo change at " << (*tempoIter)->getAbsoluteTime() << ")";
+    RG_DEBUG << "getElapsedRealTime(): " << t << " -> " << elapsed << " (last tempo change at " << entry.time << ")";
 #endif
 
     elapsed = elapsed - realStart;
@@ -1445,31 +1445,27 @@ Composition::getElapsedTimeForRealTime(RealTime t) const
 {
     calculateTempoTimestamps();
 
-    ReferenceSegment::iterator i = m_tempoSegment.findAtOrBefore(t);
-    if (i == m_tempoSegment.end()) {
-        i = m_tempoSegment.begin();
+    int i = getTempoMapIndexAt(t);
+    if (i < 0) {
         if (t >= RealTime::zero()  ||
-            (i == m_tempoSegment.end() || (*i)->getAbsoluteTime() > 0)) {
+            (m_tempoMap.empty() || m_tempoMap.front().time > 0)) {
             return realTime2Time(t, m_defaultTempo);
         }
+        i = 0;
     }
 
+    const TempoMapEntry &entry = m_tempoMap[i];
     timeT elapsed;
 
-    tempoT target = -1;
-    timeT nextTempoTime = 0;
-    if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
-
-    if (target > 0) {
-        elapsed = (*i)->getAbsoluteTime() +
-            realTime2Time(t - getTempoTimestamp(*i),
-                          (tempoT)((*i)->get<Int>(TempoProperty)),
-                          nextTempoTime - (*i)->getAbsoluteTime(),
-                          target);
+    if (entry.target > 0) {
+        elapsed = entry.time +
+            realTime2Time(t - entry.realTime,
+                          entry.tempo,
+                          entry.targetTime - entry.time,
+                          entry.target);
     } else {
-        elapsed = (*i)->getAbsoluteTime() +
-            realTime2Time(t - getTempoTimestamp(*i),
-                          (tempoT)((*i)->get<Int>(TempoProperty)));
+        elapsed = entry.time +
+            realTime2Time(t - entry.realTime, entry.tempo);
     }
 
 #ifdef DEBUG_TEMPO_STUFF
@@ -1482,8 +1478,7 @@ Composition::getElapsedTimeForRealTime(RealTime t) const
         RG_DEBUG << "getElapsedTimeForRealTime(): " << t << " -> "
              << elapsed << " (error " << (cfReal - t)
              << " or " << (cfTimeT - elapsed) << ", tempo "
-             << (*i)->getAbsoluteTime() << ":"
-             << (tempoT)((*i)->get<Int>(TempoProperty)) << ")";
+             << entry.time << ":" << entry.tempo << ")";
     }
 #endif
     return elapsed;
@@ -1502,31 +1497,27 @@ Composition::getElapsedTimeForRealTime(RealTime t) const
     RealTime realStart = time2RealTime(start, m_defaultTempo);
     t = t + realStart;
 
-    ReferenceSegment::iterator i = m_tempoSegment.findAtOrBefore(t);
-    if (i == m_tempoSegment.end()) {
-        i = m_tempoSegment.begin();
+    int i = getTempoMapIndexAt(t);
+    if (i < 0) {
         if (t >= realStart ||
-            (i == m_tempoSegment.end() || (*i)->getAbsoluteTime() > 0)) {
+            (m_tempoMap.empty() || m_tempoMap.front().time > 0)) {
             return realTime2Time(t, m_defaultTempo);
         }
+        i = 0;
     }
 
+    const TempoMapEntry &entry = m_tempoMap[i];
     timeT elapsed;
 
-    tempoT target = -1;
-    timeT nextTempoTime = 0;
-    if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
-
-    if (target > 0) {
-        elapsed = (*i)->getAbsoluteTime() +
-            realTime2Time(t - getTempoTimestamp(*i),
-                          (tempoT)((*i)->get<Int>(TempoProperty)),
-                          nextTempoTime - (*i)->getAbsoluteTime(),
-                          target);
+    if (entry.target > 0) {
+        elapsed = entry.time +
+            realTime2Time(t - entry.realTime,
+                          entry.tempo,
+                          entry.targetTime - entry.time,
+                          entry.target);
     } else {
-        elapsed = (*i)->getAbsoluteTime() +
-            realTime2Time(t - getTempoTimestamp(*i),
-                          (tempoT)((*i)->get<Int>(TempoProperty)));
+        elapsed = entry.time +
+            realTime2Time(t - entry.realTime, entry.tempo);
     }
 
 #ifdef DEBUG_TEMPO_STUFF
@@ -1539,8 +1530,7 @@ Composition::getElapsedTimeForRealTime(RealTime t) const
         RG_DEBUG << "getElapsedTimeForRealTime(): " << t << " -> "
              << elapsed << " (error " << (cfReal - t)
              << " or " << (cfTimeT - elapsed) << ", tempo "
-             << (*i)->getAbsoluteTime() << ":"
-             << (tempoT)((*i)->get<Int>(TempoProperty)) << ")";
+             << entry.time << ":" << entry.tempo << ")";
     }
 #endif
     return elapsed;
@@ -1558,6 +1548,9 @@ Composition::calculateTempoTimestamps() const
     tempoT tempo = m_defaultTempo;
     tempoT target = -1;
 
+    m_tempoMap.clear();
+    m_tempoMap.reserve(m_tempoSegment.size());
+
 #ifdef DEBUG_TEMPO_STUFF
     RG_DEBUG << "calculateTempoTimestamps(): Tempo events are:";
 #endif
@@ -1589,11 +1582,33 @@ Composition::calculateTempoTimestamps() const
         target = -1;
         timeT nextTempoTime = 0;
         if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
+
+        m_tempoMap.push_back(TempoMapEntry{
+                lastTimeT, myTime, tempo, target, nextTempoTime});
     }
 
     m_tempoTimestampsNeedCalculating = false;
 }
 
+int
+Composition::getTempoMapIndexAt(timeT t) const
+{
+    return int(std::upper_bound
+               (m_tempoMap.begin(), m_tempoMap.end(), t,
+                [](timeT time, const TempoMapEntry &entry)
+                    { return time < entry.time; }) - m_tempoMap.begin()) - 1;
+}
+
+int
+Composition::getTempoMapIndexAt(const RealTime &t) const
+{
+    return int(std::upper_bound
+               (m_tempoMap.begin(), m_tempoMap.end(), t,
+                [](const RealTime &realTime, const TempoMapEntry &entry)
+                    { return realTime < entry.realTime; }) -
+               m_tempoMap.begin()) - 1;
+}
+
 #ifdef DEBUG_TEMPO_STUFF
 static int DEBUG_silence_recursive_tempo_printout = 0;
 #endif
@@ -590,7 +590,11 @@ public:
      * Set a default tempo for the composition.  This will be
      * overridden by any tempo events encountered during playback.
      */
-    void setCompositionDefaultTempo(tempoT tempo) { m_defaultTempo = tempo; }
+    void setCompositionDefaultTempo(tempoT tempo) {
+        m_defaultTempo = tempo;
+        m_tempoTimestampsNeedCalculating = true;
+        ++m_tempoMapVersion;
+    }
     tempoT getCompositionDefaultTempo() const { return m_defaultTempo; }
 
     /**
@@ -612,6 +616,13 @@ public:
      */
     int getTempoChangeCount() const;
 
+    /// Changes whenever anything that affects getElapsedRealTime() changes.
+    /**
+     * For code that caches real times, such as InternalSegmentMapper,
+     * to check whether they are still good.
+     */
+    unsigned getTempoMapVersion() const  { return m_tempoMapVersion; }
+
     /**
      * Return the index of the last tempo change before the given
      * time, in a range suitable for passing to getTempoChange.
@@ -934,7 +945,7 @@ public:
 
 protected:
 
-    static const std::string TempoEventType;
+    static const std::string &TempoEventType;
     static const PropertyName TempoProperty;
     static const PropertyName TargetTempoProperty;
 
@@ -1056,14 +1067,57 @@ protected:
     /// Contains tempo events
     mutable ReferenceSegment m_tempoSegment;
 
-    /// affects m_timeSigSegment
+    /// A time signature change, compiled from m_timeSigSegment.
+    struct BarMapEntry
+    {
+        timeT time;
+        int barNumber;
+        timeT barDuration;
+        TimeSignature timeSignature;
+    };
+
+    /// Flat copy of m_timeSigSegment with the bar numbers worked out.
+    /**
+     * The bar and time signature lookups are binary searches on this,
+     * rather than on the events and their properties.  Rebuilt by
+     * calculateBarPositions() when m_barPositionsNeedCalculating.
+     */
+    mutable std::vector<BarMapEntry> m_barMap;
+
+    /// affects m_timeSigSegment and m_barMap
     void calculateBarPositions() const;
     mutable bool m_barPositionsNeedCalculating;
-    ReferenceSegment::iterator getTimeSignatureAtAux(timeT t) const;
+    /// Index in m_barMap of the time signature in effect at t, or -1.
+    int getTimeSignatureIndexAt(timeT t) const;
+
+    /// A tempo change, compiled from m_tempoSegment.
+    struct TempoMapEntry
+    {
+        timeT time;
+        /// Elapsed real time at time.
+        RealTime realTime;
+        tempoT tempo;
+        /// Tempo to ramp to by targetTime, or -1 if not ramping.
+        tempoT target;
+        timeT targetTime;
+    };
+
+    /// Flat copy of m_tempoSegment with the ramps and timestamps worked out.
+    /**
+     * The time conversions are binary searches on this, rather than
+     * on the events and their properties.  Rebuilt by
+     * calculateTempoTimestamps() when m_tempoTimestampsNeedCalculating.
+     */
+    mutable std::vector<TempoMapEntry> m_tempoMap;
 
-    /// affects m_tempoSegment
+    /// affects m_tempoSegment and m_tempoMap
     void calculateTempoTimestamps() const;
     mutable bool m_tempoTimestampsNeedCalculating;
+    /// Index in m_tempoMap of the last tempo change at or before t, or -1.
+    int getTempoMapIndexAt(timeT t) const;
+    int getTempoMapIndexAt(const RealTime &t) const;
+    /// See getTempoMapVersion().
+    unsigned m_tempoMapVersion;
     static RealTime time2RealTime(timeT t, tempoT tempo);
     static RealTime time2RealTime(timeT time, tempoT tempo,
                                   timeT targetTime, tempoT targetTempo);
@@ -32,7 +32,7 @@ namespace Rosegarden
 {
 
 Configuration::Configuration(const Configuration &conf) :
-    PropertyMap(),
+    PropertyStoreMap(),
     XmlExportable()
 {
     clear();
@@ -61,6 +61,14 @@ Configuration::getPropertyNames()
 }
 
 
+void
+Configuration::clear()
+{
+    for (iterator i = begin(); i != end(); ++i)
+        delete i->second;
+    PropertyStoreMap::clear();
+}
+
 bool
 Configuration::has(const PropertyName &name) const
 {
@@ -20,12 +20,14 @@
 //
 //
 
+#include <map>
 #include <string>
 #include <vector>
 
 #include "Instrument.h"
 #include "RealTime.h"
-#include "PropertyMap.h"
+#include "Property.h"
+#include "PropertyName.h"
 #include "base/Exception.h"
 #include "XmlExportable.h"
 
@@ -35,7 +37,11 @@
 namespace Rosegarden
 {
 
-class Configuration : public PropertyMap, public XmlExportable
+/// PropertyName to heap allocated PropertyStore map used by Configuration.
+typedef std::map<PropertyName, PropertyStoreBase *> PropertyStoreMap;
+typedef PropertyStoreMap::value_type PropertyPair;
+
+class Configuration : public PropertyStoreMap, public XmlExportable
 {
 public:
     class NoData : public Exception {
@@ -61,6 +67,9 @@ public:
 
     bool has(const PropertyName &name) const;
 
+    /// Remove and delete all properties.
+    void clear();
+
     template <PropertyType P>
     void
     set(const PropertyName &name,
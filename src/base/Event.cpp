@@ -20,9 +20,14 @@
 #include "XmlExportable.h"
 #include "NotationTypes.h"
 #include "BaseProperties.h"
+#include "PoolAllocator.h"
 #include "misc/Debug.h"
 
+#include <atomic>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <unordered_map>
 
 namespace Rosegarden
 {
@@ -33,10 +38,124 @@ PropertyName Event::EventData::NotationTime("!notationtime");
 PropertyName Event::EventData::NotationDuration("!notationduration");
 
 
+namespace
+{
+    // Fixed size so that the interned strings never move and
+    // Event::isInternedType() can be a range check.  There are only a few
+    // dozen types in practice.  Anything beyond this (e.g. a file full of
+    // junk types) goes into a_overflowTypes and is compared as a string.
+    constexpr size_t a_maxInternedTypes = 512;
+
+    // Pointers for create on first use to avoid static init order fiasco.
+    // Note: These are deliberate memory leaks since we cannot be sure
+    //       who might access them as we are going down.
+    std::string *a_internedTypes = nullptr;
+    // Entries below this are complete and never change, so they can be
+    // searched without the lock.
+    std::atomic<size_t> a_internedTypeCount(0);
+
+    typedef std::unordered_map<std::string, const std::string *> TypeToAtomMap;
+    TypeToAtomMap *a_typeToAtomMap = nullptr;
+
+    std::set<std::string> *a_overflowTypes = nullptr;
+
+    // Constant initialized, so safe to use during static init.
+    std::mutex a_internMutex;
+}
+
+const std::string *Event::m_internedTypesBegin = nullptr;
+const std::string *Event::m_internedTypesEnd = nullptr;
+
+const std::string &
+Event::internType(const std::string &type)
+{
+    // Already interned?  Nothing to look up.
+    if (isInternedType(&type))
+        return type;
+
+    // The loading threads all come through here for every Event, so
+    // look in the table first without the lock.  A few dozen short
+    // strings, the common ones first.
+    const size_t count = a_internedTypeCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (a_internedTypes[i] == type)
+            return a_internedTypes[i];
+    }
+
+    std::lock_guard<std::mutex> lock(a_internMutex);
+
+    if (!a_typeToAtomMap) {
+        // Create on first use to avoid static init order fiasco.
+        a_internedTypes = new std::string[a_maxInternedTypes];
+        a_typeToAtomMap = new TypeToAtomMap;
+        a_overflowTypes = new std::set<std::string>;
+        m_internedTypesBegin = a_internedTypes;
+        m_internedTypesEnd = a_internedTypes + a_maxInternedTypes;
+    }
+
+    TypeToAtomMap::const_iterator atomIter = a_typeToAtomMap->find(type);
+    // Found it?  Return it.
+    if (atomIter != a_typeToAtomMap->end())
+        return *atomIter->second;
+
+    const std::string *atom;
+
+    const size_t internedTypeCount =
+            a_internedTypeCount.load(std::memory_order_relaxed);
+    if (internedTypeCount < a_maxInternedTypes) {
+        std::string *newAtom = a_internedTypes + internedTypeCount;
+        *newAtom = type;
+        a_internedTypeCount.store(internedTypeCount + 1,
+                                  std::memory_order_release);
+        atom = newAtom;
+    } else {
+        RG_WARNING << "internType(): WARNING: Interned type table is full.  Type" << type << "will be compared as a string.";
+        atom = &*a_overflowTypes->insert(type).first;
+    }
+
+    a_typeToAtomMap->insert(TypeToAtomMap::value_type(type, atom));
+
+    return *atom;
+}
+
+
+void *
+Event::operator new(size_t size)
+{
+    // Subclasses (e.g. XmlStorableEvent) add no data, so they are the same
+    // size.  If one ever does, it will go to the regular heap.
+    if (size != sizeof(Event))
+        return ::operator new(size);
+    return FixedSizePool::getPool(sizeof(Event)).allocate();
+}
+
+void
+Event::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(Event)) {
+        ::operator delete(p);
+        return;
+    }
+    FixedSizePool::getPool(sizeof(Event)).deallocate(p);
+}
+
+void *
+Event::EventData::operator new(size_t size)
+{
+    return FixedSizePool::getPool(size).allocate();
+}
+
+void
+Event::EventData::operator delete(void *p, size_t size)
+{
+    FixedSizePool::getPool(size).deallocate(p);
+}
+
+
 Event::EventData::EventData(const std::string &type, timeT absoluteTime,
                             timeT duration, short subOrdering) :
     m_refCount(1),
-    m_type(type),
+    m_type(&internType(type)),
     m_absoluteTime(absoluteTime),
     m_duration(duration),
     m_subOrdering(subOrdering),
@@ -45,7 +164,7 @@ Event::EventData::EventData(const std::string &type, timeT absoluteTime,
     // empty
 }
 
-Event::EventData::EventData(const std::string &type, timeT absoluteTime,
+Event::EventData::EventData(const std::string *type, timeT absoluteTime,
                             timeT duration, short subOrdering,
                             const PropertyMap *properties) :
     m_refCount(1),
@@ -82,7 +201,7 @@ Event::EventData::getNotationTime() const
     if (!m_properties) return m_absoluteTime;
     PropertyMap::const_iterator i = m_properties->find(NotationTime);
     if (i == m_properties->end()) return m_absoluteTime;
-    else return static_cast<PropertyStore<Int> *>(i->second)->getData();
+    else return i->getData<Int>();
 }
 
 timeT
@@ -91,7 +210,7 @@ Event::EventData::getNotationDuration() const
     if (!m_properties) return m_duration;
     PropertyMap::const_iterator i = m_properties->find(NotationDuration);
     if (i == m_properties->end()) return m_duration;
-    else return static_cast<PropertyStore<Int> *>(i->second)->getData();
+    else return i->getData<Int>();
 }
 
 timeT
@@ -111,12 +230,11 @@ Event::EventData::setTime(const PropertyName &name, timeT t, timeT deft)
 
     if (t != deft) {
         if (i == m_properties->end()) {
-            m_properties->insert(PropertyPair(name, new PropertyStore<Int>(t)));
+            m_properties->insert<Int>(name, t);
         } else {
-            static_cast<PropertyStore<Int> *>(i->second)->setData(t);
+            i->setData<Int>(t);
         }
     } else if (i != m_properties->end()) {
-        delete i->second;
         m_properties->erase(i);
     }
 }
@@ -162,7 +280,6 @@ Event::unset(const PropertyName &name)
     PropertyMap::iterator i;
     PropertyMap *map = find(name, i);
     if (map) {
-        delete i->second;
         map->erase(i);
     }
 }
@@ -175,7 +292,7 @@ Event::getPropertyType(const PropertyName &name) const
     PropertyMap::const_iterator i;
     const PropertyMap *map = find(name, i);
     if (map) {
-        return i->second->getType();
+        return i->getType();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -189,7 +306,7 @@ Event::getPropertyTypeAsString(const PropertyName &name) const
     PropertyMap::const_iterator i;
     const PropertyMap *map = find(name, i);
     if (map) {
-        return i->second->getTypeName();
+        return i->getTypeName();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -203,7 +320,7 @@ Event::getAsString(const PropertyName &name) const
     PropertyMap::const_iterator i;
     const PropertyMap *map = find(name, i);
     if (map) {
-        return i->second->unparse();
+        return i->unparse();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -348,7 +465,7 @@ Event::getPersistentPropertyNames() const
     if (m_data->m_properties) {
         for (PropertyMap::const_iterator i = m_data->m_properties->begin();
              i != m_data->m_properties->end(); ++i) {
-            v.push_back(i->first);
+            v.push_back(i->getName());
         }
     }
     return v;
@@ -361,7 +478,7 @@ Event::getNonPersistentPropertyNames() const
     if (m_nonPersistentProperties) {
         for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
              i != m_nonPersistentProperties->end(); ++i) {
-            v.push_back(i->first);
+            v.push_back(i->getName());
         }
     }
     return v;
@@ -373,6 +490,27 @@ Event::clearNonPersistentProperties()
     if (m_nonPersistentProperties) m_nonPersistentProperties->clear();
 }
 
+Event *
+Event::copyForSaving() const
+{
+    Event *copy = new Event(*this);
+
+    if (m_nonPersistentProperties) {
+        for (const PropertyMap::Entry &property :
+                 *m_nonPersistentProperties) {
+            // View-local.  See toXmlString().
+            if (property.getName().getName().find("::") != std::string::npos)
+                continue;
+
+            if (!copy->m_nonPersistentProperties)
+                copy->m_nonPersistentProperties = new PropertyMap;
+            copy->m_nonPersistentProperties->insert(property);
+        }
+    }
+
+    return copy;
+}
+
 void
 Event::unsafeChangeTime(timeT offset)
 {
@@ -387,19 +525,19 @@ Event::unsafeChangeTime(timeT offset)
 size_t
 Event::getStorageSize() const
 {
-    size_t s = sizeof(Event) + sizeof(EventData) + m_data->m_type.size();
+    size_t s = sizeof(Event) + sizeof(EventData);
     if (m_data->m_properties) {
+        s += sizeof(PropertyMap);
         for (PropertyMap::const_iterator i = m_data->m_properties->begin();
              i != m_data->m_properties->end(); ++i) {
-            s += sizeof(i->first);
-            s += i->second->getStorageSize();
+            s += i->getStorageSize();
         }
     }
     if (m_nonPersistentProperties) {
+        s += sizeof(PropertyMap);
         for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
              i != m_nonPersistentProperties->end(); ++i) {
-            s += sizeof(i->first);
-            s += i->second->getStorageSize();
+            s += i->getStorageSize();
         }
     }
     return s;
@@ -430,27 +568,27 @@ operator<(const Event &a, const Event &b)
 // cppcheck-suppress unusedFunction
 QDebug operator<<(QDebug dbg, const Event &event)
 {
-    dbg << "Event type :" << event.m_data->m_type << "\n";
+    dbg << "Event type :" << *event.m_data->m_type << "\n";
     dbg << "  Absolute Time :" << event.m_data->m_absoluteTime << "\n";
     dbg << "  Duration :" << event.m_data->m_duration << "\n";
     dbg << "  Sub-ordering :" << event.m_data->m_subOrdering << "\n";
     dbg << "  Persistent properties :\n";
 
     if (event.m_data->m_properties) {
-        for (const PropertyMap::value_type &property :
+        for (const PropertyMap::Entry &property :
                  *(event.m_data->m_properties)) {
-            dbg << "    " << property.first.getName() << "[" <<
-                   property.first.getId() << "] :" << *(property.second) <<
+            dbg << "    " << property.getName().getName() << "[" <<
+                   property.getName().getId() << "] :" << property <<
                    "\n";
         }
     }
 
     if (event.m_nonPersistentProperties) {
         dbg << "  Non-persistent properties :\n";
-        for (const PropertyMap::value_type &property :
+        for (const PropertyMap::Entry &property :
                  *(event.m_nonPersistentProperties)) {
-            dbg << "    " << property.first.getName() << "[" <<
-                   property.first.getId() << "] :" << *(property.second) <<
+            dbg << "    " << property.getName().getName() << "[" <<
+                   property.getName().getId() << "] :" << property <<
                    "\n";
         }
     }
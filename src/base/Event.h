@@ -24,6 +24,7 @@
 
 #include <rosegardenprivate_export.h>
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -182,6 +183,10 @@ public:
 
     ~Event()  { lose(); }
 
+    // Events are allocated from a FixedSizePool.  See PoolAllocator.h.
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
     Event(const Event &e) :
         m_nonPersistentProperties(nullptr)
     {
@@ -209,6 +214,19 @@ public:
                          getNotationDuration());
     }
 
+    /// Shallow copy that keeps the non-persistent properties that are saved.
+    /**
+     * The copy constructor drops the non-persistent properties.  This
+     * keeps those that toXmlString() writes (the ones that aren't
+     * view-local), so the copy saves exactly as the original would.
+     *
+     * The persistent data is shared with the original, so the copy must
+     * be deleted on the thread that owns the original.  It may be read
+     * from any thread, though, since any change to the original unshares
+     * first.
+     */
+    Event *copyForSaving() const;
+
     // check if the events are copies
     bool isCopyOf(const Event &e) const;
 
@@ -218,17 +236,50 @@ public:
     /**
      * See NotationTypes.h and MidiTypes.h for more examples.
      */
-    std::string getType() const
+    const std::string &getType() const
     {
         if (!m_data) {
             // cppcheck-suppress ConfigurationNotChecked
             RG_DEBUG << "Event::getType(): FATAL: m_data == nullptr.  Crash likely.";
-            return "";
+            static const std::string empty;
+            return empty;
         }
-        return m_data->m_type;
+        return *m_data->m_type;
     }
     /// Check Event type.
-    bool isa(const std::string &type) const  { return (m_data->m_type == type); }
+    /**
+     * When type is one of the interned type constants (Note::EventType,
+     * Controller::EventType, etc...) this is a pointer compare.
+     */
+    bool isa(const std::string &type) const
+    {
+        if (isInternedType(&type))
+            return (m_data->m_type == &type);
+        return (*m_data->m_type == type);
+    }
+
+    // *** Event type interning
+
+    /// Get the shared, interned copy of an Event type string.
+    /**
+     * Event types work much like PropertyName: each distinct type
+     * string is stored once, and Event keeps a pointer to that copy.
+     * Two interned types are equal if and only if their addresses are
+     * equal, which lets isa() avoid string compares.
+     *
+     * The type constants (Note::EventType, etc...) are references to
+     * interned strings.  The returned reference is valid for the life
+     * of the program.
+     */
+    static const std::string &internType(const std::string &type);
+
+    /// Is this the address of a string returned by internType()?
+    static bool isInternedType(const std::string *type)
+    {
+        std::less<const std::string *> less;
+        return !less(type, m_internedTypesBegin) &&
+                less(type, m_internedTypesEnd);
+    }
 
     timeT getAbsoluteTime() const  { return m_data->m_absoluteTime; }
     timeT getNotationAbsoluteTime() const  { return m_data->getNotationTime(); }
@@ -388,7 +439,8 @@ protected:
         m_nonPersistentProperties(nullptr)
     { }
 
-    void setType(const std::string &t) { unshare(); m_data->m_type = t; }
+    void setType(const std::string &t)
+            { unshare(); m_data->m_type = &internType(t); }
     void setAbsoluteTime(timeT t)      { unshare(); m_data->m_absoluteTime = t; }
     void setDuration(timeT d)          { unshare(); m_data->m_duration = d; }
     void setSubOrdering(short o)       { unshare(); m_data->m_subOrdering = o; }
@@ -403,15 +455,20 @@ private:
     {
         EventData(const std::string &type,
                   timeT absoluteTime, timeT duration, short subOrdering);
-        EventData(const std::string &type,
+        EventData(const std::string *type,
                   timeT absoluteTime, timeT duration, short subOrdering,
                   const PropertyMap *properties);
         /// Make a unique copy.  Used for Copy On Write.
         EventData *unshare();
         ~EventData();
+
+        static void *operator new(size_t size);
+        static void operator delete(void *p, size_t size);
+
         unsigned int m_refCount;
 
-        std::string m_type;
+        /// Interned.  See internType().
+        const std::string *m_type;
         timeT m_absoluteTime;
         timeT m_duration;
         short m_subOrdering;
@@ -507,8 +564,9 @@ private:
         return map;
     }
 
+    /// Get the persistent or non-persistent map, creating it if needed.
     // cppcheck-suppress functionConst
-    PropertyMap::iterator insert(const PropertyPair &pair, bool persistent)
+    PropertyMap *getMap(bool persistent)
     {
         PropertyMap **map =
             (persistent ? &m_data->m_properties : &m_nonPersistentProperties);
@@ -517,9 +575,13 @@ private:
         if (!*map)
             *map = new PropertyMap();
 
-        return (*map)->insert(pair).first;
+        return *map;
     }
 
+    /// Range of the fixed interned type table.  See isInternedType().
+    static const std::string *m_internedTypesBegin;
+    static const std::string *m_internedTypesEnd;
+
 #ifndef NDEBUG
     static int m_getCount;
     static int m_setCount;
@@ -548,14 +610,13 @@ Event::get(const PropertyName &name,
     if (!map)
         return false;
 
-    PropertyStoreBase *sb = i->second;
-    if (sb->getType() == P) {
-        val = (static_cast<PropertyStore<P> *>(sb))->getData();
+    if (i->getType() == P) {
+        val = i->getData<P>();
         return true;
     } else {
 #ifndef NDEBUG
         // cppcheck-suppress ConfigurationNotChecked
-        RG_DEBUG << "get() Error: Attempt to get property \"" << name.getName() << "\" as" << PropertyDefn<P>::typeName() <<", actual type is" << sb->getTypeName();
+        RG_DEBUG << "get() Error: Attempt to get property \"" << name.getName() << "\" as" << PropertyDefn<P>::typeName() <<", actual type is" << i->getTypeName();
 #endif
         return false;
     }
@@ -575,12 +636,11 @@ Event::get(const PropertyName &name) const
 
     if (map) {
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P)
-            return (static_cast<PropertyStore<P> *>(sb))->getData();
+        if (i->getType() == P)
+            return i->getData<P>();
         else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
 
@@ -632,24 +692,23 @@ Event::set(const PropertyName &name, typename PropertyDefn<P>::basic_type value,
 
     // If found, update.
     if (map) {
-        bool persistentBefore = (map == m_data->m_properties);
-        if (persistentBefore != persistent) {
-            i = insert(*i, persistent);
-            map->erase(name);
+        if (i->getType() != P) {
+            throw BadType(name.getName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
+                          __FILE__, __LINE__);
         }
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P) {
-            (static_cast<PropertyStore<P> *>(sb))->setData(value);
+        bool persistentBefore = (map == m_data->m_properties);
+        if (persistentBefore != persistent) {
+            // Move to the other map.
+            map->erase(i);
+            getMap(persistent)->insert<P>(name, value);
         } else {
-            throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
-                          __FILE__, __LINE__);
+            i->setData<P>(value);
         }
 
     } else {  // Create
-        PropertyStoreBase *p = new PropertyStore<P>(value);
-        insert(PropertyPair(name, p), persistent);
+        getMap(persistent)->insert<P>(name, value);
     }
 }
 
@@ -679,19 +738,15 @@ Event::setMaybe(const PropertyName &name, typename PropertyDefn<P>::basic_type v
         if (map == m_data->m_properties)
             return;
 
-        PropertyStoreBase *sb = i->second;
-
-        if (sb->getType() == P) {
-            (static_cast<PropertyStore<P> *>(sb))->setData(value);
+        if (i->getType() == P) {
+            i->setData<P>(value);
         } else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
     } else {  // Create
-        PropertyStoreBase *p = new PropertyStore<P>(value);
-        insert(PropertyPair(name, p),
-               false);  // persistent
+        getMap(false)->insert<P>(name, value);  // non-persistent
     }
 }
 
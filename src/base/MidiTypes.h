@@ -39,7 +39,7 @@ class Event;
 
 namespace PitchBend
 {
-    extern const std::string EventType;
+    extern const std::string &EventType;
     constexpr int EventSubOrdering = -5;
 
     extern const PropertyName MSB;
@@ -53,7 +53,7 @@ namespace PitchBend
 
 namespace Controller
 {
-    extern const std::string EventType;
+    extern const std::string &EventType;
     constexpr int EventSubOrdering = -5;
 
     extern const PropertyName NUMBER;
@@ -67,7 +67,7 @@ namespace Controller
 
 namespace KeyPressure
 {
-    extern const std::string EventType;
+    extern const std::string &EventType;
     constexpr int EventSubOrdering = -5;
 
     extern const PropertyName PITCH;
@@ -81,7 +81,7 @@ namespace KeyPressure
 
 namespace ChannelPressure
 {
-    extern const std::string EventType;
+    extern const std::string &EventType;
     constexpr int EventSubOrdering = -5;
 
     extern const PropertyName PRESSURE;
@@ -94,7 +94,7 @@ namespace ChannelPressure
 
 namespace ProgramChange
 {
-    extern const std::string EventType;
+    extern const std::string &EventType;
     constexpr int EventSubOrdering = -5;
 
     extern const PropertyName PROGRAM;
@@ -107,7 +107,7 @@ namespace ProgramChange
 
 namespace SystemExclusive
 {
-    extern const std::string EventType;
+    extern const std::string &EventType;
     constexpr int EventSubOrdering = -5;
 
     struct BadEncoding : public Exception {
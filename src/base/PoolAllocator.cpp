@@ -0,0 +1,282 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "PoolAllocator.h"
+
+#include <atomic>
+
+
+namespace Rosegarden
+{
+
+
+namespace
+{
+    // Blocks are aligned (and sized) to this, which covers every
+    // fundamental type we store.
+    constexpr size_t a_blockAlignment = alignof(std::max_align_t);
+
+    // Aim for slabs of about this many bytes.
+    constexpr size_t a_slabSize = 64 * 1024;
+
+    constexpr size_t a_poolCount =
+            FixedSizePool::MaxBlockSize / a_blockAlignment + 1;
+
+    // Pointers for create on first use to avoid static init order fiasco.
+    // Note: The pools are deliberately leaked since we cannot be sure
+    //       who might free an Event as we are going down.
+    std::atomic<FixedSizePool *> a_pools[a_poolCount];
+
+    // Constant initialized, so safe to use during static init.
+    std::mutex a_poolsMutex;
+
+    size_t roundUp(size_t size)
+    {
+        if (size < sizeof(void *))
+            size = sizeof(void *);
+        return (size + a_blockAlignment - 1) / a_blockAlignment *
+                a_blockAlignment;
+    }
+
+    // Blocks moved between a thread's free list and its pool at a time.
+    constexpr size_t a_batchSize = 64;
+
+    // A thread gives a batch back once it has more free blocks than this.
+    constexpr size_t a_maxThreadBlocks = 4 * a_batchSize;
+
+    // A thread's own free list for each pool, linked through the blocks
+    // like the pool's.  Plain data so that it needs no constructing and
+    // is still there while the thread's other thread_locals go away.
+    struct ThreadList
+    {
+        void *head;
+        size_t count;
+    };
+    thread_local ThreadList a_threadLists[a_poolCount];
+
+    // Set once this thread's lists have been flushed for the last time.
+    // After that, blocks go straight to and from the pools.
+    thread_local bool a_threadExited = false;
+
+    // Flushes the thread's lists as it exits.  Only constructed (and so
+    // only destroyed) once used, see touch().
+    struct ThreadListFlusher
+    {
+        ~ThreadListFlusher()
+        {
+            FixedSizePool::flushThreadCache();
+            a_threadExited = true;
+        }
+
+        void touch()  { }
+    };
+    thread_local ThreadListFlusher a_threadListFlusher;
+}
+
+
+FixedSizePool &
+FixedSizePool::getPool(size_t size)
+{
+    const size_t blockSize = roundUp(size);
+    const size_t index = blockSize / a_blockAlignment;
+
+    FixedSizePool *pool = a_pools[index].load(std::memory_order_acquire);
+    if (pool)
+        return *pool;
+
+    std::lock_guard<std::mutex> lock(a_poolsMutex);
+
+    // Somebody else may have beaten us to it.
+    pool = a_pools[index].load(std::memory_order_relaxed);
+    if (!pool) {
+        pool = new FixedSizePool(index, blockSize);
+        a_pools[index].store(pool, std::memory_order_release);
+    }
+
+    return *pool;
+}
+
+FixedSizePool::FixedSizePool(size_t index, size_t blockSize) :
+    m_index(index),
+    m_blockSize(roundUp(blockSize)),
+    m_freeList(nullptr),
+    m_blocksInUse(0)
+{
+}
+
+FixedSizePool::~FixedSizePool()
+{
+    for (char *slab : m_slabs) {
+        ::operator delete(slab);
+    }
+}
+
+void
+FixedSizePool::grow()
+{
+    const size_t blocksPerSlab = a_slabSize / m_blockSize;
+
+    char *slab = static_cast<char *>(
+            ::operator new(blocksPerSlab * m_blockSize));
+    m_slabs.push_back(slab);
+
+    // Thread the new blocks onto the free list in address order so that
+    // consecutive allocations are adjacent in memory.
+    for (size_t i = blocksPerSlab; i > 0; --i) {
+        FreeBlock *block =
+                reinterpret_cast<FreeBlock *>(slab + (i - 1) * m_blockSize);
+        block->next = m_freeList;
+        m_freeList = block;
+    }
+}
+
+FixedSizePool::FreeBlock *
+FixedSizePool::take(size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Keep them in address order.
+    FreeBlock *list = nullptr;
+    FreeBlock **tail = &list;
+    for (size_t i = 0; i < count; ++i) {
+        if (!m_freeList)
+            grow();
+
+        FreeBlock *block = m_freeList;
+        m_freeList = block->next;
+        *tail = block;
+        tail = &block->next;
+    }
+    *tail = nullptr;
+
+    m_blocksInUse += count;
+
+    return list;
+}
+
+void
+FixedSizePool::give(FreeBlock *first, FreeBlock *last, size_t count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    last->next = m_freeList;
+    m_freeList = first;
+    m_blocksInUse -= count;
+
+    // Everything is back, so the slabs can go.
+    if (m_blocksInUse == 0) {
+        for (char *slab : m_slabs) {
+            ::operator delete(slab);
+        }
+        m_slabs.clear();
+        m_freeList = nullptr;
+    }
+}
+
+void *
+FixedSizePool::allocate()
+{
+    if (a_threadExited)
+        return take(1);
+
+    ThreadList &list = a_threadLists[m_index];
+
+    if (!list.head) {
+        // So that the blocks are returned when this thread exits.
+        a_threadListFlusher.touch();
+
+        list.head = take(a_batchSize);
+        list.count = a_batchSize;
+    }
+
+    FreeBlock *block = static_cast<FreeBlock *>(list.head);
+    list.head = block->next;
+    --list.count;
+
+    return block;
+}
+
+void
+FixedSizePool::deallocate(void *block)
+{
+    if (!block)
+        return;
+
+    FreeBlock *freeBlock = static_cast<FreeBlock *>(block);
+
+    if (a_threadExited) {
+        give(freeBlock, freeBlock, 1);
+        return;
+    }
+
+    ThreadList &list = a_threadLists[m_index];
+
+    // E.g. the GUI thread deleting Events that a loading thread created.
+    if (!list.head)
+        a_threadListFlusher.touch();
+
+    freeBlock->next = static_cast<FreeBlock *>(list.head);
+    list.head = freeBlock;
+    ++list.count;
+
+    if (list.count <= a_maxThreadBlocks)
+        return;
+
+    // Too many.  Give a batch back to the pool in one go.
+    FreeBlock *first = freeBlock;
+    FreeBlock *last = first;
+    for (size_t i = 1; i < a_batchSize; ++i) {
+        last = last->next;
+    }
+    list.head = last->next;
+    list.count -= a_batchSize;
+
+    give(first, last, a_batchSize);
+}
+
+void
+FixedSizePool::flushThreadCache()
+{
+    for (size_t index = 0; index < a_poolCount; ++index) {
+        ThreadList &list = a_threadLists[index];
+        if (!list.head)
+            continue;
+
+        // Any blocks on the list came from this pool, so it exists.
+        FixedSizePool *pool = a_pools[index].load(std::memory_order_acquire);
+
+        FreeBlock *first = static_cast<FreeBlock *>(list.head);
+        FreeBlock *last = first;
+        while (last->next) {
+            last = last->next;
+        }
+
+        list.head = nullptr;
+        const size_t count = list.count;
+        list.count = 0;
+
+        pool->give(first, last, count);
+    }
+}
+
+size_t
+FixedSizePool::getBlocksInUse() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_blocksInUse;
+}
+
+
+}
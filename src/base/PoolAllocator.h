@@ -0,0 +1,153 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_POOL_ALLOCATOR_H
+#define RG_POOL_ALLOCATOR_H
+
+#include <rosegardenprivate_export.h>
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace Rosegarden
+{
+
+
+/// Allocator for large numbers of small objects of one size.
+/**
+ * Blocks are carved out of large slabs and recycled through a free list,
+ * so allocating and freeing is a couple of pointer moves, and objects
+ * allocated together end up next to each other in memory.  This is used
+ * for Event, Event::EventData, PropertyMap and the EventContainer tree
+ * nodes, of which a large Composition has millions.
+ *
+ * Each thread keeps a short free list of its own per pool, so most
+ * allocations and frees take no lock.  Blocks move between a thread and
+ * the shared pool in batches, and go back to the pool when the thread
+ * exits.  The file loading workers, for example, can then fill pools
+ * side by side, and deleting a Composition takes a lock per batch
+ * rather than per Event.
+ *
+ * Once every block of a pool is back in the pool, its slabs are
+ * returned to the system.  flushThreadCache() makes that possible after
+ * the last Composition is closed.
+ *
+ * Thread-safe.
+ */
+class ROSEGARDENPRIVATE_EXPORT FixedSizePool
+{
+public:
+    /// Largest block size handled by getPool().
+    static constexpr size_t MaxBlockSize = 256;
+
+    /// Get the shared pool for blocks of a given size.
+    /**
+     * size is rounded up to the block alignment, so e.g. all 33 to 48
+     * byte objects share a pool.  size must be <= MaxBlockSize.
+     */
+    static FixedSizePool &getPool(size_t size);
+
+    void *allocate();
+    void deallocate(void *block);
+
+    size_t getBlockSize() const  { return m_blockSize; }
+
+    /// For debugging.  Includes blocks held in threads' free lists.
+    size_t getBlocksInUse() const;
+
+    /// Return the calling thread's free blocks to their pools.
+    /**
+     * Called after a Composition has been torn down so that its memory
+     * can be reused by other threads, or returned to the system if
+     * nothing else is using the pool.
+     */
+    static void flushThreadCache();
+
+private:
+    FixedSizePool(size_t index, size_t blockSize);
+    ~FixedSizePool();
+    FixedSizePool(const FixedSizePool &);
+    FixedSizePool &operator=(const FixedSizePool &);
+
+    /// Allocate a new slab and add its blocks to the free list.
+    void grow();
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    /// Take count blocks off the free list, as a list through next.
+    FreeBlock *take(size_t count);
+    /// Put the count blocks from first to last back on the free list.
+    void give(FreeBlock *first, FreeBlock *last, size_t count);
+
+    /// This pool's slot in getPool() and in the threads' free lists.
+    const size_t m_index;
+    const size_t m_blockSize;
+    FreeBlock *m_freeList;
+    std::vector<char *> m_slabs;
+    size_t m_blocksInUse;
+
+    mutable std::mutex m_mutex;
+};
+
+
+/// Standard allocator that takes single objects from a FixedSizePool.
+/**
+ * Intended for node based containers like std::multiset, which always
+ * allocate one node at a time.  Array allocations and oversized types
+ * go to the regular heap.
+ */
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    PoolAllocator() noexcept { }
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) noexcept { }
+
+    T *allocate(size_t n)
+    {
+        if (n == 1  &&  sizeof(T) <= FixedSizePool::MaxBlockSize)
+            return static_cast<T *>(
+                    FixedSizePool::getPool(sizeof(T)).allocate());
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        if (n == 1  &&  sizeof(T) <= FixedSizePool::MaxBlockSize)
+            FixedSizePool::getPool(sizeof(T)).deallocate(p);
+        else
+            ::operator delete(p);
+    }
+
+    // All PoolAllocators share the same pools, so any one can free
+    // what another allocated.
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const noexcept  { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const noexcept  { return false; }
+};
+
+
+}
+
+#endif
@@ -16,54 +16,214 @@
 #include <cstdio>
 #include <iostream>
 #include <string>
+#include <algorithm>
 #include "PropertyMap.h"
+#include "PoolAllocator.h"
 #include "XmlExportable.h"
 
 namespace Rosegarden 
 {
 using std::string;
 
-#ifdef PROPERTY_MAP_IS_HASH_MAP
-PropertyMap::PropertyMap() :
-    __HASH_NS::hash_map<PropertyName,
-			PropertyStoreBase *,
-			PropertyNameHash,
-			PropertyNamesEqual>(50, PropertyNameHash())
+PropertyMap::Entry::Entry(const Entry &entry) :
+    m_name(entry.m_name),
+    m_type(Int),
+    m_int(0)
 {
-    // nothing
+    copyValue(entry);
 }
-#endif
 
-PropertyMap::PropertyMap(const PropertyMap &pm) :
+PropertyMap::Entry::Entry(Entry &&entry) noexcept :
+    m_name(entry.m_name),
+    m_type(Int),
+    m_int(0)
+{
+    moveValue(entry);
+}
+
+PropertyMap::Entry &
+PropertyMap::Entry::operator=(const Entry &entry)
+{
+    if (&entry == this)
+        return *this;
+
+    m_name = entry.m_name;
+    copyValue(entry);
+
+    return *this;
+}
+
+PropertyMap::Entry &
+PropertyMap::Entry::operator=(Entry &&entry) noexcept
+{
+    if (&entry == this)
+        return *this;
+
+    m_name = entry.m_name;
+    moveValue(entry);
+
+    return *this;
+}
 
-#ifdef PROPERTY_MAP_IS_HASH_MAP
+void
+PropertyMap::Entry::copyValue(const Entry &entry)
+{
+    switch (entry.m_type) {
+    case Int:
+        setData<Int>(entry.m_int);
+        break;
+    case String:
+        setData<String>(*entry.m_string);
+        break;
+    case Bool:
+        setData<Bool>(entry.m_bool);
+        break;
+    case RealTimeT:
+        setData<RealTimeT>(entry.getData<RealTimeT>());
+        break;
+    }
+}
 
-    __HASH_NS::hash_map<PropertyName,
-			PropertyStoreBase *,
-			PropertyNameHash,
-			PropertyNamesEqual>(50, PropertyNameHash())
-#else
+void
+PropertyMap::Entry::moveValue(Entry &entry)
+{
+    if (entry.m_type != String) {
+        copyValue(entry);
+        return;
+    }
+
+    // Take the string over.
+    freeString();
+    m_type = String;
+    m_string = entry.m_string;
+    entry.m_type = Int;
+    entry.m_int = 0;
+}
+
+string
+PropertyMap::Entry::getTypeName() const
+{
+    switch (m_type) {
+    case Int:
+        return PropertyDefn<Int>::typeName();
+    case String:
+        return PropertyDefn<String>::typeName();
+    case Bool:
+        return PropertyDefn<Bool>::typeName();
+    case RealTimeT:
+        return PropertyDefn<RealTimeT>::typeName();
+    }
+
+    return "Undefined";
+}
+
+string
+PropertyMap::Entry::unparse() const
+{
+    switch (m_type) {
+    case Int:
+        return PropertyDefn<Int>::unparse(m_int);
+    case String:
+        return *m_string;
+    case Bool:
+        return PropertyDefn<Bool>::unparse(m_bool);
+    case RealTimeT:
+        return PropertyDefn<RealTimeT>::unparse(getData<RealTimeT>());
+    }
 
-    std::map<PropertyName, PropertyStoreBase *>()
+    return "";
+}
 
-#endif
+size_t
+PropertyMap::Entry::getStorageSize() const
+{
+    size_t size = sizeof(*this);
+    if (m_type == String)
+        size += sizeof(std::string) + m_string->size();
+    return size;
+}
 
+bool
+PropertyMap::Entry::operator==(const Entry &entry) const
 {
-    for (const_iterator i = pm.begin(); i != pm.end(); ++i) {
-	insert(PropertyPair(i->first, i->second->clone()));
+    if (!(m_name == entry.m_name)  ||  m_type != entry.m_type)
+        return false;
+
+    switch (m_type) {
+    case Int:
+        return m_int == entry.m_int;
+    case String:
+        return *m_string == *entry.m_string;
+    case Bool:
+        return m_bool == entry.m_bool;
+    case RealTimeT:
+        return m_realTime.sec == entry.m_realTime.sec  &&
+               m_realTime.nsec == entry.m_realTime.nsec;
     }
+
+    return false;
 }
 
-PropertyMap::~PropertyMap()
+
+void *
+PropertyMap::operator new(size_t size)
 {
-    for (iterator i = begin(); i != end(); ++i) delete i->second;
-}    
+    return FixedSizePool::getPool(size).allocate();
+}
 
 void
-PropertyMap::clear()
+PropertyMap::operator delete(void *p, size_t size)
+{
+    FixedSizePool::getPool(size).deallocate(p);
+}
+
+PropertyMap::iterator
+PropertyMap::lowerBound(const PropertyName &name)
+{
+    return std::lower_bound(
+            m_entries.begin(), m_entries.end(), name,
+            [](const Entry &entry, const PropertyName &n)
+                { return entry.getName() < n; });
+}
+
+PropertyMap::iterator
+PropertyMap::find(const PropertyName &name)
 {
-    for (iterator i = begin(); i != end(); ++i) delete i->second;
-    erase(begin(), end());
+    iterator i = lowerBound(name);
+    if (i == m_entries.end()  ||  !(i->getName() == name))
+        return m_entries.end();
+    return i;
+}
+
+PropertyMap::const_iterator
+PropertyMap::find(const PropertyName &name) const
+{
+    return const_cast<PropertyMap *>(this)->find(name);
+}
+
+PropertyMap::iterator
+PropertyMap::insert(const Entry &entry)
+{
+    iterator i = lowerBound(entry.getName());
+    if (i != m_entries.end()  &&  i->getName() == entry.getName()) {
+        *i = entry;
+        return i;
+    }
+
+    // Most Events end up with a handful of properties.  Avoid growing
+    // one at a time.
+    if (m_entries.empty())
+        m_entries.reserve(4);
+
+    return m_entries.insert(i, entry);
+}
+
+void
+PropertyMap::erase(const PropertyName &name)
+{
+    iterator i = find(name);
+    if (i != m_entries.end())
+        m_entries.erase(i);
 }
 
 
@@ -81,9 +241,9 @@ PropertyMap::toXmlString() const
     for (const_iterator i = begin(); i != end(); ++i) {
 	
 	xml +=
-	    "<property name=\"" + XmlExportable::encode(i->first.getName()) +
-	    "\" " + i->second->getTypeName() +
-	    "=\"" + XmlExportable::encode(i->second->unparse()) +
+	    "<property name=\"" + XmlExportable::encode(i->getName().getName()) +
+	    "\" " + i->getTypeName() +
+	    "=\"" + XmlExportable::encode(i->unparse()) +
 	    "\"/>";
 
     }
@@ -91,19 +251,5 @@ PropertyMap::toXmlString() const
     return xml;
 }
 
-static bool propertyPairEqual(const PropertyPair &p1, const PropertyPair &p2)
-{
-    return p1.first == p2.first &&
-            p1.second->getTypeName() == p2.second->getTypeName()
-            && p1.second->unparse() == p2.second->unparse();
-}
-
-bool PropertyMap::operator==(const PropertyMap &other) const
-{
-    // The default std::map::operator== would compare pointers, provide our own predicate
-    return size() == other.size()
-       && std::equal(begin(), end(), other.begin(), propertyPairEqual);
-}
-
 }
 
@@ -19,7 +19,10 @@
 
 #include <rosegardenprivate_export.h>
 
-#include <map>
+#include <QDebug>
+
+#include <string>
+#include <vector>
 
 namespace Rosegarden {
 
@@ -30,27 +33,221 @@ namespace Rosegarden {
  * need a time (Event::m_absoluteTime) and (usually) a duration
  * (Event::m_duration) but not all Event objects need a pitch
  * (BaseProperties::PITCH).  E.g a control change Event does not need a pitch.
+ *
+ * This is a vector of Entry objects sorted by PropertyName ID rather than
+ * a std::map of heap allocated PropertyStore objects.  Events rarely have
+ * more than a dozen properties, so a binary search over a small contiguous
+ * array beats walking a tree, and Int, Bool and RealTimeT values are stored
+ * inline in the Entry.  Only String values need their own allocation.
+ *
+ * Iterators are invalidated by insert() and erase().
  */
-class ROSEGARDENPRIVATE_EXPORT PropertyMap : public std::map<PropertyName, PropertyStoreBase *>
+class ROSEGARDENPRIVATE_EXPORT PropertyMap
 {
 public:
+
+    /// One name/value pair.
+    class ROSEGARDENPRIVATE_EXPORT Entry
+    {
+    public:
+        explicit Entry(const PropertyName &name) :
+            m_name(name),
+            m_type(Int),
+            m_int(0)
+        { }
+        Entry(const Entry &entry);
+        Entry(Entry &&entry) noexcept;
+        Entry &operator=(const Entry &entry);
+        Entry &operator=(Entry &&entry) noexcept;
+        ~Entry()  { freeString(); }
+
+        const PropertyName &getName() const  { return m_name; }
+
+        PropertyType getType() const  { return m_type; }
+        std::string getTypeName() const;
+
+        /// Get the value.  The caller must make sure getType() == P.
+        template <PropertyType P>
+        typename PropertyDefn<P>::basic_type getData() const;
+
+        /// Set the value, changing the type to P if needed.
+        template <PropertyType P>
+        void setData(typename PropertyDefn<P>::basic_type value);
+
+        std::string unparse() const;
+
+        /// Approximate.  For debugging and inspection purposes.
+        size_t getStorageSize() const;
+
+        bool operator==(const Entry &entry) const;
+        bool operator!=(const Entry &entry) const
+                { return !operator==(entry); }
+
+    private:
+        void copyValue(const Entry &entry);
+        /// Like copyValue(), but takes ownership of entry's string, if any.
+        void moveValue(Entry &entry);
+
+        void freeString()
+        {
+            if (m_type == String)
+                delete m_string;
+        }
+
+        PropertyName m_name;
+        PropertyType m_type;
+
+        union {
+            long m_int;
+            bool m_bool;
+            struct {
+                int sec;
+                int nsec;
+            } m_realTime;
+            std::string *m_string;
+        };
+    };
+
+    typedef std::vector<Entry> Container;
+    typedef Container::iterator iterator;
+    typedef Container::const_iterator const_iterator;
+
     PropertyMap() { }
-    PropertyMap(const PropertyMap &pm);
+    PropertyMap(const PropertyMap &pm) : m_entries(pm.m_entries) { }
+
+    // Allocated from a FixedSizePool.  See PoolAllocator.h.
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
+    iterator begin()  { return m_entries.begin(); }
+    iterator end()  { return m_entries.end(); }
+    const_iterator begin() const  { return m_entries.begin(); }
+    const_iterator end() const  { return m_entries.end(); }
+
+    size_t size() const  { return m_entries.size(); }
+    bool empty() const  { return m_entries.empty(); }
+
+    /// Binary search.  Returns end() if not found.
+    iterator find(const PropertyName &name);
+    const_iterator find(const PropertyName &name) const;
+
+    /// Insert a copy of entry, replacing any existing value for its name.
+    iterator insert(const Entry &entry);
+
+    /// Insert a value, replacing any existing value for name.
+    template <PropertyType P>
+    iterator insert(const PropertyName &name,
+                    typename PropertyDefn<P>::basic_type value);
+
+    void erase(iterator i)  { m_entries.erase(i); }
+    void erase(const PropertyName &name);
+
+    void clear()  { m_entries.clear(); }
 
-    ~PropertyMap();
-    
-    void clear();
-    
     std::string toXmlString() const;
 
-    bool operator==(const PropertyMap &other) const;
-    bool operator!=(const PropertyMap &other) const { return !operator==(other); }
+    bool operator==(const PropertyMap &other) const
+            { return m_entries == other.m_entries; }
+    bool operator!=(const PropertyMap &other) const
+            { return !operator==(other); }
 
 private:
     PropertyMap &operator=(const PropertyMap &); // not provided
+
+    /// First entry whose name is not less than name.
+    iterator lowerBound(const PropertyName &name);
+
+    Container m_entries;
 };
 
-typedef PropertyMap::value_type PropertyPair;
+template <>
+inline long
+PropertyMap::Entry::getData<Int>() const
+{
+    return m_int;
+}
+
+template <>
+inline bool
+PropertyMap::Entry::getData<Bool>() const
+{
+    return m_bool;
+}
+
+template <>
+inline RealTime
+PropertyMap::Entry::getData<RealTimeT>() const
+{
+    RealTime rt;
+    rt.sec = m_realTime.sec;
+    rt.nsec = m_realTime.nsec;
+    return rt;
+}
+
+template <>
+inline std::string
+PropertyMap::Entry::getData<String>() const
+{
+    return *m_string;
+}
+
+template <>
+inline void
+PropertyMap::Entry::setData<Int>(long value)
+{
+    freeString();
+    m_type = Int;
+    m_int = value;
+}
+
+template <>
+inline void
+PropertyMap::Entry::setData<Bool>(bool value)
+{
+    freeString();
+    m_type = Bool;
+    m_bool = value;
+}
+
+template <>
+inline void
+PropertyMap::Entry::setData<RealTimeT>(RealTime value)
+{
+    freeString();
+    m_type = RealTimeT;
+    m_realTime.sec = value.sec;
+    m_realTime.nsec = value.nsec;
+}
+
+template <>
+inline void
+PropertyMap::Entry::setData<String>(std::string value)
+{
+    if (m_type == String) {
+        m_string->swap(value);
+    } else {
+        m_string = new std::string(std::move(value));
+        m_type = String;
+    }
+}
+
+template <PropertyType P>
+PropertyMap::iterator
+PropertyMap::insert(const PropertyName &name,
+                    typename PropertyDefn<P>::basic_type value)
+{
+    iterator i = lowerBound(name);
+    if (i == m_entries.end()  ||  !(i->getName() == name))
+        i = m_entries.insert(i, Entry(name));
+    i->setData<P>(value);
+    return i;
+}
+
+inline QDebug operator<<(QDebug dbg, const PropertyMap::Entry &entry)
+{
+    dbg << entry.getTypeName().c_str() << "-" << entry.unparse().c_str();
+    return dbg;
+}
 
 }
 
@@ -18,8 +18,10 @@
 
 #include <QtGlobal>  // For Q_ASSERT()
 
+#include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
 
 
 namespace Rosegarden 
@@ -44,10 +46,34 @@ namespace
 
     int a_nextId = 0;
 
+    // Documents are saved on a worker thread while the GUI thread
+    // goes on creating names.
+    // Constant initialized, so safe to use during static init.
+    std::mutex a_mapMutex;
+
+    // Names this thread has looked up recently, by hash, so that the
+    // loading threads don't all queue on a_mapMutex for each property of
+    // each Event.  name points at the key in a_nameToIDMap, which is
+    // never erased from.  Plain data, so safe while the thread exits.
+    struct RecentName
+    {
+        const std::string *name;
+        int id;
+    };
+    constexpr size_t a_recentNameCount = 64;
+    thread_local RecentName a_recentNames[a_recentNameCount];
+
     // Get the existing ID for a name, or if not found, create
     // a new ID and add to the map.
     int a_getId(const std::string &name)
     {
+        RecentName &recent =
+                a_recentNames[std::hash<std::string>()(name) % a_recentNameCount];
+        if (recent.name  &&  *recent.name == name)
+            return recent.id;
+
+        std::lock_guard<std::mutex> lock(a_mapMutex);
+
         if (!a_nameToIDMap) {
             // Create on first use to avoid static init order fiasco.
             a_nameToIDMap = new NameToIDMap;
@@ -55,16 +81,18 @@ namespace
         }
 
         NameToIDMap::iterator idIter(a_nameToIDMap->find(name));
-        // Found it?  Return it.
-        if (idIter != a_nameToIDMap->end())
-            return idIter->second;
+        // Not found?  Create a new ID.
+        if (idIter == a_nameToIDMap->end()) {
+            const int newId = ++a_nextId;
+            idIter = a_nameToIDMap->insert(
+                    NameToIDMap::value_type(name, newId)).first;
+            a_idToNameMap->insert(IDToNameMap::value_type(newId, name));
+        }
 
-        // Not found.  Create a new ID.
+        recent.name = &idIter->first;
+        recent.id = idIter->second;
 
-        const int newId = ++a_nextId;
-        a_nameToIDMap->insert(NameToIDMap::value_type(name, newId));
-        a_idToNameMap->insert(IDToNameMap::value_type(newId, name));
-        return newId;
+        return idIter->second;
     }
 }
 
@@ -95,6 +123,8 @@ PropertyName &PropertyName::operator=(const std::string &name)
 
 std::string PropertyName::getName() const
 {
+    std::lock_guard<std::mutex> lock(a_mapMutex);
+
     IDToNameMap::iterator i(a_idToNameMap->find(m_id));
     // Not found?  Return the empty string.
     if (i == a_idToNameMap->end())
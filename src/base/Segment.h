@@ -29,6 +29,7 @@
 #include "RealTime.h"
 #include "MidiProgram.h"
 #include "MidiTypes.h"  // for Controller::EventType
+#include "PoolAllocator.h"
 
 #include <QColor>
 #include <QSharedPointer>
@@ -64,8 +65,11 @@ class BasicCommand;
  * EventContainer is a precursor to Segment, used in code that needs
  * to store events but doesn't need all the ancillary data and
  * behaviors that Segment provides.
+ *
+ * The tree nodes come from a FixedSizePool, like the Events themselves.
  */
-typedef std::multiset<Event *, Event::EventCmp> EventContainer;
+typedef std::multiset<Event *, Event::EventCmp, PoolAllocator<Event *> >
+        EventContainer;
 
 /// Container of Event objects.
 /**
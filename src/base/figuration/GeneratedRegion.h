@@ -29,7 +29,7 @@ namespace Rosegarden
 class GeneratedRegion
 {
 public:
-  static const std::string EventType;
+  static const std::string &EventType;
   static const int EventSubOrdering;
   static const PropertyName ChordPropertyName;
   static const PropertyName FigurationPropertyName;
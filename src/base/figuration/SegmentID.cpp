@@ -25,7 +25,7 @@
 namespace Rosegarden
 {
    //SegmentID event types
-const std::string SegmentID::EventType = "segment ID";
+const std::string &SegmentID::EventType = Event::internType("segment ID");
 const int SegmentID::EventSubOrdering = -190;
 const PropertyName SegmentID::IDPropertyName("ID");
 const PropertyName SegmentID::SubtypePropertyName("Subtype");
@@ -31,7 +31,7 @@ namespace Rosegarden
 class SegmentID
 {
  public:
-  static const std::string EventType;
+  static const std::string &EventType;
   static const int EventSubOrdering;
   static const PropertyName IDPropertyName;
   static const PropertyName SubtypePropertyName;
@@ -0,0 +1,586 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[DocumentCache]"
+
+#include "DocumentCache.h"
+
+#include "DocumentSnapshot.h"
+
+#include "base/BaseProperties.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "misc/Debug.h"
+#include "misc/Strings.h"
+
+#include <QByteArray>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cstring>
+#include <map>
+
+#include <zlib.h>
+
+namespace Rosegarden
+{
+
+
+namespace
+{
+    const char a_magic[8] = { 'R', 'G', 'E', 'V', 'C', 'A', 'C', 'H' };
+
+    // Bump whenever the layout below changes.
+    constexpr quint32 a_version = 1;
+
+    // Written natively, so this tells us if the cache came from a
+    // machine with the other byte order.
+    constexpr quint32 a_byteOrder = 0x01020304;
+
+    struct Header
+    {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+
+        // The .rg file this is for.  See readDocumentKey().
+        quint64 documentSize;
+        quint32 documentCrc;
+        quint32 documentLength;
+
+        // Everything after the header.
+        quint64 bodySize;
+        quint32 bodyCrc;
+        quint32 reserved;
+    };
+
+    // Property kinds.  The property's PropertyType, plus this bit for a
+    // non-persistent property.
+    constexpr quint8 a_nonPersistent = 0x80;
+
+    /// Identify a .rg file by its gzip trailer.
+    /**
+     * gzip ends with the CRC-32 and length (mod 2^32) of the
+     * uncompressed data, so this is a checksum of the contents that
+     * costs an 8 byte read.
+     */
+    bool readDocumentKey(const QString &documentFile, Header &header)
+    {
+        QFile file(documentFile);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+
+        const qint64 size = file.size();
+        if (size < 18)
+            return false;
+
+        unsigned char magic[2];
+        if (file.read(reinterpret_cast<char *>(magic), 2) != 2  ||
+            magic[0] != 0x1f  ||  magic[1] != 0x8b)
+            return false;
+
+        unsigned char trailer[8];
+        if (!file.seek(size - 8)  ||
+            file.read(reinterpret_cast<char *>(trailer), 8) != 8)
+            return false;
+
+        header.documentSize = quint64(size);
+        header.documentCrc = quint32(trailer[0]) |
+                             quint32(trailer[1]) << 8 |
+                             quint32(trailer[2]) << 16 |
+                             quint32(trailer[3]) << 24;
+        header.documentLength = quint32(trailer[4]) |
+                                quint32(trailer[5]) << 8 |
+                                quint32(trailer[6]) << 16 |
+                                quint32(trailer[7]) << 24;
+
+        return true;
+    }
+
+    template <typename T>
+    void put(QByteArray &buffer, T value)
+    {
+        buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void putString(QByteArray &buffer, const std::string &s)
+    {
+        put<quint32>(buffer, quint32(s.size()));
+        buffer.append(s.data(), int(s.size()));
+    }
+
+    /// Bounds checked reads from the mapping.
+    class Reader
+    {
+    public:
+        Reader(const uchar *data, qint64 size, qint64 position) :
+            m_data(data),
+            m_size(size),
+            m_position(position),
+            m_ok(position <= size)
+        { }
+
+        template <typename T>
+        T get()
+        {
+            T value = T();
+            if (!check(sizeof(T)))
+                return value;
+            memcpy(&value, m_data + m_position, sizeof(T));
+            m_position += sizeof(T);
+            return value;
+        }
+
+        std::string getString()
+        {
+            const quint32 length = get<quint32>();
+            if (!check(length))
+                return std::string();
+            std::string s(reinterpret_cast<const char *>(m_data + m_position),
+                          length);
+            m_position += length;
+            return s;
+        }
+
+        void skip(qint64 bytes)
+        {
+            if (check(bytes))
+                m_position += bytes;
+        }
+
+        void skipString()  { skip(get<quint32>()); }
+
+        qint64 getPosition() const  { return m_position; }
+        bool isOk() const  { return m_ok; }
+
+    private:
+        bool check(qint64 bytes)
+        {
+            if (m_ok  &&  m_size - m_position < bytes)
+                m_ok = false;
+            return m_ok;
+        }
+
+        const uchar *m_data;
+        qint64 m_size;
+        qint64 m_position;
+        bool m_ok;
+    };
+}
+
+
+DocumentCache::DocumentCache() :
+    m_data(nullptr),
+    m_size(0)
+{
+}
+
+DocumentCache::~DocumentCache()
+{
+    close();
+}
+
+QString
+DocumentCache::getCacheFileName(const QString &documentFile)
+{
+    const QFileInfo fileInfo(documentFile);
+    return fileInfo.absolutePath() + "/." + fileInfo.fileName() + ".cache";
+}
+
+bool
+DocumentCache::write(const DocumentSnapshot &snapshot,
+                     const std::vector<ByteRange> &eventRanges,
+                     const QString &documentFile)
+{
+    const std::vector<const std::vector<Event *> *> eventLists =
+            snapshot.getEventLists();
+
+    if (eventLists.size() != eventRanges.size())
+        return false;
+
+    Header header;
+    memcpy(header.magic, a_magic, sizeof(a_magic));
+    header.version = a_version;
+    header.byteOrder = a_byteOrder;
+    header.reserved = 0;
+
+    if (!readDocumentKey(documentFile, header))
+        return false;
+
+    // Event types and property names.
+    std::map<std::string, quint32> stringIndex;
+    std::vector<std::string> strings;
+
+    auto indexOf = [&stringIndex, &strings](const std::string &s) {
+        std::map<std::string, quint32>::const_iterator i = stringIndex.find(s);
+        if (i != stringIndex.end())
+            return i->second;
+        const quint32 index = quint32(strings.size());
+        stringIndex[s] = index;
+        strings.push_back(s);
+        return index;
+    };
+
+    QByteArray events;
+    events.reserve(int(snapshot.getEventCount() * 40));
+
+    std::vector<quint64> eventOffsets;
+
+    for (const std::vector<Event *> *eventList : eventLists) {
+
+        eventOffsets.push_back(quint64(events.size()));
+
+        for (const Event *event : *eventList) {
+
+            // As Event::toXmlString().
+            timeT duration = event->getDuration();
+            if (event->isa(Note::EventType)  &&
+                duration < 1  &&
+                !event->has(BaseProperties::IS_GRACE_NOTE))
+                duration = 1;
+
+            put<quint32>(events, indexOf(event->getType()));
+            put<qint64>(events, event->getAbsoluteTime());
+            put<qint64>(events, duration);
+            put<qint16>(events, event->getSubOrdering());
+
+            Event::PropertyNames persistent =
+                    event->getPersistentPropertyNames();
+            Event::PropertyNames nonPersistent =
+                    event->getNonPersistentPropertyNames();
+
+            // Patched up once we know how many were written.
+            const int countPosition = events.size();
+            put<quint16>(events, 0);
+            quint16 count = 0;
+
+            for (int pass = 0; pass < 2; ++pass) {
+                const Event::PropertyNames &names =
+                        (pass == 0) ? persistent : nonPersistent;
+                const quint8 flag = (pass == 0) ? 0 : a_nonPersistent;
+
+                for (const PropertyName &name : names) {
+                    const PropertyType type = event->getPropertyType(name);
+
+                    // The XML has no way to load these, so neither do we.
+                    if (type == RealTimeT)
+                        continue;
+
+                    put<quint32>(events, indexOf(name.getName()));
+                    put<quint8>(events, quint8(type) | flag);
+
+                    switch (type) {
+                    case Int:
+                        put<qint64>(events, event->get<Int>(name));
+                        break;
+                    case Bool:
+                        put<quint8>(events, event->get<Bool>(name) ? 1 : 0);
+                        break;
+                    case String:
+                        putString(events, event->get<String>(name));
+                        break;
+                    case RealTimeT:
+                        break;
+                    }
+
+                    ++count;
+                }
+            }
+
+            memcpy(events.data() + countPosition, &count, sizeof(count));
+        }
+    }
+
+    QByteArray body;
+
+    put<quint32>(body, quint32(strings.size()));
+    for (const std::string &s : strings) {
+        putString(body, s);
+    }
+
+    // Segment table, then the events.
+    const quint64 tableSize =
+            sizeof(quint32) +
+            eventLists.size() * (2 * sizeof(qint64) +
+                                 sizeof(quint64) + sizeof(quint32));
+    const quint64 eventsStart = sizeof(Header) + body.size() + tableSize;
+
+    put<quint32>(body, quint32(eventLists.size()));
+    for (size_t i = 0; i < eventLists.size(); ++i) {
+        put<qint64>(body, eventRanges[i].first);
+        put<qint64>(body, eventRanges[i].second);
+        put<quint64>(body, eventsStart + eventOffsets[i]);
+        put<quint32>(body, quint32(eventLists[i]->size()));
+    }
+
+    body.append(events);
+
+    header.bodySize = quint64(body.size());
+    header.bodyCrc = quint32(crc32(
+            0, reinterpret_cast<const Bytef *>(body.constData()),
+            uInt(body.size())));
+
+    QSaveFile file(getCacheFileName(documentFile));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(body);
+
+    if (!file.commit()) {
+        RG_WARNING << "write(): Could not write" << file.fileName();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+DocumentCache::open(const QString &documentFile)
+{
+    close();
+
+    Header key;
+    if (!readDocumentKey(documentFile, key))
+        return false;
+
+    m_file.setFileName(getCacheFileName(documentFile));
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(Header))) {
+        close();
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        close();
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, m_data, sizeof(header));
+
+    if (memcmp(header.magic, a_magic, sizeof(a_magic)) != 0  ||
+        header.version != a_version  ||
+        header.byteOrder != a_byteOrder  ||
+        header.documentSize != key.documentSize  ||
+        header.documentCrc != key.documentCrc  ||
+        header.documentLength != key.documentLength  ||
+        header.bodySize != quint64(m_size) - sizeof(Header)) {
+        RG_DEBUG << "open(): Stale cache for" << documentFile;
+        close();
+        return false;
+    }
+
+    const quint32 bodyCrc = quint32(crc32(
+            0, m_data + sizeof(Header), uInt(header.bodySize)));
+    if (bodyCrc != header.bodyCrc) {
+        RG_WARNING << "open(): Corrupt cache for" << documentFile;
+        close();
+        return false;
+    }
+
+    Reader reader(m_data, m_size, sizeof(Header));
+
+    const quint32 stringCount = reader.get<quint32>();
+    for (quint32 i = 0; i < stringCount  &&  reader.isOk(); ++i) {
+        m_strings.push_back(reader.getString());
+        m_names.push_back(PropertyName(m_strings.back()));
+    }
+
+    const quint32 segmentCount = reader.get<quint32>();
+    for (quint32 i = 0; i < segmentCount  &&  reader.isOk(); ++i) {
+        SegmentEntry entry;
+        entry.range.first = reader.get<qint64>();
+        entry.range.second = reader.get<qint64>();
+        entry.offset = reader.get<quint64>();
+        entry.eventCount = reader.get<quint32>();
+        m_segments.push_back(entry);
+    }
+
+    if (!reader.isOk()) {
+        close();
+        return false;
+    }
+
+    // Once the parser has skipped a segment's events, there is no going
+    // back to the XML for them.  So check them all now.
+    qint64 previousEnd = 0;
+    for (const SegmentEntry &entry : m_segments) {
+        if (entry.range.first < previousEnd  ||
+            entry.range.second < entry.range.first  ||
+            !checkEvents(entry)) {
+            RG_WARNING << "open(): Bad cache for" << documentFile;
+            close();
+            return false;
+        }
+        previousEnd = entry.range.second;
+    }
+
+    return true;
+}
+
+bool
+DocumentCache::checkEvents(const SegmentEntry &entry) const
+{
+    Reader reader(m_data, m_size, qint64(entry.offset));
+
+    for (quint32 i = 0; i < entry.eventCount; ++i) {
+
+        const quint32 type = reader.get<quint32>();
+        reader.skip(2 * sizeof(qint64) + sizeof(qint16));
+        const quint16 propertyCount = reader.get<quint16>();
+
+        if (!reader.isOk()  ||  type >= m_strings.size())
+            return false;
+
+        for (quint16 j = 0; j < propertyCount; ++j) {
+            const quint32 nameIndex = reader.get<quint32>();
+            const quint8 kind = reader.get<quint8>();
+
+            if (!reader.isOk()  ||  nameIndex >= m_strings.size())
+                return false;
+
+            switch (kind & ~a_nonPersistent) {
+            case Int:
+                reader.skip(sizeof(qint64));
+                break;
+            case Bool:
+                reader.skip(sizeof(quint8));
+                break;
+            case String:
+                reader.skipString();
+                break;
+            default:
+                return false;
+            }
+        }
+    }
+
+    return reader.isOk();
+}
+
+std::vector<DocumentCache::ByteRange>
+DocumentCache::getEventRanges() const
+{
+    std::vector<ByteRange> ranges;
+    ranges.reserve(m_segments.size());
+
+    for (const SegmentEntry &entry : m_segments) {
+        ranges.push_back(entry.range);
+    }
+
+    return ranges;
+}
+
+bool
+DocumentCache::insertEvents(size_t segment, Segment *target) const
+{
+    if (segment >= m_segments.size())
+        return false;
+
+    const SegmentEntry &entry = m_segments[segment];
+    Reader reader(m_data, m_size, qint64(entry.offset));
+
+    // As RoseXmlHandler.
+    std::map<long, long> groupIds;
+
+    for (quint32 i = 0; i < entry.eventCount; ++i) {
+
+        const quint32 type = reader.get<quint32>();
+        const qint64 absoluteTime = reader.get<qint64>();
+        const qint64 duration = reader.get<qint64>();
+        const qint16 subOrdering = reader.get<qint16>();
+        const quint16 propertyCount = reader.get<quint16>();
+
+        if (!reader.isOk()  ||  type >= m_strings.size())
+            return false;
+
+        Event *event = new Event(m_strings[type], absoluteTime, duration,
+                                 subOrdering);
+
+        for (quint16 j = 0; j < propertyCount; ++j) {
+            const quint32 nameIndex = reader.get<quint32>();
+            const quint8 kind = reader.get<quint8>();
+
+            if (!reader.isOk()  ||  nameIndex >= m_strings.size()) {
+                delete event;
+                return false;
+            }
+
+            const PropertyName &name = m_names[nameIndex];
+            const bool persistent = !(kind & a_nonPersistent);
+
+            switch (kind & ~a_nonPersistent) {
+            case Int:
+                event->set<Int>(name, long(reader.get<qint64>()), persistent);
+                break;
+            case Bool:
+                event->set<Bool>(name, reader.get<quint8>() != 0, persistent);
+                break;
+            case String:
+                event->set<String>(name, reader.getString(), persistent);
+                break;
+            default:
+                delete event;
+                return false;
+            }
+        }
+
+        if (!reader.isOk()) {
+            delete event;
+            return false;
+        }
+
+        if (event->has(BaseProperties::BEAMED_GROUP_ID)) {
+            const long storedId =
+                    event->get<Int>(BaseProperties::BEAMED_GROUP_ID);
+            std::map<long, long>::const_iterator id = groupIds.find(storedId);
+            if (id == groupIds.end())
+                id = groupIds.insert(std::make_pair(
+                        storedId, long(target->getNextId()))).first;
+            event->set<Int>(BaseProperties::BEAMED_GROUP_ID, id->second);
+        }
+
+        target->insert(event);
+    }
+
+    return true;
+}
+
+void
+DocumentCache::close()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+        m_data = nullptr;
+    }
+
+    m_file.close();
+    m_size = 0;
+
+    m_strings.clear();
+    m_names.clear();
+    m_segments.clear();
+}
+
+
+}
@@ -0,0 +1,125 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_DOCUMENTCACHE_H
+#define RG_DOCUMENTCACHE_H
+
+#include "base/PropertyName.h"
+
+#include <QFile>
+#include <QString>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Rosegarden
+{
+
+class DocumentSnapshot;
+class Segment;
+
+/// Binary fast-load cache of a .rg file's events.
+/**
+ * Nearly all of the time spent loading a big composition goes on
+ * parsing <event> elements and their properties.  So when a document
+ * is saved, the events are also written to a hidden file beside it
+ * (see getCacheFileName()) in a compact binary form, along with where
+ * each segment's events went in the XML.
+ *
+ * On load, if the cache is still valid for the .rg file, those parts of
+ * the XML are skipped before they get to the parser (see
+ * GzipInputFile::setSkipRanges()) and RoseXmlHandler bulk loads each
+ * segment's events from the cache instead.  Everything else still
+ * comes from the XML.
+ *
+ * The cache is keyed on the .rg file's size and on the CRC and length
+ * of its contents, which gzip stores at the end of the file, so a
+ * cache that doesn't match, because the file was changed by something
+ * else, is simply ignored.  The cache carries its own checksum too.
+ */
+class DocumentCache
+{
+public:
+    DocumentCache();
+    ~DocumentCache();
+
+    /// The cache file for a .rg file.
+    static QString getCacheFileName(const QString &documentFile);
+
+    /// [begin, end) in bytes of uncompressed XML.
+    typedef std::pair<qint64, qint64> ByteRange;
+
+    /// Write the cache for a document that was just saved.
+    /**
+     * snapshot is what was saved to documentFile and eventRanges is
+     * where DocumentSnapshot::write() put each event list.
+     */
+    static bool write(const DocumentSnapshot &snapshot,
+                      const std::vector<ByteRange> &eventRanges,
+                      const QString &documentFile);
+
+    /// Open and check the cache for documentFile.
+    /**
+     * Returns false if there is no cache or it is stale or corrupt, in
+     * which case the document must be loaded from the XML as usual.
+     */
+    bool open(const QString &documentFile);
+
+    /// Number of event lists, one per non-audio segment.
+    size_t getSegmentCount() const  { return m_segments.size(); }
+
+    /// Where the event lists are in the XML, for skipping them.
+    std::vector<ByteRange> getEventRanges() const;
+
+    /// Insert the events for the segment'th non-audio segment in the file.
+    /**
+     * open() has already checked that all the events can be read, so
+     * this only fails if there is no such segment.
+     *
+     * Beamed group IDs are remapped to new IDs from the segment, just as
+     * RoseXmlHandler does.
+     */
+    bool insertEvents(size_t segment, Segment *target) const;
+
+private:
+    struct SegmentEntry
+    {
+        ByteRange range;
+        /// Offset of the first event from the start of the mapping.
+        quint64 offset;
+        quint32 eventCount;
+    };
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+
+    std::vector<std::string> m_strings;
+    std::vector<PropertyName> m_names;
+    std::vector<SegmentEntry> m_segments;
+
+    /// Whether the segment's events can all be read.
+    bool checkEvents(const SegmentEntry &entry) const;
+
+    void close();
+};
+
+
+}
+
+#endif
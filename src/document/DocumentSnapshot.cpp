@@ -0,0 +1,166 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "DocumentSnapshot.h"
+
+#include "base/Event.h"
+#include "base/Segment.h"
+#include "misc/Strings.h"
+
+#include <QTextStream>
+
+namespace Rosegarden
+{
+
+
+DocumentSnapshot::DocumentSnapshot() :
+    m_eventCount(0)
+{
+}
+
+DocumentSnapshot::~DocumentSnapshot()
+{
+    for (const Chunk &chunk : m_chunks) {
+        for (Event *event : chunk.events) {
+            delete event;
+        }
+    }
+}
+
+void
+DocumentSnapshot::append(const QString &xml)
+{
+    // Text can only go on the end of a chunk that has no events yet.
+    if (m_chunks.empty()  ||  m_chunks.back().hasEvents)
+        m_chunks.push_back(Chunk());
+
+    m_chunks.back().xml += xml;
+}
+
+void
+DocumentSnapshot::appendEvents(const Segment *segment)
+{
+    // Each segment's events need their own chunk for the start time.
+    if (m_chunks.empty()  ||  m_chunks.back().hasEvents)
+        m_chunks.push_back(Chunk());
+
+    Chunk &chunk = m_chunks.back();
+    chunk.hasEvents = true;
+    chunk.startTime = segment->getStartTime();
+    chunk.events.reserve(segment->size());
+
+    for (const Event *event : *segment) {
+        chunk.events.push_back(event->copyForSaving());
+    }
+
+    m_eventCount += chunk.events.size();
+}
+
+std::vector<const std::vector<Event *> *>
+DocumentSnapshot::getEventLists() const
+{
+    std::vector<const std::vector<Event *> *> lists;
+
+    for (const Chunk &chunk : m_chunks) {
+        if (chunk.hasEvents)
+            lists.push_back(&chunk.events);
+    }
+
+    return lists;
+}
+
+void
+DocumentSnapshot::write(QTextStream &outStream,
+                        std::vector<ByteRange> *eventRanges) const
+{
+    if (eventRanges)
+        eventRanges->clear();
+
+    for (const Chunk &chunk : m_chunks) {
+        outStream << chunk.xml;
+
+        if (!chunk.hasEvents)
+            continue;
+
+        if (!eventRanges) {
+            writeEvents(outStream, chunk);
+            continue;
+        }
+
+        outStream.flush();
+        const qint64 begin = outStream.device()->pos();
+
+        writeEvents(outStream, chunk);
+
+        outStream.flush();
+        eventRanges->push_back(ByteRange(begin, outStream.device()->pos()));
+    }
+}
+
+void
+DocumentSnapshot::writeEvents(QTextStream &outStream, const Chunk &chunk)
+{
+    bool inChord = false;
+    timeT chordStart = 0, chordDuration = 0;
+    timeT expectedTime = chunk.startTime;
+
+    const std::vector<Event *> &events = chunk.events;
+
+    for (size_t i = 0; i < events.size(); ++i) {
+
+        const Event *event = events[i];
+        const Event *next = (i + 1 < events.size()) ? events[i + 1] : nullptr;
+
+        timeT absTime = event->getAbsoluteTime();
+
+        if (next &&
+                next->getAbsoluteTime() == absTime &&
+                event->getDuration() != 0 &&
+                !inChord) {
+            outStream << "<chord>\n";
+            inChord = true;
+            chordStart = absTime;
+            chordDuration = 0;
+        }
+
+        if (inChord && event->getDuration() > 0)
+            if (chordDuration == 0 || event->getDuration() < chordDuration)
+                chordDuration = event->getDuration();
+
+        outStream << '\t'
+        << strtoqstr(event->toXmlString(expectedTime)) << "\n";
+
+        if (next &&
+                next->getAbsoluteTime() != absTime &&
+                inChord) {
+            outStream << "</chord>\n";
+            inChord = false;
+            expectedTime = chordStart + chordDuration;
+        } else if (inChord) {
+            expectedTime = absTime;
+        } else {
+            expectedTime = absTime + event->getDuration();
+        }
+    }
+
+    if (inChord) {
+        outStream << "</chord>\n";
+    }
+}
+
+
+}
@@ -0,0 +1,108 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_DOCUMENTSNAPSHOT_H
+#define RG_DOCUMENTSNAPSHOT_H
+
+#include "base/TimeT.h"
+
+#include <QString>
+
+#include <utility>
+#include <vector>
+
+class QTextStream;
+
+namespace Rosegarden
+{
+
+class Event;
+class Segment;
+
+/// A frozen copy of a document's XML, for saving on another thread.
+/**
+ * RosegardenDocument builds one of these on the GUI thread.  Everything
+ * other than the segments' events is rendered to XML text straight away,
+ * since that is quick.  The events, which are the bulk of any real
+ * composition, are only copied, and the copies share their data with
+ * the originals (see Event::copyForSaving()), so taking a snapshot costs
+ * little more than a pointer copy per event.
+ *
+ * write() then produces the .rg XML from the snapshot and is safe to
+ * call from any thread, while the document carries on being edited.
+ *
+ * The snapshot must be destroyed on the thread that created it, since
+ * destroying the copies touches the reference counts they share with
+ * the document's events.
+ */
+class DocumentSnapshot
+{
+public:
+    DocumentSnapshot();
+    ~DocumentSnapshot();
+
+    /// Append some XML text.
+    void append(const QString &xml);
+
+    /// Append a copy of a segment's events, to be written as XML later.
+    void appendEvents(const Segment *segment);
+
+    /// Number of events held.
+    size_t getEventCount() const  { return m_eventCount; }
+
+    /// The events from each appendEvents() call, in order.
+    std::vector<const std::vector<Event *> *> getEventLists() const;
+
+    /// [begin, end) byte offsets in the written text.
+    typedef std::pair<qint64, qint64> ByteRange;
+
+    /// Write the whole snapshot out as XML.
+    /**
+     * If eventRanges is given, it is filled in with where each of the
+     * event lists went in the output, going by the stream's device's
+     * pos().
+     */
+    void write(QTextStream &outStream,
+               std::vector<ByteRange> *eventRanges = nullptr) const;
+
+private:
+    // Not provided.
+    DocumentSnapshot(const DocumentSnapshot &);
+    DocumentSnapshot &operator=(const DocumentSnapshot &);
+
+    /// Some XML text followed by some events.
+    struct Chunk
+    {
+        QString xml;
+
+        /// Whether appendEvents() was called for this chunk.
+        bool hasEvents = false;
+        timeT startTime = 0;
+        std::vector<Event *> events;
+    };
+
+    std::vector<Chunk> m_chunks;
+
+    size_t m_eventCount;
+
+    static void writeEvents(QTextStream &outStream, const Chunk &chunk);
+};
+
+
+}
+
+#endif
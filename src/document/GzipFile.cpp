@@ -16,8 +16,15 @@
 */
 
 #include "GzipFile.h"
+#include <QFileInfo>
+#include <QMutexLocker>
 #include <QString>
+#include <QThread>
+
+#include <algorithm>
+#include <cstring>
 #include <string>
+
 #include <zlib.h>
 
 namespace Rosegarden
@@ -26,17 +33,15 @@ namespace Rosegarden
 bool
 GzipFile::writeToFile(QString file, QString text)
 {
-    std::string stext = std::string(text.toUtf8().data());
-    const char *ctext = stext.c_str();
-    size_t csize = stext.length();
+    const QByteArray utf8 = text.toUtf8();
 
     gzFile fd = gzopen(file.toLocal8Bit().data(), "wb");
     if (!fd) return false;
 
-    int actual = gzwrite(fd, (void *)ctext, csize);
-    gzclose(fd);
+    int actual = gzwrite(fd, utf8.constData(), unsigned(utf8.size()));
+    int closed = gzclose(fd);
 
-    return ((size_t)actual == csize);
+    return (actual == utf8.size()  &&  closed == Z_OK);
 }
 
 bool
@@ -58,7 +63,313 @@ GzipFile::readFromFile(QString file, QString &text)
     gzclose(fd);
     text = QString::fromUtf8(ba);
     return ok;
-}    
+}
+
+
+GzipOutputFile::GzipOutputFile(const QString &file) :
+    m_file(file),
+    m_fd(nullptr),
+    m_written(0),
+    m_error(false)
+{
+}
+
+GzipOutputFile::~GzipOutputFile()
+{
+    close();
+}
+
+bool
+GzipOutputFile::open(OpenMode mode)
+{
+    if (m_fd  ||  (mode & ReadOnly)  ||  !(mode & WriteOnly)) return false;
+
+    m_fd = gzopen(m_file.toLocal8Bit().data(), "wb");
+    if (!m_fd) {
+        m_error = true;
+        return false;
+    }
+
+    // zlib's default 8k buffer means a lot of small writes.
+    gzbuffer(m_fd, 128 * 1024);
+
+    m_written = 0;
+    m_error = false;
+    return QIODevice::open(mode);
+}
+
+void
+GzipOutputFile::close()
+{
+    if (!m_fd) return;
+
+    // Let any QTextStream writing to us flush first.
+    QIODevice::close();
+
+    if (gzclose(m_fd) != Z_OK) m_error = true;
+    m_fd = nullptr;
+}
+
+qint64
+GzipOutputFile::readData(char *, qint64)
+{
+    return -1;
+}
+
+qint64
+GzipOutputFile::writeData(const char *data, qint64 size)
+{
+    if (!m_fd  ||  m_error) return -1;
+
+    qint64 written = 0;
+
+    // gzwrite() takes an unsigned int length.
+    while (written < size) {
+        const unsigned chunk =
+            unsigned(std::min<qint64>(size - written, 1 << 30));
+        const int actual = gzwrite(m_fd, data + written, chunk);
+        if (actual <= 0) {
+            m_error = true;
+            return -1;
+        }
+        written += actual;
+    }
+
+    m_written += written;
+
+    return written;
+}
+
+
+namespace
+{
+    // Large enough that the threads don't spend their time handing
+    // over chunks, small enough that the queue stays at about a meg.
+    constexpr int inflateChunkSize = 256 * 1024;
+    constexpr size_t maxQueuedChunks = 4;
+}
+
+class GzipInputFile::InflateThread : public QThread
+{
+public:
+    explicit InflateThread(GzipInputFile *file) :
+        m_file(file)
+    { }
+
+protected:
+    void run() override;
+
+private:
+    GzipInputFile *m_file;
+};
+
+void
+GzipInputFile::InflateThread::run()
+{
+    gzFile fd = gzopen(m_file->m_file.toLocal8Bit().data(), "rb");
+    bool error = !fd;
+
+    const std::vector<ByteRange> &skipRanges = m_file->m_skipRanges;
+    std::vector<ByteRange>::const_iterator skip = skipRanges.begin();
+
+    // Uncompressed position of the start of the next chunk.
+    qint64 position = 0;
+
+    if (fd) {
+        gzbuffer(fd, inflateChunkSize);
+
+        while (true) {
+            Chunk chunk;
+            chunk.data.resize(inflateChunkSize);
+
+            const int got = gzread(fd, chunk.data.data(), inflateChunkSize);
+            if (got <= 0) {
+                error = (got < 0  ||  !gzeof(fd));
+                break;
+            }
+
+            // Squeeze out anything we've been asked to skip.
+            char *data = chunk.data.data();
+            const qint64 chunkEnd = position + got;
+            int kept = 0;
+            qint64 from = position;
+
+            while (from < chunkEnd) {
+                while (skip != skipRanges.end()  &&  skip->second <= from)
+                    ++skip;
+
+                qint64 to = chunkEnd;
+                if (skip != skipRanges.end()  &&  skip->first < chunkEnd)
+                    to = std::max(from, skip->first);
+
+                if (to > from) {
+                    memmove(data + kept, data + (from - position),
+                            size_t(to - from));
+                    kept += int(to - from);
+                }
+
+                from = to;
+                if (skip != skipRanges.end()  &&  from >= skip->first)
+                    from = std::min(chunkEnd, skip->second);
+            }
+
+            position = chunkEnd;
+
+            if (kept == 0)
+                continue;
+
+            chunk.data.resize(kept);
+            chunk.offset = gzoffset(fd);
+
+            QMutexLocker locker(&m_file->m_mutex);
+
+            while (m_file->m_queue.size() >= maxQueuedChunks  &&
+                   !m_file->m_stopping) {
+                m_file->m_chunkTaken.wait(&m_file->m_mutex);
+            }
+
+            if (m_file->m_stopping)
+                break;
+
+            m_file->m_queue.push_back(chunk);
+            m_file->m_chunkQueued.wakeOne();
+        }
+
+        gzclose(fd);
+    }
+
+    QMutexLocker locker(&m_file->m_mutex);
+    m_file->m_finished = true;
+    if (error)
+        m_file->m_error = true;
+    m_file->m_chunkQueued.wakeAll();
+}
+
+GzipInputFile::GzipInputFile(const QString &file) :
+    m_file(file),
+    m_fileSize(0),
+    m_thread(nullptr),
+    m_readPos(0),
+    m_readOffset(0),
+    m_finished(false),
+    m_stopping(false),
+    m_error(false)
+{
+}
+
+GzipInputFile::~GzipInputFile()
+{
+    close();
+}
+
+bool
+GzipInputFile::open(OpenMode mode)
+{
+    if (m_thread  ||  (mode & WriteOnly)  ||  !(mode & ReadOnly)) return false;
+
+    QFileInfo fileInfo(m_file);
+    if (!fileInfo.isReadable()) {
+        m_error = true;
+        return false;
+    }
+
+    m_fileSize = fileInfo.size();
+    m_queue.clear();
+    m_readPos = 0;
+    m_readOffset = 0;
+    m_finished = false;
+    m_stopping = false;
+    m_error = false;
+
+    // We do our own buffering.
+    if (!QIODevice::open(mode | Unbuffered)) return false;
+
+    m_thread = new InflateThread(this);
+    m_thread->start();
+
+    return true;
+}
+
+void
+GzipInputFile::close()
+{
+    if (!m_thread) return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_chunkTaken.wakeAll();
+    }
+
+    m_thread->wait();
+    delete m_thread;
+    m_thread = nullptr;
+
+    m_queue.clear();
+
+    QIODevice::close();
+}
+
+bool
+GzipInputFile::atEnd() const
+{
+    if (!isOpen()) return true;
+
+    QMutexLocker locker(&m_mutex);
+    return (m_finished  &&  m_queue.empty());
+}
+
+bool
+GzipInputFile::hasError() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_error;
+}
+
+int
+GzipInputFile::getProgress() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_fileSize <= 0) return 0;
+
+    return int(std::min<qint64>(m_readOffset * 100 / m_fileSize, 100));
+}
+
+qint64
+GzipInputFile::readData(char *data, qint64 maxSize)
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (m_queue.empty()  &&  !m_finished) {
+        m_chunkQueued.wait(&m_mutex);
+    }
+
+    if (m_queue.empty()) return m_error ? -1 : 0;
+
+    Chunk &chunk = m_queue.front();
+
+    const qint64 count =
+        std::min<qint64>(maxSize, chunk.data.size() - m_readPos);
+    memcpy(data, chunk.data.constData() + m_readPos, size_t(count));
+
+    m_readPos += int(count);
+    m_readOffset = chunk.offset;
+
+    if (m_readPos == chunk.data.size()) {
+        m_queue.pop_front();
+        m_readPos = 0;
+        m_chunkTaken.wakeOne();
+    }
+
+    return count;
+}
+
+qint64
+GzipInputFile::writeData(const char *, qint64)
+{
+    return -1;
+}
 
 }
 
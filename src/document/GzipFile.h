@@ -15,7 +15,20 @@
     COPYING included with this distribution for more information.
 */
 
+#ifndef RG_GZIPFILE_H
+#define RG_GZIPFILE_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QMutex>
 #include <QString>
+#include <QWaitCondition>
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+struct gzFile_s;
 
 namespace Rosegarden
 {
@@ -27,6 +40,129 @@ public:
     static bool readFromFile(QString file, QString &text);
 };
 
+/// Write-only QIODevice that gzips everything written to it into a file.
+/**
+ * For writing large documents through a QTextStream a piece at a time,
+ * so that neither the text nor the compressed data ever has to be held
+ * in memory all at once.
+ *
+ * Check hasError() after close() to find out whether everything made
+ * it to disk.
+ */
+class GzipOutputFile : public QIODevice
+{
+public:
+    explicit GzipOutputFile(const QString &file);
+    ~GzipOutputFile() override;
+
+    /// Only WriteOnly is supported.
+    bool open(OpenMode mode) override;
+
+    /// Flush and close the file.
+    void close() override;
+
+    bool isSequential() const override  { return true; }
+
+    /// Number of (uncompressed) bytes written so far.
+    qint64 pos() const override  { return m_written; }
+
+    /// True if anything failed to open, compress or write.
+    bool hasError() const  { return m_error; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    QString m_file;
+    gzFile_s *m_fd;
+    qint64 m_written;
+    bool m_error;
+};
+
+/// Read-only QIODevice that decompresses a gzip file on another thread.
+/**
+ * For reading large documents without holding either the compressed
+ * data or the full text in memory.  A background thread inflates the
+ * file a chunk at a time into a short queue, and reads take from the
+ * front of it, blocking only if the thread hasn't caught up.  So a
+ * parser reading from this overlaps with the decompression, and only
+ * a few chunks are ever in memory.
+ *
+ * Uncompressed files are read as is.
+ */
+class GzipInputFile : public QIODevice
+{
+public:
+    explicit GzipInputFile(const QString &file);
+    ~GzipInputFile() override;
+
+    /// [begin, end) in uncompressed bytes.
+    typedef std::pair<qint64, qint64> ByteRange;
+
+    /// Leave out parts of the uncompressed text.
+    /**
+     * ranges must be sorted and must not overlap.  Call before open().
+     * Skipped bytes are still inflated but never reach the reader.
+     */
+    void setSkipRanges(const std::vector<ByteRange> &ranges)
+            { m_skipRanges = ranges; }
+
+    /// Only ReadOnly is supported.  Starts the decompression.
+    bool open(OpenMode mode) override;
+
+    /// Stop decompressing and close the file.
+    void close() override;
+
+    bool isSequential() const override  { return true; }
+    bool atEnd() const override;
+
+    /// True if the file couldn't be opened or was corrupt or truncated.
+    bool hasError() const;
+
+    /// How far through the file reading has got, as a percentage.
+    int getProgress() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    class InflateThread;
+    friend class InflateThread;
+
+    QString m_file;
+    qint64 m_fileSize;
+
+    std::vector<ByteRange> m_skipRanges;
+
+    InflateThread *m_thread;
+
+    struct Chunk
+    {
+        QByteArray data;
+        /// Position in the compressed file at the end of this chunk.
+        qint64 offset;
+    };
+
+    /// Guards everything below.
+    mutable QMutex m_mutex;
+    /// Signalled when a chunk is queued or the thread finishes.
+    QWaitCondition m_chunkQueued;
+    /// Signalled when a chunk is taken from the queue, or on close().
+    QWaitCondition m_chunkTaken;
+
+    std::deque<Chunk> m_queue;
+    /// Position of the next byte to read in the chunk at the front.
+    int m_readPos;
+    qint64 m_readOffset;
+    bool m_finished;
+    bool m_stopping;
+    bool m_error;
+};
+
 }
 
+#endif
+
 
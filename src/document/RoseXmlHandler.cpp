@@ -19,6 +19,8 @@
 #define RG_NO_DEBUG_PRINT
 
 #include "RoseXmlHandler.h"
+#include "GzipFile.h"
+#include "DocumentCache.h"
 
 #include "sound/Midi.h"
 #include "misc/Debug.h"
@@ -62,8 +64,15 @@
 #include <QDataStream>
 #include <QDialog>
 #include <QFileInfo>
+#include <QMutex>
 #include <QString>
 #include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+#include <QXmlStreamAttributes>
+
+#include <algorithm>
+#include <deque>
 
 namespace Rosegarden
 {
@@ -207,8 +216,455 @@ ConfigurationXmlSubHandler::endElement(const QString&,
 
 
 
+/// Builds the events of non-audio segments on a pool of worker threads.
+/**
+ * Turning <event> elements into Events, and their attributes into
+ * properties, is most of the work of loading a composition.  Each
+ * segment's events only depend on each other, so while the XML is being
+ * read, the elements found within a segment are just recorded.  At the
+ * end of the segment they are handed to a worker thread, which builds
+ * the events much as RoseXmlHandler used to, while the XML reader moves
+ * on to the next segment.
+ *
+ * Segments and the Composition may only be touched on the GUI thread,
+ * so the finished events are inserted from there, one segment at a time
+ * and in file order, as each segment's turn comes up.
+ */
+class RoseXmlHandler::SegmentDecoder
+{
+public:
+    SegmentDecoder();
+    ~SegmentDecoder();
+
+    /// Start recording the events for a segment.
+    void beginSegment(Segment *segment, timeT startTime);
+
+    /// Record an element if it belongs to the segment's events.
+    /**
+     * Returns false if the element is something else, which the
+     * handler should deal with as usual.
+     */
+    bool startElement(const QString &lcName,
+                      const QXmlStreamAttributes &atts);
+    bool endElement(const QString &lcName);
+
+    /// Hand the recorded events to the worker threads.
+    /**
+     * Takes ownership of endMarkerTime, which may be null, since it can
+     * only be applied once the events are in.
+     */
+    void endSegment(timeT *endMarkerTime);
+
+    /// Wait for all of the segments and insert their events.
+    void finish();
+
+private:
+    enum ElementType {
+        EventStart,
+        EventEnd,
+        Property,
+        NonPersistentProperty,
+        ChordStart,
+        ChordEnd,
+        GroupStart,
+        GroupEnd
+    };
+
+    struct Element
+    {
+        ElementType type;
+        QXmlStreamAttributes attributes;
+    };
+
+    struct Job
+    {
+        Segment *segment;
+        timeT startTime;
+        timeT *endMarkerTime;
+
+        std::vector<Element> elements;
+
+        // Filled in by decode().
+
+        std::vector<Event *> events;
+        /// Indices of events in groups, and of their groups, to be given
+        /// a real BEAMED_GROUP_ID from the Segment.
+        std::vector<std::pair<size_t, long> > groupedEvents;
+        long groupCount;
+
+        /// Guarded by m_mutex.
+        bool done;
+    };
+
+    /// Jobs in file order, waiting to be inserted.
+    std::deque<Job *> m_jobs;
+    /// The job being recorded.
+    Job *m_current;
+
+    class WorkerThread;
+    std::vector<WorkerThread *> m_threads;
+
+    /// Guards m_queue, m_exiting and Job::done.
+    QMutex m_mutex;
+    QWaitCondition m_jobQueued;
+    QWaitCondition m_jobDone;
+    /// Jobs that no worker has taken yet.
+    std::deque<Job *> m_queue;
+    bool m_exiting;
+
+    /// Called by the workers.  Returns nullptr when it is time to exit.
+    Job *takeJob();
+    static void decode(Job &job);
+
+    /// Insert the events of the finished jobs at the front of m_jobs.
+    void insertEvents(bool wait);
+};
+
+class RoseXmlHandler::SegmentDecoder::WorkerThread : public QThread
+{
+public:
+    explicit WorkerThread(SegmentDecoder *decoder) :
+        m_decoder(decoder)
+    { }
+
+protected:
+    void run() override
+    {
+        while (Job *job = m_decoder->takeJob()) {
+            decode(*job);
+
+            QMutexLocker locker(&m_decoder->m_mutex);
+            job->done = true;
+            m_decoder->m_jobDone.wakeAll();
+        }
+    }
+
+private:
+    SegmentDecoder *m_decoder;
+};
+
+RoseXmlHandler::SegmentDecoder::SegmentDecoder() :
+    m_current(nullptr),
+    m_exiting(false)
+{
+    // The GUI thread is kept busy reading the XML, so one worker per
+    // core is about right.
+    const int threadCount = std::max(1, QThread::idealThreadCount());
+
+    for (int i = 0; i < threadCount; ++i) {
+        WorkerThread *thread = new WorkerThread(this);
+        thread->start();
+        m_threads.push_back(thread);
+    }
+}
+
+RoseXmlHandler::SegmentDecoder::~SegmentDecoder()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_exiting = true;
+        m_jobQueued.wakeAll();
+    }
+
+    for (WorkerThread *thread : m_threads) {
+        thread->wait();
+        delete thread;
+    }
+
+    // Anything left over is from a load that failed or was cancelled.
+    if (m_current)
+        m_jobs.push_back(m_current);
+
+    for (Job *job : m_jobs) {
+        for (Event *event : job->events) {
+            delete event;
+        }
+        delete job->endMarkerTime;
+        delete job;
+    }
+}
+
+void
+RoseXmlHandler::SegmentDecoder::beginSegment(Segment *segment,
+                                             timeT startTime)
+{
+    m_current = new Job;
+    m_current->segment = segment;
+    m_current->startTime = startTime;
+    m_current->endMarkerTime = nullptr;
+    m_current->groupCount = 0;
+    m_current->done = false;
+}
+
+bool
+RoseXmlHandler::SegmentDecoder::startElement(const QString &lcName,
+                                             const QXmlStreamAttributes &atts)
+{
+    ElementType type;
+
+    if (lcName == "event")
+        type = EventStart;
+    else if (lcName == "property")
+        type = Property;
+    else if (lcName == "nproperty")
+        type = NonPersistentProperty;
+    else if (lcName == "chord")
+        type = ChordStart;
+    else if (lcName == "group")
+        type = GroupStart;
+    else
+        return false;
+
+    m_current->elements.push_back(Element{type, atts});
+
+    return true;
+}
+
+bool
+RoseXmlHandler::SegmentDecoder::endElement(const QString &lcName)
+{
+    ElementType type;
+
+    if (lcName == "event")
+        type = EventEnd;
+    else if (lcName == "chord")
+        type = ChordEnd;
+    else if (lcName == "group")
+        type = GroupEnd;
+    else if (lcName == "property"  ||  lcName == "nproperty")
+        return true;
+    else
+        return false;
+
+    m_current->elements.push_back(Element{type, QXmlStreamAttributes()});
+
+    return true;
+}
+
+void
+RoseXmlHandler::SegmentDecoder::endSegment(timeT *endMarkerTime)
+{
+    m_current->endMarkerTime = endMarkerTime;
+    m_jobs.push_back(m_current);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queue.push_back(m_current);
+        m_jobQueued.wakeOne();
+    }
+
+    m_current = nullptr;
+
+    // Keep up with the workers rather than leaving it all to the end.
+    insertEvents(false);
+}
+
+void
+RoseXmlHandler::SegmentDecoder::finish()
+{
+    insertEvents(true);
+}
+
+RoseXmlHandler::SegmentDecoder::Job *
+RoseXmlHandler::SegmentDecoder::takeJob()
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (m_queue.empty()  &&  !m_exiting) {
+        m_jobQueued.wait(&m_mutex);
+    }
+
+    if (m_exiting)
+        return nullptr;
+
+    Job *job = m_queue.front();
+    m_queue.pop_front();
+
+    return job;
+}
+
+void
+RoseXmlHandler::SegmentDecoder::decode(Job &job)
+{
+    // This is what RoseXmlHandler's startElement() and endElement() did
+    // for events, with the state kept locally.
+
+    timeT currentTime = job.startTime;
+    bool inChord = false;
+    timeT chordDuration = 0;
+
+    bool inGroup = false;
+    long groupId = 0;
+    std::string groupType;
+    int groupTupletBase = 0;
+    int groupTupledCount = 0;
+    int groupUntupledCount = 0;
+
+    // Stored group ID to index in the segment's groups.
+    std::map<long, long> groupIdMap;
+
+    XmlStorableEvent *event = nullptr;
+    /// Index of the event's group, or -1.
+    long eventGroup = -1;
+
+    for (const Element &element : job.elements) {
+
+        switch (element.type) {
+
+        case EventStart: {
+            if (event) {
+                RG_DEBUG << "SegmentDecoder::decode(): Warning: new event found at time " << currentTime << " before previous event has ended; previous event will be lost";
+                delete event;
+            }
+
+            event = new XmlStorableEvent(element.attributes, currentTime);
+            eventGroup = -1;
+
+            if (event->has(BEAMED_GROUP_ID)) {
+                const long storedId = event->get<Int>(BEAMED_GROUP_ID);
+
+                std::map<long, long>::const_iterator i =
+                        groupIdMap.find(storedId);
+                if (i == groupIdMap.end())
+                    i = groupIdMap.insert(std::make_pair(
+                            storedId, job.groupCount++)).first;
+
+                eventGroup = i->second;
+
+            } else if (inGroup) {
+                event->set<String>(BEAMED_GROUP_TYPE, groupType);
+                if (groupType == GROUP_TYPE_TUPLED) {
+                    event->set<Int>(BEAMED_GROUP_TUPLET_BASE,
+                                    groupTupletBase);
+                    event->set<Int>(BEAMED_GROUP_TUPLED_COUNT,
+                                    groupTupledCount);
+                    event->set<Int>(BEAMED_GROUP_UNTUPLED_COUNT,
+                                    groupUntupledCount);
+                }
+                eventGroup = groupId;
+            }
+
+            const timeT duration = event->getDuration();
+
+            if (!inChord) {
+                currentTime = event->getAbsoluteTime() + duration;
+            } else if (duration != 0) {
+                // Chord duration is that of the shortest element with
+                // a non-null duration.
+                if (chordDuration == 0  ||  duration < chordDuration)
+                    chordDuration = duration;
+            }
+
+            break;
+        }
+
+        case EventEnd:
+            if (event) {
+                if (eventGroup >= 0) {
+                    job.groupedEvents.push_back(
+                            std::make_pair(job.events.size(), eventGroup));
+                }
+                job.events.push_back(event);
+                event = nullptr;
+            }
+            break;
+
+        case Property:
+        case NonPersistentProperty:
+            if (!event) {
+                RG_DEBUG << "SegmentDecoder::decode(): Warning: Found property outside of event at time " << currentTime << ", ignoring";
+            } else {
+                event->setPropertyFromAttributes(
+                        element.attributes, element.type == Property);
+            }
+            break;
+
+        case ChordStart:
+            inChord = true;
+            break;
+
+        case ChordEnd:
+            currentTime += chordDuration;
+            inChord = false;
+            chordDuration = 0;
+            break;
+
+        case GroupStart:
+            inGroup = true;
+            groupId = job.groupCount++;
+            groupType = qstrtostr(element.attributes.value("type").toString());
+            if (groupType == GROUP_TYPE_TUPLED) {
+                groupTupletBase = element.attributes.value("base").toInt();
+                groupTupledCount = element.attributes.value("tupled").toInt();
+                groupUntupledCount =
+                        element.attributes.value("untupled").toInt();
+            }
+            break;
+
+        case GroupEnd:
+            inGroup = false;
+            break;
+        }
+    }
+
+    // Only possible if the XML was cut short.
+    delete event;
+
+    // The XML is no longer needed.
+    std::vector<Element>().swap(job.elements);
+}
+
+void
+RoseXmlHandler::SegmentDecoder::insertEvents(bool wait)
+{
+    while (!m_jobs.empty()) {
+
+        Job *job = m_jobs.front();
+
+        {
+            QMutexLocker locker(&m_mutex);
+
+            while (!job->done) {
+                if (!wait)
+                    return;
+                m_jobDone.wait(&m_mutex);
+            }
+        }
+
+        m_jobs.pop_front();
+
+        Segment *segment = job->segment;
+
+        // Take the group IDs from the segment in the order the groups
+        // were found, as loading one event at a time would.
+        std::vector<long> groupIds(job->groupCount);
+        for (long &id : groupIds) {
+            id = segment->getNextId();
+        }
+        for (const std::pair<size_t, long> &grouped : job->groupedEvents) {
+            job->events[grouped.first]->set<Int>(
+                    BEAMED_GROUP_ID, groupIds[grouped.second]);
+        }
+
+        for (Event *event : job->events) {
+            segment->insert(event);
+        }
+
+        if (job->endMarkerTime) {
+            setSegmentEndMarker(segment, *job->endMarkerTime);
+            delete job->endMarkerTime;
+        }
+
+        delete job;
+    }
+}
+
+
+//----------------------------------------
+
+
 RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
-                               unsigned int elementCount,
+                               const GzipInputFile *input,
                                QPointer<QProgressDialog> progressDialog,
                                bool createNewDevicesWhenNeeded) :
     m_doc(doc),
@@ -246,8 +702,12 @@ RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
     m_colourMap(nullptr),
     m_keyMapping(),
     m_pluginId(0),
-    m_totalElements(elementCount),
+    m_input(input),
     m_elementsSoFar(0),
+    m_cache(nullptr),
+    m_cacheSegment(0),
+    m_segmentDecoder(nullptr),
+    m_decodingSegment(false),
     m_subHandler(nullptr),
     m_deprecation(false),
     m_createDevices(createNewDevicesWhenNeeded),
@@ -260,6 +720,7 @@ RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
 
 RoseXmlHandler::~RoseXmlHandler()
 {
+    delete m_segmentDecoder;
     delete m_subHandler;
 }
 
@@ -328,6 +789,10 @@ RoseXmlHandler::startElement(const QString& namespaceURI,
         return getSubHandler()->startElement(namespaceURI, localName, lcName, atts);
     }
 
+    // Events within a segment are built on the decoder's threads.
+    if (m_decodingSegment  &&  m_segmentDecoder->startElement(lcName, atts))
+        return true;
+
     if (lcName == "event") {
 
         //RG_DEBUG << "startElement(): found event, current time is " << m_currentTime;
@@ -1144,6 +1609,27 @@ RoseXmlHandler::startElement(const QString& namespaceURI,
 
         m_groupIdMap.clear();
 
+        if (m_currentSegment->getType() == Segment::Internal) {
+            // Only segments the cache has an entry for had their events
+            // skipped.  Should there be more in the file, the cache
+            // doesn't match it after all, so use the XML from here on.
+            if (m_cache  &&  m_cacheSegment >= m_cache->getSegmentCount()) {
+                RG_WARNING << "startElement(): Fast-load cache does not match the file, reading events from the XML";
+                m_cache = nullptr;
+            }
+
+            if (m_cache) {
+                // The events were skipped, so load them from the cache.
+                // DocumentCache::open() checked they can all be read.
+                m_cache->insertEvents(m_cacheSegment++, m_currentSegment);
+            } else {
+                if (!m_segmentDecoder)
+                    m_segmentDecoder = new SegmentDecoder;
+                m_segmentDecoder->beginSegment(m_currentSegment, startTime);
+                m_decodingSegment = true;
+            }
+        }
+
     } else if (lcName == "matrix") {  // <matrix>
 
         // If we're in a <segment>, <matrix> is valid.
@@ -2318,17 +2804,15 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
 
     // Set percentage done
     //
-    if ((m_totalElements > m_elementsSoFar) &&
-        (++m_elementsSoFar % 300 == 0)) {
+    if (++m_elementsSoFar % 300 == 0) {
 
         if (m_progressDialog) {
             // If the user cancelled, bail.
             if (m_progressDialog->wasCanceled())
                 return false;
 
-            m_progressDialog->setValue(static_cast<int>(
-                    static_cast<double>(m_elementsSoFar) /
-                    static_cast<double>(m_totalElements) * 100.0));
+            if (m_input)
+                m_progressDialog->setValue(m_input->getProgress());
         }
 
         // Kick the event loop so that we don't appear to be in
@@ -2338,8 +2822,15 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
 
     QString lcName = qName.toLower();
 
+    if (m_decodingSegment  &&  m_segmentDecoder->endElement(lcName))
+        return true;
+
     if (lcName == "rosegarden-data") {
 
+        // All of the segments' events must be in before going further.
+        if (m_segmentDecoder)
+            m_segmentDecoder->finish();
+
         Composition &comp = getComposition();
 
         // Remap all the instrument IDs in track and metronome objects
@@ -2399,18 +2890,13 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
 
     } else if (lcName == "segment") {
 
-        if (m_currentSegment && m_segmentEndMarkerTime) {
-            m_currentSegment->setEndMarkerTime(*m_segmentEndMarkerTime);
-
-            // If the segment is zero or negative duration
-            if (m_currentSegment->getEndMarkerTime() <=
-                    m_currentSegment->getStartTime()) {
-                // Make it stick out so the user can take care of it.
-                m_currentSegment->setEndMarkerTime(
-                    m_currentSegment->getStartTime() +
-                        Note(Note::Shortest).getDuration());
-            }
-
+        if (m_decodingSegment) {
+            // The end marker has to wait for the events.
+            m_segmentDecoder->endSegment(m_segmentEndMarkerTime);
+            m_segmentEndMarkerTime = nullptr;
+            m_decodingSegment = false;
+        } else if (m_currentSegment && m_segmentEndMarkerTime) {
+            setSegmentEndMarker(m_currentSegment, *m_segmentEndMarkerTime);
             delete m_segmentEndMarkerTime;
             m_segmentEndMarkerTime = nullptr;
         }
@@ -2518,6 +3004,19 @@ RoseXmlHandler::fatalError(int lineNumber, int columnNumber,
     return false;
 }
 
+void
+RoseXmlHandler::setSegmentEndMarker(Segment *segment, timeT endMarkerTime)
+{
+    segment->setEndMarkerTime(endMarkerTime);
+
+    // If the segment is zero or negative duration
+    if (segment->getEndMarkerTime() <= segment->getStartTime()) {
+        // Make it stick out so the user can take care of it.
+        segment->setEndMarkerTime(
+            segment->getStartTime() + Note(Note::Shortest).getDuration());
+    }
+}
+
 bool
 RoseXmlHandler::endDocument()
 {
@@ -48,6 +48,8 @@ class Device;
 class Composition;
 class ColourMap;
 class Buss;
+class GzipInputFile;
+class DocumentCache;
 class AudioPluginManager;
 class AudioPluginInstance;
 class AudioFileManager;
@@ -77,9 +79,12 @@ public:
     /**
      * Construct a new RoseXmlHandler which will put the data extracted
      * from the XML file into the specified composition
+     *
+     * input, if given, is the file being parsed, which is asked how far
+     * it has got for the progress dialog.
      */
     RoseXmlHandler(RosegardenDocument *doc,
-                   unsigned int elementCount,
+                   const GzipInputFile *input,
                    QPointer<QProgressDialog> progressDialog,
                    bool createNewDevicesWhenNeeded);
 
@@ -106,6 +111,13 @@ public:
     QString errorString() const override;
 
     bool hasActiveAudio() const { return m_hasActiveAudio; }
+
+    /// Take the events of non-audio segments from cache, not the XML.
+    /**
+     * For when the parser's input has had the events skipped, see
+     * DocumentCache.
+     */
+    void setDocumentCache(const DocumentCache *cache)  { m_cache = cache; }
     std::set<QString> &pluginsNotFound() { return m_pluginsNotFound; }
 
     bool fatalError(int lineNumber, int columnNumber,
@@ -132,6 +144,9 @@ protected:
     // unused void skipToNextPlayDevice();
     InstrumentId mapToActualInstrument(InstrumentId oldId);
 
+    /// Apply a segment's endmarker attribute once its events are in.
+    static void setSegmentEndMarker(Segment *segment, timeT endMarkerTime);
+
     RosegardenDocument    *m_doc;
     Segment *m_currentSegment;
     XmlStorableEvent    *m_currentEvent;
@@ -185,8 +200,16 @@ protected:
     QSharedPointer<MidiKeyMapping> m_keyMapping;
     MidiKeyMapping::KeyNameMap        m_keyNameMap;
     unsigned int                      m_pluginId;
-    unsigned int                      m_totalElements;
+    const GzipInputFile              *m_input;
     unsigned int                      m_elementsSoFar;
+    const DocumentCache              *m_cache;
+    size_t                            m_cacheSegment;
+
+    /// Builds the events of each non-audio segment on worker threads.
+    class SegmentDecoder;
+    SegmentDecoder                   *m_segmentDecoder;
+    /// The current segment's events are going to m_segmentDecoder.
+    bool                              m_decodingSegment;
 
     XmlSubHandler                    *m_subHandler;
     bool                              m_deprecation;
@@ -21,6 +21,8 @@
 #include "RosegardenDocument.h"
 
 #include "CommandHistory.h"
+#include "DocumentCache.h"
+#include "DocumentSnapshot.h"
 #include "RoseXmlHandler.h"
 #include "GzipFile.h"
 
@@ -108,6 +110,7 @@
 #include <QString>
 #include <QStringList>
 #include <QTextStream>
+#include <QThread>
 #include <QWidget>
 #include <QHostInfo>
 #include <QLockFile>
@@ -122,6 +125,42 @@ namespace Rosegarden
 
 RosegardenDocument *RosegardenDocument::currentDocument{};
 
+class RosegardenDocument::AutoSaveThread : public QThread
+{
+public:
+    /// Takes ownership of snapshot.
+    AutoSaveThread(DocumentSnapshot *snapshot, const QString &filename) :
+        m_snapshot(snapshot),
+        m_filename(filename),
+        m_success(false)
+    { }
+
+    /// Deletes the snapshot, so must be deleted on the GUI thread.
+    ~AutoSaveThread() override
+    {
+        wait();
+        delete m_snapshot;
+    }
+
+    /// Only valid once the thread has finished.
+    bool getSuccess() const  { return m_success; }
+    QString getErrorMessage() const  { return m_errMsg; }
+
+protected:
+    void run() override
+    {
+        m_success = saveSnapshot(*m_snapshot, m_filename, m_errMsg);
+    }
+
+private:
+    DocumentSnapshot *m_snapshot;
+    QString m_filename;
+
+    bool m_success;
+    QString m_errMsg;
+};
+
+
 RosegardenDocument::RosegardenDocument(
         QObject *parent,
         QSharedPointer<AudioPluginManager> audioPluginManager,
@@ -131,6 +170,7 @@ RosegardenDocument::RosegardenDocument(
     QObject(parent),
     m_modified(false),
     m_autoSaved(false),
+    m_autoSaveThread(nullptr),
     m_lockFile(nullptr),
     m_audioFileManager(this),
     m_audioPeaksThread(&m_audioFileManager),
@@ -166,6 +206,8 @@ RosegardenDocument::~RosegardenDocument()
     m_audioPeaksThread.finish();
     m_audioPeaksThread.wait();
 
+    waitForAutoSave();
+
     deleteEditViews();
 
     //     ControlRulerCanvasRepository::clear();
@@ -237,6 +279,9 @@ const QString &RosegardenDocument::getAbsFilePath() const
 
 void RosegardenDocument::deleteAutoSaveFile()
 {
+    // Don't let a background autosave write it again afterwards.
+    waitForAutoSave();
+
     QFile::remove(getAutoSaveFileName());
 }
 
@@ -342,16 +387,56 @@ void RosegardenDocument::slotAutoSave()
     if (isAutoSaved() || !isModified())
         return ;
 
+    // Still writing the last one?  Try again next time.
+    if (m_autoSaveThread)
+        return;
+
     QString autoSaveFileName = getAutoSaveFileName();
 
     RG_DEBUG << "RosegardenDocument::slotAutoSave() - doc modified - saving '"
     << getAbsFilePath() << "' as"
     << autoSaveFileName;
 
-    QString errMsg;
+    // Taking the snapshot is quick.  Writing and compressing it, which
+    // isn't, happens in the background so that editing (and the
+    // sequencer's refills) carry on meanwhile.
+    DocumentSnapshot *snapshot = new DocumentSnapshot;
+    takeSnapshot(*snapshot);
+
+    m_autoSaveThread = new AutoSaveThread(snapshot, autoSaveFileName);
+    connect(m_autoSaveThread, &QThread::finished,
+            this, &RosegardenDocument::slotAutoSaveFinished);
+    m_autoSaveThread->start(QThread::LowPriority);
+
+    // Any modification from here on clears this again.
+    setAutoSaved(true);
+}
+
+void RosegardenDocument::slotAutoSaveFinished()
+{
+    // Already cleaned up by waitForAutoSave()?
+    if (!m_autoSaveThread  ||  !m_autoSaveThread->isFinished())
+        return;
 
-    saveDocument(autoSaveFileName, errMsg, true);
+    waitForAutoSave();
+}
+
+void RosegardenDocument::waitForAutoSave()
+{
+    if (!m_autoSaveThread)
+        return;
 
+    m_autoSaveThread->wait();
+
+    if (!m_autoSaveThread->getSuccess()) {
+        RG_WARNING << "waitForAutoSave(): autosave failed:"
+                   << m_autoSaveThread->getErrorMessage();
+        // Try again next time.
+        setAutoSaved(false);
+    }
+
+    delete m_autoSaveThread;
+    m_autoSaveThread = nullptr;
 }
 
 bool RosegardenDocument::isRegularDotRGFile() const
@@ -604,10 +689,18 @@ bool RosegardenDocument::openDocument(const QString &filename,
 
     // Load.
 
-    QString fileContents;
+    // Unzip on another thread while the XML is parsed as it arrives.
+    GzipInputFile inputFile(filename);
+
+    // If the fast-load cache is good, the events come from there and
+    // the parser never sees them.
+    DocumentCache cache;
+    const bool useCache =
+            Preferences::getUseLoadCache()  &&  cache.open(filename);
+    if (useCache)
+        inputFile.setSkipRanges(cache.getEventRanges());
 
-    // Unzip
-    bool okay = GzipFile::readFromFile(filename, fileContents);
+    bool okay = inputFile.open(QIODevice::ReadOnly);
 
     QString errMsg;
     bool cancelled = false;
@@ -616,10 +709,16 @@ bool RosegardenDocument::openDocument(const QString &filename,
         errMsg = tr("Could not open Rosegarden file");
     } else {
         // Parse the XML
-        okay = xmlParse(fileContents,
+        okay = xmlParse(inputFile,
+                        useCache ? &cache : nullptr,
                         errMsg,
                         permanent,
                         cancelled);
+
+        if (okay  &&  !cancelled  &&  inputFile.hasError()) {
+            errMsg = tr("Could not open Rosegarden file");
+            okay = false;
+        }
     }
 
     if (!okay) {
@@ -1124,12 +1223,56 @@ int RosegardenDocument::FILE_FORMAT_VERSION_POINT = 9;
 
 bool RosegardenDocument::saveDocument(const QString& filename,
                                     QString& errMsg,
-                                    bool autosave)
+                                    bool autosave,
+                                    bool allowLoadCache)
+{
+    // Don't race a background autosave.
+    waitForAutoSave();
+
+    DocumentSnapshot snapshot;
+    takeSnapshot(snapshot);
+
+    // Note where the events went for the fast-load cache.
+    const bool writeCache =
+            !autosave  &&  allowLoadCache  &&  Preferences::getUseLoadCache();
+    std::vector<DocumentSnapshot::ByteRange> eventRanges;
+
+    if (!saveSnapshot(snapshot, filename, errMsg,
+                      writeCache ? &eventRanges : nullptr)) {
+        // errMsg should be already set
+        return false;
+    }
+
+    // The cache is only an optimisation, so failing to write it is
+    // not an error.
+    if (writeCache  &&
+        !DocumentCache::write(snapshot, eventRanges, filename)) {
+        RG_WARNING << "saveDocument(): could not write cache for" << filename;
+    }
+
+    RG_DEBUG << "RosegardenDocument::saveDocument() finished";
+
+    if (!autosave) {
+        m_modified = false;
+        emit documentModified(false);
+        CommandHistory::getInstance()->documentSaved();
+    }
+
+    setAutoSaved(true);
+
+    return true;
+}
+
+bool RosegardenDocument::saveSnapshot(const DocumentSnapshot &snapshot,
+                                      const QString &filename,
+                                      QString &errMsg,
+                                      std::vector<std::pair<qint64, qint64> >
+                                              *eventRanges)
 {
     QFileInfo fileInfo(filename);
 
     if (!fileInfo.exists()) { // safe to write directly
-        return saveDocumentActual(filename, errMsg, autosave);
+        return saveDocumentActual(snapshot, filename, errMsg, eventRanges);
     }
 
     if (fileInfo.exists()  &&  !fileInfo.isWritable()) {
@@ -1161,7 +1304,8 @@ bool RosegardenDocument::saveDocument(const QString& filename,
         return false;
     }
 
-    bool success = saveDocumentActual(tempFileName, errMsg, autosave);
+    bool success =
+            saveDocumentActual(snapshot, tempFileName, errMsg, eventRanges);
 
     if (!success) {
         // errMsg should be already set
@@ -1182,16 +1326,26 @@ bool RosegardenDocument::saveDocument(const QString& filename,
 }
 
 
-bool RosegardenDocument::saveDocumentActual(const QString& filename,
-                                          QString& errMsg,
-                                          bool autosave)
+bool RosegardenDocument::saveDocumentActual(const DocumentSnapshot &snapshot,
+                                            const QString &filename,
+                                            QString &errMsg,
+                                            std::vector<std::pair<qint64, qint64> >
+                                                    *eventRanges)
 {
     //Profiler profiler("RosegardenDocument::saveDocumentActual");
 
     RG_DEBUG << "RosegardenDocument::saveDocumentActual(" << filename << ")";
 
-    QString outText;
-    QTextStream outStream(&outText, QIODevice::WriteOnly);
+    // Stream straight into the compressor rather than building the
+    // whole document in memory first.  The segments, which are the
+    // bulk of it, go out an event at a time.
+    GzipOutputFile outFile(filename);
+    if (!outFile.open(QIODevice::WriteOnly)) {
+        errMsg = tr("Could not open file '%1' for writing").arg(filename);
+        return false;
+    }
+
+    QTextStream outStream(&outFile);
 //    outStream.setEncoding(QTextStream::UnicodeUTF8); qt3
 #if (QT_VERSION >= QT_VERSION_CHECK(6, 0, 0))
     // qt6 default codec is UTF-8
@@ -1199,6 +1353,26 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     outStream.setCodec("UTF-8");
 #endif
 
+    snapshot.write(outStream, eventRanges);
+
+    outStream.flush();
+    outFile.close();
+
+    if (outStream.status() != QTextStream::Ok  ||  outFile.hasError()) {
+        errMsg = tr("Error while writing on '%1'").arg(filename);
+        return false;
+    }
+
+    return true;
+}
+
+void RosegardenDocument::takeSnapshot(DocumentSnapshot &snapshot)
+{
+    //Profiler profiler("RosegardenDocument::takeSnapshot");
+
+    QString outText;
+    QTextStream outStream(&outText, QIODevice::WriteOnly);
+
     // output XML header
     //
     outStream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
@@ -1225,27 +1399,18 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     outStream << strtoqstr(getConfiguration().toXmlString())
               << "\n\n";
 
-    long totalEvents = 0;
-    for (Composition::iterator segitr = m_composition.begin();
-         segitr != m_composition.end(); ++segitr) {
-        totalEvents += (long)(*segitr)->size();
-    }
+    // Put a break in the file
+    //
+    outStream << "\n\n";
 
-    for (Composition::triggersegmentcontaineriterator ci =
-             m_composition.getTriggerSegments().begin();
-         ci != m_composition.getTriggerSegments().end(); ++ci) {
-        totalEvents += (long)(*ci)->getSegment()->size();
-    }
+    outStream.flush();
+    snapshot.append(outText);
+    outText.clear();
+    outStream.setString(&outText, QIODevice::WriteOnly);
 
     // output all elements
     //
     // Iterate on segments
-    long eventCount = 0;
-
-    // Put a break in the file
-    //
-    outStream << "\n\n";
-
     for (Composition::iterator segitr = m_composition.begin();
          segitr != m_composition.end(); ++segitr) {
 
@@ -1269,17 +1434,16 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
               .arg(segment->getLinkTransposeParams().m_transposeSegmentBack
                                                          ? "true" : "false");
 
-            saveSegment(outStream, segment, totalEvents,
-                                            eventCount, linkedSegAtts);
+            saveSegment(snapshot, segment, linkedSegAtts);
         } else {
-            saveSegment(outStream, segment, totalEvents, eventCount);
+            saveSegment(snapshot, segment);
         }
 
     }
 
     // Put a break in the file
     //
-    outStream << "\n\n";
+    snapshot.append("\n\n");
 
     for (Composition::triggersegmentcontaineriterator ci =
                 m_composition.getTriggerSegments().begin();
@@ -1294,7 +1458,7 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
                               .arg(strtoqstr((*ci)->getDefaultTimeAdjust()));
 
         Segment *segment = (*ci)->getSegment();
-        saveSegment(outStream, segment, totalEvents, eventCount, triggerAtts);
+        saveSegment(snapshot, segment, triggerAtts);
     }
 
     // Put a break in the file
@@ -1315,23 +1479,10 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     //
     outStream << "</rosegarden-data>\n";
 
-    bool okay = GzipFile::writeToFile(filename, outText);
-    if (!okay) {
-        errMsg = tr("Error while writing on '%1'").arg(filename);
-        return false;
-    }
-
-    RG_DEBUG << "RosegardenDocument::saveDocument() finished";
-
-    if (!autosave) {
-        m_modified = false;
-        emit documentModified(false);
-        CommandHistory::getInstance()->documentSaved();
-    }
-
-    setAutoSaved(true);
+    outStream.flush();
+    snapshot.append(outText);
 
-    return true;
+    RG_DEBUG << "takeSnapshot():" << snapshot.getEventCount() << "events";
 }
 
 bool RosegardenDocument::exportStudio(const QString& filename,
@@ -1374,11 +1525,12 @@ bool RosegardenDocument::exportStudio(const QString& filename,
     return true;
 }
 
-void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
-                                   long /*totalEvents*/, long &/*count*/,
-                                   QString extraAttributes)
+void RosegardenDocument::saveSegment(DocumentSnapshot &snapshot,
+                                     Segment *segment,
+                                     QString extraAttributes)
 {
-    QString time;
+    QString outText;
+    QTextStream outStream(&outText, QIODevice::WriteOnly);
 
     outStream << QString("<%1 track=\"%2\" start=\"%3\" ")
     .arg(segment->getXmlElementName())
@@ -1475,55 +1627,13 @@ void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
     {
         outStream << "\">\n";
 
-        bool inChord = false;
-        timeT chordStart = 0, chordDuration = 0;
-        timeT expectedTime = segment->getStartTime();
-
-        for (Segment::iterator i = segment->begin();
-                i != segment->end(); ++i) {
-
-            timeT absTime = (*i)->getAbsoluteTime();
-
-            Segment::iterator nextEl = i;
-            ++nextEl;
-
-            if (nextEl != segment->end() &&
-                    (*nextEl)->getAbsoluteTime() == absTime &&
-                    (*i)->getDuration() != 0 &&
-                    !inChord) {
-                outStream << "<chord>\n";
-                inChord = true;
-                chordStart = absTime;
-                chordDuration = 0;
-            }
-
-            if (inChord && (*i)->getDuration() > 0)
-                if (chordDuration == 0 || (*i)->getDuration() < chordDuration)
-                    chordDuration = (*i)->getDuration();
-
-            outStream << '\t'
-            << strtoqstr((*i)->toXmlString(expectedTime)) << "\n";
-
-            if (nextEl != segment->end() &&
-                    (*nextEl)->getAbsoluteTime() != absTime &&
-                    inChord) {
-                outStream << "</chord>\n";
-                inChord = false;
-                expectedTime = chordStart + chordDuration;
-            } else if (inChord) {
-                expectedTime = absTime;
-            } else {
-                expectedTime = absTime + (*i)->getDuration();
-            }
-
-//            if ((++count % 500 == 0) && progress) {
-//                progress->setValue(count * 100 / totalEvents);
-//            }
-        }
-
-        if (inChord) {
-            outStream << "</chord>\n";
-        }
+        // The events themselves are written out later, from the
+        // snapshot.
+        outStream.flush();
+        snapshot.append(outText);
+        snapshot.appendEvents(segment);
+        outText.clear();
+        outStream.setString(&outText, QIODevice::WriteOnly);
 
         // <matrix>
 
@@ -1570,6 +1680,8 @@ void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
 
     outStream << QString("</%1>\n").arg(segment->getXmlElementName()); //-------------------------
 
+    outStream.flush();
+    snapshot.append(outText);
 }
 
 bool RosegardenDocument::saveAs(const QString &newName, QString &errMsg)
@@ -1624,7 +1736,9 @@ bool RosegardenDocument::isSoundEnabled() const
 }
 
 bool
-RosegardenDocument::xmlParse(QString fileContents, QString &errMsg,
+RosegardenDocument::xmlParse(GzipInputFile &input,
+                             const DocumentCache *cache,
+                             QString &errMsg,
                            bool permanent,
                            bool &cancelled)
 {
@@ -1632,21 +1746,15 @@ RosegardenDocument::xmlParse(QString fileContents, QString &errMsg,
 
     cancelled = false;
 
-    unsigned int elementCount = 0;
-    for (int i = 0; i < fileContents.length() - 1; ++i) {
-        if (fileContents[i] == '<' && fileContents[i+1] != '/') {
-            ++elementCount;
-        }
-    }
-
     if (permanent && m_soundEnabled) RosegardenSequencer::getInstance()->removeAllDevices();
 
-    RoseXmlHandler handler(this, elementCount, m_progressDialog, permanent);
+    RoseXmlHandler handler(this, &input, m_progressDialog, permanent);
+    handler.setDocumentCache(cache);
 
     XMLReader reader;
     reader.setHandler(&handler);
 
-    bool ok = reader.parse(fileContents);
+    bool ok = reader.parse(input);
 
     if (m_progressDialog  &&  m_progressDialog->wasCanceled()) {
         QMessageBox::information(dynamic_cast<QWidget *>(parent()), tr("Rosegarden"), tr("File load cancelled"));
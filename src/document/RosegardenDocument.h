@@ -53,6 +53,9 @@ class RosegardenMainViewWidget;
 class MappedEventList;
 class Event;
 class EditViewBase;
+class DocumentCache;
+class DocumentSnapshot;
+class GzipInputFile;
 class AudioPluginManager;
 
 
@@ -228,9 +231,13 @@ public:
      * saves the document under filename and format.
      *
      * errMsg will be set to a user-readable error message if save fails
+     *
+     * The fast-load cache (see DocumentCache) is only written if the
+     * user has asked for it and allowLoadCache is true.
      */
     bool saveDocument(const QString &filename, QString& errMsg,
-                      bool autosave = false);
+                      bool autosave = false,
+                      bool allowLoadCache = true);
 
     /// Save under a new name.
     bool saveAs(const QString &newName, QString &errMsg);
@@ -506,6 +513,9 @@ public slots:
 
     /**
      * saves the document to a suitably-named backup file
+     *
+     * Only a snapshot is taken here.  The file is written in the
+     * background.
      */
     void slotAutoSave();
 
@@ -573,6 +583,10 @@ signals:
     void docColoursChanged();
     void devicesResyncd();
 
+private slots:
+    /// The background autosave thread has finished.
+    void slotAutoSaveFinished();
+
 private:
     /**
      * initializes the document generally
@@ -585,7 +599,10 @@ private:
     void performAutoload();
 
     /**
-     * Parse the Rosegarden file in \a file
+     * Parse the Rosegarden file being read from \a input
+     *
+     * \a cache, if given, supplies the events that \a input has
+     * been told to skip.
      *
      * \a errMsg will contains the error messages
      * if parsing failed.
@@ -593,7 +610,8 @@ private:
      * @return false if parsing failed
      * @see RoseXmlHandler
      */
-    bool xmlParse(QString fileContents, QString &errMsg,
+    bool xmlParse(GzipInputFile &input, const DocumentCache *cache,
+                  QString &errMsg,
                   bool permanent,
                   bool &cancelled);
 
@@ -615,22 +633,47 @@ private:
     QString getAutoSaveFileName();
 
     /**
-     * Save document to the given file.  This function does the actual
-     * save of the file to the given filename; saveDocument() wraps
-     * this, saving to a temporary file and then renaming to the
-     * required file, so as not to lose the original if a failure
-     * occurs during overwriting.
+     * Take a snapshot of the whole document for saving.  The snapshot
+     * can then be written from any thread while editing carries on.
      */
-    bool saveDocumentActual(const QString &filename, QString& errMsg,
-                            bool autosave = false);
+    void takeSnapshot(DocumentSnapshot &snapshot);
 
     /**
-     * Save one segment to the given text stream
+     * Save a snapshot to the given file, saving to a temporary file
+     * and then renaming to the required file, so as not to lose the
+     * original if a failure occurs during overwriting.
+     *
+     * Safe to call from any thread.
+     */
+    static bool saveSnapshot(const DocumentSnapshot &snapshot,
+                             const QString &filename, QString &errMsg,
+                             std::vector<std::pair<qint64, qint64> >
+                                     *eventRanges = nullptr);
+
+    /**
+     * Save a snapshot to the given file.  This function does the actual
+     * save of the file to the given filename; saveSnapshot() wraps it.
+     *
+     * If eventRanges is given, it is filled in as for
+     * DocumentSnapshot::write().
      */
-    void saveSegment(QTextStream&, Segment*,
-                     long totalNbOfEvents, long &count,
+    static bool saveDocumentActual(const DocumentSnapshot &snapshot,
+                                   const QString &filename, QString &errMsg,
+                                   std::vector<std::pair<qint64, qint64> >
+                                           *eventRanges = nullptr);
+
+    /**
+     * Add one segment to the snapshot
+     */
+    void saveSegment(DocumentSnapshot &snapshot, Segment *,
                      QString extraAttributes = QString());
 
+    /// Writes an autosave snapshot in the background.
+    class AutoSaveThread;
+
+    /// Wait for any background autosave to finish, and clean up after it.
+    void waitForAutoSave();
+
     /// Identifies a specific event within a specific segment.
     /**
      * A struct formed by a Segment pointer and an iterator into the same
@@ -709,6 +752,11 @@ private:
      */
     bool m_autoSaved;
 
+    /**
+     * the autosave being written in the background, if any
+     */
+    AutoSaveThread *m_autoSaveThread;
+
     /**
      * the title of the current document
      */
@@ -60,6 +60,15 @@ bool XMLReader::parse(QFile& xmlFile)
     return doParse(xml);
 }
 
+bool XMLReader::parse(QIODevice& device)
+{
+    if (! m_handler) return false;
+    QXmlStreamReader xml;
+    xml.setDevice(&device);
+
+    return doParse(xml);
+}
+
 bool XMLReader::doParse(QXmlStreamReader& reader)
 {
     bool ok = true;
@@ -19,6 +19,7 @@
 #define RG_XMLREADER_H
 
 class QFile;
+class QIODevice;
 class QXmlStreamReader;
 
 #include <QString>
@@ -48,6 +49,13 @@ class ROSEGARDENPRIVATE_EXPORT XMLReader
 
     /// parse the XML file
     bool parse(QFile& xmlFile);
+
+    /// Parse XML from an already open device, as it arrives.
+    /**
+     * Reads from the device a buffer at a time, so the whole text is
+     * never in memory at once.
+     */
+    bool parse(QIODevice& device);
     
  private:
     XMLHandler* m_handler;
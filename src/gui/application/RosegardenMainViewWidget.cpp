@@ -1647,7 +1647,7 @@ RosegardenMainViewWidget::slotDroppedNewAudio(QString audioDesc)
     }
 
     try {
-        aFM.generatePreview(audioFileId);
+        aFM.queuePreview(audioFileId);
     } catch (const Exception &e) {
         QString message = strtoqstr(e.getMessage()) + "\n\n" +
                           tr("Try copying this file to a directory where you have write permission and re-add it");
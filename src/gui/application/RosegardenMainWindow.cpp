@@ -1693,7 +1693,9 @@ RosegardenMainWindow::saveGlobalProperties()
         QString tempname = AutoSaveFinder().getAutoSavePath(filename);
         if (tempname != "") {
             QString errMsg;
-            bool res = RosegardenDocument::currentDocument->saveDocument(tempname, errMsg);
+            // A temporary copy, so no cache.
+            bool res = RosegardenDocument::currentDocument->saveDocument(
+                    tempname, errMsg, false, false);
             if (!res) {
                 if (!errMsg.isEmpty()) {
                     QMessageBox::critical(this, tr("Rosegarden"), tr("Could not save document at %1\nError was : %2").arg(tempname).arg(errMsg));
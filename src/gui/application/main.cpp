@@ -28,6 +28,8 @@
 #include "base/RealTime.h"
 #include "misc/Preferences.h"
 
+#include "document/io/LilyPondExporter.h"
+#include "document/io/MusicXMLLoader.h"
 #include "sound/MidiFile.h"
 #include "sound/audiostream/WavFileReadStream.h"
 #include "sound/audiostream/WavFileWriteStream.h"
@@ -55,6 +57,14 @@
 #include <QtGui>
 #include <QPixmapCache>
 #include <QStringList>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QMap>
+#include <QProcess>
+#include <QThread>
+
+#include <functional>
 
 #include <sound/SoundDriverFactory.h>
 #include <sys/time.h>
@@ -338,18 +348,98 @@ static void usage()
 {
     std::cerr << "Rosegarden: A sequencer and musical notation editor\n";
     std::cerr << "Usage: rosegarden [--nosplash] [--nosound] [file.rg]\n";
-    std::cerr << "       rosegarden --convert source.rg dest.mid\n";
+    std::cerr << "       rosegarden --convert source dest\n";
+    std::cerr << "       rosegarden --convert-batch sourcedir destdir rg|mid|ly [jobs]\n";
     std::cerr << "       rosegarden --version\n";
+    std::cerr << "Sources can be .rg, .mid or MusicXML (.xml, .musicxml).\n";
+    std::cerr << "Destinations can be .rg, .mid or LilyPond (.ly).\n";
     exit(2);
 }
 
+/// Load a .rg, MIDI or MusicXML file for --convert.
+static bool loadForConversion(RosegardenDocument &doc, const QString &inFile)
+{
+    const QString suffix = QFileInfo(inFile).suffix().toLower();
+
+    if (suffix == "mid"  ||  suffix == "midi") {
+        MidiFile midiFile;
+        if (!midiFile.convertToRosegarden(inFile, &doc)) {
+            std::cerr << "Error reading MIDI file: " << inFile << ": " <<
+                    midiFile.getError() << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    if (suffix == "xml"  ||  suffix == "musicxml") {
+        MusicXMLLoader loader(&doc.getStudio());
+        if (!loader.load(inFile, doc.getComposition(), doc.getStudio())) {
+            std::cerr << "Error reading MusicXML file: " << inFile << ": " <<
+                    loader.errorMessage() << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    const bool ok = doc.openDocument(
+            inFile,
+            false,  // permanent
+            true,  // squelchProgressDialog
+            false);  // enableLock
+    if (!ok)
+        std::cerr << "Error opening rg file: " << inFile << "\n";
+
+    return ok;
+}
+
+/// Save a document as .rg, MIDI or LilyPond for --convert.
+static bool saveConversion(RosegardenDocument &doc, const QString &outFile)
+{
+    const QString suffix = QFileInfo(outFile).suffix().toLower();
+
+    if (suffix == "rg") {
+        // Don't leave hidden cache files all over the output.
+        QString errMsg;
+        if (!doc.saveDocument(outFile, errMsg, false, false)) {
+            std::cerr << "Error writing rg file: " << outFile << ": " <<
+                    errMsg << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    if (suffix == "ly") {
+        LilyPondExporter exporter(&doc, SegmentSelection(), qstrtostr(outFile));
+        if (!exporter.write()) {
+            std::cerr << "Error writing LilyPond file: " << outFile << ": " <<
+                    exporter.getMessage() << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    MidiFile midiFile;
+    if (!midiFile.convertToMidi(&doc, outFile)) {
+        std::cerr << "Error writing MIDI file: " << outFile << "\n";
+        return false;
+    }
+
+    return true;
+}
+
 static void convert(const QStringList &args)
 {
+    if (args.size() < 4)
+        usage();
+
     QString inFile  = args[2];
     QString outFile = args[3];
 
     std::cout << "Converting from \"" << inFile << "\" to \"" << outFile << "\"\n";
 
+    QElapsedTimer timer;
+    timer.start();
+
     RosegardenDocument doc(
             nullptr,  // parent
             {},  // audioPluginManager
@@ -359,28 +449,207 @@ static void convert(const QStringList &args)
 
     RosegardenDocument::currentDocument = &doc;
 
-    bool ok;
-
-    ok = doc.openDocument(
-            inFile,
-            false,  // permanent
-            true,  // squelchProgressDialog
-            false);  // enableLock
-    if (!ok) {
-        std::cerr << "Error opening rg file: " << inFile << "\n";
+    if (!loadForConversion(doc, inFile))
         exit(1);
+
+    size_t eventCount = 0;
+    const Composition::segmentcontainer &segments =
+            doc.getComposition().getSegments();
+    for (const Segment *segment : segments) {
+        eventCount += segment->size();
     }
 
-    MidiFile midiFile;
-    ok = midiFile.convertToMidi(&doc, outFile);
-    if (!ok) {
-        std::cerr << "Error writing MIDI file: " << outFile << "\n";
+    if (!saveConversion(doc, outFile))
         exit(1);
-    }
+
+    // --convert-batch reads this.
+    std::cout << "Converted " << eventCount << " events in " <<
+            timer.elapsed() << " ms\n";
 
     exit(0);
 }
 
+/// Convert a whole directory tree by running --convert for each file.
+/**
+ * A document can only be loaded on the GUI thread, and a lot of what it
+ * touches is global, so the files are shared out between a pool of
+ * rosegarden processes rather than threads.
+ */
+static void convertBatch(const QStringList &args)
+{
+    if (args.size() < 5)
+        usage();
+
+    const QDir sourceDir(args[2]);
+    const QDir destDir(args[3]);
+    const QString destSuffix = args[4].toLower();
+
+    if (destSuffix != "rg"  &&  destSuffix != "mid"  &&  destSuffix != "ly")
+        usage();
+
+    int jobs = QThread::idealThreadCount();
+    if (args.size() > 5)
+        jobs = args[5].toInt();
+    if (jobs < 1)
+        jobs = 1;
+
+    // Find the files to convert.
+    QStringList sources;
+    QDirIterator it(sourceDir.absolutePath(),
+                    QStringList() << "*.rg" << "*.mid" << "*.midi" <<
+                            "*.xml" << "*.musicxml",
+                    QDir::Files,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        sources << it.next();
+    }
+    sources.sort();
+
+    // Where each goes.  Sources that differ only by extension, e.g.
+    // foo.mid and foo.rg, keep it so as not to overwrite each other.
+    QStringList dests;
+    QMap<QString, int> destCount;
+    for (const QString &source : sources) {
+        const QFileInfo sourceInfo(source);
+        const QString relative = sourceDir.relativeFilePath(
+                sourceInfo.absolutePath());
+        dests << QDir(destDir.filePath(relative)).filePath(
+                sourceInfo.completeBaseName() + "." + destSuffix);
+        ++destCount[dests.back()];
+    }
+    for (int i = 0; i < sources.size(); ++i) {
+        if (destCount[dests[i]] < 2)
+            continue;
+        const QFileInfo destInfo(dests[i]);
+        const QString dest = destInfo.dir().filePath(
+                QFileInfo(sources[i]).fileName() + "." + destSuffix);
+        std::cout << "Writing " << sources[i] << " to " << dest <<
+                " as another source would also go to " << dests[i] << "\n";
+        dests[i] = dest;
+    }
+
+    std::cout << "Converting " << sources.size() << " files from \"" <<
+            sourceDir.absolutePath() << "\" to \"" <<
+            destDir.absolutePath() << "\" with " << jobs << " jobs\n";
+
+    struct Job
+    {
+        QString source;
+        QString dest;
+        QElapsedTimer timer;
+    };
+
+    const QString program = QCoreApplication::applicationFilePath();
+
+    int next = 0;
+    int running = 0;
+    int failed = 0;
+    qint64 totalEvents = 0;
+    QElapsedTimer batchTimer;
+    batchTimer.start();
+
+    QEventLoop loop;
+
+    std::function<void ()> startNext = [&]() {
+        while (running < jobs  &&  next < sources.size()) {
+            Job *job = new Job;
+            job->source = sources[next];
+            job->dest = dests[next];
+            ++next;
+
+            QDir().mkpath(QFileInfo(job->dest).absolutePath());
+
+            QProcess *process = new QProcess;
+            process->setProcessChannelMode(QProcess::SeparateChannels);
+
+            // A process that never starts never finishes either.
+            QObject::connect(process,
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
+                    &QProcess::errorOccurred,
+#else
+                    static_cast<void (QProcess::*)(QProcess::ProcessError)>(
+                            &QProcess::error),
+#endif
+                    [&, process, job](QProcess::ProcessError error) {
+                if (error != QProcess::FailedToStart)
+                    return;
+
+                ++failed;
+                std::cout << "FAILED " << job->source << " (" <<
+                        process->errorString() << ")\n";
+                std::cout.flush();
+
+                process->deleteLater();
+                delete job;
+                --running;
+
+                startNext();
+                if (running == 0)
+                    loop.quit();
+            });
+
+            QObject::connect(process,
+                    static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(
+                            &QProcess::finished),
+                    [&, process, job](int exitCode,
+                                      QProcess::ExitStatus exitStatus) {
+                const qint64 msecs = job->timer.elapsed();
+                const QString output =
+                        QString::fromLocal8Bit(process->readAllStandardOutput());
+
+                // "Converted <n> events in <t> ms"
+                qint64 events = -1;
+                const int at = output.lastIndexOf("Converted ");
+                if (at >= 0)
+                    events = output.mid(at + 10).section(' ', 0, 0).toLongLong();
+
+                if (exitStatus != QProcess::NormalExit  ||  exitCode != 0  ||
+                    events < 0) {
+                    ++failed;
+                    std::cout << "FAILED " << job->source << " (" << msecs <<
+                            " ms)\n" << QString::fromLocal8Bit(
+                                    process->readAllStandardError());
+                } else {
+                    totalEvents += events;
+                    std::cout << job->source << ": " << events <<
+                            " events, " << msecs << " ms, " <<
+                            qint64(events * 1000.0 / std::max(msecs, qint64(1))) <<
+                            " events/sec\n";
+                }
+                std::cout.flush();
+
+                process->deleteLater();
+                delete job;
+                --running;
+
+                startNext();
+                if (running == 0)
+                    loop.quit();
+            });
+
+            ++running;
+            job->timer.start();
+            process->start(program,
+                           QStringList() << "--convert" << job->source <<
+                                   job->dest);
+        }
+    };
+
+    startNext();
+    if (running > 0)
+        loop.exec();
+
+    const qint64 msecs = std::max(batchTimer.elapsed(), qint64(1));
+
+    std::cout << "Converted " << sources.size() - failed << " of " <<
+            sources.size() << " files, " << totalEvents << " events in " <<
+            msecs << " ms (" << qint64(sources.size() * 1000.0 / msecs) <<
+            " files/sec, " << qint64(totalEvents * 1000.0 / msecs) <<
+            " events/sec)\n";
+
+    exit(failed ? 1 : 0);
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -528,6 +797,7 @@ int main(int argc, char *argv[])
             if (args[i] == "--nosplash") nosplash = true;
             else if (args[i] == "--nosound") nosound = true;
             else if (args[i] == "--convert") convert(args);
+            else if (args[i] == "--convert-batch") convertBatch(args);
             else usage();
         } else {
             ++nonOptArgs;
@@ -292,6 +292,22 @@ GeneralConfigurationPage::GeneralConfigurationPage(QWidget *parent) :
 
     ++row;
 
+    tipText = tr(
+            "<qt><p>When saving, also write a hidden .cache file beside "
+            "the .rg file so that it loads faster next time.</p></qt>");
+    label = new QLabel(tr("Fast-load cache (experimental)"), frame);
+    label->setToolTip(tipText);
+    layout->addWidget(label, row, 0);
+    m_useLoadCache = new QCheckBox(frame);
+    m_useLoadCache->setToolTip(tipText);
+    m_useLoadCache->setChecked(Preferences::getUseLoadCache());
+    connect(m_useLoadCache, &QCheckBox::stateChanged,
+            this, &GeneralConfigurationPage::slotModified);
+
+    layout->addWidget(m_useLoadCache, row, 1, 1, 2);
+
+    ++row;
+
     settings.beginGroup(GeneralOptionsConfigGroup);
 
     // Skip a row.  Leave some space for the next field.
@@ -591,6 +607,7 @@ void GeneralConfigurationPage::apply()
     Preferences::setJumpToLoop(m_jumpToLoop->isChecked());
     Preferences::setAdvancedLooping(m_advancedLooping->isChecked());
     Preferences::setAutoChannels(m_autoChannels->isChecked());
+    Preferences::setUseLoadCache(m_useLoadCache->isChecked());
 
     // Presentation tab
 
@@ -200,6 +200,10 @@ AudioManagerDialog::AudioManagerDialog(QWidget *parent,
     connect(CommandHistory::getInstance(), &CommandHistory::commandExecuted,
             this, &AudioManagerDialog::slotCommandExecuted);
 
+    // Previews are generated in the background when files are added.
+    connect(&m_doc->getAudioFileManager(), &AudioFileManager::peaksReady,
+            this, &AudioManagerDialog::slotPopulateFileList);
+
     connect(m_playTimer, &QTimer::timeout,
             this, &AudioManagerDialog::slotCancelPlayingAudio);
 
@@ -1203,7 +1207,7 @@ AudioManagerDialog::addFile(const QUrl& kurl)
     }
 
     try {
-        aFM.generatePreview(id);
+        aFM.queuePreview(id);
     } catch (const Exception &e) {
         QString message = strtoqstr(e.getMessage()) + "\n\n" +
                           tr("Try copying this file to a directory where you have write permission and re-add it");
@@ -39,7 +39,7 @@ class Chord
     friend bool operator<(const Chord&, const Chord&);
 
 public:
-    static const std::string EventType;
+    static const std::string &EventType;
     static const short EventSubOrdering;
 
     Chord();
@@ -175,6 +175,10 @@ CompositionView::CompositionView(RosegardenDocument *doc,
     connect(doc, &RosegardenDocument::audioFileFinalized,
             m_model, &CompositionModelImpl::slotAudioFileFinalized);
 
+    // Audio previews whose peak files were generated in the background.
+    connect(&doc->getAudioFileManager(), &AudioFileManager::peaksReady,
+            this, &CompositionView::slotAudioPeaksReady);
+
     // Connect for high-frequency control change notifications.
     connect(Instrument::getStaticSignals().data(),
                 &InstrumentStaticSignals::controlChange,
@@ -1534,6 +1538,22 @@ void CompositionView::slotControlChange(Instrument *instrument, int cc)
     slotAllNeedRefresh(viewportContentsRect);
 }
 
+void CompositionView::slotAudioPeaksReady()
+{
+    // Any audio preview drawn before the peaks were ready is empty.
+    // Start again with them all, which is simpler than working out
+    // which segments use the audio file.
+    m_deleteAudioPreviewsNeeded = true;
+
+    // The entire viewport in contents coords.
+    QRect viewportContentsRect(
+            contentsX(), contentsY(),
+            viewport()->rect().width(), viewport()->rect().height());
+
+    // Signal that a refresh is needed on the next timer.
+    slotAllNeedRefresh(viewportContentsRect);
+}
+
 void CompositionView::makeTrackPosVisible(int trackPos)
 {
     if (!m_model)
@@ -361,6 +361,9 @@ private slots:
     /// Connected to InstrumentStaticSignals::controlChange().
     void slotControlChange(Instrument *instrument, int cc);
 
+    /// Connected to AudioFileManager::peaksReady().
+    void slotAudioPeaksReady();
+
 private:
 
     CompositionModelImpl *m_model;
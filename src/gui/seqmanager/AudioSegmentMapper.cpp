@@ -52,6 +52,8 @@ AudioSegmentMapper::fillBuffer()
     // Can't write out if no track
     if (!track) {
         RG_WARNING << "AudioSegmentMapper::fillBuffer: ERROR: No track for segment!";
+        // Don't leave stale events in the write buffer.
+        resize(0);
         return;
     }
 
@@ -91,14 +93,16 @@ AudioSegmentMapper::fillBuffer()
                       audioStart);
 
         e.setTrackId(track->getId());
-        e.setRuntimeSegmentId(m_segment->getRuntimeId());
+
+        MappedEvent::AudioData audioData = e.getAudioData();
+        audioData.runtimeSegmentId = m_segment->getRuntimeId();
 
         // Send the autofade if required
         //
         if (m_segment->isAutoFading()) {
-            e.setAutoFade(true);
-            e.setFadeInTime(m_segment->getFadeInTime());
-            e.setFadeOutTime(m_segment->getFadeOutTime());
+            audioData.autoFade = true;
+            audioData.fadeInTime = m_segment->getFadeInTime();
+            audioData.fadeOutTime = m_segment->getFadeOutTime();
             RG_DEBUG << "AudioSegmentMapper::fillBuffer - "
                       << "SETTING AUTOFADE "
                       << "in = " << m_segment->getFadeInTime()
@@ -108,6 +112,9 @@ AudioSegmentMapper::fillBuffer()
             //                      << "NO AUTOFADE SET ON SEGMENT";
         }
 
+        // One shared block for all the repeats.
+        e.setAudioData(audioData);
+
         getBuffer()[index] = e;
         ++index;
     }
@@ -47,7 +47,9 @@ InternalSegmentMapper::InternalSegmentMapper(RosegardenDocument *doc,
                                              Segment *segment)
     : SegmentMapper(doc, segment),
       m_channelManager(doc->getInstrument(segment)),
-      m_triggeredEvents(new Segment)
+      m_triggeredEvents(new Segment),
+      m_refreshStatusId(segment->getNewRefreshStatusId()),
+      m_fillParameters()
 {}
 
 InternalSegmentMapper::
@@ -65,6 +67,53 @@ toRealTime(Composition &comp, timeT t)
 }
 
 
+bool
+InternalSegmentMapper::FillParameters::operator==(
+        const FillParameters &other) const
+{
+    return startTime == other.startTime  &&
+           endMarkerTime == other.endMarkerTime  &&
+           delay == other.delay  &&
+           realTimeDelay == other.realTimeDelay  &&
+           transpose == other.transpose  &&
+           repeatCount == other.repeatCount  &&
+           trackId == other.trackId  &&
+           compositionStart == other.compositionStart  &&
+           tempoMapVersion == other.tempoMapVersion;
+}
+
+InternalSegmentMapper::FillParameters
+InternalSegmentMapper::getFillParameters(TrackId trackId,
+                                         const Composition &comp) const
+{
+    FillParameters parameters;
+
+    parameters.startTime = m_segment->getStartTime();
+    parameters.endMarkerTime = m_segment->getEndMarkerTime();
+    parameters.delay = m_segment->getDelay();
+    parameters.realTimeDelay = m_segment->getRealTimeDelay();
+    parameters.transpose = m_segment->getTranspose();
+    parameters.repeatCount = getSegmentRepeatCount();
+    parameters.trackId = trackId;
+    parameters.compositionStart = comp.getStartMarker();
+    parameters.tempoMapVersion = comp.getTempoMapVersion();
+
+    return parameters;
+}
+
+bool
+InternalSegmentMapper::affectsNeighbours(const Event *e)
+{
+    // Tied notes and grace notes are timed by looking at the notes
+    // around them.  Triggered segments get expanded into
+    // m_triggeredEvents which we don't keep checkpoints for.
+    return e->has(BaseProperties::TIED_FORWARD)  ||
+           e->has(BaseProperties::TIED_BACKWARD)  ||
+           e->has(BaseProperties::IS_GRACE_NOTE)  ||
+           e->has(BaseProperties::MAY_HAVE_GRACE_NOTES)  ||
+           e->has(BaseProperties::TRIGGER_SEGMENT_ID);
+}
+
 void InternalSegmentMapper::fillBuffer()
 {
     Composition &comp = m_doc->getComposition();
@@ -76,6 +125,71 @@ void InternalSegmentMapper::fillBuffer()
         << endl;
 #endif
 
+    const FillParameters parameters = getFillParameters(track->getId(), comp);
+
+    SegmentRefreshStatus &refreshStatus =
+            m_segment->getRefreshStatus(m_refreshStatusId);
+
+    bool remapped = false;
+
+    if (canRemapIncrementally(parameters)) {
+        remapped = remapIncrementally(
+                track->getId(), comp,
+                refreshStatus.from(), changedEnd(refreshStatus));
+    }
+
+    if (!remapped)
+        mapAll(track->getId(), comp);
+
+    refreshStatus.setNeedsRefresh(false);
+    m_fillParameters = parameters;
+
+    bool anything = (size() != 0);
+
+    RealTime minRealTime;
+    RealTime maxRealTime;
+    if (anything) {
+        minRealTime = getBuffer()[0].getEventTime();
+        // ??? Shouldn't we add the duration of the event?  getDuration().
+        maxRealTime = getBuffer()[size() - 1].getEventTime();
+
+        // Fix for bug #1378.  Start slightly before the first note so
+        // that program etc is sent then.  We'll allow it to be before
+        // zeroTimeF(), since MappedBufMetaIterator can handle early
+        // start-times.
+        static const RealTime preparationTime = RealTime::fromSeconds(0.5);
+        minRealTime = minRealTime - preparationTime;
+    } else {
+        minRealTime = maxRealTime = RealTime::zero();
+    }
+
+    m_channelManager.setRequiredInterval(minRealTime, maxRealTime,
+                                         RealTime::zero(), RealTime(1,0));
+
+    // If the track is making sound
+    if (!ControlBlock::getInstance()->isTrackMuted(track->getId())  &&
+        !ControlBlock::getInstance()->isTrackArchived(track->getId())) {
+        // Track is unmuted, so get a channel interval to play on.
+        // This also releases the old channel interval (possibly
+        // getting it again)
+        m_channelManager.allocateChannelInterval(false);
+    } else {
+        // But if track is muted, don't waste a channel interval on
+        // it.  If that changes later, the first played note will
+        // trigger a search for one.
+        m_channelManager.freeChannelInterval();
+    }
+
+
+    // We have changed the contents, so force a reinit.  Even if the
+    // length is the same, the current controllers for a given time
+    // may have changed.
+    m_channelManager.setDirty();
+    setStartEnd(minRealTime, maxRealTime);
+}
+
+void InternalSegmentMapper::mapAll(TrackId trackId, Composition &comp)
+{
     timeT segmentStartTime = m_segment->getStartTime();
     timeT segmentEndTime = m_segment->getEndMarkerTime();
     timeT segmentDuration = segmentEndTime - segmentStartTime;
@@ -90,7 +204,7 @@ void InternalSegmentMapper::fillBuffer()
 
 #ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
     RG_DEBUG
-        << "fillBuffer(): "
+        << "mapAll(): "
         << (void *)this
         << "Segment"
         << (void *)m_segment
@@ -102,6 +216,18 @@ void InternalSegmentMapper::fillBuffer()
     m_triggeredEvents->clear();
     m_controllerCache.clear();
     m_noteOffs = NoteoffContainer();
+    m_checkpoints.clear();
+
+    // Whether remapIncrementally() will be able to work from this.
+    bool checkpointing = (repeatCount == 0);
+
+    if (checkpointing) {
+        // The start, before the first Event.
+        Checkpoint start;
+        start.time = std::numeric_limits<timeT>::min();
+        start.index = 0;
+        m_checkpoints.push_back(start);
+    }
 
     for (int repeatNo = 0; repeatNo <= repeatCount; ++repeatNo) {
 
@@ -115,6 +241,9 @@ void InternalSegmentMapper::fillBuffer()
         // segment duration later and so forth.
         timeT timeForRepeats = repeatNo * segmentDuration;
 
+        // Time of the last Event mapped, for checkpoint().
+        timeT previousTime = std::numeric_limits<timeT>::min();
+
         for (Segment::iterator j = m_segment->begin();
              m_segment->isBeforeEndMarker(j) ||
                  (implied != m_triggeredEvents->end());
@@ -150,10 +279,20 @@ void InternalSegmentMapper::fillBuffer()
             // compare to the performance time since noteoffs already
             // take repeat-times into count.
             if (haveEarlierNoteoff(bestBaseTime + timeForRepeats)) {
-                popInsertNoteoff(track->getId(), comp);
+                popInsertNoteoff(trackId, comp);
                 continue;
             }
 
+            if (checkpointing) {
+                if (affectsNeighbours(**k)) {
+                    checkpointing = false;
+                    m_checkpoints.clear();
+                } else if (bestBaseTime > previousTime) {
+                    checkpoint(bestBaseTime);
+                }
+                previousTime = bestBaseTime;
+            }
+
             // We handle nested ornament expansion elsewhere, so
             // trigger events won't be found in implied.
             if (!usingImplied) {
@@ -206,74 +345,9 @@ void InternalSegmentMapper::fillBuffer()
                 }
             }
 
-            // Ignore rests
-            //
-            if (!(**k)->isa(Note::EventRestType)) {
-
-                SegmentPerformanceHelper helper
-                (usingImplied ? *m_triggeredEvents : *m_segment);
-
-                timeT playTime =
-                    helper.getSoundingAbsoluteTime(*k) + timeForRepeats;
-                if (playTime >= repeatEndTime) break;
-
-                timeT playDuration = helper.getSoundingDuration(*k);
-
-                // Ignore notes without duration -- they're probably in a tied
-                // series but not as first note
-                //
-                if (playDuration > 0 || !(**k)->isa(Note::EventType)) {
-
-                    if (playTime + playDuration > repeatEndTime)
-                        playDuration = repeatEndTime - playTime;
-
-                    playTime = playTime + m_segment->getDelay();
-                    const RealTime eventTime = toRealTime(comp, playTime);
-
-                    // slightly quicker than calling helper.getRealSoundingDuration()
-                    RealTime endTime =
-                        toRealTime(comp, playTime + playDuration);
-                    const RealTime duration = endTime - eventTime;
-
-                    try {
-                        // Create mapped event and put it in buffer.
-                        // The instrument will be set later by
-                        // ChannelManager, so we set it to zero here.
-                        MappedEvent e(0,
-                                      ***k,  // three stars! what an accolade
-                                      eventTime,
-                                      duration);
-
-                        // Somewhat hacky: The MappedEvent ctor makes
-                        // events that needn't be inserted invalid.
-                        if (e.isValid()) {
-                            e.setTrackId(track->getId());
-
-                            if ((**k)->isa(Controller::EventType) ||
-                                (**k)->isa(PitchBend::EventType)) {
-                                m_controllerCache.storeLatestValue((**k));
-                            }
-
-                            if ((**k)->isa(Note::EventType)) {
-                                if (m_segment->getTranspose() != 0) {
-                                    e.setPitch(e.getPitch() +
-                                               m_segment->getTranspose());
-                                }
-                                if (e.getType() != MappedEvent::MidiNoteOneShot) {
-                                    enqueueNoteoff(playTime + playDuration,
-                                                   e.getPitch());
-                                }
-                            }
-                            mapAnEvent(&e);
-                        } else {}
-
-                    } catch (...) {
-#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
-                        RG_DEBUG << "fillBuffer() - caught exception while trying to create MappedEvent";
-#endif
-                    }
-                }
-            }
+            if (!mapEvent(*k, usingImplied, timeForRepeats, repeatEndTime,
+                          trackId, comp, true))
+                break;
 
             ++*k; // increment either i or j, whichever one we just used
         }
@@ -281,51 +355,270 @@ void InternalSegmentMapper::fillBuffer()
 
     // After all the other events, there may still be Noteoffs.
     while (!m_noteOffs.empty()) {
-        popInsertNoteoff(track->getId(), comp);
+        popInsertNoteoff(trackId, comp);
     }
+}
 
-    bool anything = (size() != 0);
+bool
+InternalSegmentMapper::mapEvent(Segment::iterator i, bool triggered,
+                                timeT timeForRepeats, timeT repeatEndTime,
+                                TrackId trackId, Composition &comp,
+                                bool cacheControllers)
+{
+    // Ignore rests
+    //
+    if ((*i)->isa(Note::EventRestType))
+        return true;
+
+    SegmentPerformanceHelper helper
+    (triggered ? *m_triggeredEvents : *m_segment);
+
+    timeT playTime =
+        helper.getSoundingAbsoluteTime(i) + timeForRepeats;
+    if (playTime >= repeatEndTime) return false;
+
+    timeT playDuration = helper.getSoundingDuration(i);
+
+    // Ignore notes without duration -- they're probably in a tied
+    // series but not as first note
+    //
+    if (playDuration > 0 || !(*i)->isa(Note::EventType)) {
+
+        if (playTime + playDuration > repeatEndTime)
+            playDuration = repeatEndTime - playTime;
+
+        playTime = playTime + m_segment->getDelay();
+        const RealTime eventTime = toRealTime(comp, playTime);
+
+        // slightly quicker than calling helper.getRealSoundingDuration()
+        RealTime endTime =
+            toRealTime(comp, playTime + playDuration);
+        const RealTime duration = endTime - eventTime;
+
+        try {
+            // Create mapped event and put it in buffer.
+            // The instrument will be set later by
+            // ChannelManager, so we set it to zero here.
+            MappedEvent e(0,
+                          **i,
+                          eventTime,
+                          duration);
+
+            // Somewhat hacky: The MappedEvent ctor makes
+            // events that needn't be inserted invalid.
+            if (e.isValid()) {
+                e.setTrackId(trackId);
+
+                if (cacheControllers  &&
+                    ((*i)->isa(Controller::EventType) ||
+                     (*i)->isa(PitchBend::EventType))) {
+                    m_controllerCache.storeLatestValue((*i));
+                }
 
-    RealTime minRealTime;
-    RealTime maxRealTime;
-    if (anything) {
-        minRealTime = getBuffer()[0].getEventTime();
-        // ??? Shouldn't we add the duration of the event?  getDuration().
-        maxRealTime = getBuffer()[size() - 1].getEventTime();
+                if ((*i)->isa(Note::EventType)) {
+                    if (m_segment->getTranspose() != 0) {
+                        e.setPitch(e.getPitch() +
+                                   m_segment->getTranspose());
+                    }
+                    if (e.getType() != MappedEvent::MidiNoteOneShot) {
+                        enqueueNoteoff(playTime + playDuration,
+                                       e.getPitch());
+                    }
+                }
+                mapAnEvent(&e);
+            } else {}
 
-        // Fix for bug #1378.  Start slightly before the first note so
-        // that program etc is sent then.  We'll allow it to be before
-        // zeroTimeF(), since MappedBufMetaIterator can handle early
-        // start-times.
-        static const RealTime preparationTime = RealTime::fromSeconds(0.5);
-        minRealTime = minRealTime - preparationTime;
-    } else {
-        minRealTime = maxRealTime = RealTime::zero();
+        } catch (...) {
+#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
+            RG_DEBUG << "mapEvent() - caught exception while trying to create MappedEvent";
+#endif
+        }
     }
 
-    m_channelManager.setRequiredInterval(minRealTime, maxRealTime,
-                                         RealTime::zero(), RealTime(1,0));
+    return true;
+}
 
-    // If the track is making sound
-    if (!ControlBlock::getInstance()->isTrackMuted(track->getId())  &&
-        !ControlBlock::getInstance()->isTrackArchived(track->getId())) {
-        // Track is unmuted, so get a channel interval to play on.
-        // This also releases the old channel interval (possibly
-        // getting it again)
-        m_channelManager.allocateChannelInterval(false);
-    } else {
-        // But if track is muted, don't waste a channel interval on
-        // it.  If that changes later, the first played note will
-        // trigger a search for one.
-        m_channelManager.freeChannelInterval();
+void
+InternalSegmentMapper::checkpoint(timeT time)
+{
+    if (!m_checkpoints.empty()  &&
+        size() - m_checkpoints.back().index < CheckpointInterval)
+        return;
+
+    Checkpoint checkpoint;
+    checkpoint.time = time;
+    checkpoint.index = size();
+    checkpoint.noteOffs = m_noteOffs;
+    m_checkpoints.push_back(checkpoint);
+}
+
+timeT
+InternalSegmentMapper::changedEnd(const SegmentRefreshStatus &refreshStatus)
+{
+    // An empty range is an edit at one time, e.g. a controller added or
+    // removed, so it covers the Events at that time.
+    if (refreshStatus.to() <= refreshStatus.from())
+        return refreshStatus.from() + 1;
+
+    return refreshStatus.to();
+}
+
+bool
+InternalSegmentMapper::canRemapIncrementally(const FillParameters &parameters)
+{
+    // Last mapping wasn't suitable.
+    if (m_checkpoints.empty())
+        return false;
+
+    // Something other than the Events changed, e.g. tempo.
+    if (!(parameters == m_fillParameters))
+        return false;
+
+    const SegmentRefreshStatus &refreshStatus =
+            m_segment->getRefreshStatus(m_refreshStatusId);
+
+    // We don't know what changed.
+    if (!refreshStatus.needsRefresh())
+        return false;
+
+    const timeT changedTo = changedEnd(refreshStatus);
+
+    // Check the Events in the changed range.
+    for (Segment::iterator i = m_segment->findTime(refreshStatus.from());
+         i != m_segment->end()  &&
+             (*i)->getAbsoluteTime() < changedTo;
+         ++i) {
+        if (affectsNeighbours(*i))
+            return false;
+        // m_controllerCache would need updating.
+        if ((*i)->isa(Controller::EventType)  ||
+            (*i)->isa(PitchBend::EventType))
+            return false;
     }
 
+    return true;
+}
 
-    // We have changed the contents, so force a reinit.  Even if the
-    // length is the same, the current controllers for a given time
-    // may have changed.
-    m_channelManager.setDirty();
-    setStartEnd(minRealTime, maxRealTime);
+namespace
+{
+    bool isCachedController(const MappedEvent &event)
+    {
+        return event.getType() == MappedEvent::MidiController  ||
+               event.getType() == MappedEvent::MidiPitchBend;
+    }
+}
+
+bool
+InternalSegmentMapper::remapIncrementally(
+        TrackId trackId, Composition &comp,
+        timeT changedFrom, timeT changedTo)
+{
+    // Last Checkpoint at or before the change.  There always is one
+    // since the first is at the very start.
+    std::vector<Checkpoint>::const_iterator startIter = std::upper_bound(
+            m_checkpoints.begin(), m_checkpoints.end(), changedFrom,
+            [](timeT t, const Checkpoint &c)  { return t < c.time; });
+    --startIter;
+
+    std::vector<Checkpoint> oldCheckpoints;
+    oldCheckpoints.swap(m_checkpoints);
+
+    const size_t startCheckpoint = startIter - oldCheckpoints.begin();
+    const Checkpoint &start = oldCheckpoints[startCheckpoint];
+
+    // Everything up to the Checkpoint is unchanged.
+    m_checkpoints.assign(oldCheckpoints.begin(),
+                         oldCheckpoints.begin() + startCheckpoint + 1);
+    // Re-map in place over what was published two refreshes ago.
+    beginSplice();
+    resize(start.index);
+    m_noteOffs = start.noteOffs;
+
+    // Old Checkpoint to compare with once we are past the change.
+    size_t next = startCheckpoint + 1;
+    // Where we stopped re-mapping in the old and new buffers.
+    int oldEnd = publishedSize();
+    int newEnd = -1;
+
+    timeT previousTime = std::numeric_limits<timeT>::min();
+
+    Segment::iterator j =
+            (start.time == std::numeric_limits<timeT>::min()) ?
+                    m_segment->begin() : m_segment->findTime(start.time);
+
+    while (m_segment->isBeforeEndMarker(j)) {
+        const timeT time = (*j)->getAbsoluteTime();
+
+        if (haveEarlierNoteoff(time)) {
+            popInsertNoteoff(trackId, comp);
+            continue;
+        }
+
+        if (time > previousTime) {
+            while (next < oldCheckpoints.size()  &&
+                   oldCheckpoints[next].time < time)
+                ++next;
+
+            // Back in step with the old mapping?
+            if (time >= changedTo  &&
+                next < oldCheckpoints.size()  &&
+                oldCheckpoints[next].time == time  &&
+                oldCheckpoints[next].noteOffs == m_noteOffs) {
+                oldEnd = oldCheckpoints[next].index;
+                newEnd = size();
+                break;
+            }
+
+            checkpoint(time);
+        }
+        previousTime = time;
+
+        if (!mapEvent(j, false, 0, m_segment->getEndMarkerTime(),
+                      trackId, comp, false))
+            break;
+
+        ++j;
+    }
+
+    if (newEnd < 0) {
+        // We mapped to the end.
+        while (!m_noteOffs.empty()) {
+            popInsertNoteoff(trackId, comp);
+        }
+        newEnd = size();
+    }
+
+    // A controller was removed.  m_controllerCache needs rebuilding.
+    int oldControllers = 0;
+    for (int i = start.index; i < oldEnd; ++i) {
+        if (isCachedController(getPublished(i)))
+            ++oldControllers;
+    }
+    int newControllers = 0;
+    for (int i = start.index; i < newEnd; ++i) {
+        if (isCachedController(getBuffer()[i]))
+            ++newControllers;
+    }
+    if (oldControllers != newControllers)
+        return false;
+
+    // The rest is as it was.
+    endSplice(start.index, oldEnd, newEnd);
+
+    if (oldEnd < publishedSize()) {
+        const int shift = newEnd - oldEnd;
+        for (size_t i = next; i < oldCheckpoints.size(); ++i) {
+            m_checkpoints.push_back(oldCheckpoints[i]);
+            m_checkpoints.back().index += shift;
+        }
+    }
+
+#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
+    RG_DEBUG << "remapIncrementally(): re-mapped" << newEnd - start.index
+             << "of" << size() << "events";
+#endif
+
+    return true;
 }
 
     /** Functions about the noteoff queue **/
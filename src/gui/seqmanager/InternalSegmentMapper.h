@@ -19,18 +19,20 @@
 #define RG_INTERNALSEGMENTMAPPER_H
 
 #include "base/ControllerContext.h"
+#include "base/RealTime.h"
+#include "base/Segment.h"
 #include "gui/seqmanager/MappedEventBuffer.h"
 #include "gui/seqmanager/SegmentMapper.h"
 #include "gui/seqmanager/ChannelManager.h"
 
 #include <set>
+#include <vector>
 
 namespace Rosegarden
 {
 
 class TriggerSegmentRec;
 class Composition;
-class RealTime;
 
 /// Converts (maps) Event objects into MappedEvent objects for a Segment
 /**
@@ -54,6 +56,9 @@ class RealTime;
  * This is the first part of a two-part process to convert the Event objects
  * in a Composition into MappedEvent objects that can be sent to ALSA.  For
  * the second part of this conversion, see MappedBufMetaIterator.
+ *
+ * Edits usually touch a small part of a Segment, so fillBuffer() tries
+ * to re-map only the part that changed.  See remapIncrementally().
  */
 class InternalSegmentMapper : public SegmentMapper
 {
@@ -97,6 +102,71 @@ private:
      */
     ControllerAndPBList getControllers(Instrument *instrument, RealTime start);
 
+    /// Map the whole Segment.
+    void mapAll(TrackId trackId, Composition &comp);
+
+    /// Map one Event.
+    /**
+     * Returns false if the Event starts at or after repeatEndTime, in
+     * which case nothing after it in the same repeat will play either.
+     *
+     * cacheControllers is false when re-mapping part of the Segment, as
+     * m_controllerCache must only ever see controllers in time order.
+     */
+    bool mapEvent(Segment::iterator i, bool triggered, timeT timeForRepeats,
+                  timeT repeatEndTime, TrackId trackId, Composition &comp,
+                  bool cacheControllers);
+
+    /// Whether mapping e affects how other Events are mapped.
+    /**
+     * E.g. tied notes, grace notes, and triggered ornaments.
+     */
+    static bool affectsNeighbours(const Event *e);
+
+    /// Everything, other than the Events, that fillBuffer() output depends on.
+    struct FillParameters
+    {
+        timeT startTime;
+        timeT endMarkerTime;
+        timeT delay;
+        RealTime realTimeDelay;
+        int transpose;
+        int repeatCount;
+        TrackId trackId;
+        timeT compositionStart;
+        unsigned tempoMapVersion;
+
+        bool operator==(const FillParameters &other) const;
+    };
+    FillParameters getFillParameters(TrackId trackId,
+                                     const Composition &comp) const;
+
+    /// End of the changed range, exclusive.
+    /**
+     * Never the same as refreshStatus.from(), so that an edit at a single
+     * time covers the Events at that time.
+     */
+    static timeT changedEnd(const SegmentRefreshStatus &refreshStatus);
+
+    /// Whether remapIncrementally() can be used for the pending changes.
+    bool canRemapIncrementally(const FillParameters &parameters);
+
+    /// Re-map just the changed part of the Segment.
+    /**
+     * mapAll() saves a Checkpoint every CheckpointInterval events.  We
+     * restart mapping from the last Checkpoint before the change.  Once
+     * past the change, as soon as we reach the time of one of the old
+     * Checkpoints with the same pending noteoffs, the rest of the
+     * mapping must come out as it did last time, so we keep it.  This
+     * works in place on the write buffer (see beginSplice()), so an edit
+     * that doesn't change the number of MappedEvent's only writes the
+     * re-mapped part and what the previous edit changed.
+     *
+     * Returns false if a full mapAll() turns out to be needed after all.
+     */
+    bool remapIncrementally(TrackId trackId, Composition &comp,
+                            timeT changedFrom, timeT changedTo);
+
     typedef std::pair<timeT, int> Noteoff;
     struct NoteoffCmp
     {
@@ -141,6 +211,32 @@ private:
 
     /// Queue of noteoffs.
     NoteoffContainer m_noteOffs;
+
+    /// Mapping state between Events.  See remapIncrementally().
+    struct Checkpoint
+    {
+        /// Events before this time have been mapped and none after it.
+        timeT time;
+        /// Number of MappedEvent's in the buffer at that point.
+        int index;
+        /// Pending noteoffs at that point.
+        NoteoffContainer noteOffs;
+    };
+    /// Checkpoints for the published buffer, in time order.
+    /**
+     * Empty if the Segment can't be re-mapped incrementally (repeats,
+     * triggered segments, ties, grace notes).
+     */
+    std::vector<Checkpoint> m_checkpoints;
+    /// Events between Checkpoints.
+    static constexpr int CheckpointInterval = 256;
+    /// Add a Checkpoint if CheckpointInterval events have gone by.
+    void checkpoint(timeT time);
+
+    /// Our SegmentRefreshStatus for the changed time range.
+    unsigned int m_refreshStatusId;
+    /// FillParameters for the published buffer.
+    FillParameters m_fillParameters;
 };
 
 
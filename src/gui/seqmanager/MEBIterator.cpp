@@ -27,18 +27,53 @@ namespace Rosegarden
 MEBIterator::MEBIterator(
         QSharedPointer<MappedEventBuffer> mappedEventBuffer) :
     m_mappedEventBuffer(mappedEventBuffer),
+    m_lockedBuffer(nullptr),
+    m_lockCount(0),
     m_index(0),
     m_ready(false),
-    m_active(false),
     m_currentTime()
 {
 }
 
+MEBIterator::~MEBIterator()
+{
+    Q_ASSERT(m_lockCount == 0);
+}
+
+void
+MEBIterator::lockForRead()
+{
+    if (m_lockCount++ == 0)
+        m_lockedBuffer = m_mappedEventBuffer->lockForRead();
+}
+
+void
+MEBIterator::unlock()
+{
+    Q_ASSERT(m_lockCount > 0);
+
+    if (--m_lockCount == 0) {
+        m_mappedEventBuffer->unlockForRead(m_lockedBuffer);
+        m_lockedBuffer = nullptr;
+    }
+}
+
+int
+MEBIterator::size() const
+{
+    if (m_lockedBuffer)
+        return m_lockedBuffer->size.load(std::memory_order_relaxed);
+
+    // Not locked.  Good enough for atEnd() and operator++().  peek()
+    // will check again against what is locked.
+    return m_mappedEventBuffer->readSize();
+}
+
 // ++prefix
 MEBIterator &
 MEBIterator::operator++()
 {
-    if (m_index < m_mappedEventBuffer->size())
+    if (m_index < size())
         ++m_index;
 
     return *this;
@@ -49,7 +84,7 @@ MEBIterator::moveTo(const RealTime &time)
 {
     // Rather than briefly unlock and immediately relock each
     // iteration, we leave the lock on until we're done.
-    QReadLocker locker(getLock());
+    ReadLocker locker(*this);
 
     // For each event from the current iterator position
     while (1) {
@@ -86,14 +121,17 @@ MEBIterator::moveTo(const RealTime &time)
 MappedEvent *
 MEBIterator::peek() const
 {
-    // The lock formerly here has moved out to callers.
+    // Callers lock with ReadLocker.
+    Q_ASSERT(m_lockedBuffer);
+    if (!m_lockedBuffer)
+        return nullptr;
 
     // If we're at the end, return nullptr
-    if (m_index >= m_mappedEventBuffer->size())
+    if (m_index >= m_lockedBuffer->size.load(std::memory_order_relaxed))
         return nullptr;
 
     // Otherwise return a pointer into the buffer.
-    return &m_mappedEventBuffer->m_buffer[m_index];
+    return &m_lockedBuffer->events[m_index];
 }
 
 void
@@ -34,12 +34,38 @@ class MEBIterator
 {
 public:
     explicit MEBIterator(QSharedPointer<MappedEventBuffer> mappedEventBuffer);
+    ~MEBIterator();
+
+    /// Locks the MappedEventBuffer's events for peek().
+    /**
+     * While a ReadLocker exists, the events the iterator sees will not
+     * change, even if the GUI thread refreshes the MappedEventBuffer.
+     * Never blocks.  Hold it for as long as you are using the pointer
+     * returned by peek().
+     *
+     *   MEBIterator::ReadLocker locker(*iter);
+     *
+     * May be nested.
+     */
+    class ReadLocker
+    {
+    public:
+        explicit ReadLocker(MEBIterator &iter) : m_iter(iter)
+            { m_iter.lockForRead(); }
+        ~ReadLocker()  { m_iter.unlock(); }
+
+    private:
+        ReadLocker(const ReadLocker &);
+        ReadLocker &operator=(const ReadLocker &);
+
+        MEBIterator &m_iter;
+    };
 
     /// Go back to the beginning of the MappedEventBuffer
     void reset()  { m_index = 0; }
 
     bool atEnd() const
-        { return (m_index >= m_mappedEventBuffer->size()); }
+        { return (m_index >= size()); }
 
     /// Prefix operator++
     MEBIterator& operator++();
@@ -53,12 +79,12 @@ public:
      *
      * Returns 0 if atEnd().
      *
-     * Callers should lock the iterator by using QReadLocker on the return
-     * from getLock() for as long as they are using the pointer.
+     * Callers must lock the iterator with a ReadLocker for as long as
+     * they are using the pointer.
      *
-     *   QReadLocker locker(iter->getLock());
+     *   MEBIterator::ReadLocker locker(*iter);
      *
-     * @see getLock()
+     * @see ReadLocker
      */
     MappedEvent *peek() const;
 
@@ -81,34 +107,15 @@ public:
     QSharedPointer<MappedEventBuffer> getMappedEventBuffer() const
             { return m_mappedEventBuffer; }
 
+    /// Set the time the next event starts sounding from.
     /**
-     * Called by MappedBufMetaIterator::fetchEventsNoncompeting().
+     * Called by MappedBufMetaIterator::fetchEventsNoncompeting() before
+     * taking events in each slice.
      *
-     * @see setInactive()
-     * @see getActive()
+     * @see m_currentTime
      */
-    void setActive(bool value, RealTime currentTime) {
-        m_active = value;
-        m_currentTime = currentTime;
-    }
-    /**
-     * Called by MappedBufMetaIterator::fetchEventsNoncompeting().
-     *
-     * @see setActive()
-     * @see getActive()
-     */
-    void setInactive()  { m_active = false; }
-    /**
-     * Whether this iterator has more events to give within the current
-     * time slice.
-     *
-     * Called by MappedBufMetaIterator::fetchEventsNoncompeting().
-     *
-     * @see setActive()
-     * @see setInactive()
-     * @see m_active
-     */
-    bool getActive() const  { return m_active; }
+    void setCurrentTime(RealTime currentTime)
+            { m_currentTime = currentTime; }
 
     /// Whether makeReady() needs to be called.
     /**
@@ -148,18 +155,26 @@ public:
     bool shouldPlay(MappedEvent *evt, RealTime startTime)
         { return m_mappedEventBuffer->shouldPlay(evt, startTime); }
 
-    /// Get a pointer to the MappedEventBuffer's lock.
-    /**
-     * This is used when reading to prevent MappedEventBuffer from
-     * reallocating the buffer while we are holding a pointer.
-     */
-    QReadWriteLock *getLock() const
-        { return &m_mappedEventBuffer->m_lock; }
-
 private:
+    // Hidden and not implemented.  Copies would share m_lockedBuffer.
+    MEBIterator(const MEBIterator &);
+    MEBIterator &operator=(const MEBIterator &);
+
     /// The buffer this iterator points into.
     QSharedPointer<MappedEventBuffer> m_mappedEventBuffer;
 
+    // For ReadLocker.
+    void lockForRead();
+    void unlock();
+
+    /// The events we are locked to, or nullptr if not locked.
+    const MappedEventBuffer::Buffer *m_lockedBuffer;
+    /// Nesting depth of ReadLocker's.
+    int m_lockCount;
+
+    /// Number of events.  Locked or not.
+    int size() const;
+
     /// Position of the iterator in the buffer.
     int m_index;
 
@@ -172,12 +187,6 @@ private:
      */
     bool m_ready;
 
-    /**
-     * Whether this iterator has more events to give within the current
-     * time slice.
-     */
-    bool m_active;
-
     /// RealTime when the current event starts sounding.
     /**
      * Either the current event's time or the time the loop starts,
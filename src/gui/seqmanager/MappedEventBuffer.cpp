@@ -24,6 +24,9 @@
 #include "sound/MappedEvent.h"
 #include "sound/MappedInserterBase.h"
 
+#include <QThread>
+
+#include <algorithm>
 #include <limits>  // for std::numeric_limits
 
 // #define DEBUG_MAPPED_EVENT_BUFFER 1
@@ -31,13 +34,12 @@
 namespace Rosegarden
 {
 
+std::atomic<unsigned> MappedEventBuffer::m_publishCount(0);
+
 MappedEventBuffer::MappedEventBuffer(RosegardenDocument *doc) :
     m_doc(doc),
     m_end(std::numeric_limits<int>::max(), 0),  // 68 years
-    m_buffer(nullptr),
-    m_capacity(0),
-    m_size(0),
-    m_lock(),
+    m_readIndex(0),
     m_refCount(0)
 {
 }
@@ -45,7 +47,8 @@ MappedEventBuffer::MappedEventBuffer(RosegardenDocument *doc) :
 MappedEventBuffer::~MappedEventBuffer()
 {
     // Safe even if nullptr.
-    delete[] m_buffer;
+    delete[] m_buffers[0].events;
+    delete[] m_buffers[1].events;
 }
 
 void
@@ -58,7 +61,10 @@ MappedEventBuffer::init()
 
         //RG_DEBUG << "init() : size = " << size;
 
+        m_splice = Splice();
         fillBuffer();
+        publish();
+        m_lastSplice = m_splice;
     } else {
         //RG_DEBUG << "init() : mmap size = 0 - skipping mmapping for now";
     }
@@ -69,13 +75,15 @@ MappedEventBuffer::refresh()
 {
     bool resized = false;
 
+    beginWrite();
+
     int newFill = calculateSize();
     int oldSize = capacity();
 
 #ifdef DEBUG_MAPPED_EVENT_BUFFER
     RG_DEBUG << "refresh() - " << this
                  << " - old size = " << oldSize
-                 << " - old fill = " << size()
+                 << " - old fill = " << readSize()
                  << " - new fill = " << newFill;
 #endif
 
@@ -86,70 +94,101 @@ MappedEventBuffer::refresh()
     }
 
     // Ask the deriver to fill the buffer from the document
+    m_splice = Splice();
     fillBuffer();
 
+    // Let the sequencer see it.
+    publish();
+    m_lastSplice = m_splice;
+
     return resized;
 }
 
 int
 MappedEventBuffer::capacity() const
 {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-    return m_capacity.loadRelaxed();
-#else
-    return m_capacity.load();
-#endif
+    return writeBuffer().capacity;
 }
 
 int
 MappedEventBuffer::size() const
 {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-    return m_size.loadRelaxed();
-#else
-    return m_size.load();
-#endif
+    return writeBuffer().size.load(std::memory_order_relaxed);
 }
 
 void
 MappedEventBuffer::reserve(int newSize)
 {
-    if (newSize <= capacity())  return;
+    Buffer &buffer = writeBuffer();
+
+    if (newSize <= buffer.capacity)  return;
 
-    MappedEvent *oldBuffer = m_buffer;
     MappedEvent *newBuffer = new MappedEvent[newSize];
 
-    if (oldBuffer) {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-        for (int i = 0; i < m_size.loadRelaxed(); ++i) {
-#else
-        for (int i = 0; i < m_size.load(); ++i) {
-#endif
-            newBuffer[i] = m_buffer[i];
-        }
+    // Some mappers grow the buffer part way through filling it.
+    const int oldSize = buffer.size.load(std::memory_order_relaxed);
+    for (int i = 0; i < oldSize; ++i) {
+        newBuffer[i] = buffer.events[i];
     }
 
-    {
-        QWriteLocker locker(&m_lock);
-        m_buffer = newBuffer;
-        m_capacity.storeRelease(newSize);
-    }
+    // No need to lock.  The sequencer can't see the write buffer.
+    delete[] buffer.events;
+    buffer.events = newBuffer;
+    buffer.capacity = newSize;
 
 #ifdef DEBUG_MAPPED_EVENT_BUFFER
     SEQUENCER_DEBUG << "MappedEventBuffer::reserve: Resized to " << newSize << " events";
 #endif
-
-    delete[] oldBuffer;
 }
 
 void
 MappedEventBuffer::resize(int newFill)
 {
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
-    m_size.storeRelaxed(newFill);
-#else
-    m_size.store(newFill);
-#endif
+    writeBuffer().size.store(newFill, std::memory_order_relaxed);
+}
+
+void
+MappedEventBuffer::beginWrite()
+{
+    const Buffer &buffer = writeBuffer();
+
+    // A reader that pinned this buffer before the last publish() might
+    // still be using it.  They only hold on for an event or so.
+    while (buffer.readers.load() != 0) {
+        QThread::yieldCurrentThread();
+    }
+}
+
+void
+MappedEventBuffer::publish()
+{
+    // Sequentially consistent, which lockForRead() depends on.
+    m_readIndex.store(1 - m_readIndex.load());
+
+    ++m_publishCount;
+}
+
+const MappedEventBuffer::Buffer *
+MappedEventBuffer::lockForRead() const
+{
+    while (true) {
+        const Buffer *buffer = &m_buffers[m_readIndex.load()];
+        ++buffer->readers;
+
+        // Still the read buffer?  Then beginWrite() will see our count
+        // before it can reuse this one.
+        if (buffer == &m_buffers[m_readIndex.load()])
+            return buffer;
+
+        // publish() got in between.  Try the new read buffer.
+        --buffer->readers;
+    }
+}
+
+void
+MappedEventBuffer::unlockForRead(const Buffer *buffer) const
+{
+    --buffer->readers;
 }
 
 void
@@ -173,6 +212,83 @@ mapAnEvent(MappedEvent *e)
     resize(size() + 1);
 }
 
+const MappedEvent &
+MappedEventBuffer::getPublished(int index) const
+{
+    return m_buffers[m_readIndex.load()].events[index];
+}
+
+void
+MappedEventBuffer::copyPublished(int begin, int end)
+{
+    if (end <= begin)
+        return;
+
+    Buffer &buffer = writeBuffer();
+    const Buffer &published = m_buffers[m_readIndex.load()];
+
+    const int oldSize = buffer.size.load(std::memory_order_relaxed);
+    const int newSize = oldSize + end - begin;
+    if (newSize > buffer.capacity)
+        reserve(newSize);
+
+    std::copy(published.events + begin, published.events + end,
+              buffer.events + oldSize);
+    resize(newSize);
+}
+
+void
+MappedEventBuffer::beginSplice()
+{
+    // So that the events after the splice aren't lost if the deriver
+    // maps past the end of the write buffer.
+    reserve(publishedSize());
+}
+
+void
+MappedEventBuffer::endSplice(int begin, int oldEnd, int newEnd)
+{
+    Buffer &buffer = writeBuffer();
+    const MappedEvent *published = m_buffers[m_readIndex.load()].events;
+    const int publishedEnd = publishedSize();
+
+    // The write buffer was published before the last refresh, so it only
+    // differs from the published events where that refresh changed them.
+    int staleBegin = 0;
+    int staleEnd = publishedEnd;
+    if (m_lastSplice.valid) {
+        staleBegin = m_lastSplice.begin;
+        if (m_lastSplice.newEnd == m_lastSplice.oldEnd)
+            staleEnd = m_lastSplice.newEnd;
+    }
+
+    // Before the splice.
+    if (staleBegin < begin) {
+        std::copy(published + staleBegin,
+                  published + std::min(staleEnd, begin),
+                  buffer.events + staleBegin);
+    }
+
+    // After it.  These only need to move if the number of events changed.
+    const int newSize = newEnd + publishedEnd - oldEnd;
+    if (newEnd != oldEnd) {
+        copyPublished(oldEnd, publishedEnd);
+    } else {
+        // beginSplice() made sure they are all still there.
+        const int from = std::max(oldEnd, staleBegin);
+        if (from < staleEnd) {
+            std::copy(published + from, published + staleEnd,
+                      buffer.events + from);
+        }
+    }
+    resize(newSize);
+
+    m_splice.valid = true;
+    m_splice.begin = begin;
+    m_splice.oldEnd = oldEnd;
+    m_splice.newEnd = newEnd;
+}
+
 void
 MappedEventBuffer::
 doInsert(MappedInserterBase &inserter, MappedEvent &evt,
@@ -21,8 +21,7 @@
 #include "base/RealTime.h"
 #include "base/Track.h"
 
-#include <QReadWriteLock>
-#include <QAtomicInt>
+#include <atomic>
 
 namespace Rosegarden
 {
@@ -46,13 +45,10 @@ class RosegardenDocument;
  * The mapping logic is handled by mappers derived from this class; this
  * class provides the basic container and the reading logic.
  *
- * Reading and writing may take place simultaneously without locks (we are
- * prepared to accept the lossage from individual mangled MappedEvent
- * reads) but a read/write lock (m_lock) on the buffer space guards
- * against bad
- * access caused by resizes.  [Actually, it doesn't at all since the
- * caller of peek() has a pointer they can access after the lock has
- * been released.  See comments on m_lock below and in iterator::peek().]
+ * The events are double buffered so that the sequencer thread never
+ * waits on the GUI thread.  refresh() fills a private write buffer while
+ * the sequencer keeps reading the last published one, then publishes the
+ * new one in a single atomic step.  See m_buffers.
  *
  * MappedEventBuffer only concerns itself with the state of the
  * composition, as opposed to the state of performance.  No matter how
@@ -77,9 +73,10 @@ public:
      */
     void init();
 
-    /// Access to the internal buffer of events.  NOT LOCKED
+    /// Access to the write buffer.
     /**
-     * un-locked, use only from write/resize thread
+     * For use by fillBuffer() only.  The sequencer never sees the write
+     * buffer until refresh() publishes it.
      *
      * This is always used along with [] to access a specific MappedEvent.
      *
@@ -87,14 +84,14 @@ public:
      *     sort of range checking.  Recommend adding an operator[] and/or an
      *     at() that asserts on range problems.
      */
-    MappedEvent *getBuffer()  { return m_buffer; }
+    MappedEvent *getBuffer()  { return writeBuffer().events; }
 
-    /// Capacity of the buffer in MappedEvent's.
+    /// Capacity of the write buffer in MappedEvent's.
     int capacity() const;
-    /// Number of MappedEvent objects in the buffer.
+    /// Number of MappedEvent objects in the write buffer.
     int size() const;
 
-    /// Sets the buffer capacity.
+    /// Sets the write buffer capacity.
     /**
      * Ignored if smaller than old capacity.
      *
@@ -103,7 +100,7 @@ public:
      */
     void reserve(int newSize);
 
-    /// Sets the number of events in the buffer.
+    /// Sets the number of events in the write buffer.
     /**
      * Must be no bigger than buffer capacity.
      *
@@ -114,8 +111,9 @@ public:
 
     /// Refresh the buffer
     /**
-     * Called after the segment has been modified.  Resizes the buffer if
-     * needed, then calls fillBuffer() to fill it from the segment.
+     * Called after the segment has been modified.  Resizes the write
+     * buffer if needed, calls fillBuffer() to fill it from the segment,
+     * then publishes it to the sequencer.
      *
      * Returns true if buffer size changed (and thus the sequencer
      * needs to be told about it).
@@ -134,6 +132,13 @@ public:
         end   = m_end;
     }
 
+    /// Number of times any MappedEventBuffer has been published.
+    /**
+     * Lets MappedBufMetaIterator know when what it has cached about
+     * the buffers might be out of date.
+     */
+    static unsigned getPublishCount()  { return m_publishCount.load(); }
+
     virtual TrackId getTrackID() const  { return NoTrack; }
     virtual void insertChannelSetup(MappedInserterBase &)  { }
 
@@ -192,6 +197,10 @@ protected:
      * processes note events while TempoSegmentMapper processes tempo
      * change events.
      *
+     * The write buffer holds whatever was published two refreshes ago,
+     * so this must either fill it from scratch and call resize(), or
+     * re-map part of the published events with beginSplice() and
+     * endSplice().
      */
     virtual void fillBuffer() = 0;
 
@@ -232,6 +241,31 @@ protected:
     /// Add an event to the buffer.
     void mapAnEvent(MappedEvent *e);
 
+    /// Number of events last published by refresh().
+    /**
+     * For fillBuffer().  Nothing changes the published events while
+     * fillBuffer() is running.
+     */
+    int publishedSize() const  { return readSize(); }
+    /// Access to a published event.
+    const MappedEvent &getPublished(int index) const;
+
+    /// Start re-mapping part of the published events in place.
+    /**
+     * For fillBuffer().  After this, resize() to the start of the part
+     * to re-map, map the new events from there, then call endSplice().
+     * The write buffer isn't brought up to date with the published
+     * events until endSplice(), when it is known what must be copied.
+     */
+    void beginSplice();
+    /// Replace published events [begin, oldEnd) with [begin, newEnd).
+    /**
+     * The published events from oldEnd on follow the new ones.  Only
+     * what the last refresh changed is copied, plus the events after
+     * the splice if the number of events changed.
+     */
+    void endSplice(int begin, int oldEnd, int newEnd);
+
     /// Set the sounding times (m_start, m_end).
     /**
      * InternalSegmentMapper::fillBuffer() keeps this updated.
@@ -250,8 +284,7 @@ private:
     MappedEventBuffer &operator=(const MappedEventBuffer &);
 
     // MEBIterator needs:
-    //   m_buffer
-    //   m_lock
+    //   Buffer, lockForRead(), unlockForRead(), readSize()
     //   makeReady()
     //   shouldPlay()
     //   doInsert()
@@ -259,37 +292,80 @@ private:
     //     just make those public and get rid of this.
     friend class MEBIterator;
 
-    /// The Mapped Event Buffer
-    MappedEvent *m_buffer;
-
-    /// Capacity of the buffer.
+    /// One of the two event arrays.  See m_buffers.
+    struct Buffer
+    {
+        Buffer() : events(nullptr), capacity(0), size(0), readers(0)  { }
+
+        MappedEvent *events;
+        /// Capacity of events.
+        int capacity;
+        /// Number of events in use.
+        std::atomic<int> size;
+        /// Number of MEBIterator's currently reading this Buffer.
+        mutable std::atomic<int> readers;
+    };
+
+    /// Read and write buffers.
     /**
-     * ??? While storeRelease() is used with this, it's somewhat dubious
-     *     as to whether that is necessary.  There are no other uses
-     *     of m_capacity anywhere near that one.  It's very likely that
-     *     QAtomicInt is not needed here.
+     * m_buffers[m_readIndex] is the read buffer.  It is what the sequencer
+     * sees, and nothing modifies it while it is the read buffer.  The
+     * other is the write buffer which only fillBuffer() touches.
+     *
+     * publish() swaps them by flipping m_readIndex.  A reader may still be
+     * looking at the old read buffer at that point, so beginWrite() waits
+     * for its reader count to drop to zero before the next fill reuses it.
+     * Readers hold a buffer for one event at a time, so that wait is very
+     * short, and it is only ever the GUI thread that waits.  The sequencer
+     * thread never blocks.
      */
-    mutable QAtomicInt m_capacity;
-
-    /// Number of events in the buffer.
+    Buffer m_buffers[2];
+    std::atomic<int> m_readIndex;
+
+    Buffer &writeBuffer()  { return m_buffers[1 - m_readIndex.load()]; }
+    const Buffer &writeBuffer() const
+        { return m_buffers[1 - m_readIndex.load()]; }
+
+    /// Append published events [begin, end) to the write buffer.
+    void copyPublished(int begin, int end);
+
+    /// A splice of the events.  See endSplice().
+    struct Splice
+    {
+        Splice() : valid(false), begin(0), oldEnd(0), newEnd(0)  { }
+
+        bool valid;
+        int begin;
+        int oldEnd;
+        int newEnd;
+    };
+    /// The splice made by the fillBuffer() in progress, if any.
+    Splice m_splice;
+    /// The splice made by the last refresh(), if any.
     /**
-     * ??? We only use load() and store().  This doesn't need to be a
-     *     QAtomicInt.
+     * The write buffer is the read buffer from before that splice, so
+     * this is all endSplice() needs to copy to catch it up.
      */
-    mutable QAtomicInt m_size;
+    Splice m_lastSplice;
 
-    /// Lock for reserve() and callers to iterator::peek()
+    /// Wait until no reader is left holding the write buffer.
+    void beginWrite();
+    /// Make the write buffer the read buffer.
+    void publish();
+
+    /// Pin the read buffer for MEBIterator.
     /**
-     * Used by reserve() to lock the swapping of the old for the new
-     * and the changing of the buffer capacity.
-     *
-     * Used by callers to MappedEventBuffer::iterator::peek() to
-     * ensure that buffer isn't reallocated while the caller is
-     * holding the current item.  Doing so avoids the scenario where
-     * peek() gets a pointer to the element and then reserve() swaps
-     * the entire buffer out from under it.
+     * The returned Buffer will not be modified until unlockForRead().
+     * Never blocks.
      */
-    QReadWriteLock m_lock;
+    const Buffer *lockForRead() const;
+    void unlockForRead(const Buffer *buffer) const;
+    /// Number of events in the read buffer.  Does not need a lock.
+    int readSize() const
+        { return m_buffers[m_readIndex.load()].size.load(); }
+
+    /// See getPublishCount().
+    static std::atomic<unsigned> m_publishCount;
 
     /// How many metaiterators share this mapper.
     /**
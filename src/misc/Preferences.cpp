@@ -174,6 +174,44 @@ bool Preferences::getJACKLoadCheck()
     return jackLoadCheck.get();
 }
 
+PreferenceInt audioMixerThreads(
+        SequencerOptionsConfigGroup, "audioMixerThreads", -1);
+
+void Preferences::setAudioMixerThreads(int value)
+{
+    audioMixerThreads.set(value);
+}
+
+int Preferences::getAudioMixerThreads()
+{
+    return audioMixerThreads.get();
+}
+
+PreferenceInt audioMixerThreadPriority(
+        SequencerOptionsConfigGroup, "audioMixerThreadPriority", 3);
+
+void Preferences::setAudioMixerThreadPriority(int value)
+{
+    audioMixerThreadPriority.set(value);
+}
+
+int Preferences::getAudioMixerThreadPriority()
+{
+    return audioMixerThreadPriority.get();
+}
+
+PreferenceBool useLoadCache(GeneralOptionsConfigGroup, "useLoadCache", false);
+
+void Preferences::setUseLoadCache(bool value)
+{
+    useLoadCache.set(value);
+}
+
+bool Preferences::getUseLoadCache()
+{
+    return useLoadCache.get();
+}
+
 PreferenceBool bug1623(ExperimentalConfigGroup, "bug1623", false);
 
 bool Preferences::getBug1623()
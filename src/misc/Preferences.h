@@ -85,6 +85,20 @@ namespace Preferences
     void setJACKLoadCheck(bool value);
     bool getJACKLoadCheck();
 
+    // Extra threads for rendering audio instruments in parallel.
+    // -1 picks a number to suit the machine.  Takes effect on restart.
+    void setAudioMixerThreads(int value);
+    int getAudioMixerThreads();
+
+    // SCHED_FIFO priority for those threads.
+    void setAudioMixerThreadPriority(int value);
+    int getAudioMixerThreadPriority();
+
+    // Write and use the binary fast-load cache beside .rg files.
+    // See DocumentCache.
+    void setUseLoadCache(bool value);
+    bool getUseLoadCache();
+
     // Experimental
 
     bool getBug1623();
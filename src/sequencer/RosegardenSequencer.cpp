@@ -1023,7 +1023,7 @@ void RosegardenSequencer::dumpFirstSegment()
 
     MEBIterator it(firstMappedEventBuffer);
 
-    QReadLocker locker(it.getLock());
+    MEBIterator::ReadLocker locker(it);
 
     for (; !it.atEnd(); ++it) {
 
@@ -1260,18 +1260,18 @@ RosegardenSequencer::keepPlaying()
     if (isLooping()  &&  fetchEnd >= m_loopEnd)
         fetchEnd = m_loopEnd - RealTime(0, 1);
 
-    MappedEventList mappedEventList;
+    m_sliceEvents.clear();
 
     // If time has actually moved, get the events.
     if (fetchEnd > m_lastFetchSongPosition) {
         fetchEvents(
-                mappedEventList, m_lastFetchSongPosition, fetchEnd, false);
+                m_sliceEvents, m_lastFetchSongPosition, fetchEnd, false);
     }
 
     // Again, process whether we need to or not to keep
     // the Sequencer up-to-date with audio events
     m_driver->processEventsOut(
-            mappedEventList, m_lastFetchSongPosition, fetchEnd);
+            m_sliceEvents, m_lastFetchSongPosition, fetchEnd);
 
     if (fetchEnd > m_lastFetchSongPosition)
         m_lastFetchSongPosition = fetchEnd;
@@ -1489,16 +1489,13 @@ RosegardenSequencer::applyFiltering(MappedEventList *mC,
          i != mC->end();
          /* increment in loop */) {
 
-        // Hold on to the current event for processing.
-        MappedEventList::iterator j = i;
-        // Move to the next in case the current is erased.
-        ++i;
-
         // If this event matches the filter, erase it from the list
-        if (((*j)->getType() & filter) ||
-                (filterControlDevice && ((*j)->getRecordedDevice() ==
+        if (((*i)->getType() & filter) ||
+                (filterControlDevice && ((*i)->getRecordedDevice() ==
                                          Device::EXTERNAL_CONTROLLER))) {
-            mC->erase(j);
+            i = mC->erase(i);
+        } else {
+            ++i;
         }
     }
 }
@@ -517,6 +517,12 @@ private:
     MappedBufMetaIterator m_metaIterator;
     RealTime m_lastStartTime;
 
+    /// The events for each slice in keepPlaying().
+    /**
+     * Kept between slices so that its memory can be reused.
+     */
+    MappedEventList m_sliceEvents;
+
     /**
      * m_asyncOutQueue is not a MappedEventList: order of receipt
      * matters in ordering, timestamp doesn't
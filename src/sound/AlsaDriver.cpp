@@ -2261,31 +2261,30 @@ AlsaDriver::resetPlayback(const RealTime &oldPosition, const RealTime &position)
     // modify the note offs that exist as they're relative to the
     // playStartPosition terms.
     //
-    for (NoteOffQueue::iterator i = m_noteOffQueue.begin();
-         i != m_noteOffQueue.end(); ++i) {
+    m_noteOffQueue.retime([&](NoteOffEvent &noteOff) {
 
         // if we're fast forwarding then we bring the note off closer
         if (jump >= RealTime::zero()) {
 
-            RealTime endTime = formerStartPosition + (*i)->realTime;
+            RealTime endTime = formerStartPosition + noteOff.realTime;
 
 #ifdef DEBUG_PROCESS_MIDI_OUT
             RG_DEBUG << "resetPlayback(): Forward jump of " << jump << ": adjusting note off from "
-                      << (*i)->getRealTime() << " (absolute " << endTime
+                      << noteOff.realTime << " (absolute " << endTime
                       << ") to:";
 #endif
-            (*i)->realTime = endTime - position;
+            noteOff.realTime = endTime - position;
 #ifdef DEBUG_PROCESS_MIDI_OUT
-            RG_DEBUG << "resetPlayback():     " << (*i)->getRealTime();
+            RG_DEBUG << "resetPlayback():     " << noteOff.realTime;
 #endif
         } else // we're rewinding - kill the note immediately
             {
 #ifdef DEBUG_PROCESS_MIDI_OUT
                 RG_DEBUG << "resetPlayback(): Rewind by " << jump << ": setting note off to zero";
 #endif
-                (*i)->realTime = RealTime::zero();
+                noteOff.realTime = RealTime::zero();
             }
-    }
+    });
 
     pushRecentNoteOffs();
     processNotesOff(getAlsaTime(), true);
@@ -2375,57 +2374,37 @@ AlsaDriver::pushRecentNoteOffs()
 #endif
 
     // Move all to m_noteOffQueue.
-    for (NoteOffQueue::iterator i = m_recentNoteOffs.begin();
-         i != m_recentNoteOffs.end(); ++i) {
-        (*i)->realTime = RealTime::zero();
-        m_noteOffQueue.insert(*i);
+    NoteOffEvent noteOff;
+    while (m_recentNoteOffs.pop(noteOff)) {
+        noteOff.realTime = RealTime::zero();
+        m_noteOffQueue.insert(noteOff);
     }
-
-    m_recentNoteOffs.clear();
 }
 
 // Remove m_recentNoteOffs that are before time t
 void
 AlsaDriver::cropRecentNoteOffs(const RealTime &t)
 {
-    while (!m_recentNoteOffs.empty()) {
-        NoteOffQueue::const_iterator noteOffIter = m_recentNoteOffs.begin();
-        const NoteOffEvent *noteOff = *noteOffIter;
 #ifdef DEBUG_PROCESS_MIDI_OUT
-        RG_DEBUG << "cropRecentNoteOffs(): " << noteOff->getRealTime() << " vs " << t;
+    RG_DEBUG << "cropRecentNoteOffs(): " << t;
 #endif
-        if (noteOff->realTime >= t)
-            break;
 
-        delete noteOff;
-        m_recentNoteOffs.erase(noteOffIter);
-    }
+    m_recentNoteOffs.dropBefore(t);
 }
 
 void
 AlsaDriver::weedRecentNoteOffs(unsigned int pitch, MidiByte channel,
                                InstrumentId instrument)
 {
-    for (NoteOffQueue::iterator i = m_recentNoteOffs.begin();
-         i != m_recentNoteOffs.end(); ++i) {
-        if ((*i)->pitch == pitch &&
-            (*i)->channel == channel &&
-            (*i)->instrumentId == instrument) {
+    if (m_recentNoteOffs.drop(pitch, channel, instrument)) {
 #ifdef DEBUG_PROCESS_MIDI_OUT
-            RG_DEBUG << "weedRecentNoteOffs(): deleting one";
+        RG_DEBUG << "weedRecentNoteOffs(): deleting one";
 #endif
-            delete *i;
-            m_recentNoteOffs.erase(i);
-            break;
-        }
     }
 }
 
 void AlsaDriver::clearRecentNoteOffs()
 {
-    for (NoteOffEvent *noteOff : m_recentNoteOffs) {
-        delete noteOff;
-    }
     m_recentNoteOffs.clear();
 }
 
@@ -2444,11 +2423,11 @@ AlsaDriver::allNotesOff()
     snd_seq_ev_clear(&event);
     offTime = getAlsaTime();
 
-    for (NoteOffQueue::iterator it = m_noteOffQueue.begin();
-         it != m_noteOffQueue.end(); ++it) {
+    NoteOffEvent noteOff;
+    while (m_noteOffQueue.pop(noteOff)) {
         // Set destination according to connection for instrument
         //
-        outputDevice = getPairForMappedInstrument((*it)->instrumentId);
+        outputDevice = getPairForMappedInstrument(noteOff.instrumentId);
         if (outputDevice.client < 0  ||  outputDevice.port < 0)
             continue;
 
@@ -2456,14 +2435,14 @@ AlsaDriver::allNotesOff()
 
         // Set source according to port for device
         //
-        int src = getOutputPortForMappedInstrument((*it)->instrumentId);
+        int src = getOutputPortForMappedInstrument(noteOff.instrumentId);
         if (src < 0)
             continue;
         snd_seq_ev_set_source(&event, src);
 
         snd_seq_ev_set_noteoff(&event,
-                               (*it)->channel,
-                               (*it)->pitch,
+                               noteOff.channel,
+                               noteOff.pitch,
                                NOTE_OFF_VELOCITY);
 
         //snd_seq_event_output(m_midiHandle, &event);
@@ -2475,12 +2454,8 @@ AlsaDriver::allNotesOff()
 #endif
 
         }
-
-        delete(*it);
     }
 
-    m_noteOffQueue.erase(m_noteOffQueue.begin(), m_noteOffQueue.end());
-
     //RG_DEBUG << "allNotesOff() - queue size = " << m_noteOffQueue.size();
 
     // flush
@@ -2505,27 +2480,17 @@ AlsaDriver::processNotesOff(const RealTime &time, bool now, bool everything)
     RG_DEBUG << "processNotesOff(" << time << "): alsaTime = " << alsaTime << ", now = " << now;
 #endif
 
-    // For each note-off event in the note-off queue.
-    while (!m_noteOffQueue.empty()) {
-        // Use the begin() element since we will be deleting from the
-        // container and an iterator will become invalid after erase().
-        // Actually, erase() returns the next element.  We could do it
-        // that way.  Or increment before use.  So many options.
-        NoteOffQueue::iterator noteOffIter = m_noteOffQueue.begin();
-        NoteOffEvent *noteOff = *noteOffIter;
+    NoteOffEvent noteOff;
 
-        if (noteOff->realTime > time) {
-#ifdef DEBUG_PROCESS_MIDI_OUT
-            RG_DEBUG << "processNotesOff(): Note off time " << noteOff->getRealTime() << " is beyond current time " << time;
-#endif
-            if (!everything) break;
-        }
+    // For each note-off event that is due, or all of them.
+    while (everything ? m_noteOffQueue.pop(noteOff) :
+                        m_noteOffQueue.popDue(time, noteOff)) {
 
 #ifdef DEBUG_PROCESS_MIDI_OUT
-        RG_DEBUG << "processNotesOff(" << time << "): found event at " << noteOff->getRealTime() << ", instr " << noteOff->getInstrument() << ", channel " << int(noteOff->getChannel()) << ", pitch " << int(noteOff->getPitch());
+        RG_DEBUG << "processNotesOff(" << time << "): found event at " << noteOff.realTime << ", instr " << noteOff.instrumentId << ", channel " << int(noteOff.channel) << ", pitch " << int(noteOff.pitch);
 #endif
 
-        RealTime offTime = noteOff->realTime;
+        RealTime offTime = noteOff.realTime;
         if (offTime < RealTime::zero())
             offTime = RealTime::zero();
         bool scheduled = (offTime > alsaTime) && !now;
@@ -2536,11 +2501,11 @@ AlsaDriver::processNotesOff(const RealTime &time, bool now, bool everything)
                                             (unsigned int)offTime.nsec };
 
         snd_seq_ev_set_noteoff(&alsaEvent,
-                               noteOff->channel,
-                               noteOff->pitch,
+                               noteOff.channel,
+                               noteOff.pitch,
                                NOTE_OFF_VELOCITY);
 
-        bool isSoftSynth = (noteOff->instrumentId >= SoftSynthInstrumentBase);
+        bool isSoftSynth = (noteOff.instrumentId >= SoftSynthInstrumentBase);
 
         if (!isSoftSynth) {
 
@@ -2548,11 +2513,9 @@ AlsaDriver::processNotesOff(const RealTime &time, bool now, bool everything)
 
             // Set source according to instrument
             //
-            int src = getOutputPortForMappedInstrument(noteOff->instrumentId);
+            int src = getOutputPortForMappedInstrument(noteOff.instrumentId);
             if (src < 0) {
-                RG_WARNING << "processNotesOff(): WARNING: Note off has no output port (instr = " << noteOff->instrumentId << ")";
-                delete noteOff;
-                m_noteOffQueue.erase(noteOffIter);
+                RG_WARNING << "processNotesOff(): WARNING: Note off has no output port (instr = " << noteOff.instrumentId << ")";
                 continue;
             }
 
@@ -2572,15 +2535,11 @@ AlsaDriver::processNotesOff(const RealTime &time, bool now, bool everything)
 
             alsaEvent.time.time = alsaOffTime;
 
-            processSoftSynthEventOut(noteOff->instrumentId, &alsaEvent, now);
+            processSoftSynthEventOut(noteOff.instrumentId, &alsaEvent, now);
         }
 
-        if (!now) {
+        if (!now)
             m_recentNoteOffs.insert(noteOff);
-        } else {
-            delete noteOff;
-        }
-        m_noteOffQueue.erase(noteOffIter);
     }
 
     // We don't flush the queue here, as this is called nested from
@@ -3742,7 +3701,7 @@ AlsaDriver::processMidiOut(const MappedEventList &rgEventList,
     // hard to follow.
     std::string sysExData;
 
-    // NB the MappedEventList is implicitly ordered by time (std::multiset)
+    // NB the MappedEventList is ordered by time
 
     // For each incoming mapped (Rosegarden) event
     for (MappedEvent *rgEvent : rgEventList) {
@@ -4006,7 +3965,7 @@ AlsaDriver::processMidiOut(const MappedEventList &rgEventList,
                 sprintf(out, "%c", MIDI_SYSTEM_EXCLUSIVE);
                 sysExData = out;
 
-                sysExData += DataBlockRepository::getDataBlockForEvent(rgEvent);
+                DataBlockRepository::appendDataBlockForEvent(rgEvent, sysExData);
 
                 sprintf(out, "%c", MIDI_END_OF_EXCLUSIVE);
                 sysExData += out;
@@ -4130,17 +4089,14 @@ AlsaDriver::processMidiOut(const MappedEventList &rgEventList,
         // Add note to note off stack
         //
         if (needNoteOff) {
-            NoteOffEvent *noteOffEvent =
-                new NoteOffEvent(outputStopTime,  // already calculated
-                                 rgEvent->getPitch(),
-                                 channel,
-                                 rgEvent->getInstrument());
-
 #ifdef DEBUG_ALSA
             RG_DEBUG << "processMidiOut(): Adding NOTE OFF at " << outputStopTime;
 #endif
 
-            m_noteOffQueue.insert(noteOffEvent);
+            m_noteOffQueue.insert(NoteOffEvent(outputStopTime,  // already calculated
+                                               rgEvent->getPitch(),
+                                               channel,
+                                               rgEvent->getInstrument()));
         }
     }  // for each event
 
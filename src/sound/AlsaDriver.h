@@ -18,7 +18,7 @@
 #ifdef HAVE_ALSA
 
 #include "SoundDriver.h"
-#include "NoteOffEvent.h"
+#include "NoteOffQueue.h"
 #include "base/Instrument.h"
 #include "base/Device.h"
 #include "AlsaPort.h"
@@ -665,7 +665,7 @@ private:
     std::vector<AlsaTimerInfo> m_timers;
     QString m_currentTimerName;
 
-    /// A time ordered set of pending MIDI NoteOffEvent objects.
+    /// Pending MIDI note-offs, by time.
     /**
      * This is used to turn off all notes when Stop is pressed.
      *
@@ -141,6 +141,65 @@ public:
     virtual std::string getSampleFrameSlice(std::ifstream *file,
                                             const RealTime &time) = 0;
 
+    /// Read and de-interleave samples straight into float buffers.
+    /**
+     * Reads up to frames sample frames from the current file pointer
+     * position and converts them directly into channels, which must
+     * point to getChannels() buffers of at least frames floats each.
+     * There is no resampling or channel mapping; see decode() for that.
+     *
+     * Returns the actual number of frames read.
+     */
+    virtual size_t getSampleFrames(std::ifstream *file,
+                                   float **channels,
+                                   size_t frames) = 0;
+
+    /// Map the sample data into memory for zero-copy reads.
+    /**
+     * Returns false if this file type can't be mapped or the mapping
+     * failed, in which case callers should fall back on the
+     * std::ifstream interface.  Safe to call more than once and from
+     * more than one thread; the file is only mapped, or tried, once.
+     */
+    virtual bool mapSampleData() = 0;
+
+    /// Raw sample data starting at the given frame, from the mapping.
+    /**
+     * mapSampleData() must have returned true.  On return, frames has
+     * been clamped to the number of frames available from that point.
+     * Returns nullptr (and sets frames to 0) if frame is past the end.
+     *
+     * The data is in the same format as getSampleFrames() returns, so
+     * it can be passed straight to decode().
+     */
+    virtual const unsigned char *getMappedSampleData(size_t frame,
+                                                     size_t &frames) const = 0;
+
+    /// Mapped equivalent of getSampleFrames(file, channels, frames).
+    /**
+     * mapSampleData() must have returned true.  Returns the actual
+     * number of frames read.
+     */
+    virtual size_t getMappedSampleFrames(size_t frame,
+                                         float **channels,
+                                         size_t frames) const = 0;
+
+    /// Ask the OS to start paging in the given frames of the mapping.
+    /**
+     * A hint only; returns immediately.  Used for read-ahead from the
+     * playback position so that reads from the mapping don't block on
+     * the disk.
+     */
+    virtual void prefetchMappedSampleData(size_t frame,
+                                          size_t frames) const = 0;
+
+    /// Whether all of the mapped sample data is in the page cache.
+    /**
+     * Reading from a resident mapping costs no more than reading from a
+     * copy in memory.
+     */
+    virtual bool isMappedSampleDataResident() const = 0;
+
     /// Append a string of samples to an already open (for writing)
     /// audio file.  Caller must have interleaved samples etc.
     ///
@@ -117,6 +117,9 @@ AudioFileManager::AudioFileManager(RosegardenDocument *doc) :
 
     pthread_mutex_init(&audioFileManagerLock, &attr);
 
+    connect(&m_peakManager, &PeakFileManager::jobsDone,
+            this, &AudioFileManager::slotPeakJobsDone,
+            Qt::QueuedConnection);
 }
 
 AudioFileManager::~AudioFileManager()
@@ -463,6 +466,9 @@ AudioFileManager::clear()
     MutexLock lock (&audioFileManagerLock)
         ;
 
+    // Before the AudioFiles go, as the peak workers may be reading them.
+    m_peakManager.clear();
+
     // For each AudioFile
     for (AudioFile *audioFile : m_audioFiles) {
         m_recordedAudioFiles.erase(audioFile);
@@ -471,8 +477,6 @@ AudioFileManager::clear()
     }
 
     m_audioFiles.erase(m_audioFiles.begin(), m_audioFiles.end());
-
-    m_peakManager.clear();
 }
 
 AudioFile *
@@ -823,7 +827,7 @@ AudioFileManager::generatePreviews()
     // For each AudioFile
     for (AudioFile *audioFile : m_audioFiles) {
         if (!m_peakManager.hasValidPeaks(audioFile))
-            m_peakManager.generatePeaks(audioFile);
+            m_peakManager.queuePeaks(audioFile);
 
         if (m_progressDialog  &&  m_progressDialog->wasCanceled())
             break;
@@ -860,6 +864,43 @@ AudioFileManager::generatePreview(AudioFileId id)
     return true;
 }
 
+bool
+AudioFileManager::queuePreview(AudioFileId id)
+{
+    MutexLock lock (&audioFileManagerLock)
+        ;
+
+    // Only used if the file can't be done in the background.
+    m_peakManager.setProgressDialog(m_progressDialog);
+
+    AudioFile *audioFile = getAudioFile(id);
+
+    if (audioFile == nullptr)
+        return false;
+
+    if (!m_peakManager.hasValidPeaks(audioFile))
+        m_peakManager.queuePeaks(audioFile);
+
+    return true;
+}
+
+void
+AudioFileManager::slotPeakJobsDone()
+{
+    std::vector<AudioFileId> ids;
+
+    {
+        MutexLock lock (&audioFileManagerLock)
+            ;
+
+        ids = m_peakManager.collectFinishedPeaks();
+    }
+
+    for (const AudioFileId id : ids) {
+        emit peaksReady(id);
+    }
+}
+
 AudioFile *
 AudioFileManager::getAudioFile(AudioFileId id)
 {
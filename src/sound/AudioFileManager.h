@@ -197,6 +197,9 @@ public:
     /**
      * Generates preview peak files or peak chunks according to file type.
      *
+     * This is done in the background (see queuePreview()), so the
+     * previews may not be ready when this returns.
+     *
      * throw BadSoundFileException, BadPeakFileException
      */
     void generatePreviews();
@@ -212,6 +215,16 @@ public:
      */
     bool generatePreview(AudioFileId id);
 
+    /// Generate preview for a single audio file in the background.
+    /**
+     * Returns straight away, and peaksReady() is emitted once the
+     * preview is available.  Used when importing, so that several files
+     * can be worked on at once while the user carries on.
+     *
+     * throws BadSoundFileException, BadPeakFileException
+     */
+    bool queuePreview(AudioFileId id);
+
     /**
      * Get a preview for an AudioFile adjusted to Segment start and
      * end parameters (assuming they fall within boundaries).
@@ -299,6 +312,14 @@ public:
         QString m_path;
     };
 
+signals:
+    /// A preview from generatePreviews() or queuePreview() is ready.
+    void peaksReady(AudioFileId id);
+
+private slots:
+    /// Connected to PeakFileManager::jobsDone().
+    void slotPeakJobsDone();
+
 private:
     // Hide copy ctor and op=.
     AudioFileManager(const AudioFileManager &aFM);
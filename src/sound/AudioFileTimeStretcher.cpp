@@ -114,10 +114,6 @@ AudioFileTimeStretcher::getStretchedAudioFile(AudioFileId source,
 
     size_t padding = stretcher.getWindowSize()/2;
 
-    // cppcheck-suppress allocaCalled
-    char *ebf = (char *)alloca
-        (ch * ibs * sourceFile->getBytesPerFrame());
-
     std::vector<float *> dbfs;
     for (int c = 0; c < ch; ++c) {
         // cppcheck-suppress allocaCalled
@@ -172,7 +168,7 @@ AudioFileTimeStretcher::getStretchedAudioFile(AudioFileId source,
         unsigned int thisRead = 0;
 
         if (!inputExhausted) {
-            thisRead = sourceFile->getSampleFrames(&streamIn, ebf, ibs);
+            thisRead = sourceFile->getSampleFrames(&streamIn, ibfs, ibs);
             if (int(thisRead) < ibs) inputExhausted = true;
         }
 
@@ -190,14 +186,6 @@ AudioFileTimeStretcher::getStretchedAudioFile(AudioFileId source,
             }
         }
 
-        if (!sourceFile->decode((unsigned char *)ebf,
-                                thisRead * sourceFile->getBytesPerFrame(),
-                                sr, ch,
-                                thisRead, dbfs, false)) {
-            RG_WARNING << "getStretchedAudioFile(): ERROR: AudioFile failed to decode its own output";
-            break;
-        }
-
         stretcher.putInput(ibfs, thisRead);
         totalIn += thisRead;
 
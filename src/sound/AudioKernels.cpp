@@ -0,0 +1,614 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "AudioKernels.h"
+
+#if defined(__GNUC__)  &&  (defined(__x86_64__)  ||  defined(__i386__))
+#define RG_AUDIO_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+
+namespace Rosegarden
+{
+
+
+namespace
+{
+
+
+// *** Scalar
+
+void applyGainScalar(float *buffer, float gain, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        buffer[i] *= gain;
+}
+
+float applyGainPeakScalar(float *destination, const float *source,
+                          float gain, size_t count)
+{
+    float peak = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const float sample = source[i] * gain;
+        if (sample > peak)
+            peak = sample;
+        destination[i] = sample;
+    }
+    return peak;
+}
+
+void mixAddScalar(float *destination, const float *source, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        destination[i] += source[i];
+}
+
+float mixAddPeakScalar(float *destination, const float *source, size_t count)
+{
+    float peak = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const float sample = source[i];
+        if (sample > peak)
+            peak = sample;
+        destination[i] += sample;
+    }
+    return peak;
+}
+
+float peakScalar(const float *buffer, size_t count)
+{
+    float peak = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (buffer[i] > peak)
+            peak = buffer[i];
+    }
+    return peak;
+}
+
+void minMaxScalar(const float *buffer, size_t count,
+                  float &minimum, float &maximum)
+{
+    float lo = count ? buffer[0] : 0;
+    float hi = lo;
+    for (size_t i = 1; i < count; ++i) {
+        if (buffer[i] < lo)
+            lo = buffer[i];
+        if (buffer[i] > hi)
+            hi = buffer[i];
+    }
+    minimum = lo;
+    maximum = hi;
+}
+
+bool panScalar(float *left, float *right, const float *source,
+               float gainLeft, float gainRight, size_t count)
+{
+    bool silent = true;
+    for (size_t i = 0; i < count; ++i) {
+        const float sample = source[i];
+        left[i] = sample * gainLeft;
+        right[i] = sample * gainRight;
+        if (sample != 0)
+            silent = false;
+    }
+    return silent;
+}
+
+bool isSilentScalar(const float *buffer, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (buffer[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+void interleaveScalar(float *destination, const float *const *channels,
+                      size_t channelCount, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i) {
+        for (size_t ch = 0; ch < channelCount; ++ch)
+            *destination++ = channels[ch][i];
+    }
+}
+
+void deinterleaveScalar(float *const *channels, const float *source,
+                        size_t channelCount, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i) {
+        for (size_t ch = 0; ch < channelCount; ++ch)
+            channels[ch][i] = *source++;
+    }
+}
+
+
+#ifdef RG_AUDIO_KERNELS_X86
+
+// For the peaks, note that max(x, peak) returns peak if x is a NaN,
+// just as the scalar comparison ignores NaNs.
+
+// *** SSE2
+
+__attribute__((target("sse2")))
+float horizontalMaxSSE2(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse2")))
+void applyGainSSE2(float *buffer, float gain, size_t count)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4)
+        _mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), g));
+    applyGainScalar(buffer + i, gain, count - i);
+}
+
+__attribute__((target("sse2")))
+float applyGainPeakSSE2(float *destination, const float *source,
+                        float gain, size_t count)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    __m128 peak = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_mul_ps(_mm_loadu_ps(source + i), g);
+        peak = _mm_max_ps(x, peak);
+        _mm_storeu_ps(destination + i, x);
+    }
+    const float tail =
+        applyGainPeakScalar(destination + i, source + i, gain, count - i);
+    const float p = horizontalMaxSSE2(peak);
+    return tail > p ? tail : p;
+}
+
+__attribute__((target("sse2")))
+void mixAddSSE2(float *destination, const float *source, size_t count)
+{
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(destination + i,
+                      _mm_add_ps(_mm_loadu_ps(destination + i),
+                                 _mm_loadu_ps(source + i)));
+    }
+    mixAddScalar(destination + i, source + i, count - i);
+}
+
+__attribute__((target("sse2")))
+float mixAddPeakSSE2(float *destination, const float *source, size_t count)
+{
+    __m128 peak = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_loadu_ps(source + i);
+        peak = _mm_max_ps(x, peak);
+        _mm_storeu_ps(destination + i,
+                      _mm_add_ps(_mm_loadu_ps(destination + i), x));
+    }
+    const float tail = mixAddPeakScalar(destination + i, source + i, count - i);
+    const float p = horizontalMaxSSE2(peak);
+    return tail > p ? tail : p;
+}
+
+__attribute__((target("sse2")))
+float peakSSE2(const float *buffer, size_t count)
+{
+    __m128 peak = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4)
+        peak = _mm_max_ps(_mm_loadu_ps(buffer + i), peak);
+    const float tail = peakScalar(buffer + i, count - i);
+    const float p = horizontalMaxSSE2(peak);
+    return tail > p ? tail : p;
+}
+
+__attribute__((target("sse2")))
+float horizontalMinSSE2(__m128 v)
+{
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse2")))
+void minMaxSSE2(const float *buffer, size_t count,
+                float &minimum, float &maximum)
+{
+    if (count < 4) {
+        minMaxScalar(buffer, count, minimum, maximum);
+        return;
+    }
+
+    // Start from the first four samples rather than zero.
+    __m128 lo = _mm_loadu_ps(buffer);
+    __m128 hi = lo;
+    size_t i = 4;
+    for ( ; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_loadu_ps(buffer + i);
+        lo = _mm_min_ps(x, lo);
+        hi = _mm_max_ps(x, hi);
+    }
+    minimum = horizontalMinSSE2(lo);
+    maximum = horizontalMaxSSE2(hi);
+    for ( ; i < count; ++i) {
+        if (buffer[i] < minimum)
+            minimum = buffer[i];
+        if (buffer[i] > maximum)
+            maximum = buffer[i];
+    }
+}
+
+__attribute__((target("sse2")))
+bool panSSE2(float *left, float *right, const float *source,
+             float gainLeft, float gainRight, size_t count)
+{
+    const __m128 gl = _mm_set1_ps(gainLeft);
+    const __m128 gr = _mm_set1_ps(gainRight);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 nonZero = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_loadu_ps(source + i);
+        nonZero = _mm_or_ps(nonZero, _mm_cmpneq_ps(x, zero));
+        _mm_storeu_ps(left + i, _mm_mul_ps(x, gl));
+        _mm_storeu_ps(right + i, _mm_mul_ps(x, gr));
+    }
+    const bool tailSilent = panScalar(left + i, right + i, source + i,
+                                      gainLeft, gainRight, count - i);
+    return tailSilent  &&  _mm_movemask_ps(nonZero) == 0;
+}
+
+__attribute__((target("sse2")))
+bool isSilentSSE2(const float *buffer, size_t count)
+{
+    const __m128 zero = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        if (_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(buffer + i), zero)))
+            return false;
+    }
+    return isSilentScalar(buffer + i, count - i);
+}
+
+__attribute__((target("sse2")))
+void interleaveSSE2(float *destination, const float *const *channels,
+                    size_t channelCount, size_t frames)
+{
+    if (channelCount != 2) {
+        interleaveScalar(destination, channels, channelCount, frames);
+        return;
+    }
+
+    const float *left = channels[0];
+    const float *right = channels[1];
+    size_t i = 0;
+    for ( ; i + 4 <= frames; i += 4) {
+        const __m128 l = _mm_loadu_ps(left + i);
+        const __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(destination + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(destination + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+    const float *rest[2] = { left + i, right + i };
+    interleaveScalar(destination + i * 2, rest, 2, frames - i);
+}
+
+__attribute__((target("sse2")))
+void deinterleaveSSE2(float *const *channels, const float *source,
+                      size_t channelCount, size_t frames)
+{
+    if (channelCount != 2) {
+        deinterleaveScalar(channels, source, channelCount, frames);
+        return;
+    }
+
+    float *left = channels[0];
+    float *right = channels[1];
+    size_t i = 0;
+    for ( ; i + 4 <= frames; i += 4) {
+        const __m128 a = _mm_loadu_ps(source + i * 2);
+        const __m128 b = _mm_loadu_ps(source + i * 2 + 4);
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    float *rest[2] = { left + i, right + i };
+    deinterleaveScalar(rest, source + i * 2, 2, frames - i);
+}
+
+
+// *** AVX2
+//
+// Interleaving stays on SSE2, which is already memory bound.
+
+__attribute__((target("avx2")))
+float horizontalMaxAVX2(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(m);
+}
+
+__attribute__((target("avx2")))
+void applyGainAVX2(float *buffer, float gain, size_t count)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(buffer + i,
+                         _mm256_mul_ps(_mm256_loadu_ps(buffer + i), g));
+    }
+    applyGainScalar(buffer + i, gain, count - i);
+}
+
+__attribute__((target("avx2")))
+float applyGainPeakAVX2(float *destination, const float *source,
+                        float gain, size_t count)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    __m256 peak = _mm256_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_mul_ps(_mm256_loadu_ps(source + i), g);
+        peak = _mm256_max_ps(x, peak);
+        _mm256_storeu_ps(destination + i, x);
+    }
+    const float tail =
+        applyGainPeakScalar(destination + i, source + i, gain, count - i);
+    const float p = horizontalMaxAVX2(peak);
+    return tail > p ? tail : p;
+}
+
+__attribute__((target("avx2")))
+void mixAddAVX2(float *destination, const float *source, size_t count)
+{
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(destination + i,
+                         _mm256_add_ps(_mm256_loadu_ps(destination + i),
+                                       _mm256_loadu_ps(source + i)));
+    }
+    mixAddScalar(destination + i, source + i, count - i);
+}
+
+__attribute__((target("avx2")))
+float mixAddPeakAVX2(float *destination, const float *source, size_t count)
+{
+    __m256 peak = _mm256_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_loadu_ps(source + i);
+        peak = _mm256_max_ps(x, peak);
+        _mm256_storeu_ps(destination + i,
+                         _mm256_add_ps(_mm256_loadu_ps(destination + i), x));
+    }
+    const float tail = mixAddPeakScalar(destination + i, source + i, count - i);
+    const float p = horizontalMaxAVX2(peak);
+    return tail > p ? tail : p;
+}
+
+__attribute__((target("avx2")))
+float peakAVX2(const float *buffer, size_t count)
+{
+    __m256 peak = _mm256_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8)
+        peak = _mm256_max_ps(_mm256_loadu_ps(buffer + i), peak);
+    const float tail = peakScalar(buffer + i, count - i);
+    const float p = horizontalMaxAVX2(peak);
+    return tail > p ? tail : p;
+}
+
+__attribute__((target("avx2")))
+void minMaxAVX2(const float *buffer, size_t count,
+                float &minimum, float &maximum)
+{
+    if (count < 8) {
+        minMaxSSE2(buffer, count, minimum, maximum);
+        return;
+    }
+
+    __m256 lo = _mm256_loadu_ps(buffer);
+    __m256 hi = lo;
+    size_t i = 8;
+    for ( ; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_loadu_ps(buffer + i);
+        lo = _mm256_min_ps(x, lo);
+        hi = _mm256_max_ps(x, hi);
+    }
+    const __m128 lo4 = _mm_min_ps(_mm256_castps256_ps128(lo),
+                                  _mm256_extractf128_ps(lo, 1));
+    minimum = horizontalMinSSE2(lo4);
+    maximum = horizontalMaxAVX2(hi);
+    for ( ; i < count; ++i) {
+        if (buffer[i] < minimum)
+            minimum = buffer[i];
+        if (buffer[i] > maximum)
+            maximum = buffer[i];
+    }
+}
+
+__attribute__((target("avx2")))
+bool panAVX2(float *left, float *right, const float *source,
+             float gainLeft, float gainRight, size_t count)
+{
+    const __m256 gl = _mm256_set1_ps(gainLeft);
+    const __m256 gr = _mm256_set1_ps(gainRight);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 nonZero = _mm256_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_loadu_ps(source + i);
+        nonZero = _mm256_or_ps(nonZero, _mm256_cmp_ps(x, zero, _CMP_NEQ_UQ));
+        _mm256_storeu_ps(left + i, _mm256_mul_ps(x, gl));
+        _mm256_storeu_ps(right + i, _mm256_mul_ps(x, gr));
+    }
+    const bool tailSilent = panScalar(left + i, right + i, source + i,
+                                      gainLeft, gainRight, count - i);
+    return tailSilent  &&  _mm256_movemask_ps(nonZero) == 0;
+}
+
+__attribute__((target("avx2")))
+bool isSilentAVX2(const float *buffer, size_t count)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(buffer + i),
+                                             zero, _CMP_NEQ_UQ)))
+            return false;
+    }
+    return isSilentScalar(buffer + i, count - i);
+}
+
+#endif
+
+
+struct Kernels
+{
+    void (*applyGain)(float *, float, size_t);
+    float (*applyGainPeak)(float *, const float *, float, size_t);
+    void (*mixAdd)(float *, const float *, size_t);
+    float (*mixAddPeak)(float *, const float *, size_t);
+    float (*peak)(const float *, size_t);
+    void (*minMax)(const float *, size_t, float &, float &);
+    bool (*pan)(float *, float *, const float *, float, float, size_t);
+    bool (*isSilent)(const float *, size_t);
+    void (*interleave)(float *, const float *const *, size_t, size_t);
+    void (*deinterleave)(float *const *, const float *, size_t, size_t);
+    const char *name;
+};
+
+Kernels chooseKernels()
+{
+#ifdef RG_AUDIO_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return Kernels {
+            applyGainAVX2, applyGainPeakAVX2, mixAddAVX2, mixAddPeakAVX2,
+            peakAVX2, minMaxAVX2, panAVX2, isSilentAVX2, interleaveSSE2,
+            deinterleaveSSE2,
+            "AVX2"
+        };
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return Kernels {
+            applyGainSSE2, applyGainPeakSSE2, mixAddSSE2, mixAddPeakSSE2,
+            peakSSE2, minMaxSSE2, panSSE2, isSilentSSE2, interleaveSSE2,
+            deinterleaveSSE2,
+            "SSE2"
+        };
+    }
+#endif
+
+    return Kernels {
+        applyGainScalar, applyGainPeakScalar, mixAddScalar, mixAddPeakScalar,
+        peakScalar, minMaxScalar, panScalar, isSilentScalar,
+        interleaveScalar, deinterleaveScalar, "scalar"
+    };
+}
+
+const Kernels &kernels()
+{
+    // Chosen on first use so that there are no static init order
+    // problems.
+    static const Kernels k = chooseKernels();
+    return k;
+}
+
+
+}
+
+
+void
+AudioKernels::applyGain(float *buffer, float gain, size_t count)
+{
+    kernels().applyGain(buffer, gain, count);
+}
+
+float
+AudioKernels::applyGainPeak(float *destination, const float *source,
+                            float gain, size_t count)
+{
+    return kernels().applyGainPeak(destination, source, gain, count);
+}
+
+void
+AudioKernels::mixAdd(float *destination, const float *source, size_t count)
+{
+    kernels().mixAdd(destination, source, count);
+}
+
+float
+AudioKernels::mixAddPeak(float *destination, const float *source,
+                         size_t count)
+{
+    return kernels().mixAddPeak(destination, source, count);
+}
+
+float
+AudioKernels::peak(const float *buffer, size_t count)
+{
+    return kernels().peak(buffer, count);
+}
+
+void
+AudioKernels::minMax(const float *buffer, size_t count,
+                     float &minimum, float &maximum)
+{
+    kernels().minMax(buffer, count, minimum, maximum);
+}
+
+bool
+AudioKernels::pan(float *left, float *right, const float *source,
+                  float gainLeft, float gainRight, size_t count)
+{
+    return kernels().pan(left, right, source, gainLeft, gainRight, count);
+}
+
+bool
+AudioKernels::isSilent(const float *buffer, size_t count)
+{
+    return kernels().isSilent(buffer, count);
+}
+
+void
+AudioKernels::interleave(float *destination, const float *const *channels,
+                         size_t channelCount, size_t frames)
+{
+    kernels().interleave(destination, channels, channelCount, frames);
+}
+
+void
+AudioKernels::deinterleave(float *const *channels, const float *source,
+                           size_t channelCount, size_t frames)
+{
+    kernels().deinterleave(channels, source, channelCount, frames);
+}
+
+const char *
+AudioKernels::getImplementationName()
+{
+    return kernels().name;
+}
+
+
+}
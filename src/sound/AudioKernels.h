@@ -0,0 +1,96 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_AUDIO_KERNELS_H
+#define RG_AUDIO_KERNELS_H
+
+#include <cstddef>
+
+namespace Rosegarden
+{
+
+
+/// Vectorized inner loops for the audio mixers and metering.
+/**
+ * Each function has a scalar implementation along with SSE2 and AVX2
+ * implementations on x86.  The fastest one the CPU supports is picked
+ * the first time any of them is called.
+ *
+ * All of these are real-time safe.  Buffers need not be aligned.
+ *
+ * "Peak" here follows the meters: the largest sample value, or zero
+ * if there are no positive samples.
+ */
+class AudioKernels
+{
+public:
+    /// buffer[i] *= gain
+    static void applyGain(float *buffer, float gain, size_t count);
+
+    /// destination[i] = source[i] * gain, returning the peak of the result.
+    /**
+     * destination may be the same as source.
+     */
+    static float applyGainPeak(float *destination, const float *source,
+                               float gain, size_t count);
+
+    /// destination[i] += source[i]
+    static void mixAdd(float *destination, const float *source,
+                       size_t count);
+
+    /// destination[i] += source[i], returning the peak of source.
+    static float mixAddPeak(float *destination, const float *source,
+                            size_t count);
+
+    /// Peak of buffer.
+    static float peak(const float *buffer, size_t count);
+
+    /// Smallest and largest sample values in buffer, for peak files.
+    /**
+     * Unlike peak(), these are the plain minimum and maximum, so both
+     * may be negative.  Both are zero if count is zero.
+     */
+    static void minMax(const float *buffer, size_t count,
+                       float &minimum, float &maximum);
+
+    /// Pan a mono source out to left and right.
+    /**
+     * left[i] = source[i] * gainLeft and right[i] = source[i] * gainRight.
+     * source may be the same as left or right.
+     *
+     * Returns true if every sample in source was zero.
+     */
+    static bool pan(float *left, float *right, const float *source,
+                    float gainLeft, float gainRight, size_t count);
+
+    /// Whether every sample in buffer is zero.
+    static bool isSilent(const float *buffer, size_t count);
+
+    /// Interleave frames from channelCount separate buffers.
+    static void interleave(float *destination, const float *const *channels,
+                           size_t channelCount, size_t frames);
+
+    /// De-interleave frames into channelCount separate buffers.
+    static void deinterleave(float *const *channels, const float *source,
+                             size_t channelCount, size_t frames);
+
+    /// "AVX2", "SSE2" or "scalar", for debug output.
+    static const char *getImplementationName();
+};
+
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include "MappedStudio.h"
 #include "base/AudioLevel.h"
 #include "AudioPlayQueue.h"
+#include "AudioKernels.h"
 #include "PluginFactory.h"
 #include "ControlBlock.h"
 
@@ -29,7 +30,9 @@
 #include <sys/time.h>
 #include <pthread.h>
 
+#include <algorithm>
 #include <cmath>
+#include <thread>
 
 #ifdef __FreeBSD__
 #include <stdlib.h>
@@ -774,9 +777,8 @@ AudioBussMixer::processBlocks()
                 if (dormant) {
                     rec.buffers[ch]->zero(m_blockSize);
                 } else {
-                    for (size_t j = 0; j < m_blockSize; ++j) {
-                        m_processBuffers[ch][j] *= gain[ch];
-                    }
+                    AudioKernels::applyGain(m_processBuffers[ch], gain[ch],
+                                            m_blockSize);
                     rec.buffers[ch]->write(m_processBuffers[ch], m_blockSize);
                 }
             }
@@ -852,6 +854,96 @@ AudioBussMixer::threadRun()
 }
 
 
+/// A thread that helps the AudioInstrumentMixer render its instruments.
+class AudioInstrumentMixer::Worker : public AudioThread
+{
+public:
+    Worker(AudioInstrumentMixer *mixer, int priority) :
+        AudioThread("AudioInstrumentMixerWorker",
+                    mixer->m_driver, mixer->m_sampleRate),
+        m_mixer(mixer),
+        m_priority(priority),
+        m_run(0)
+    { }
+
+    /// Wake up and take part in the given run of jobs.
+    void wake(unsigned int run) {
+        getLock();
+        m_run = run;
+        signal();
+        releaseLock();
+    }
+
+    ProcessContext &getContext() { return m_context; }
+
+protected:
+    void threadRun() override;
+
+    int getPriority() override { return m_priority; }
+
+private:
+    AudioInstrumentMixer *m_mixer;
+    int m_priority;
+
+    // The latest run we have been woken for.  Guarded by m_lock.
+    unsigned int m_run;
+
+    ProcessContext m_context;
+};
+
+void
+AudioInstrumentMixer::Worker::threadRun()
+{
+    unsigned int done = 0;
+
+    while (!m_exiting) {
+
+        if (m_run == done) {
+            pthread_cond_wait(&m_condition, &m_lock);
+            pthread_testcancel();
+            continue;
+        }
+
+        done = m_run;
+
+        // Don't hold the lock while rendering, or wake() would block
+        // the mixer until we were finished.  And don't get cancelled
+        // halfway through a job the mixer is waiting for.
+
+        int cancelState;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+        releaseLock();
+
+        m_mixer->renderJobs(done, m_context);
+
+        getLock();
+        pthread_setcancelstate(cancelState, nullptr);
+    }
+}
+
+
+AudioInstrumentMixer::ProcessContext::~ProcessContext()
+{
+    for (size_t i = 0; i < buffers.size(); ++i)
+        delete[] buffers[i];
+}
+
+void
+AudioInstrumentMixer::ProcessContext::resize(unsigned int channels,
+                                             size_t blockSize)
+{
+    // Not RT safe
+
+    while ((unsigned int)buffers.size() > channels) {
+        delete[] buffers.back();
+        buffers.pop_back();
+    }
+    while ((unsigned int)buffers.size() < channels) {
+        buffers.push_back(new sample_t[blockSize]);
+    }
+}
+
+
 AudioInstrumentMixer::AudioInstrumentMixer(SoundDriver *driver,
         AudioFileReader *fileReader,
         unsigned int sampleRate,
@@ -859,8 +951,16 @@ AudioInstrumentMixer::AudioInstrumentMixer(SoundDriver *driver,
         AudioThread("AudioInstrumentMixer", driver, sampleRate),
         m_fileReader(fileReader),
         m_bussMixer(nullptr),
-        m_blockSize(blockSize)
+        m_blockSize(blockSize),
+        m_processChannels(0),
+        m_jobCount(0),
+        m_nextJob(0),
+        m_jobsDone(0),
+        m_jobsWantMore(false)
 {
+    pthread_mutex_init(&m_jobsDoneLock, nullptr);
+    pthread_cond_init(&m_jobsDoneCondition, nullptr);
+
     // Pregenerate empty plugin slots
 
     InstrumentId audioInstrumentBase;
@@ -900,12 +1000,15 @@ AudioInstrumentMixer::~AudioInstrumentMixer()
     //std::cerr << "AudioInstrumentMixer::~AudioInstrumentMixer" << std::endl;
     // BufferRec dtor will handle the BufferMap
 
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->terminate();
+        delete m_workers[i];
+    }
+
     removeAllPlugins();
 
-    for (std::vector<sample_t *>::iterator i = m_processBuffers.begin();
-            i != m_processBuffers.end(); ++i) {
-        delete[] *i;
-    }
+    pthread_cond_destroy(&m_jobsDoneCondition);
+    pthread_mutex_destroy(&m_jobsDoneLock);
 
     //std::cerr << "AudioInstrumentMixer::~AudioInstrumentMixer exiting" << std::endl;
 }
@@ -1448,15 +1551,46 @@ AudioInstrumentMixer::generateBuffers()
         }
     }
 
-    while ((unsigned int)m_processBuffers.size() > maxChannels) {
-        std::vector<sample_t *>::iterator bi = m_processBuffers.end();
-        --bi;
-        delete[] *bi;
-        m_processBuffers.erase(bi);
+    m_processChannels = maxChannels;
+    m_processContext.resize(maxChannels, m_blockSize);
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->getContext().resize(maxChannels, m_blockSize);
     }
-    while ((unsigned int)m_processBuffers.size() < maxChannels) {
-        m_processBuffers.push_back(new sample_t[m_blockSize]);
+
+    m_jobs.resize(m_bufferMap.size(), nullptr);
+}
+
+void
+AudioInstrumentMixer::setWorkerThreads(int count, int priority)
+{
+    // Not RT safe
+
+    if (count < 0) {
+        // Leave half the cores for JACK, the buss mixer, the disk
+        // threads and everything else; this thread is one of ours.
+        count = int(std::thread::hardware_concurrency()) / 2 - 1;
+        count = std::max(0, std::min(count, 7));
+    }
+
+    getLock();
+
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->terminate();
+        delete m_workers[i];
+    }
+    m_workers.clear();
+
+    for (int i = 0; i < count; ++i) {
+        Worker *worker = new Worker(this, priority);
+        worker->getContext().resize(m_processChannels, m_blockSize);
+        worker->run();
+        m_workers.push_back(worker);
     }
+
+    releaseLock();
+
+    std::cerr << "AudioInstrumentMixer::setWorkerThreads: " << count
+              << " worker thread(s) at priority " << priority << std::endl;
 }
 
 void
@@ -1651,17 +1785,19 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
         // read it, so it'll fall behind if we put the volume up again.
     }
 
-    bool more = true;
-
-    static const int MAX_FILES_PER_INSTRUMENT = 500;
-    static PlayableAudioFile *playing[MAX_FILES_PER_INSTRUMENT];
+    m_processContext.readSomething = false;
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->getContext().readSomething = false;
+    }
 
-    RealTime blockDuration = RealTime::frame2RealTime(m_blockSize, m_sampleRate);
+    bool more = true;
 
     while (more) {
 
         more = false;
 
+        size_t jobCount = 0;
+
         for (BufferMap::iterator i = m_bufferMap.begin();
                 i != m_bufferMap.end(); ++i) {
 
@@ -1673,34 +1809,126 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
                 continue;
             }
 
-            size_t playCount = MAX_FILES_PER_INSTRUMENT;
+            // Instruments are independent of one another, so they can
+            // be handed out to the workers -- except for grouped DSSI
+            // synths, which share state and must stay on one thread.
+
+            bool here = (m_workers.empty() || jobCount >= m_jobs.size());
 
-            if (id >= SoftSynthInstrumentBase)
-                playCount = 0;
-            else {
-                queue->getPlayingFilesForInstrument(rec.filledTo,
-                                                    blockDuration, id,
-                                                    playing, playCount);
+            if (!here) {
+                SynthPluginMap::iterator si = m_synths.find(id);
+                here = (si != m_synths.end()  &&
+                        si->second  &&
+                        si->second->isInGroup());
             }
 
-            if (processBlock(id, playing, playCount, readSomething)) {
+            if (here) {
+                if (processBlock(id, rec, m_processContext)) {
+                    more = true;
+                }
+            } else {
+                m_jobs[jobCount++] = &*i;
+            }
+        }
+
+        if (jobCount > 0) {
+            m_jobCount = jobCount;
+            if (runJobs()) {
                 more = true;
             }
         }
     }
+
+    if (m_processContext.readSomething)
+        readSomething = true;
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        if (m_workers[i]->getContext().readSomething)
+            readSomething = true;
+    }
+}
+
+bool
+AudioInstrumentMixer::runJobs()
+{
+    // Needs to be RT safe
+
+    const size_t jobCount = m_jobCount;
+
+    unsigned int run = (unsigned int)(m_nextJob >> 32) + 1;
+    m_jobsDone = 0;
+    m_jobsWantMore = false;
+
+    // Publishes m_jobs and m_jobCount for the new run.
+    m_nextJob = (unsigned long long)run << 32;
+
+    // We take a share ourselves, so there's no point in waking more
+    // workers than there are other jobs.
+    for (size_t i = 0; i < m_workers.size()  &&  i + 1 < jobCount; ++i) {
+        m_workers[i]->wake(run);
+    }
+
+    renderJobs(run, m_processContext);
+
+    // Wait for the jobs the workers claimed.  The buss mixer reads our
+    // ring buffers, so they all have to be filled before we return.
+
+    pthread_mutex_lock(&m_jobsDoneLock);
+    while (m_jobsDone < jobCount) {
+        pthread_cond_wait(&m_jobsDoneCondition, &m_jobsDoneLock);
+    }
+    pthread_mutex_unlock(&m_jobsDoneLock);
+
+    return m_jobsWantMore;
+}
+
+void
+AudioInstrumentMixer::renderJobs(unsigned int run, ProcessContext &context)
+{
+    // Needs to be RT safe
+
+    const unsigned long long runBits = (unsigned long long)run << 32;
+
+    unsigned long long next = m_nextJob;
+
+    while ((next & 0xffffffff00000000ULL) == runBits) {
+
+        const size_t job = size_t(next & 0xffffffffULL);
+        const size_t jobCount = m_jobCount;
+
+        if (job >= jobCount)
+            break;
+
+        // On failure next is reloaded, so just go round again.
+        if (!m_nextJob.compare_exchange_weak(next, next + 1))
+            continue;
+
+        BufferMap::value_type *instrument = m_jobs[job];
+
+        if (processBlock(instrument->first, instrument->second, context)) {
+            m_jobsWantMore = true;
+        }
+
+        if (++m_jobsDone == jobCount) {
+            pthread_mutex_lock(&m_jobsDoneLock);
+            pthread_cond_signal(&m_jobsDoneCondition);
+            pthread_mutex_unlock(&m_jobsDoneLock);
+        }
+
+        next = m_nextJob;
+    }
 }
 
 
 bool
 AudioInstrumentMixer::processBlock(InstrumentId id,
-                                   PlayableAudioFile **playing,
-                                   size_t playCount,
-                                   bool &readSomething)
+                                   BufferRec &rec,
+                                   ProcessContext &context)
 {
-    // Needs to be RT safe
+    // Needs to be RT safe, and safe to call for different instruments
+    // on different threads at once.
 
-    BufferRec &rec = m_bufferMap[id];
     RealTime bufferTime = rec.filledTo;
+    std::vector<sample_t *> &processBuffers = context.buffers;
 
 #ifdef DEBUG_MIXER
     //    if (m_driver->isPlaying()) {
@@ -1712,12 +1940,12 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
     unsigned int channels = rec.channels;
     if (channels > (unsigned int)rec.buffers.size())
         channels = (unsigned int)rec.buffers.size();
-    if (channels > (unsigned int)m_processBuffers.size())
-        channels = (unsigned int)m_processBuffers.size();
+    if (channels > (unsigned int)processBuffers.size())
+        channels = (unsigned int)processBuffers.size();
     if (channels == 0) {
 #ifdef DEBUG_MIXER
         if ((id % 100) == 0)
-            std::cerr << "AudioInstrumentMixer::processBlock(" << id << "): nominal channels " << rec.channels << ", ring buffers " << rec.buffers.size() << ", process buffers " << m_processBuffers.size() << std::endl;
+            std::cerr << "AudioInstrumentMixer::processBlock(" << id << "): nominal channels " << rec.channels << ", ring buffers " << rec.buffers.size() << ", process buffers " << processBuffers.size() << std::endl;
 #endif
 
         return false; // buffers just haven't been set up yet
@@ -1745,8 +1973,20 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
         }
     }
 
+    // m_plugins has an entry for every instrument from construction,
+    // so this doesn't modify the map.
     PluginList &plugins = m_plugins[id];
 
+    PlayableAudioFile **playing = context.playing;
+    size_t playCount = 0;
+
+    if (id < SoftSynthInstrumentBase) {
+        playCount = MAX_FILES_PER_INSTRUMENT;
+        m_driver->getAudioQueue()->getPlayingFilesForInstrument
+            (bufferTime, RealTime::frame2RealTime(m_blockSize, m_sampleRate),
+             id, playing, playCount);
+    }
+
 #ifdef DEBUG_MIXER
 
     if ((id % 100) == 0 && m_driver->isPlaying())
@@ -1832,10 +2072,12 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 #endif
 
     for (unsigned int ch = 0; ch < targetChannels; ++ch) {
-        memset(m_processBuffers[ch], 0, sizeof(sample_t) * m_blockSize);
+        memset(processBuffers[ch], 0, sizeof(sample_t) * m_blockSize);
     }
 
-    RunnablePluginInstance *synth = m_synths[id];
+    // Not m_synths[id], which could insert on another thread's behalf.
+    SynthPluginMap::iterator si = m_synths.find(id);
+    RunnablePluginInstance *synth = (si == m_synths.end() ? nullptr : si->second);
 
     if (synth && !synth->isBypassed()) {
 
@@ -1846,7 +2088,7 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
         while (ch < synth->getAudioOutputCount() && ch < channels) {
             denormalKill(synth->getAudioOutputBuffers()[ch],
                          m_blockSize);
-            memcpy(m_processBuffers[ch],
+            memcpy(processBuffers[ch],
                    synth->getAudioOutputBuffers()[ch],
                    m_blockSize * sizeof(sample_t));
             ++ch;
@@ -1889,8 +2131,8 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
             // pooled buffers.
 
             if (blockSize > 0) {
-                file->addSamples(m_processBuffers, channels, blockSize, offset);
-                readSomething = true;
+                file->addSamples(processBuffers, channels, blockSize, offset);
+                context.readSomething = true;
             }
         }
     }
@@ -1919,7 +2161,7 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 
             if (ch < channels || ch < 2) {
                 memcpy(plugin->getAudioInputBuffers()[ch],
-                       m_processBuffers[ch % channels],
+                       processBuffers[ch % channels],
                        m_blockSize * sizeof(sample_t));
             } else {
                 memset(plugin->getAudioInputBuffers()[ch], 0,
@@ -1943,15 +2185,15 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
                          m_blockSize);
 
             if (ch < channels) {
-                memcpy(m_processBuffers[ch],
+                memcpy(processBuffers[ch],
                        plugin->getAudioOutputBuffers()[ch],
                        m_blockSize * sizeof(sample_t));
             } else if (ch == 1) {
                 // stereo output from plugin on a mono track
                 for (size_t i = 0; i < m_blockSize; ++i) {
-                    m_processBuffers[0][i] +=
+                    processBuffers[0][i] +=
                         plugin->getAudioOutputBuffers()[ch][i];
-                    m_processBuffers[0][i] /= 2;
+                    processBuffers[0][i] /= 2;
                 }
             } else {
                 break;
@@ -1967,19 +2209,15 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 
     if (targetChannels == 2 && channels == 1) {
 
-        for (size_t i = 0; i < m_blockSize; ++i) {
-
-            sample_t sample = m_processBuffers[0][i];
-
-            m_processBuffers[0][i] = sample * rec.gainLeft;
-            m_processBuffers[1][i] = sample * rec.gainRight;
-
-            if (allZeros && sample != 0.0)
-                allZeros = false;
-        }
+        allZeros = AudioKernels::pan(processBuffers[0],
+                                     processBuffers[1],
+                                     processBuffers[0],
+                                     rec.gainLeft,
+                                     rec.gainRight,
+                                     m_blockSize);
 
-        rec.buffers[0]->write(m_processBuffers[0], m_blockSize);
-        rec.buffers[1]->write(m_processBuffers[1], m_blockSize);
+        rec.buffers[0]->write(processBuffers[0], m_blockSize);
+        rec.buffers[1]->write(processBuffers[1], m_blockSize);
 
     } else {
 
@@ -1988,16 +2226,14 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
             float gain = ((ch == 0) ? rec.gainLeft :
                           (ch == 1) ? rec.gainRight : rec.volume);
 
-            for (size_t i = 0; i < m_blockSize; ++i) {
-
-                // handle volume and pan
-                m_processBuffers[ch][i] *= gain;
+            // handle volume and pan
+            AudioKernels::applyGain(processBuffers[ch], gain, m_blockSize);
 
-                if (allZeros && m_processBuffers[ch][i] != 0.0)
-                    allZeros = false;
-            }
+            if (allZeros  &&
+                !AudioKernels::isSilent(processBuffers[ch], m_blockSize))
+                allZeros = false;
 
-            rec.buffers[ch]->write(m_processBuffers[ch], m_blockSize);
+            rec.buffers[ch]->write(processBuffers[ch], m_blockSize);
         }
     }
 
@@ -24,6 +24,8 @@
 #include "AudioPlayQueue.h"
 #include "RecordableAudioFile.h"
 
+#include <atomic>
+
 namespace Rosegarden
 {
 
@@ -182,6 +184,19 @@ public:
 
     void setBussMixer(AudioBussMixer *mixer) { m_bussMixer = mixer; }
 
+    /// Render instruments in parallel on count extra threads.
+    /**
+     * Each block, independent instruments (synth plus insert plugins)
+     * are shared out between the workers and the thread calling
+     * kick(), which then waits for all of them to finish before the
+     * busses are mixed.  A count of zero renders everything on the
+     * calling thread; a negative count picks one to suit the machine.
+     * priority is the SCHED_FIFO priority for the workers.
+     *
+     * Not RT safe.
+     */
+    void setWorkerThreads(int count, int priority);
+
     void setPlugin(InstrumentId id, int position, QString identifier);
     void removePlugin(InstrumentId id, int position);
     void removeAllPlugins();
@@ -283,11 +298,50 @@ protected:
 
     int getPriority() override { return 3; }
 
+    static const int MAX_FILES_PER_INSTRUMENT = 500;
+
+    /// Scratch space for rendering one instrument on one thread.
+    struct ProcessContext
+    {
+        ProcessContext() : buffers(), readSomething(false) { }
+        ~ProcessContext();
+
+        void resize(unsigned int channels, size_t blockSize);
+
+        // maintain the same number of these as the maximum number of
+        // channels on any audio instrument
+        std::vector<sample_t *> buffers;
+
+        PlayableAudioFile *playing[MAX_FILES_PER_INSTRUMENT];
+        bool readSomething;
+    };
+
+    struct BufferRec;
+
     void processBlocks(bool &readSomething);
     void processEmptyBlocks(InstrumentId id);
-    bool processBlock(InstrumentId id, PlayableAudioFile **, size_t, bool &readSomething);
+    bool processBlock(InstrumentId id, BufferRec &rec,
+                      ProcessContext &context);
     void generateBuffers();
 
+    /// Render the first m_jobCount jobs in m_jobs across the workers.
+    /**
+     * Returns once they are all done, with true if any of them
+     * wanted more.
+     */
+    bool runJobs();
+
+    /// Claim and render jobs from the current run until there are none left.
+    /**
+     * Called from runJobs() and from the workers.  Only renders jobs
+     * from the given run, so a worker that wakes late can't take part
+     * in the next one.
+     */
+    void renderJobs(unsigned int run, ProcessContext &context);
+
+    class Worker;
+    friend class Worker;
+
     AudioFileReader  *m_fileReader;
     AudioBussMixer   *m_bussMixer;
     size_t            m_blockSize;
@@ -299,9 +353,9 @@ protected:
     PluginMap m_plugins;
     SynthPluginMap m_synths;
 
-    // maintain the same number of these as the maximum number of
-    // channels on any audio instrument
-    std::vector<sample_t *> m_processBuffers;
+    // for the thread calling kick()
+    ProcessContext m_processContext;
+    unsigned int m_processChannels;
 
     struct BufferRec
     {
@@ -327,6 +381,21 @@ protected:
 
     typedef std::map<InstrumentId, BufferRec> BufferMap;
     BufferMap m_bufferMap;
+
+    std::vector<Worker *> m_workers;
+
+    // Instruments for the workers to render, sized in generateBuffers
+    // so that filling it in is RT safe.
+    std::vector<BufferMap::value_type *> m_jobs;
+    std::atomic<size_t> m_jobCount;
+
+    // Run number in the top 32 bits, next job to claim in the bottom 32.
+    std::atomic<unsigned long long> m_nextJob;
+    std::atomic<size_t> m_jobsDone;
+    std::atomic<bool> m_jobsWantMore;
+
+    pthread_mutex_t m_jobsDoneLock;
+    pthread_cond_t m_jobsDoneCondition;
 };
 
 
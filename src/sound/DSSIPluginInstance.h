@@ -71,7 +71,7 @@ public:
     void discardEvents() override;
     void setIdealChannelCount(size_t channels) override; // may re-instantiate
 
-    virtual bool isInGroup() const { return m_grouped; }
+    bool isInGroup() const override { return m_grouped; }
     virtual void detachFromGroup();
 
 protected:
@@ -19,6 +19,7 @@
 #include "AlsaDriver.h"
 #include "MappedStudio.h"
 #include "AudioProcess.h"
+#include "AudioKernels.h"
 #include "base/Profiler.h"
 #include "base/AudioLevel.h"
 #include "Audit.h"
@@ -288,6 +289,9 @@ JackDriver::initialise(bool reinitialise)
         m_bussMixer = new AudioBussMixer
                       (m_alsaDriver, m_instrumentMixer, m_sampleRate, m_bufferSize);
         m_instrumentMixer->setBussMixer(m_bussMixer);
+        m_instrumentMixer->setWorkerThreads
+            (Preferences::getAudioMixerThreads(),
+             Preferences::getAudioMixerThreadPriority());
 
         // We run the file reader whatever, but we only run the other
         // threads (instrument mixer, buss mixer, file writer) when we
@@ -1071,12 +1075,8 @@ JackDriver::jackProcess(jack_nframes_t nframes)
                 if (actual < nframes) {
                     reportFailure(MappedEvent::FailureBussMixUnderrun);
                 }
-                for (size_t i = 0; i < nframes; ++i) {
-                    sample_t sample = submaster[ch][i];
-                    if (sample > peak[ch])
-                        peak[ch] = sample;
-                    master[ch][i] += sample;
-                }
+                peak[ch] = AudioKernels::mixAddPeak(master[ch], submaster[ch],
+                                                    nframes);
             }
         }
 
@@ -1187,12 +1187,11 @@ JackDriver::jackProcess(jack_nframes_t nframes)
                     reportFailure(MappedEvent::FailureMixUnderrun);
                 }
 
-                for (size_t f = 0; f < nframes; ++f) {
-                    sample_t sample = instrument[ch][f];
-                    if (sample > peak[ch])
-                        peak[ch] = sample;
-                    if (directToMaster)
-                        master[ch][f] += sample;
+                if (directToMaster) {
+                    peak[ch] = AudioKernels::mixAddPeak(
+                            master[ch], instrument[ch], nframes);
+                } else {
+                    peak[ch] = AudioKernels::peak(instrument[ch], nframes);
                 }
             }
 
@@ -1233,12 +1232,8 @@ JackDriver::jackProcess(jack_nframes_t nframes)
     float masterPeak[2] = { 0.0, 0.0 };
 
     for (int ch = 0; ch < 2; ++ch) {
-        for (size_t i = 0; i < nframes; ++i) {
-            sample_t sample = master[ch][i] * gain;
-            if (sample > masterPeak[ch])
-                masterPeak[ch] = sample;
-            master[ch][i] = sample;
-        }
+        masterPeak[ch] = AudioKernels::applyGainPeak(
+                master[ch], master[ch], gain, nframes);
     }
 
     LevelInfo info;
@@ -1428,21 +1423,15 @@ JackDriver::jackProcessRecord(InstrumentId id,
         memset(m_tempOutBuffer, 0, nframes * sizeof(sample_t));
 
         if (inputBufferLeft) {
-            for (size_t i = 0; i < nframes; ++i) {
-                sample_t sample = inputBufferLeft[i] * gain;
-                if (sample > peakLeft)
-                    peakLeft = sample;
-                m_tempOutBuffer[i] = sample;
-            }
+            peakLeft = AudioKernels::applyGainPeak(
+                    m_tempOutBuffer, inputBufferLeft, gain, nframes);
 
             if (!m_outputMonitors.empty()) {
                 sample_t *buf =
                     static_cast<sample_t *>
                     (jack_port_get_buffer(m_outputMonitors[0], nframes));
                 if (buf) {
-                    for (size_t i = 0; i < nframes; ++i) {
-                        buf[i] += m_tempOutBuffer[i];
-                    }
+                    AudioKernels::mixAdd(buf, m_tempOutBuffer, nframes);
                 }
             }
 
@@ -1452,20 +1441,14 @@ JackDriver::jackProcessRecord(InstrumentId id,
         if (channels == 2) {
 
             if (inputBufferRight) {
-                for (size_t i = 0; i < nframes; ++i) {
-                    sample_t sample = inputBufferRight[i] * gain;
-                    if (sample > peakRight)
-                        peakRight = sample;
-                    m_tempOutBuffer[i] = sample;
-                }
+                peakRight = AudioKernels::applyGainPeak(
+                        m_tempOutBuffer, inputBufferRight, gain, nframes);
                 if (m_outputMonitors.size() > 1) {
                     sample_t *buf =
                         static_cast<sample_t *>
                         (jack_port_get_buffer(m_outputMonitors[1], nframes));
                     if (buf) {
-                        for (size_t i = 0; i < nframes; ++i) {
-                            buf[i] += m_tempOutBuffer[i];
-                        }
+                        AudioKernels::mixAdd(buf, m_tempOutBuffer, nframes);
                     }
                 }
             }
@@ -1491,12 +1474,13 @@ JackDriver::jackProcessRecord(InstrumentId id,
                     (jack_port_get_buffer(m_outputMonitors[0], nframes));
             }
 
-            for (size_t i = 0; i < nframes; ++i) {
-                sample_t sample = inputBufferLeft[i] * gain;
-                if (sample > peakLeft)
-                    peakLeft = sample;
-                if (buf)
-                    buf[i] = sample;
+            // With no monitor out we still want the peak.  The gain is
+            // never negative, so it can be applied afterwards.
+            if (buf) {
+                peakLeft = AudioKernels::applyGainPeak(
+                        buf, inputBufferLeft, gain, nframes);
+            } else {
+                peakLeft = AudioKernels::peak(inputBufferLeft, nframes) * gain;
             }
 
             if (channels == 2 && inputBufferRight) {
@@ -1507,12 +1491,12 @@ JackDriver::jackProcessRecord(InstrumentId id,
                         (jack_port_get_buffer(m_outputMonitors[1], nframes));
                 }
 
-                for (size_t i = 0; i < nframes; ++i) {
-                    sample_t sample = inputBufferRight[i] * gain;
-                    if (sample > peakRight)
-                        peakRight = sample;
-                    if (buf)
-                        buf[i] = sample;
+                if (buf) {
+                    peakRight = AudioKernels::applyGainPeak(
+                            buf, inputBufferRight, gain, nframes);
+                } else {
+                    peakRight =
+                        AudioKernels::peak(inputBufferRight, nframes) * gain;
                 }
             }
         }
@@ -25,8 +25,7 @@
 #include "gui/seqmanager/MEBIterator.h"
 #include "sound/ControlBlock.h"
 
-#include <queue>  // std::priority_queue
-#include <functional>  // std::greater
+#include <algorithm>  // std::push_heap() etc.
 
 //#define DEBUG_META_ITERATOR 1
 //#define DEBUG_PLAYING_AUDIO_FILES 1
@@ -35,6 +34,12 @@ namespace Rosegarden
 {
 
 
+MappedBufMetaIterator::MappedBufMetaIterator() :
+    m_heapValid(false),
+    m_heapPublishCount(0)
+{
+}
+
 void
 MappedBufMetaIterator::addBuffer(
         QSharedPointer<MappedEventBuffer> mappedEventBuffer)
@@ -53,6 +58,8 @@ MappedBufMetaIterator::addBuffer(
     QSharedPointer<MEBIterator> iter(new MEBIterator(mappedEventBuffer));
     iter->moveTo(m_currentTime);
     m_iterators.push_back(iter);
+
+    m_heapValid = false;
 }
 
 void
@@ -72,6 +79,8 @@ MappedBufMetaIterator::removeBuffer(
 
     // Remove from m_segments
     m_buffers.erase(mappedEventBuffer);
+
+    m_heapValid = false;
 }
 
 void
@@ -79,6 +88,9 @@ MappedBufMetaIterator::clear()
 {
     m_iterators.clear();
     m_buffers.clear();
+    m_heap.clear();
+
+    m_heapValid = false;
 }
 
 void
@@ -92,6 +104,8 @@ MappedBufMetaIterator::reset()
          ++i) {
         (*i)->reset();
     }
+
+    m_heapValid = false;
 }
 
 void
@@ -108,6 +122,8 @@ MappedBufMetaIterator::jumpToTime(const RealTime &time)
          ++i) {
         (*i)->moveTo(time);
     }
+
+    m_heapValid = false;
 }
 
 void
@@ -211,6 +227,53 @@ MappedBufMetaIterator::fetchEvents(MappedInserterBase &inserter,
 
 }
 
+bool
+MappedBufMetaIterator::getWakeupTime(MEBIterator &iter, RealTime &time)
+{
+    if (iter.atEnd())
+        return false;
+
+    MEBIterator::ReadLocker locker(iter);
+
+    const MappedEvent *event = iter.peek();
+
+    // Nothing useful until the buffer is refreshed.  An invalid event
+    // would never be taken, so the iterator can't get past it.
+    if (!event  ||  !event->isValid())
+        return false;
+
+    RealTime start;
+    RealTime end;
+    iter.getMappedEventBuffer()->getStartEnd(start, end);
+
+    if (!iter.isReady()) {
+        // Make the mapper ready as soon as its buffer starts, even if
+        // its first note is a while later, to fix bug #1378.
+        time = start;
+    } else {
+        // Nothing is taken from a buffer before it starts.
+        time = std::max(event->getEventTime(), start);
+    }
+
+    return true;
+}
+
+void
+MappedBufMetaIterator::rebuildHeap()
+{
+    m_heap.clear();
+
+    for (size_t i = 0; i < m_iterators.size(); ++i) {
+        RealTime time;
+        if (getWakeupTime(*m_iterators[i], time))
+            m_heap.push_back(Wakeup{time, i});
+    }
+
+    std::make_heap(m_heap.begin(), m_heap.end());
+
+    m_heapValid = true;
+}
+
 void
 MappedBufMetaIterator::
 fetchEventsNoncompeting(MappedInserterBase &inserter,
@@ -224,116 +287,66 @@ fetchEventsNoncompeting(MappedInserterBase &inserter,
     Profiler profiler("MappedBufMetaIterator::fetchEventsNoncompeting", false);
 
     m_currentTime = endTime;
-    
-    // For each segment (MEBIterator), activate segments that have anything
-    // playing.
-    for (IteratorVector::iterator i = m_iterators.begin();
-         i != m_iterators.end();
-         ++i) { 
-        RealTime start;
-        RealTime end;
-        (*i)->getMappedEventBuffer()->getStartEnd(start, end);
-
-        // Activate MEBIterators for Segments that have something playing during
-        // this time slice.  We include Segments that end exactly when we start,
-        // but not Segments that start exactly when we end.
-        //
-        // Activation makes it easier to focus on relevant Segments later in
-        // this routine.
-        // Might want to consider assembling a vector of relevant MEBIterators
-        // and iterating through that instead of storing a flag in MEBIterator.
-        // We'll still need to set the current time.  Alternatively, we could
-        // do this check further down while we are going through the
-        // MEBIterators.  That would eliminate the need for a flag or a vector.
-        bool active = (start < endTime  &&  end >= startTime);
-        (*i)->setActive(active, startTime);
+
+    // Take the count first, so that a refresh while we rebuild gets us
+    // another rebuild next time.
+    const unsigned publishCount = MappedEventBuffer::getPublishCount();
+    if (!m_heapValid  ||  publishCount != m_heapPublishCount) {
+        m_heapPublishCount = publishCount;
+        rebuildHeap();
     }
 
-    // State variable to allow the outer (round-robin) loop to run until
-    // the inner (segment) loop has nothing to do.
-    bool segmentsHaveMore = false;
-
-    // For each pass through the segments.
-    // On each pass, we only process one event in each segment.
-    // ??? Why not process all the events in each segment?
-    //     for each segment
-    //         for each event
-    //             process the event
-    //         rof
-    //     rof
-    //     Is this round-robin approach intended to spread the locks out?
-    //     Is it really necessary?
-    //     Prior to the auto-channels feature, this routine was called
-    //     MappedSegmentsMetaIterator::fillCompositionWithEventsUntil().
-    //     It has always used this round-robin approach.
-    do {
-        segmentsHaveMore = false;
-
-        // For each segment, process only the first event.
-        for (IteratorVector::iterator i = m_iterators.begin();
-             i != m_iterators.end();
-             ++i) {
-            QSharedPointer<MEBIterator> iter = (*i);
+    // Merge the events that are due from each buffer, earliest first.
+    // Buffers with nothing to do in this slice stay in the heap and are
+    // never looked at.
+    //
+    // Each time round, either an event is taken, or the iterator goes
+    // back in the heap due at or after endTime, or it is dropped, so
+    // this always ends.
+    while (!m_heap.empty()  &&  m_heap.front().time < endTime) {
+        std::pop_heap(m_heap.begin(), m_heap.end());
+        const size_t index = m_heap.back().index;
+        m_heap.pop_back();
 
-#ifdef DEBUG_META_ITERATOR
-            RG_DEBUG << "fetchEventsNoncompeting() : checking segment #" << i;
-#endif
+        MEBIterator &iter = *m_iterators[index];
 
-            // Skip any segments that aren't active.
-            if (!iter->getActive()) {
-#ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : no more events to get for this slice in segment #" << i;
-#endif
+        RealTime start;
+        RealTime end;
+        iter.getMappedEventBuffer()->getStartEnd(start, end);
 
-                continue;
-            }
+        // Done sounding before this slice.  Only a refresh or a jump can
+        // change that, and either will rebuild the heap.
+        if (end < startTime)
+            continue;
 
-            if (iter->atEnd()) {
-#ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : " << endTime << " reached end of segment #" << i;
-#endif
-                // Make this iterator abort early in future
-                // iterations, since we know it's all done.
-                iter->setInactive();
-                continue;
-            }
+        iter.setCurrentTime(startTime);
 
-            // This locks the iterator's buffer against writes, lest
-            // writing cause reallocating the buffer while we are
-            // holding a pointer into it.  No function we call will
+        {
+            // This pins the iterator's events so that a refresh on the
+            // GUI thread can't reuse them while we are holding a pointer
+            // into them.  It never blocks.  No function we call will
             // hold the `event' pointer past its own scope, implying
-            // that nothing holds it past an iteration of this loop,
-            // which is this lock's scope.
-            QReadLocker locker(iter->getLock());
+            // that nothing holds it past this block, which is this
+            // lock's scope.
+            MEBIterator::ReadLocker locker(iter);
 
-            MappedEvent *event = iter->peek();
+            MappedEvent *event = iter.peek();
 
-            // We couldn't fetch an event or it failed a sanity check.
-            // So proceed to the next iterator but keep looking at
-            // this one - incrementing it does nothing useful, and it
-            // might get more events.  But don't set segmentsHaveMore,
-            // lest we loop forever waiting for a valid event.
+            // Changed under us.  Drop it until the heap is rebuilt.
             if (!event  ||  !event->isValid())
                 continue;
 
-            // If we got this far, make the mapper ready.  Do this
-            // even if the note won't play during this slice, because
-            // sometimes/always we prepare channels slightly ahead of
-            // their first notes, to fix bug #1378
-            if (!iter->isReady())
-                iter->makeReady(inserter, startTime);
+            // Make the mapper ready.  Do this even if the note won't
+            // play during this slice, because sometimes/always we
+            // prepare channels slightly ahead of their first notes, to
+            // fix bug #1378
+            if (!iter.isReady())
+                iter.makeReady(inserter, startTime);
 
             // If this event starts prior to the end of the slice, take it.
             if (event->getEventTime() < endTime) {
-                // Increment the iterator, since we're taking this
-                // event.  NB, in the other branch it is not yet used
-                // so we leave `iter' where it is.
-                ++(*iter);
-
-                // If we got this far, we'll want to try the next
-                // iteration, so note it.
-                segmentsHaveMore = true;
-                
+                ++iter;
+
 #ifdef DEBUG_META_ITERATOR
                 RG_DEBUG << "  Event...";
                 QString trackId = QString::number(event->getTrackId());
@@ -354,8 +367,8 @@ fetchEventsNoncompeting(MappedInserterBase &inserter,
                             " data2:" << (unsigned int)event->getData2();
 #endif
 
-                if (iter->shouldPlay(event, startTime)) {
-                    iter->doInsert(inserter, *event);
+                if (iter.shouldPlay(event, startTime)) {
+                    iter.doInsert(inserter, *event);
 #ifdef DEBUG_META_ITERATOR
                     RG_DEBUG << "  Inserting event";
 #endif
@@ -365,19 +378,16 @@ fetchEventsNoncompeting(MappedInserterBase &inserter,
                     RG_DEBUG << "  Skipping event";
 #endif
                 }
-            } else {
-                // This iterator has more events but they only sound
-                // after the end of this slice, so it's done.
-                iter->setInactive();
-
-#ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : Event is past end for segment #" << i;
-#endif
             }
         }
-    } while (segmentsHaveMore);
 
-    return;
+        // Back in the heap for when it next has something to do.
+        RealTime time;
+        if (getWakeupTime(iter, time)) {
+            m_heap.push_back(Wakeup{time, index});
+            std::push_heap(m_heap.begin(), m_heap.end());
+        }
+    }
 }
 
 void
@@ -405,6 +415,8 @@ MappedBufMetaIterator::resetIteratorForBuffer(
                 iter->setReady(false);
             }
 
+            m_heapValid = false;
+
             break;
         }
     }
@@ -422,13 +434,10 @@ MappedBufMetaIterator::getAudioEvents(std::vector<MappedEvent> &audioEvents)
          i != m_buffers.end(); ++i) {
 
         // ??? The various features of MEBIterator are not needed here.
-        //     Instead, we should probably lock the buffer for read
-        //     (MappedEventBuffer::m_lock which should probably be
-        //     public) and get at it directly via
-        //     MappedEventBuffer::getBuffer() (or just make m_buffer public).
+        //     We only need its ReadLocker.
         MEBIterator iter(*i);
 
-        QReadLocker locker(iter.getLock());
+        MEBIterator::ReadLocker locker(iter);
 
         // For each event
         while (!iter.atEnd()) {
@@ -60,6 +60,8 @@ class MEBIterator;
 class MappedBufMetaIterator
 {
 public:
+    MappedBufMetaIterator();
+
     void addBuffer(QSharedPointer<MappedEventBuffer>);
     void removeBuffer(QSharedPointer<MappedEventBuffer>);
 
@@ -123,6 +125,48 @@ private:
                                  const RealTime &startTime,
                                  const RealTime &endTime);
 
+    /// An iterator that will need attention at a certain time.
+    struct Wakeup
+    {
+        /// When the iterator next has anything to do.
+        RealTime time;
+        /// Index into m_iterators.
+        size_t index;
+
+        /// Reversed, for a min-heap with std::push_heap() and friends.
+        bool operator<(const Wakeup &other) const
+        {
+            if (time != other.time)
+                return time > other.time;
+            return index > other.index;
+        }
+    };
+
+    /// Min-heap of iterators by when they next have something to do.
+    /**
+     * This lets fetchEventsNoncompeting() touch only the buffers that
+     * have events due in a slice, rather than every buffer every slice,
+     * which adds up with lots of sparse segments.
+     *
+     * Iterators that are at the end of their buffers, or otherwise have
+     * nothing more to give, are left out.  Only a refresh of a buffer or
+     * repositioning the iterators can change that, so the heap is rebuilt
+     * after either.  See m_heapValid and m_heapPublishCount.
+     */
+    std::vector<Wakeup> m_heap;
+    /// False after anything that moves the iterators.
+    bool m_heapValid;
+    /// MappedEventBuffer::getPublishCount() when m_heap was built.
+    unsigned m_heapPublishCount;
+
+    /// Recompute m_heap from the iterators.
+    void rebuildHeap();
+    /// Find when iter next needs attention.
+    /**
+     * Returns false if it has nothing more to give.
+     */
+    static bool getWakeupTime(MEBIterator &iter, RealTime &time);
+
 };
 
 
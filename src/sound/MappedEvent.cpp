@@ -20,14 +20,16 @@
 #include "base/MidiTypes.h"
 #include "base/NotationTypes.h" // for Note::EventType
 #include "misc/Debug.h"
-#include "misc/TempDir.h"
 
-#include <QDir>
-#include <QFile>
-#include <QFileInfo>
+#include <QMutexLocker>
 #include <QtGlobal>
 
-#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <new>
+#include <thread>
+#include <tuple>
 
 // #define DEBUG_MAPPEDEVENT 1
 
@@ -45,10 +47,8 @@ MappedEvent::MappedEvent(InstrumentId id,
         m_data2(0),
         m_eventTime(eventTime),
         m_duration(duration),
-        m_audioStartMarker(0, 0),
         m_dataBlockId(0),
-        m_runtimeSegmentId( -1),
-        m_autoFade(false),
+        m_audioDataId(0),
         m_recordedChannel(0),
         m_recordedDevice(0)
 
@@ -164,12 +164,8 @@ MappedEvent::operator=(const MappedEvent &mE)
     m_data2 = mE.getData2();
     m_eventTime = mE.getEventTime();
     m_duration = mE.getDuration();
-    m_audioStartMarker = mE.getAudioStartMarker();
     m_dataBlockId = mE.getDataBlockId();
-    m_runtimeSegmentId = mE.getRuntimeSegmentId();
-    m_autoFade = mE.isAutoFading();
-    m_fadeInTime = mE.getFadeInTime();
-    m_fadeOutTime = mE.getFadeOutTime();
+    m_audioDataId = mE.m_audioDataId;
     m_recordedChannel = mE.getRecordedChannel();
     m_recordedDevice = mE.getRecordedDevice();
 
@@ -183,6 +179,178 @@ MappedEvent::addDataString(const std::string& rawData)
         setDataBlockForEvent(this, rawData, true);
 }
 
+namespace
+{
+    // The AudioData records that MappedEvent::m_audioDataId refers to.
+    //
+    // MappedEvents are copied byte for byte into buffers and lists and
+    // across threads, so no one event owns a record and there is no
+    // point at which one could be released.  Instead, equal AudioData
+    // share a record and records are never freed.  There is one per
+    // distinct start marker/fade/segment combination, which is a few
+    // per audio segment edit.
+    //
+    // Lookups take no lock, so the sequencer thread can read audio
+    // fields while the GUI thread maps more.
+    class AudioDataTable
+    {
+    public:
+        AudioDataTable() : m_nextId(1)
+        {
+            for (size_t i = 0; i < PageCount; ++i)
+                m_pages[i] = nullptr;
+        }
+
+        /// The record for id, or nullptr if there is no such record.
+        const MappedEvent::AudioData *find(unsigned int id) const
+        {
+            const Page *page = m_pages[id >> PageBits].load();
+            if (!page)
+                return nullptr;
+            return &page->records[id & (PageSize - 1)];
+        }
+
+        /// The ID of the record equal to audioData, or 0 if full.
+        unsigned int intern(const MappedEvent::AudioData &audioData);
+
+    private:
+        static const int PageBits = 10;
+        static const size_t PageSize = size_t(1) << PageBits;
+        static const size_t PageCount = size_t(1) << 12;
+
+        struct Page
+        {
+            MappedEvent::AudioData records[PageSize];
+        };
+        std::atomic<Page *> m_pages[PageCount];
+
+        QMutex m_mutex;
+        unsigned int m_nextId;
+
+        // The fields of an AudioData, in an order that makes a key.
+        typedef std::tuple<int, int, int, int, int, int, int, bool> Key;
+        std::map<Key, unsigned int> m_ids;
+    };
+
+    unsigned int
+    AudioDataTable::intern(const MappedEvent::AudioData &audioData)
+    {
+        const Key key(audioData.audioStartMarker.sec,
+                      audioData.audioStartMarker.nsec,
+                      audioData.runtimeSegmentId,
+                      audioData.fadeInTime.sec,
+                      audioData.fadeInTime.nsec,
+                      audioData.fadeOutTime.sec,
+                      audioData.fadeOutTime.nsec,
+                      audioData.autoFade);
+
+        QMutexLocker locker(&m_mutex);
+
+        std::map<Key, unsigned int>::const_iterator found = m_ids.find(key);
+        if (found != m_ids.end())
+            return found->second;
+
+        if (m_nextId >= PageCount * PageSize) {
+            RG_WARNING << "intern(): Out of audio data IDs";
+            return 0;
+        }
+
+        const unsigned int id = m_nextId++;
+
+        std::atomic<Page *> &pageEntry = m_pages[id >> PageBits];
+        Page *page = pageEntry.load();
+        if (!page) {
+            page = new Page;
+            // Publish it once its records are constructed.
+            pageEntry = page;
+        }
+
+        // Nobody can see this record until the ID has been handed out.
+        page->records[id & (PageSize - 1)] = audioData;
+        m_ids[key] = id;
+
+        return id;
+    }
+
+    AudioDataTable &audioDataTable()
+    {
+        // Create on first use to avoid static init order fiasco.
+        // Note: This is a deliberate memory leak since we cannot be sure
+        //       who might access it as we are going down.
+        static AudioDataTable *table = new AudioDataTable;
+        return *table;
+    }
+}
+
+MappedEvent::AudioData
+MappedEvent::getAudioData() const
+{
+    if (m_audioDataId == 0)
+        return AudioData();
+
+    const AudioData *audioData = audioDataTable().find(m_audioDataId);
+    if (!audioData)
+        return AudioData();
+
+    return *audioData;
+}
+
+void
+MappedEvent::setAudioData(const AudioData &audioData)
+{
+    // The defaults don't need a record.
+    if (audioData.audioStartMarker == RealTime::zero()  &&
+        audioData.runtimeSegmentId == -1  &&
+        !audioData.autoFade  &&
+        audioData.fadeInTime == RealTime::zero()  &&
+        audioData.fadeOutTime == RealTime::zero()) {
+        m_audioDataId = 0;
+        return;
+    }
+
+    m_audioDataId = audioDataTable().intern(audioData);
+}
+
+void
+MappedEvent::setAudioStartMarker(const RealTime &aS)
+{
+    AudioData audioData = getAudioData();
+    audioData.audioStartMarker = aS;
+    setAudioData(audioData);
+}
+
+void
+MappedEvent::setRuntimeSegmentId(int id)
+{
+    AudioData audioData = getAudioData();
+    audioData.runtimeSegmentId = id;
+    setAudioData(audioData);
+}
+
+void
+MappedEvent::setAutoFade(bool value)
+{
+    AudioData audioData = getAudioData();
+    audioData.autoFade = value;
+    setAudioData(audioData);
+}
+
+void
+MappedEvent::setFadeInTime(const RealTime &time)
+{
+    AudioData audioData = getAudioData();
+    audioData.fadeInTime = time;
+    setAudioData(audioData);
+}
+
+void
+MappedEvent::setFadeOutTime(const RealTime &time)
+{
+    AudioData audioData = getAudioData();
+    audioData.fadeOutTime = time;
+    setAudioData(audioData);
+}
+
 QDebug operator<<(QDebug dbg, const MappedEvent &mE)
 {
     dbg << "MappedEvent" << "\n";
@@ -309,11 +477,12 @@ QDebug operator<<(QDebug dbg, const MappedEvent &mE)
     dbg << "  Data 2:" << mE.m_data2 << "\n";
     dbg << "  Event Time:" << mE.m_eventTime << "\n";
     dbg << "  Duration:" << mE.m_duration << "\n";
-    dbg << "  Audio Start Marker:" << mE.m_audioStartMarker << "\n";
-    dbg << "  Runtime Segment ID:" << mE.m_runtimeSegmentId << "\n";
-    dbg << "  Auto Fade:" << mE.m_autoFade << "\n";
-    dbg << "  Fade In Time:" << mE.m_fadeInTime << "\n";
-    dbg << "  Fade Out Time:" << mE.m_fadeOutTime << "\n";
+    const MappedEvent::AudioData audioData = mE.getAudioData();
+    dbg << "  Audio Start Marker:" << audioData.audioStartMarker << "\n";
+    dbg << "  Runtime Segment ID:" << audioData.runtimeSegmentId << "\n";
+    dbg << "  Auto Fade:" << audioData.autoFade << "\n";
+    dbg << "  Fade In Time:" << audioData.fadeInTime << "\n";
+    dbg << "  Fade Out Time:" << audioData.fadeOutTime << "\n";
     dbg << "  Recorded Channel:" << mE.m_recordedChannel << "\n";
     dbg << "  Recorded Device:" << mE.m_recordedDevice << "\n";
 
@@ -322,143 +491,140 @@ QDebug operator<<(QDebug dbg, const MappedEvent &mE)
 
 //--------------------------------------------------
 
-class DataBlockFile
+namespace
 {
-public:
-    explicit DataBlockFile(DataBlockRepository::blockid id);
-    ~DataBlockFile();
-
-    QString getFileName() const
-    {
-        return m_fileName;
-    }
-
-    void addDataString(const std::string&);
-
-    void clear()
-    {
-        m_cleared = true;
-    }
-    bool exists();
-    void setData(const std::string&);
-    std::string getData();
-
-protected:
-    void prepareToWrite();
-    void prepareToRead();
-
-    //--------------- Data members ---------------------------------
-    QString m_fileName;
-    QFile m_file;
-    bool m_cleared;
-};
-
-DataBlockFile::DataBlockFile(DataBlockRepository::blockid id)
-    : m_fileName(TempDir::path() + QString("/rosegarden_datablock_%1").arg(id)),
-      m_file(m_fileName),
-      m_cleared(false)
-{
-    //     std::cerr << "DataBlockFile " << m_fileName.toLatin1().data() << std::endl;
+    /// Arena chunks start this big and double up to MaxChunkSize.
+    const size_t MinChunkSize = 64 * 1024;
+    const size_t MaxChunkSize = 4 * 1024 * 1024;
 }
 
-DataBlockFile::~DataBlockFile()
+DataBlockRepository* DataBlockRepository::getInstance()
 {
-    if (m_cleared) {
-//        std::cerr << "~DataBlockFile : removing " << m_fileName.toLatin1().data() << std::endl;
-        QFile::remove
-            (m_fileName);
-    }
-
+    // Never deleted, so it is still there for the sequencer thread
+    // during static destruction.
+    static DataBlockRepository *instance = new DataBlockRepository;
+    return instance;
 }
 
-bool DataBlockFile::exists()
+DataBlockRepository::DataBlockRepository() :
+    m_chunkUsed(0),
+    m_chunkSize(0),
+    m_nextId(1),
+    m_readers(0)
 {
-    return QFile::exists(m_fileName);
+    for (size_t i = 0; i < PageCount; ++i)
+        m_pages[i] = nullptr;
 }
 
-void DataBlockFile::setData(const std::string& s)
+const DataBlockRepository::Block *
+DataBlockRepository::findBlock(blockid id) const
 {
-  //  std::cerr << "DataBlockFile::setData() : setting data to " << m_fileName << std::endl;
-    prepareToWrite();
+    if (id == 0  ||  id >= PageCount * PageSize)
+        return nullptr;
 
-    QDataStream stream(&m_file);
-    stream.writeRawData(s.data(), s.length());
+    const Page *page = m_pages[id >> PageBits].load();
+    if (!page)
+        return nullptr;
+
+    return page->blocks[id & (PageSize - 1)].load();
 }
 
-std::string DataBlockFile::getData()
+std::string DataBlockRepository::getDataBlock(DataBlockRepository::blockid id)
 {
-    if (!exists())
-        return std::string();
+    std::string result;
+    DataBlockRepository *repository = getInstance();
 
-    prepareToRead();
+    ++repository->m_readers;
+    const Block *block = repository->findBlock(id);
+    if (block)
+        result.assign(block->data(), block->length);
+    --repository->m_readers;
 
-    QDataStream stream(&m_file);
- //   std::cerr << "DataBlockFile::getData() : file size = " << m_file.size() << std::endl;
-    char* tmp = new char[m_file.size()];
-    stream.readRawData(tmp, m_file.size());
-    std::string res(tmp, m_file.size());
-    delete[] tmp;
-
-    return res;
+    return result;
 }
 
-void DataBlockFile::addDataString(const std::string& s)
-{
-    prepareToWrite();
-    QDataStream stream(&m_file);
-    stream.writeRawData(s.data(), s.length());
-}
 
-void DataBlockFile::prepareToWrite()
+std::string DataBlockRepository::getDataBlockForEvent(const MappedEvent* e)
 {
- //   std::cerr << "DataBlockFile[" << m_fileName << "]: prepareToWrite" << std::endl;
-    if (!m_file.isWritable()) {
-        m_file.close();
-        m_file.open(QIODevice::WriteOnly | QIODevice::Append);
-        Q_ASSERT(m_file.isWritable());
+    blockid id = e->getDataBlockId();
+    if (id == 0) {
+   //     std::cerr << "WARNING: DataBlockRepository::getDataBlockForEvent called on event with data block id 0" << std::endl;
+        return "";
     }
+    return getInstance()->getDataBlock(id);
 }
 
-void DataBlockFile::prepareToRead()
+void DataBlockRepository::appendDataBlockForEvent(const MappedEvent *e,
+                                                  std::string &destination)
 {
-//    std::cerr << "DataBlockFile[" << m_fileName << "]: prepareToRead" << std::endl;
-    if (!m_file.isReadable()) {
-        m_file.close();
-        m_file.open(QIODevice::ReadOnly);
-        Q_ASSERT(m_file.isReadable());
-    }
-}
-
-
+    blockid id = e->getDataBlockId();
+    if (id == 0)
+        return;
 
-//--------------------------------------------------
+    DataBlockRepository *repository = getInstance();
 
-DataBlockRepository* DataBlockRepository::getInstance()
-{
-    if (!m_instance)
-        m_instance = new DataBlockRepository;
-    return m_instance;
+    ++repository->m_readers;
+    const Block *block = repository->findBlock(id);
+    if (block)
+        destination.append(block->data(), block->length);
+    --repository->m_readers;
 }
 
-std::string DataBlockRepository::getDataBlock(DataBlockRepository::blockid id)
+const DataBlockRepository::Block *
+DataBlockRepository::makeBlock(const Block *prefix, const std::string &s)
 {
-    DataBlockFile dataBlockFile(id);
+    const size_t prefixLength = prefix ? prefix->length : 0;
+    const size_t length = prefixLength + s.length();
+
+    // Keep each header aligned.
+    const size_t align = alignof(Block);
+    const size_t needed =
+        (sizeof(Block) + length + align - 1) / align * align;
+
+    char *memory;
+
+    if (needed > MaxChunkSize / 4) {
+        // Big blocks get a chunk to themselves, kept in front of the
+        // current chunk so that it can still be filled.
+        memory = new char[needed];
+        m_chunks.insert(m_chunks.empty() ? m_chunks.end() :
+                                           m_chunks.end() - 1,
+                        memory);
+    } else {
+        if (m_chunks.empty()  ||  m_chunkUsed + needed > m_chunkSize) {
+            m_chunkSize = (m_chunkSize == 0) ? MinChunkSize :
+                          std::min(m_chunkSize * 2, MaxChunkSize);
+            m_chunks.push_back(new char[m_chunkSize]);
+            m_chunkUsed = 0;
+        }
+        memory = m_chunks.back() + m_chunkUsed;
+        m_chunkUsed += needed;
+    }
 
-    if (dataBlockFile.exists())
-        return dataBlockFile.getData();
+    Block *block = new (memory) Block;
+    block->length = length;
 
-    return std::string();
-}
+    char *data = memory + sizeof(Block);
+    if (prefixLength)
+        memcpy(data, prefix->data(), prefixLength);
+    memcpy(data + prefixLength, s.data(), s.length());
 
+    return block;
+}
 
-std::string DataBlockRepository::getDataBlockForEvent(const MappedEvent* e)
+void DataBlockRepository::setBlock(blockid id, const Block *block)
 {
-    blockid id = e->getDataBlockId();
-    if (id == 0) {
-   //     std::cerr << "WARNING: DataBlockRepository::getDataBlockForEvent called on event with data block id 0" << std::endl;
-        return "";
+    std::atomic<Page *> &pageEntry = m_pages[id >> PageBits];
+
+    Page *page = pageEntry.load();
+    if (!page) {
+        page = new Page;
+        for (size_t i = 0; i < PageSize; ++i)
+            page->blocks[i] = nullptr;
+        pageEntry = page;
     }
-    return getInstance()->getDataBlock(id);
+
+    page->blocks[id & (PageSize - 1)] = block;
 }
 
 void DataBlockRepository::setDataBlockForEvent(MappedEvent* e,
@@ -474,90 +640,81 @@ void DataBlockRepository::setDataBlockForEvent(MappedEvent* e,
     } else {
 #ifdef DEBUG_MAPPEDEVENT
         RG_DEBUG << "Writing" << s.length()
-                  << "chars to file for datablock" << id;
+                  << "chars to datablock" << id;
 #endif
-        DataBlockFile dataBlockFile(id);
-        if (extend)
-            { dataBlockFile.addDataString(s);}
-        else
-            { dataBlockFile.setData(s); }
-    }
-}
+        DataBlockRepository *repository = getInstance();
+        QMutexLocker locker(&repository->m_writeMutex);
 
-/* unused
-bool DataBlockRepository::hasDataBlock(DataBlockRepository::blockid id)
-{
-    return DataBlockFile(id).exists();
+        // Not an ID we handed out.
+        if (id >= repository->m_nextId)
+            return;
+
+        // Only writers change blocks, so no need to pin m_readers.
+        const Block *prefix = extend ? repository->findBlock(id) : nullptr;
+
+        // The old block stays in the arena until clear(), in case the
+        // sequencer thread is reading it.
+        repository->setBlock(id, repository->makeBlock(prefix, s));
+    }
 }
-*/
 
 DataBlockRepository::blockid DataBlockRepository::registerDataBlock(const std::string& s)
 {
-    blockid id = 0;
-    while (id == 0 || DataBlockFile(id).exists())
-        id = (blockid)random();
+    DataBlockRepository *repository = getInstance();
+    QMutexLocker locker(&repository->m_writeMutex);
 
- //   std::cerr << "DataBlockRepository::registerDataBlock: " << s.length() << " chars, id is " << id << std::endl;
+    if (repository->m_nextId >= PageCount * PageSize) {
+        RG_WARNING << "registerDataBlock(): Out of data block IDs";
+        return 0;
+    }
 
-    DataBlockFile dataBlockFile(id);
-    dataBlockFile.setData(s);
+    blockid id = repository->m_nextId++;
 
-    return id;
-}
+ //   std::cerr << "DataBlockRepository::registerDataBlock: " << s.length() << " chars, id is " << id << std::endl;
 
-/* unused
-void DataBlockRepository::unregisterDataBlock(DataBlockRepository::blockid id)
-{
-    DataBlockFile dataBlockFile(id);
+    repository->setBlock(id, repository->makeBlock(nullptr, s));
 
-    dataBlockFile.clear();
+    return id;
 }
-*/
 
 void DataBlockRepository::registerDataBlockForEvent(const std::string& s, MappedEvent* e)
 {
     e->setDataBlockId(registerDataBlock(s));
 }
 
-/* unused
-void DataBlockRepository::unregisterDataBlockForEvent(MappedEvent* e)
-{
-    unregisterDataBlock(e->getDataBlockId());
-}
-*/
-
-DataBlockRepository::DataBlockRepository()
-{}
-
 void DataBlockRepository::clear()
 {
 #ifdef DEBUG_MAPPEDEVENT
     RG_DEBUG << "DataBlockRepository::clear()";
 #endif
 
-    // Erase all 'datablock_*' files
-    //
-    QString tmpPath = TempDir::path();
-
-    QDir segmentsDir(tmpPath, "rosegarden_datablock_*");
+    DataBlockRepository *repository = getInstance();
+    QMutexLocker locker(&repository->m_writeMutex);
 
-    if (segmentsDir.count() > 2000) {
-        RG_DEBUG << "DataBlockRepository::clear(): A rather large number of rosegarden_datablock_*\n" <<
-                     "  files (" << segmentsDir.count() << " of them) have been found in " << tmpPath.toStdString() << ".\n" <<
-                     "  It may take a while to delete them all.  Working...";
+    // Unhook the pages first so that new readers find nothing...
+    std::vector<Page *> pages;
+    for (size_t i = 0; i < PageCount; ++i) {
+        Page *page = repository->m_pages[i].exchange(nullptr);
+        if (page)
+            pages.push_back(page);
     }
 
-    for (unsigned int i = 0; i < segmentsDir.count(); ++i) {
-        QString segmentName = tmpPath + '/' + segmentsDir[i];
-        QFile::remove
-            (segmentName);
-    }
-}
+    // ...then wait for any that were already in.  They only ever hold
+    // on for the length of a copy.
+    while (repository->m_readers.load() != 0)
+        std::this_thread::yield();
 
-// setDataBlockForEvent does what addDataStringForEvent used to do.
+    for (Page *page : pages)
+        delete page;
 
+    for (char *chunk : repository->m_chunks)
+        delete[] chunk;
+    repository->m_chunks.clear();
+    repository->m_chunkUsed = 0;
+    repository->m_chunkSize = 0;
+}
 
-DataBlockRepository* DataBlockRepository::m_instance = nullptr;
+// setDataBlockForEvent does what addDataStringForEvent used to do.
 
 
 }
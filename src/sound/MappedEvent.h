@@ -16,11 +16,16 @@
 #define RG_MAPPEDEVENT_H
 
 #include <QDataStream>
+#include <QMutex>
 
 #include "base/RealTime.h"
 #include "base/Track.h"
 #include "base/Event.h"
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 
 namespace Rosegarden
 {
@@ -28,23 +33,45 @@ class MappedEvent;
 
 /// Used for storing data blocks for SysEx messages.
 /**
+ *  Blocks are kept in memory, in an append-only arena, and are looked up
+ *  by ID through a two-level table.  Reading a block takes no lock, so
+ *  the sequencer thread can fetch SysEx data while the GUI thread is
+ *  adding more.  Writers are serialized by a mutex.
+ *
+ *  Blocks are never changed once written.  Setting or extending the data
+ *  for an event writes a new block and switches the event's ID over to
+ *  it, so a reader always sees either the old data or the new.  Nothing
+ *  is freed until clear(), which waits for any readers still copying a
+ *  block out of the arena.
+ *
+ *  IDs are never reused, not even after clear(), so an event left over
+ *  from before a clear() gets an empty block rather than somebody
+ *  else's.
+ *
  *  @see MappedEvent::m_dataBlockId
  */
 class DataBlockRepository
 {
 public:
     friend class MappedEvent;
-    typedef unsigned long blockid;
+    typedef unsigned int blockid;
 
     static DataBlockRepository* getInstance();
     static std::string getDataBlockForEvent(const MappedEvent*);
+    /// Append an event's data block to destination.
+    /**
+     * Same as destination += getDataBlockForEvent(e), without the
+     * temporary string.
+     */
+    static void appendDataBlockForEvent(const MappedEvent*,
+                                        std::string &destination);
     static void setDataBlockForEvent(MappedEvent*, const std::string&,
                                      bool extend = false);
     /**
-     * Clear all block files
+     * Free all blocks.  Events mapped before this lose their SysEx data.
+     * Audio events keep their audio fields, which are stored elsewhere.
      */
     static void clear();
-    // unused static bool hasDataBlock(blockid);
 
 protected:
     DataBlockRepository();
@@ -52,15 +79,49 @@ protected:
     static std::string getDataBlock(blockid);
 
     static blockid registerDataBlock(const std::string&);
-    // unused static void unregisterDataBlock(blockid);
 
     static void registerDataBlockForEvent(const std::string&, MappedEvent*);
-    // unused static void unregisterDataBlockForEvent(MappedEvent*);
 
+private:
+    /// A block as stored in the arena.  The data follows the header.
+    struct Block
+    {
+        size_t length;
+
+        const char *data() const
+            { return reinterpret_cast<const char *>(this + 1); }
+    };
+
+    static const int PageBits = 14;
+    static const size_t PageSize = size_t(1) << PageBits;
+    static const size_t PageCount = size_t(1) << PageBits;
+
+    struct Page
+    {
+        std::atomic<const Block *> blocks[PageSize];
+    };
+
+    /// Second level of the ID table, allocated as IDs reach each page.
+    std::atomic<Page *> m_pages[PageCount];
+
+    /// Arena chunks the blocks are carved from.  Writers only.
+    std::vector<char *> m_chunks;
+    size_t m_chunkUsed;
+    size_t m_chunkSize;
+
+    /// Serializes writers, including clear().
+    QMutex m_writeMutex;
+    blockid m_nextId;
 
-    //--------------- Data members ---------------------------------
+    /// Readers currently copying out of a block.
+    std::atomic<int> m_readers;
 
-    static DataBlockRepository* m_instance;
+    /// Call with m_writeMutex held.
+    const Block *makeBlock(const Block *prefix, const std::string &s);
+    /// Call with m_writeMutex held.
+    void setBlock(blockid id, const Block *block);
+    /// Look up a block.  Call between pinning and unpinning m_readers.
+    const Block *findBlock(blockid id) const;
 };
 
 /// A MIDI event that is ready for playback
@@ -212,10 +273,8 @@ public:
                    m_data2(0),
                    m_eventTime(0, 0),
                    m_duration(0, 0),
-                   m_audioStartMarker(0, 0),
                    m_dataBlockId(0),
-                   m_runtimeSegmentId(-1),
-                   m_autoFade(false),
+                   m_audioDataId(0),
                    m_recordedChannel(0),
                    m_recordedDevice(0) {}
 
@@ -245,12 +304,14 @@ public:
         m_data2(velocity),
         m_eventTime(absTime),
         m_duration(duration),
-        m_audioStartMarker(audioStartMarker),
         m_dataBlockId(0),
-        m_runtimeSegmentId(-1),
-        m_autoFade(false),
+        m_audioDataId(0),
         m_recordedChannel(0),
-        m_recordedDevice(0) {}
+        m_recordedDevice(0)
+    {
+        if (audioStartMarker != RealTime::zero())
+            setAudioStartMarker(audioStartMarker);
+    }
 
     // Audio MappedEvent shortcut constructor
     //
@@ -266,12 +327,14 @@ public:
          m_data2(audioID / 256),
          m_eventTime(eventTime),
          m_duration(duration),
-         m_audioStartMarker(audioStartMarker),
          m_dataBlockId(0),
-         m_runtimeSegmentId(-1),
-         m_autoFade(false),
+         m_audioDataId(0),
          m_recordedChannel(0),
-         m_recordedDevice(0) {}
+         m_recordedDevice(0)
+    {
+        if (audioStartMarker != RealTime::zero())
+            setAudioStartMarker(audioStartMarker);
+    }
 
     // More generalised MIDI event containers for
     // large and small events (one param, two param)
@@ -287,10 +350,8 @@ public:
          m_data2(data2),
          m_eventTime(RealTime(0, 0)),
          m_duration(RealTime(0, 0)),
-         m_audioStartMarker(RealTime(0, 0)),
          m_dataBlockId(0),
-         m_runtimeSegmentId(-1),
-         m_autoFade(false),
+         m_audioDataId(0),
          m_recordedChannel(0),
          m_recordedDevice(0) {}
 
@@ -312,10 +373,8 @@ public:
         m_data2(0),
         m_eventTime(RealTime(0, 0)),
         m_duration(RealTime(0, 0)),
-        m_audioStartMarker(RealTime(0, 0)),
         m_dataBlockId(0),
-        m_runtimeSegmentId(-1),
-        m_autoFade(false),
+        m_audioDataId(0),
         m_recordedChannel(0),
         m_recordedDevice(0) {}
 
@@ -328,10 +387,8 @@ public:
         m_data2(0),
         m_eventTime(RealTime(0, 0)),
         m_duration(RealTime(0, 0)),
-        m_audioStartMarker(RealTime(0, 0)),
         m_dataBlockId(0),
-        m_runtimeSegmentId(-1),
-        m_autoFade(false),
+        m_audioDataId(0),
         m_recordedChannel(0),
         m_recordedDevice(0) {}
 
@@ -346,12 +403,8 @@ public:
         m_data2(mE.getData2()),
         m_eventTime(mE.getEventTime()),
         m_duration(mE.getDuration()),
-        m_audioStartMarker(mE.getAudioStartMarker()),
         m_dataBlockId(mE.getDataBlockId()),
-        m_runtimeSegmentId(mE.getRuntimeSegmentId()),
-        m_autoFade(mE.isAutoFading()),
-        m_fadeInTime(mE.getFadeInTime()),
-        m_fadeOutTime(mE.getFadeOutTime()),
+        m_audioDataId(mE.m_audioDataId),
         m_recordedChannel(mE.getRecordedChannel()),
         m_recordedDevice(mE.getRecordedDevice()) {}
 
@@ -365,12 +418,8 @@ public:
         m_data2(mE->getData2()),
         m_eventTime(mE->getEventTime()),
         m_duration(mE->getDuration()),
-        m_audioStartMarker(mE->getAudioStartMarker()),
         m_dataBlockId(mE->getDataBlockId()),
-        m_runtimeSegmentId(mE->getRuntimeSegmentId()),
-        m_autoFade(mE->isAutoFading()),
-        m_fadeInTime(mE->getFadeInTime()),
-        m_fadeOutTime(mE->getFadeOutTime()),
+        m_audioDataId(mE->m_audioDataId),
         m_recordedChannel(mE->getRecordedChannel()),
         m_recordedDevice(mE->getRecordedDevice()) {}
 
@@ -426,10 +475,9 @@ public:
     // where in the sample it should be played.  Duration is measured
     // against total sounding length (not absolute position).
     //
-    void setAudioStartMarker(const RealTime &aS)
-        { m_audioStartMarker = aS; }
+    void setAudioStartMarker(const RealTime &aS);
     RealTime getAudioStartMarker() const
-        { return m_audioStartMarker; }
+        { return getAudioData().audioStartMarker; }
 
     MappedEventType getType() const { return m_type; }
     void setType(const MappedEventType &value) { m_type = value; }
@@ -481,21 +529,47 @@ public:
     /// Size of a MappedEvent in a stream
     static const size_t streamedSize;
 
+    /// The fields only Audio events use.
+    /**
+     * These are kept out of line to keep MappedEvent small, since the
+     * sequencer copies and compares a great many MIDI events and hardly
+     * any audio ones.  See m_audioDataId.
+     */
+    struct AudioData
+    {
+        AudioData() : runtimeSegmentId(-1), autoFade(false)  { }
+
+        /// Where in the file to start playing.  See setAudioStartMarker().
+        RealTime audioStartMarker;
+        /// Id of the segment the event is derived from.
+        int runtimeSegmentId;
+        bool autoFade;
+        RealTime fadeInTime;
+        RealTime fadeOutTime;
+    };
+
+    /// All of the audio fields at once.
+    AudioData getAudioData() const;
+    /// Set all of the audio fields at once.
+    /**
+     * Cheaper than setting them one at a time.
+     */
+    void setAudioData(const AudioData &audioData);
+
     // The runtime segment id of an audio file
     //
-    int getRuntimeSegmentId() const { return m_runtimeSegmentId; }
-    void setRuntimeSegmentId(int id) { m_runtimeSegmentId = id; }
+    int getRuntimeSegmentId() const
+        { return getAudioData().runtimeSegmentId; }
+    void setRuntimeSegmentId(int id);
 
-    bool isAutoFading() const { return m_autoFade; }
-    void setAutoFade(bool value) { m_autoFade = value; }
+    bool isAutoFading() const { return getAudioData().autoFade; }
+    void setAutoFade(bool value);
 
-    RealTime getFadeInTime() const { return m_fadeInTime; }
-    void setFadeInTime(const RealTime &time)
-            { m_fadeInTime = time; }
+    RealTime getFadeInTime() const { return getAudioData().fadeInTime; }
+    void setFadeInTime(const RealTime &time);
 
-    RealTime getFadeOutTime() const { return m_fadeOutTime; }
-    void setFadeOutTime(const RealTime &time)
-            { m_fadeOutTime = time; }
+    RealTime getFadeOutTime() const { return getAudioData().fadeOutTime; }
+    void setFadeOutTime(const RealTime &time);
 
     // Original event input channel as it was recorded
     //
@@ -516,22 +590,19 @@ private:
     MidiByte         m_data2;
     RealTime         m_eventTime;
     RealTime         m_duration;
-    RealTime         m_audioStartMarker;
 
     // Use this when we want to store something in addition to the
     // other bytes in this type, e.g. System Exclusive.
     //
     DataBlockRepository::blockid m_dataBlockId;
 
-    // Id of the segment that this (audio) event is derived from
-    //
-    int              m_runtimeSegmentId;
-
-    // Audio autofading
+    // Record holding the AudioData for an Audio event, or 0 for the
+    // defaults.  Records are shared between all the events with the
+    // same AudioData, and never change.  They are kept apart from the
+    // DataBlockRepository, which clear() empties while events may still
+    // be live.  See MappedEvent.cpp.
     //
-    bool                  m_autoFade;
-    RealTime  m_fadeInTime;
-    RealTime  m_fadeOutTime;
+    unsigned int m_audioDataId;
 
     // For input events, original data, stored as it was recorded.
     // For output events, channel to play on.  m_recordedDevice is not
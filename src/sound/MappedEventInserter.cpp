@@ -25,7 +25,7 @@ void
 MappedEventInserter:: 
 insertCopy(const MappedEvent &evt)
 {
-  m_list.insert(new MappedEvent(evt));
+  m_list.insertCopy(evt);
 }
 
 }
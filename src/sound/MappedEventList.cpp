@@ -12,29 +12,38 @@
     COPYING included with this distribution for more information.
 */
 
-#include <QDataStream>
 #include "MappedEventList.h"
-#include "MappedEvent.h"
-#include "base/SegmentPerformanceHelper.h"
+
+#include <algorithm>
 
 namespace Rosegarden
 {
 
-MappedEventList::~MappedEventList()
+namespace
 {
-    clear();
+    bool eventLess(const MappedEvent *a, const MappedEvent *b)
+    {
+        return *a < *b;
+    }
 }
 
-// copy constructor
-MappedEventList::MappedEventList(const MappedEventList &mC):
-    std::multiset<MappedEvent *, MappedEvent::MappedEventCmp>()
+MappedEventList::MappedEventList() :
+    m_sorted(true),
+    m_used(0)
 {
-    clear();
+}
 
-    // deep copy
-    for (MappedEventList::const_iterator it = mC.begin(); it != mC.end(); ++it)
-        insert(new MappedEvent(**it));
+MappedEventList::MappedEventList(const MappedEventList &mC) :
+    m_sorted(true),
+    m_used(0)
+{
+    merge(mC);
+}
 
+MappedEventList::~MappedEventList()
+{
+    for (MappedEvent *chunk : m_chunks)
+        delete[] chunk;
 }
 
 MappedEventList &
@@ -43,29 +52,97 @@ MappedEventList::operator=(const MappedEventList &mC)
     if (&mC == this) return *this;
 
     clear();
-
-    for (MappedEventList::const_iterator it = mC.begin(); it != mC.end(); ++it)
-        insert(new MappedEvent(**it));
+    merge(mC);
 
     return *this;
 }
 
+MappedEvent *
+MappedEventList::allocate()
+{
+    const size_t chunk = m_used / ChunkSize;
+    if (chunk == m_chunks.size())
+        m_chunks.push_back(new MappedEvent[ChunkSize]);
+
+    MappedEvent *event = &m_chunks[chunk][m_used % ChunkSize];
+    ++m_used;
+
+    return event;
+}
+
+void
+MappedEventList::insertCopy(const MappedEvent &event)
+{
+    MappedEvent *copy = allocate();
+    *copy = event;
+
+    // Events mostly arrive in order, so this rarely needs a sort.
+    if (m_sorted  &&  !m_events.empty()  &&  *copy < *m_events.back())
+        m_sorted = false;
+
+    m_events.push_back(copy);
+}
+
+void
+MappedEventList::insert(MappedEvent *event)
+{
+    insertCopy(*event);
+    delete event;
+}
+
 void
 MappedEventList::merge(const MappedEventList &mC)
 {
-    for (MappedEventList::const_iterator it = mC.begin(); it != mC.end(); ++it)
-        insert(new MappedEvent(**it)); // deep copy
+    for (const MappedEvent *event : mC)
+        insertCopy(*event);
+}
+
+MappedEventList::iterator
+MappedEventList::erase(iterator i)
+{
+    return m_events.erase(i);
 }
 
 void
 MappedEventList::clear()
 {
-    for (MappedEventListIterator it = begin(); it != end(); ++it)
-        delete (*it);
-
-    erase(begin(), end());
+    m_events.clear();
+    m_sorted = true;
+    m_used = 0;
 }
 
+void
+MappedEventList::sort() const
+{
+    if (m_sorted)
+        return;
+
+    // Bottom-up merge sort.  std::stable_sort() would do, but it may
+    // allocate its own buffer every time.
+    const size_t count = m_events.size();
+    m_sortBuffer.resize(count);
+
+    std::vector<MappedEvent *> *from = &m_events;
+    std::vector<MappedEvent *> *to = &m_sortBuffer;
+
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t begin = 0; begin < count; begin += 2 * width) {
+            const size_t middle = std::min(begin + width, count);
+            const size_t end = std::min(begin + 2 * width, count);
+            // std::merge() takes from the first range on ties, which
+            // keeps equal events in insertion order.
+            std::merge(from->begin() + begin, from->begin() + middle,
+                       from->begin() + middle, from->begin() + end,
+                       to->begin() + begin, eventLess);
+        }
+        std::swap(from, to);
+    }
+
+    if (from != &m_events)
+        m_events.swap(m_sortBuffer);
+
+    m_sorted = true;
+}
 
 
 }
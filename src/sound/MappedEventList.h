@@ -19,8 +19,8 @@
 
 #include "base/Composition.h"
 #include "MappedEvent.h"
-#include <set>
-#include <QDataStream>
+
+#include <vector>
 
 namespace Rosegarden
 {
@@ -36,26 +36,86 @@ namespace Rosegarden
  * MappedEventList is a normal container with nothing fixed about it;
  * it's just the container that happens to be used in sequencer
  * threads when a set of MappedEvents is called for.
+ *
+ * The list iterates over MappedEvent pointers in time order, with
+ * events at the same time in the order they were inserted, as a
+ * std::multiset would.  It owns the events.
+ *
+ * Since a list is built and played for every slice during playback,
+ * it is designed to be reused without touching the heap.  The events
+ * are copied into a slab of fixed-size chunks, and clear() keeps the
+ * slab and the index for next time.  Insertion just appends, and the
+ * index is only sorted when it is next read, if it needs it at all.
+ * Once the list has grown to the size of a typical slice, filling and
+ * playing it allocates nothing.
  */
-class MappedEventList : public std::multiset<MappedEvent *,
-                                             MappedEvent::MappedEventCmp>
+class MappedEventList
 {
 public:
-    MappedEventList() { }
+    typedef std::vector<MappedEvent *>::iterator iterator;
+    typedef std::vector<MappedEvent *>::const_iterator const_iterator;
+
+    MappedEventList();
     MappedEventList(const MappedEventList &mC);
+    ~MappedEventList();
+
+    MappedEventList &operator=(const MappedEventList &mC);
+
+    /// Insert a copy of event.
+    void insertCopy(const MappedEvent &event);
+    /// Insert an event allocated with new, which the list then deletes.
+    /**
+     * The event is copied into the slab and deleted straight away, so
+     * don't use the pointer afterwards.  Prefer insertCopy().
+     */
+    void insert(MappedEvent *event);
 
+    /// Insert copies of all the events in mC.
     void merge(const MappedEventList &mC);
 
-    MappedEventList &operator=(const MappedEventList &mC);
+    /// Remove an event, returning the iterator following it.
+    /**
+     * The event's slot in the slab isn't reused until clear().
+     */
+    iterator erase(iterator i);
 
-    ~MappedEventList();
+    iterator begin()  { sort(); return m_events.begin(); }
+    iterator end()  { sort(); return m_events.end(); }
+    const_iterator begin() const  { sort(); return m_events.begin(); }
+    const_iterator end() const  { sort(); return m_events.end(); }
 
-    // Clear out
+    size_t size() const  { return m_events.size(); }
+    bool empty() const  { return m_events.empty(); }
+
+    /// Remove all events, keeping the memory for reuse.
     void clear();
+
+private:
+    /// Events in the order they will be iterated.  Sorted by sort().
+    /**
+     * mutable so that the sort can be put off until the list is read,
+     * which is often through a const reference.
+     */
+    mutable std::vector<MappedEvent *> m_events;
+    /// Whether m_events is in order.
+    mutable bool m_sorted;
+    /// Scratch space for sort(), kept to avoid allocating.
+    mutable std::vector<MappedEvent *> m_sortBuffer;
+
+    /// Stable sort of m_events by time if needed.
+    void sort() const;
+
+    /// The slab the events live in.
+    static const size_t ChunkSize = 256;
+    std::vector<MappedEvent *> m_chunks;
+    /// Slots of the slab used so far.
+    size_t m_used;
+
+    /// A free slot in the slab.
+    MappedEvent *allocate();
 };
 
-typedef std::multiset<MappedEvent *, MappedEvent::MappedEventCmp>::iterator
-    MappedEventListIterator;
+typedef MappedEventList::iterator MappedEventListIterator;
 
 }
 
@@ -38,8 +38,14 @@
 #include "sound/MidiInserter.h"
 #include "sound/SortingInserter.h"
 
+#include <QByteArray>
+#include <QFile>
 #include <QProgressDialog>
+#include <QThread>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <sstream>
@@ -71,169 +77,128 @@ MidiFile::~MidiFile()
     clearMidiComposition();
 }
 
-long
-MidiFile::midiBytesToLong(const std::string &bytes)
+namespace
 {
-    if (bytes.length() != 4) {
-        RG_WARNING << "midiBytesToLong(): WARNING: Wrong length for long data (" << bytes.length() << ", should be 4)";
-
-        // TRANSLATOR: "long" is a C++ data type
-        throw Exception(qstrtostr(tr("Wrong length for long data in MIDI stream")));
-    }
-
-    long longRet = static_cast<long>(static_cast<MidiByte>(bytes[0])) << 24 |
-                   static_cast<long>(static_cast<MidiByte>(bytes[1])) << 16 |
-                   static_cast<long>(static_cast<MidiByte>(bytes[2])) << 8 |
-                   static_cast<long>(static_cast<MidiByte>(bytes[3]));
-
-    RG_DEBUG << "midiBytesToLong(" << static_cast<long>(static_cast<MidiByte>(bytes[0])) << "," << static_cast<long>(static_cast<MidiByte>(bytes[1])) << "," << static_cast<long>(static_cast<MidiByte>(bytes[2])) << "," << static_cast<long>(static_cast<MidiByte>(bytes[3])) << ") -> " << longRet;
-
-    return longRet;
-}
-
-int
-MidiFile::midiBytesToInt(const std::string &bytes)
-{
-    if (bytes.length() != 2) {
-        RG_WARNING << "midiBytesToInt(): WARNING: Wrong length for int data (" << bytes.length() << ", should be 2)";
-
-        // TRANSLATOR: "int" is a C++ data type
-        throw Exception(qstrtostr(tr("Wrong length for int data in MIDI stream")));
-    }
-
-    return static_cast<int>(static_cast<MidiByte>(bytes[0])) << 8 |
-           static_cast<int>(static_cast<MidiByte>(bytes[1]));
-}
-
-MidiByte
-MidiFile::read(std::ifstream *midiFile)
-{
-    return static_cast<MidiByte>(read(midiFile, 1)[0]);
-}
-
-std::string
-MidiFile::read(std::ifstream *midiFile, unsigned long numberOfBytes)
-{
-    if (midiFile->eof()) {
-        RG_WARNING << "read(): MIDI file EOF - got 0 bytes out of " << numberOfBytes;
-
-        throw Exception(qstrtostr(tr("End of MIDI file encountered while reading")));
+    // Big-endian values in the MIDI file headers.
+
+    unsigned long bytesToLong(const MidiByte *bytes)
+    {
+        return static_cast<unsigned long>(bytes[0]) << 24 |
+               static_cast<unsigned long>(bytes[1]) << 16 |
+               static_cast<unsigned long>(bytes[2]) << 8 |
+               static_cast<unsigned long>(bytes[3]);
     }
 
-    // For each track section we can read only m_trackByteCount bytes.
-    if (m_decrementCount  &&
-        numberOfBytes > static_cast<unsigned long>(m_trackByteCount)) {
-
-        RG_WARNING << "read(): Attempt to get more bytes than allowed on Track (" << numberOfBytes << " > " << m_trackByteCount << ")";
-
-        throw Exception(qstrtostr(tr("Attempt to get more bytes than expected on Track")));
+    int bytesToInt(const MidiByte *bytes)
+    {
+        return static_cast<int>(bytes[0]) << 8 |
+               static_cast<int>(bytes[1]);
     }
 
-    char fileMidiByte;
-    std::string stringRet;
-
-    // ??? Reading one byte at a time is terribly slow.  However, this
-    //     routine is usually called with numberOfBytes == 1.
-    while (stringRet.length() < numberOfBytes  &&
-           midiFile->read(&fileMidiByte, 1)) {
-        stringRet += fileMidiByte;
-
-        // Kick the event loop to make sure the UI doesn't become
-        // unresponsive during a long load.
-        qApp->processEvents();
-    }
-
-    // Unexpected EOF
-    if (stringRet.length() < numberOfBytes) {
-        RG_WARNING << "read(): Attempt to read past file end - got " << stringRet.length() << " bytes out of " << numberOfBytes;
-
-        throw Exception(qstrtostr(tr("Attempt to read past MIDI file end")));
-    }
-
-    if (m_decrementCount)
-        m_trackByteCount -= numberOfBytes;
-
-    m_bytesRead += numberOfBytes;
-
-    // Every 2000 bytes...
-    if (m_bytesRead >= 2000) {
-        m_bytesRead = 0;
-
-        // Update the progress dialog if one is connected.
-        if (m_progressDialog) {
-            if (m_progressDialog->wasCanceled())
-                throw Exception(qstrtostr(tr("Cancelled by user")));
-
-            // This is the first 20% of the "reading" process.
-            int progressValue = static_cast<int>(
-                    static_cast<double>(midiFile->tellg()) /
-                    static_cast<double>(m_fileSize) * 20.0);
-
-            m_progressDialog->setValue(progressValue);
+    /// Reads a MIDI file track straight out of memory.
+    /**
+     * Throws if asked for more bytes than the track has.
+     */
+    class TrackReader
+    {
+    public:
+        TrackReader(const MidiByte *data, size_t size) :
+            m_pos(data),
+            m_end(data + size)
+        { }
+
+        size_t remaining() const  { return m_end - m_pos; }
+
+        MidiByte readByte()
+        {
+            need(1);
+            return *m_pos++;
         }
-    }
 
-    return stringRet;
-}
+        /// Read a "variable-length quantity".
+        /**
+         * In case the first byte has already been read, it can be sent
+         * in as firstByte.
+         */
+        unsigned long readNumber(int firstByte = -1)
+        {
+            MidiByte midiByte = (firstByte >= 0) ?
+                    static_cast<MidiByte>(firstByte) : readByte();
+
+            unsigned long value = midiByte;
+
+            // See MIDI spec section 4, pages 2 and 11.
+            if (midiByte & 0x80) {
+                value &= 0x7F;
+                do {
+                    midiByte = readByte();
+                    value = (value << 7) + (midiByte & 0x7F);
+                } while (midiByte & 0x80);
+            }
 
-long
-MidiFile::readNumber(std::ifstream *midiFile, int firstByte)
-{
-    if (midiFile->eof())
-        return 0;
+            return value;
+        }
 
-    MidiByte midiByte;
+        std::string readString(size_t length)
+        {
+            need(length);
+            std::string value(reinterpret_cast<const char *>(m_pos), length);
+            m_pos += length;
+            return value;
+        }
 
-    // If we already have the first byte, use it
-    if (firstByte >= 0) {
-        midiByte = static_cast<MidiByte>(firstByte);
-    } else {  // read it
-        midiByte = read(midiFile);
-    }
+    private:
+        const MidiByte *m_pos;
+        const MidiByte *m_end;
 
-    long longRet = midiByte;
+        void need(size_t length) const
+        {
+            if (length <= remaining())
+                return;
 
-    // See MIDI spec section 4, pages 2 and 11.
+            RG_WARNING << "TrackReader: Attempt to get more bytes than allowed on Track (" << length << " > " << remaining() << ")";
 
-    if (midiByte & 0x80) {
-        longRet &= 0x7F;
-        do {
-            midiByte = read(midiFile);
-            longRet = (longRet << 7) + (midiByte & 0x7F);
-        } while (!midiFile->eof() && (midiByte & 0x80));
-    }
+            throw Exception(qstrtostr(
+                    MidiFile::tr("Attempt to get more bytes than expected on Track")));
+        }
+    };
 
-    return longRet;
+    /// Files smaller than this aren't worth starting threads for.
+    constexpr size_t a_parallelParseBytes = 64 * 1024;
 }
 
-void
-MidiFile::findNextTrack(std::ifstream *midiFile)
+size_t
+MidiFile::findNextTrack(const MidiByte *data, size_t size, size_t pos,
+                        ParsedTrack &track)
 {
     // Conforms to recommendation in the MIDI spec, section 4, page 3:
     // "Your programs should /expect/ alien chunks and treat them as if
     // they weren't there."  (Emphasis theirs.)
 
-    // Assume not found.
-    m_decrementCount = false;
-    m_trackByteCount = -1;
-
     // For each chunk
-    while (!midiFile->eof()) {
+    while (size - pos >= 8) {
         // Read the chunk type and size.
-        std::string chunkType = read(midiFile, 4);
-        long chunkSize = midiBytesToLong(read(midiFile, 4));
+        const MidiByte *chunkType = data + pos;
+        const unsigned long chunkSize = bytesToLong(data + pos + 4);
+        pos += 8;
+
+        if (chunkSize > size - pos) {
+            RG_WARNING << "findNextTrack(): Attempt to read past file end - chunk of" << chunkSize << "bytes with" << size - pos << "left";
+
+            throw Exception(qstrtostr(tr("Attempt to read past MIDI file end")));
+        }
 
         // If we've found a track chunk
-        if (chunkType.compare(0, 4, MIDI_TRACK_HEADER) == 0) {
-            m_trackByteCount = chunkSize;
-            m_decrementCount = true;
-            return;
+        if (memcmp(chunkType, MIDI_TRACK_HEADER, 4) == 0) {
+            track.data = data + pos;
+            track.size = chunkSize;
+            return pos + chunkSize;
         }
 
-        RG_DEBUG << "findNextTrack(): skipping alien chunk.  Type:" << chunkType;
+        RG_DEBUG << "findNextTrack(): skipping alien chunk.  Type:" << std::string(reinterpret_cast<const char *>(chunkType), 4);
 
         // Alien chunk encountered, initiate evasive maneuvers (skip it).
-        midiFile->seekg(chunkSize, std::ios::cur);
+        pos += chunkSize;
     }
 
     // Track not found.
@@ -249,76 +214,93 @@ MidiFile::read(const QString &filename)
     clearMidiComposition();
 
     // Open the file
-    std::ifstream *midiFile =
-            new std::ifstream(filename.toLocal8Bit(),
-                              std::ios::in | std::ios::binary);
+    QFile midiFile(filename);
 
-    if (!(*midiFile)) {
+    if (!midiFile.open(QIODevice::ReadOnly)) {
         m_error = "File not found or not readable.";
         m_format = MIDI_FILE_NOT_LOADED;
         return false;
     }
 
-    // Compute the file size so we can report progress.
-    midiFile->seekg(0, std::ios::end);
-    m_fileSize = midiFile->tellg();
-    midiFile->seekg(0, std::ios::beg);
+    // Map the whole file, or failing that, read it all in one go.  The
+    // mapping stays valid until midiFile goes away.
+    const qint64 fileSize = midiFile.size();
+    const MidiByte *data = nullptr;
+    size_t size = fileSize;
+    QByteArray contents;
+
+    if (fileSize > 0)
+        data = midiFile.map(0, fileSize);
+    if (!data) {
+        contents = midiFile.readAll();
+        data = reinterpret_cast<const MidiByte *>(contents.constData());
+        size = contents.size();
+    }
+
+    std::vector<ParsedTrack> tracks;
 
     // The parsing process throws string exceptions back up here if we
     // run into trouble which we can then pass back out to whomever
     // called us using m_error and a nice bool.
     try {
         // Parse the MIDI header first.
-        parseHeader(midiFile);
-
-        // For each track chunk in the MIDI file.
-        for (unsigned track = 0; track < m_numberOfTracks; ++track) {
+        size_t pos = parseHeader(data, size);
 
-            RG_DEBUG << "read(): Parsing MIDI file track " << track;
+        // Find each track chunk in the MIDI file, skipping any alien
+        // chunks.
+        tracks.resize(m_numberOfTracks);
+        for (ParsedTrack &track : tracks) {
+            pos = findNextTrack(data, size, pos, track);
+        }
 
-            // Skip any alien chunks.
-            findNextTrack(midiFile);
+        parseTracks(tracks);
 
-            RG_DEBUG << "read(): Track has " << m_trackByteCount << " bytes";
+        // Add them to m_midiComposition in order.
+        for (ParsedTrack &track : tracks) {
+            if (!track.error.empty())
+                throw Exception(track.error);
 
-            // Read the track into m_midiComposition.
-            parseTrack(midiFile);
+            addTrack(track);
         }
 
     } catch (const Exception &e) {
         RG_WARNING << "read() - caught exception - " << e.getMessage();
 
+        // Free anything that didn't make it into m_midiComposition.
+        for (const ParsedTrack &track : tracks) {
+            for (const MidiTrack &midiTrack : track.tracks) {
+                for (MidiEvent *midiEvent : midiTrack) {
+                    delete midiEvent;
+                }
+            }
+        }
+
         m_error = e.getMessage();
         m_format = MIDI_FILE_NOT_LOADED;
         return false;
     }
 
-    midiFile->close();
-
     return true;
 }
 
-void
-MidiFile::parseHeader(std::ifstream *midiFile)
+size_t
+MidiFile::parseHeader(const MidiByte *data, size_t size)
 {
     // The basic MIDI header is 14 bytes.
-    std::string midiHeader = read(midiFile, 14);
-
-    if (midiHeader.size() < 14) {
+    if (size < 14) {
         RG_WARNING << "parseHeader() - file header undersized";
         throw Exception(qstrtostr(tr("Not a MIDI file")));
     }
 
-    if (midiHeader.compare(0, 4, MIDI_FILE_HEADER) != 0) {
+    if (memcmp(data, MIDI_FILE_HEADER, 4) != 0) {
         RG_WARNING << "parseHeader() - file header not found or malformed";
         throw Exception(qstrtostr(tr("Not a MIDI file")));
     }
 
-    long chunkSize = midiBytesToLong(midiHeader.substr(4, 4));
-    m_format = static_cast<FileFormatType>(
-            midiBytesToInt(midiHeader.substr(8, 2)));
-    m_numberOfTracks = midiBytesToInt(midiHeader.substr(10, 2));
-    m_timingDivision = midiBytesToInt(midiHeader.substr(12, 2));
+    const unsigned long chunkSize = bytesToLong(data + 4);
+    m_format = static_cast<FileFormatType>(bytesToInt(data + 8));
+    m_numberOfTracks = bytesToInt(data + 10);
+    m_timingDivision = bytesToInt(data + 12);
     m_timingFormat = MIDI_TIMING_PPQ_TIMEBASE;
 
     if (m_format == MIDI_SEQUENTIAL_TRACK_FILE) {
@@ -334,27 +316,122 @@ MidiFile::parseHeader(std::ifstream *midiFile)
         m_subframes = (m_timingDivision & 0xff);
     }
 
+    // Skip any remaining bytes in the header chunk.
+    // MIDI spec section 4, page 5: "[...] more parameters may be
+    // added to the MThd chunk in the future: it is important to
+    // read and honor the length, even if it is longer than 6."
     if (chunkSize > 6) {
-        // Skip any remaining bytes in the header chunk.
-        // MIDI spec section 4, page 5: "[...] more parameters may be
-        // added to the MThd chunk in the future: it is important to
-        // read and honor the length, even if it is longer than 6."
-        midiFile->seekg(chunkSize - 6, std::ios::cur);
+        if (chunkSize - 6 > size - 14)
+            throw Exception(qstrtostr(tr("Attempt to read past MIDI file end")));
+        return 14 + (chunkSize - 6);
     }
+
+    return 14;
+}
+
+/// Parses MIDI file tracks alongside the thread that called parseTracks().
+class MidiFile::TrackParserThread : public QThread
+{
+public:
+    TrackParserThread(std::vector<ParsedTrack> &tracks,
+                      std::atomic<size_t> &nextTrack,
+                      std::atomic<bool> &cancelled) :
+        m_tracks(tracks),
+        m_nextTrack(nextTrack),
+        m_cancelled(cancelled)
+    { }
+
+protected:
+    void run() override
+    {
+        while (!m_cancelled) {
+            const size_t track = m_nextTrack++;
+            if (track >= m_tracks.size())
+                break;
+            parseTrack(m_tracks[track]);
+        }
+    }
+
+private:
+    std::vector<ParsedTrack> &m_tracks;
+    std::atomic<size_t> &m_nextTrack;
+    std::atomic<bool> &m_cancelled;
+};
+
+void
+MidiFile::parseTracks(std::vector<ParsedTrack> &tracks)
+{
+    size_t totalSize = 0;
+    for (const ParsedTrack &track : tracks) {
+        totalSize += track.size;
+    }
+
+    // Tracks are independent of each other, so big files get a few
+    // threads to share them out.  This thread takes its share too, and
+    // looks after the progress dialog.
+    const int threadCount = (totalSize < a_parallelParseBytes) ? 0 :
+            std::min(static_cast<int>(tracks.size()),
+                     QThread::idealThreadCount()) - 1;
+
+    std::atomic<size_t> nextTrack(0);
+    std::atomic<bool> cancelled(false);
+
+    std::vector<TrackParserThread *> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        TrackParserThread *thread =
+                new TrackParserThread(tracks, nextTrack, cancelled);
+        thread->start();
+        threads.push_back(thread);
+    }
+
+    while (!cancelled) {
+        const size_t track = nextTrack++;
+        if (track >= tracks.size())
+            break;
+
+        parseTrack(tracks[track]);
+
+        // Update the progress dialog if one is connected.
+        if (m_progressDialog) {
+            if (m_progressDialog->wasCanceled()) {
+                cancelled = true;
+                break;
+            }
+
+            // This is the first 20% of the "reading" process.
+            const size_t tracksStarted =
+                    std::min(nextTrack.load(), tracks.size());
+            m_progressDialog->setValue(static_cast<int>(
+                    20 * tracksStarted / tracks.size()));
+        }
+
+        // Kick the event loop to make sure the UI doesn't become
+        // unresponsive during a long load.
+        qApp->processEvents();
+    }
+
+    for (TrackParserThread *thread : threads) {
+        thread->wait();
+        delete thread;
+    }
+
+    if (cancelled)
+        throw Exception(qstrtostr(tr("Cancelled by user")));
 }
 
 static const std::string defaultTrackName = "Imported MIDI";
 
 void
-MidiFile::parseTrack(std::ifstream *midiFile)
+MidiFile::parseTrack(ParsedTrack &parsedTrack)
 {
     // The term "Track" is overloaded in this routine.  The first
     // meaning is a track in the MIDI file.  That is what this routine
     // processes.  A single track from a MIDI file.  The second meaning
-    // is a track in m_midiComposition.  This is the most common usage.
-    // To improve clarity, "MIDI file track" will be used to refer to
-    // the first sense of the term.  Occasionally, "m_midiComposition
-    // track" will be used to refer to the second sense.
+    // is a track in m_midiComposition, which is what each entry in
+    // parsedTrack.tracks will become.  To improve clarity, "MIDI file
+    // track" will be used to refer to the first sense of the term.
+    // Occasionally, "m_midiComposition track" will be used to refer to
+    // the second sense.
 
     // Absolute time of the last event on any track.
     unsigned long eventTime = 0;
@@ -363,22 +440,23 @@ MidiFile::parseTrack(std::ifstream *midiFile)
     // all on the same channel.  If we find events on more than one
     // channel, we increment lastTrackNum and record the mapping from
     // channel to trackNum in channelToTrack.
-    TrackId lastTrackNum = m_midiComposition.size();
+    size_t lastTrackNum = 0;
+
+    std::vector<MidiTrack> &tracks = parsedTrack.tracks;
+    tracks.resize(1);
+    parsedTrack.channels.assign(1, -1);
 
-    // MIDI channel to m_midiComposition track.
-    // Note: This would be a vector<TrackId> but TrackId is unsigned
-    //       and we need -1 to indicate "not yet used"
+    // MIDI channel to parsedTrack.tracks index.
     std::vector<int> channelToTrack(16, -1);
 
     // This is used to store the last absolute time found on each track,
     // allowing us to modify delta-times correctly when separating events
     // out from one to multiple tracks
-    std::map<int /*track*/, unsigned long /*lastTime*/> lastEventTime;
-    lastEventTime[lastTrackNum] = 0;
+    std::vector<unsigned long> lastEventTime(1, 0);
 
     // Meta-events don't have a channel, so we place them in a fixed
     // track number instead
-    TrackId metaTrack = lastTrackNum;
+    const size_t metaTrack = 0;
 
     std::string trackName = defaultTrackName;
     std::string instrumentName;
@@ -388,208 +466,213 @@ MidiFile::parseTrack(std::ifstream *midiFile)
 
     bool firstTrack = true;
 
-    RG_DEBUG << "parseTrack(): last track number is " << lastTrackNum;
-
-    // While there is still data to read in the MIDI file track.
-    // Why "m_trackByteCount > 1" instead of "m_trackByteCount > 0"?  Since
-    // no event and its associated delta time can fit in just one
-    // byte, a single remaining byte in the MIDI file track has to be padding.
-    // This is obscure and non-standard, but such files do exist; ordinarily
-    // there should be no bytes in the MIDI file track after the last event.
-    while (!midiFile->eof()  &&  m_trackByteCount > 1) {
-
-        unsigned long deltaTime = readNumber(midiFile);
+    TrackReader reader(parsedTrack.data, parsedTrack.size);
 
-        RG_DEBUG << "parseTrack(): read delta time " << deltaTime;
+    try {
 
-        // Compute the absolute time for the event.
-        eventTime += deltaTime;
+        // While there is still data to read in the MIDI file track.
+        // Why "remaining() > 1" instead of "remaining() > 0"?  Since
+        // no event and its associated delta time can fit in just one
+        // byte, a single remaining byte in the MIDI file track has to be padding.
+        // This is obscure and non-standard, but such files do exist; ordinarily
+        // there should be no bytes in the MIDI file track after the last event.
+        while (reader.remaining() > 1) {
 
-        // Get a single byte
-        MidiByte midiByte = read(midiFile);
+            unsigned long deltaTime = reader.readNumber();
 
-        MidiByte statusByte = 0;
-        MidiByte data1 = 0;
+            RG_DEBUG << "parseTrack(): read delta time " << deltaTime;
 
-        // If this is a status byte, use it.
-        if (midiByte & MIDI_STATUS_BYTE_MASK) {
-            RG_DEBUG << "parseTrack(): have new status byte" << QString("0x%1").arg(midiByte, 0, 16);
+            // Compute the absolute time for the event.
+            eventTime += deltaTime;
 
-            statusByte = midiByte;
-            data1 = read(midiFile);
-        } else {  // Use running status.
-            // If we haven't seen a status byte yet, fail.
-            if (runningStatus < 0)
-                throw Exception(qstrtostr(tr("Running status used for first event in track")));
+            // Get a single byte
+            MidiByte midiByte = reader.readByte();
 
-            statusByte = static_cast<MidiByte>(runningStatus);
-            data1 = midiByte;
+            MidiByte statusByte = 0;
+            MidiByte data1 = 0;
 
-            RG_DEBUG << "parseTrack(): using running status (byte " << QString("0x%1").arg(midiByte, 0, 16) << " found)";
-        }
+            // If this is a status byte, use it.
+            if (midiByte & MIDI_STATUS_BYTE_MASK) {
+                RG_DEBUG << "parseTrack(): have new status byte" << QString("0x%1").arg(midiByte, 0, 16);
 
-        if (statusByte == MIDI_FILE_META_EVENT) {
+                statusByte = midiByte;
+                data1 = reader.readByte();
+            } else {  // Use running status.
+                // If we haven't seen a status byte yet, fail.
+                if (runningStatus < 0)
+                    throw Exception(qstrtostr(tr("Running status used for first event in track")));
 
-            MidiByte metaEventCode = data1;
-            unsigned messageLength = readNumber(midiFile);
+                statusByte = static_cast<MidiByte>(runningStatus);
+                data1 = midiByte;
 
-            RG_DEBUG << "parseTrack(): Meta event of type " << QString("0x%1").arg(metaEventCode, 0, 16) << " and " << messageLength << " bytes found";
+                RG_DEBUG << "parseTrack(): using running status (byte " << QString("0x%1").arg(midiByte, 0, 16) << " found)";
+            }
 
-            std::string metaMessage = read(midiFile, messageLength);
+            if (statusByte == MIDI_FILE_META_EVENT) {
 
-            // Compute the difference between this event and the previous
-            // event on this track.
-            deltaTime = eventTime - lastEventTime[metaTrack];
-            // Store the absolute time of the last event on this track.
-            lastEventTime[metaTrack] = eventTime;
+                MidiByte metaEventCode = data1;
+                unsigned messageLength = reader.readNumber();
 
-            // create and store our event
-            MidiEvent *e = new MidiEvent(deltaTime,
-                                         MIDI_FILE_META_EVENT,
-                                         metaEventCode,
-                                         metaMessage);
-            m_midiComposition[metaTrack].push_back(e);
+                RG_DEBUG << "parseTrack(): Meta event of type " << QString("0x%1").arg(metaEventCode, 0, 16) << " and " << messageLength << " bytes found";
 
-            if (metaEventCode == MIDI_TRACK_NAME)
-                trackName = metaMessage;
-            else if (metaEventCode == MIDI_INSTRUMENT_NAME)
-                instrumentName = metaMessage;
+                std::string metaMessage = reader.readString(messageLength);
 
-            // Get the next event.
-            continue;
-        }
+                // Compute the difference between this event and the previous
+                // event on this track.
+                deltaTime = eventTime - lastEventTime[metaTrack];
+                // Store the absolute time of the last event on this track.
+                lastEventTime[metaTrack] = eventTime;
 
-        runningStatus = statusByte;
-
-        int channel = (statusByte & MIDI_CHANNEL_NUM_MASK);
-
-        // If this channel hasn't been seen yet in this MIDI file track
-        if (channelToTrack[channel] == -1) {
-            // If this is the first m_midiComposition track we've
-            // used
-            if (firstTrack) {
-                // We've already allocated an m_midiComposition track for
-                // the first channel we encounter.  Use it.
-                firstTrack = false;
-            } else {  // We need a new track.
-                // Allocate a new track for this channel.
-                ++lastTrackNum;
-                lastEventTime[lastTrackNum] = 0;
+                // create and store our event
+                MidiEvent *e = new MidiEvent(deltaTime,
+                                             MIDI_FILE_META_EVENT,
+                                             metaEventCode,
+                                             metaMessage);
+                tracks[metaTrack].push_back(e);
+
+                if (metaEventCode == MIDI_TRACK_NAME)
+                    trackName = metaMessage;
+                else if (metaEventCode == MIDI_INSTRUMENT_NAME)
+                    instrumentName = metaMessage;
+
+                // Get the next event.
+                continue;
             }
 
-            RG_DEBUG << "parseTrack(): new channel map entry: channel " << channel << " -> track " << lastTrackNum;
+            runningStatus = statusByte;
+
+            int channel = (statusByte & MIDI_CHANNEL_NUM_MASK);
+
+            // If this channel hasn't been seen yet in this MIDI file track
+            if (channelToTrack[channel] == -1) {
+                // If this is the first m_midiComposition track we've
+                // used
+                if (firstTrack) {
+                    // We've already allocated an m_midiComposition track for
+                    // the first channel we encounter.  Use it.
+                    firstTrack = false;
+                } else {  // We need a new track.
+                    // Allocate a new track for this channel.
+                    ++lastTrackNum;
+                    tracks.resize(lastTrackNum + 1);
+                    parsedTrack.channels.resize(lastTrackNum + 1);
+                    lastEventTime.push_back(0);
+                }
 
-            channelToTrack[channel] = lastTrackNum;
-            m_trackChannelMap[lastTrackNum] = channel;
-        }
+                RG_DEBUG << "parseTrack(): new channel map entry: channel " << channel << " -> track " << lastTrackNum;
 
-        TrackId trackNum = channelToTrack[channel];
+                channelToTrack[channel] = lastTrackNum;
+                parsedTrack.channels[lastTrackNum] = channel;
+            }
 
-#ifdef DEBUG
-        {
-            static int prevTrackNum = -1;
-            static int prevChannel = -1;
+            const size_t trackNum = channelToTrack[channel];
 
-            // If we're on a different track or channel
-            if (prevTrackNum != static_cast<int>(trackNum)  ||
-                prevChannel != channel) {
+            // Compute the difference between this event and the previous
+            // event on this track.
+            deltaTime = eventTime - lastEventTime[trackNum];
+            // Store the absolute time of the last event on this track.
+            lastEventTime[trackNum] = eventTime;
 
-                // Report it for debugging.
-                RG_DEBUG << "parseTrack(): track number for channel " << channel << " is " << trackNum;
+            switch (statusByte & MIDI_MESSAGE_TYPE_MASK) {
+            case MIDI_NOTE_ON:        // These events have two data bytes.
+            case MIDI_NOTE_OFF:
+            case MIDI_POLY_AFTERTOUCH:
+            case MIDI_CTRL_CHANGE:
+            case MIDI_PITCH_BEND:
+                {
+                    MidiByte data2 = reader.readByte();
 
-                prevTrackNum = trackNum;
-                prevChannel = channel;
-            }
-        }
-#endif
+                    // create and store our event
+                    MidiEvent *midiEvent =
+                            new MidiEvent(deltaTime, statusByte, data1, data2);
+                    tracks[trackNum].push_back(midiEvent);
 
-        // Compute the difference between this event and the previous
-        // event on this track.
-        deltaTime = eventTime - lastEventTime[trackNum];
-        // Store the absolute time of the last event on this track.
-        lastEventTime[trackNum] = eventTime;
-
-        switch (statusByte & MIDI_MESSAGE_TYPE_MASK) {
-        case MIDI_NOTE_ON:        // These events have two data bytes.
-        case MIDI_NOTE_OFF:
-        case MIDI_POLY_AFTERTOUCH:
-        case MIDI_CTRL_CHANGE:
-        case MIDI_PITCH_BEND:
-            {
-                MidiByte data2 = read(midiFile);
+                    if (statusByte != MIDI_PITCH_BEND) {
+                        RG_DEBUG << "parseTrack(): MIDI event for channel " << channel + 1 << " (track " << trackNum << ')';
+                        RG_DEBUG << *midiEvent;
+                    }
+                }
+                break;
 
-                // create and store our event
-                MidiEvent *midiEvent =
-                        new MidiEvent(deltaTime, statusByte, data1, data2);
-                m_midiComposition[trackNum].push_back(midiEvent);
+            case MIDI_PROG_CHANGE:    // These events have a single data byte.
+            case MIDI_CHNL_AFTERTOUCH:
+                {
+                    RG_DEBUG << "parseTrack(): Program change (Cn) or channel aftertouch (Dn): time " << deltaTime << ", code " << QString("0x%1").arg(statusByte, 0, 16) << ", data " << (int) data1  << " going to track " << trackNum;
 
-                if (statusByte != MIDI_PITCH_BEND) {
-                    RG_DEBUG << "parseTrack(): MIDI event for channel " << channel + 1 << " (track " << trackNum << ')';
-                    RG_DEBUG << *midiEvent;
+                    // create and store our event
+                    MidiEvent *midiEvent =
+                            new MidiEvent(deltaTime, statusByte, data1);
+                    tracks[trackNum].push_back(midiEvent);
                 }
-            }
-            break;
+                break;
 
-        case MIDI_PROG_CHANGE:    // These events have a single data byte.
-        case MIDI_CHNL_AFTERTOUCH:
-            {
-                RG_DEBUG << "parseTrack(): Program change (Cn) or channel aftertouch (Dn): time " << deltaTime << ", code " << QString("0x%1").arg(statusByte, 0, 16) << ", data " << (int) data1  << " going to track " << trackNum;
+            case MIDI_SYSTEM_EXCLUSIVE:
+                {
+                    unsigned messageLength = reader.readNumber(data1);
 
-                // create and store our event
-                MidiEvent *midiEvent =
-                        new MidiEvent(deltaTime, statusByte, data1);
-                m_midiComposition[trackNum].push_back(midiEvent);
-            }
-            break;
+                    RG_DEBUG << "parseTrack(): SysEx of " << messageLength << " bytes found";
 
-        case MIDI_SYSTEM_EXCLUSIVE:
-            {
-                unsigned messageLength = readNumber(midiFile, data1);
+                    std::string sysex = reader.readString(messageLength);
 
-                RG_DEBUG << "parseTrack(): SysEx of " << messageLength << " bytes found";
+                    if (sysex.empty()  ||
+                        MidiByte(sysex[sysex.length() - 1]) !=
+                            MIDI_END_OF_EXCLUSIVE) {
+                        RG_WARNING << "parseTrack() - malformed or unsupported SysEx type";
+                        continue;
+                    }
 
-                std::string sysex = read(midiFile, messageLength);
+                    // Chop off the EOX.
+                    sysex = sysex.substr(0, sysex.length() - 1);
 
-                if (MidiByte(sysex[sysex.length() - 1]) !=
-                        MIDI_END_OF_EXCLUSIVE) {
-                    RG_WARNING << "parseTrack() - malformed or unsupported SysEx type";
-                    continue;
+                    // create and store our event
+                    MidiEvent *midiEvent =
+                            new MidiEvent(deltaTime,
+                                          MIDI_SYSTEM_EXCLUSIVE,
+                                          sysex);
+                    tracks[trackNum].push_back(midiEvent);
                 }
+                break;
 
-                // Chop off the EOX.
-                sysex = sysex.substr(0, sysex.length() - 1);
+            case MIDI_END_OF_EXCLUSIVE:
+                RG_WARNING << "parseTrack() - Found a stray MIDI_END_OF_EXCLUSIVE";
+                break;
 
-                // create and store our event
-                MidiEvent *midiEvent =
-                        new MidiEvent(deltaTime,
-                                      MIDI_SYSTEM_EXCLUSIVE,
-                                      sysex);
-                m_midiComposition[trackNum].push_back(midiEvent);
+            default:
+                RG_WARNING << "parseTrack() - Unsupported MIDI Status Byte:  " << QString("0x%1").arg(statusByte, 0, 16);
+                break;
             }
-            break;
-
-        case MIDI_END_OF_EXCLUSIVE:
-            RG_WARNING << "parseTrack() - Found a stray MIDI_END_OF_EXCLUSIVE";
-            break;
-
-        default:
-            RG_WARNING << "parseTrack() - Unsupported MIDI Status Byte:  " << QString("0x%1").arg(statusByte, 0, 16);
-            break;
         }
-    }
 
-    // If the MIDI file track has a padding byte, read and discard it
-    // to make sure that the stream is positioned at the beginning of
-    // the following MIDI file track (if there is one.)
-    if (m_trackByteCount == 1)
-        midiFile->ignore();
+    } catch (const Exception &e) {
+        // This may be on a worker thread, so read() reports it.
+        parsedTrack.error = e.getMessage();
+        return;
+    }
 
     if (instrumentName != "")
         trackName += " (" + instrumentName + ")";
 
-    // Fill out the Track Names
-    for (TrackId i = metaTrack; i <= lastTrackNum; ++i)
-        m_trackNames.push_back(trackName);
+    parsedTrack.trackName = trackName;
+}
+
+void
+MidiFile::addTrack(ParsedTrack &parsedTrack)
+{
+    const TrackId firstTrack = m_midiComposition.size();
+
+    for (size_t i = 0; i < parsedTrack.tracks.size(); ++i) {
+        const TrackId trackId = firstTrack + i;
+
+        m_midiComposition[trackId].swap(parsedTrack.tracks[i]);
+
+        if (parsedTrack.channels[i] >= 0)
+            m_trackChannelMap[trackId] = parsedTrack.channels[i];
+
+        // Fill out the Track Names
+        m_trackNames.push_back(parsedTrack.trackName);
+    }
+
+    parsedTrack.tracks.clear();
 }
 
 bool
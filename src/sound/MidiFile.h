@@ -123,50 +123,57 @@ private:
     // *** Standard MIDI File to Rosegarden
 
     /// Read a MIDI file into m_midiComposition.
+    /**
+     * The whole file is mapped (or read in one go) and parsed straight
+     * from memory.
+     */
     bool read(const QString &filename);
-    void parseHeader(std::ifstream *midiFile);
-    /// Convert a track to events in m_midiComposition.
-    void parseTrack(std::ifstream *midiFile);
+    /// Parse the MThd chunk.  Returns the offset of the chunk after it.
+    size_t parseHeader(const MidiByte *data, size_t size);
     // m_midiComposition track to MIDI channel.
     std::map<TrackId, int /*channel*/> m_trackChannelMap;
     // Names for each track.
     std::vector<std::string> m_trackNames;
-    /// Find the next track chunk and set m_trackByteCount.
-    void findNextTrack(std::ifstream *midiFile);
+
+    /// A MIDI file track and the events parsed from it.
+    struct ParsedTrack
+    {
+        /// The MTrk chunk's data.
+        const MidiByte *data = nullptr;
+        size_t size = 0;
+
+        /// Events for each channel found, in the order they were found.
+        /**
+         * Meta-events go in the first, along with the first channel.
+         * These become tracks in m_midiComposition.
+         */
+        std::vector<MidiTrack> tracks;
+        /// MIDI channel for each of tracks, or -1 if there were none.
+        std::vector<int> channels;
+        std::string trackName;
+
+        /// Set if the track couldn't be parsed.
+        std::string error;
+    };
+    /// Find the next track chunk at or after offset pos.
+    /**
+     * Returns the offset of the chunk after it.
+     */
+    size_t findNextTrack(const MidiByte *data, size_t size, size_t pos,
+                         ParsedTrack &track);
+    /// Parse the tracks, on worker threads if they are big enough.
+    void parseTracks(std::vector<ParsedTrack> &tracks);
+    class TrackParserThread;
+    /// Convert a MIDI file track's data to events.  Thread-safe.
+    static void parseTrack(ParsedTrack &track);
+    /// Append a parsed MIDI file track's events to m_midiComposition.
+    void addTrack(ParsedTrack &track);
     /// Combine each note-on/note-off pair into a single note event with a duration.
     void consolidateNoteEvents(TrackId trackId);
     /// Configure the Instrument based on events in Segment at time 0.
     static void configureInstrument(
             Track *track, Segment *segment, Instrument *instrument);
 
-    // Read
-    /// Read a "variable-length quantity" from the MIDI byte stream.
-    /**
-     * In case the first byte has already been read, it can be sent
-     * in as firstByte.
-     */
-    long readNumber(std::ifstream *midiFile, int firstByte = -1);
-    MidiByte read(std::ifstream *midiFile);
-    std::string read(std::ifstream *midiFile,
-                     unsigned long numberOfBytes);
-
-    // Conversion
-    int midiBytesToInt(const std::string &bytes);
-    long midiBytesToLong(const std::string &bytes);
-
-    size_t m_fileSize;
-    /// Number of bytes left to read in the current track.
-    long m_trackByteCount;
-    /// Allow decrementing of m_trackByteCount while reading.
-    /**
-     * Set to true while processing a track.  false while processing other
-     * parts of the file.
-     */
-    bool m_decrementCount;
-
-    /// Counter for kicking the message loop.
-    int m_bytesRead;
-
     std::string m_error;
 
     // *** Rosegarden to Standard MIDI File
@@ -17,8 +17,6 @@
 #include "base/MidiProgram.h"  // For MidiByte
 #include "base/RealTime.h"
 
-#include <set>
-
 namespace Rosegarden
 {
 
@@ -49,15 +47,5 @@ struct NoteOffEvent
     InstrumentId instrumentId;
 };
 
-struct NoteOffEventCmp
-{
-    bool operator()(const NoteOffEvent *lhs, const NoteOffEvent *rhs) const
-    {
-        return (lhs->realTime < rhs->realTime);
-    }
-};
-
-typedef std::multiset<NoteOffEvent *, NoteOffEventCmp> NoteOffQueue;
-
 
 }
@@ -0,0 +1,354 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+/*
+  Rosegarden
+  A sequencer and musical notation editor.
+  Copyright 2020-2023 the Rosegarden development team.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.  See the file
+  COPYING included with this distribution for more information.
+*/
+
+#include "NoteOffQueue.h"
+
+#include <algorithm>
+
+
+namespace Rosegarden
+{
+
+
+NoteOffQueue::NoteOffQueue() :
+    m_now(0),
+    m_size(0),
+    m_free(nullptr)
+{
+    std::fill(&m_slots[0][0], &m_slots[0][0] + Levels * Slots, nullptr);
+    std::fill(&m_occupied[0][0], &m_occupied[0][0] + Levels * BitmapWords,
+              uint64_t(0));
+    std::fill(m_index, m_index + IndexSize, nullptr);
+
+    grow();
+}
+
+NoteOffQueue::~NoteOffQueue()
+{
+}
+
+int64_t
+NoteOffQueue::toTick(const RealTime &time)
+{
+    if (time < RealTime::zero())
+        return 0;
+
+    return int64_t(time.sec) * 1000 + time.nsec / 1000000;
+}
+
+void
+NoteOffQueue::grow()
+{
+    Node *chunk = new Node[ChunkSize];
+    m_chunks.push_back(std::unique_ptr<Node[]>(chunk));
+
+    for (int i = 0; i < ChunkSize; ++i) {
+        chunk[i].next = m_free;
+        m_free = &chunk[i];
+    }
+}
+
+void
+NoteOffQueue::insert(const NoteOffEvent &noteOff)
+{
+    if (!m_free)
+        grow();
+
+    Node *node = m_free;
+    m_free = node->next;
+
+    node->event = noteOff;
+
+    // With nothing pending, the wheel can go back as far as needed.
+    if (m_size == 0)
+        m_now = std::min(m_now, toTick(noteOff.realTime));
+
+    link(node);
+
+    Node *&head = m_index[toIndex(noteOff.pitch, noteOff.channel)];
+    node->indexPrev = nullptr;
+    node->indexNext = head;
+    if (head)
+        head->indexPrev = node;
+    head = node;
+
+    ++m_size;
+}
+
+void
+NoteOffQueue::link(Node *node)
+{
+    int64_t tick = std::max(toTick(node->event.realTime), m_now);
+    // Too far ahead, so park it in the top level for another time round.
+    if (tick - m_now >= Horizon)
+        tick = m_now + Horizon - 1;
+
+    // The lowest level that reaches far enough.
+    const int64_t delta = tick - m_now;
+    int level = 0;
+    while ((delta >> ((level + 1) * SlotBits)) != 0)
+        ++level;
+
+    const int slot = int((tick >> (level * SlotBits)) & SlotMask);
+    node->level = level;
+    node->slot = slot;
+
+    Node *&head = m_slots[level][slot];
+    node->prev = nullptr;
+    node->next = head;
+    if (head)
+        head->prev = node;
+    head = node;
+
+    m_occupied[level][slot / 64] |= uint64_t(1) << (slot % 64);
+}
+
+void
+NoteOffQueue::unlink(Node *node)
+{
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        m_slots[node->level][node->slot] = node->next;
+        if (!node->next) {
+            m_occupied[node->level][node->slot / 64] &=
+                    ~(uint64_t(1) << (node->slot % 64));
+        }
+    }
+    if (node->next)
+        node->next->prev = node->prev;
+}
+
+void
+NoteOffQueue::remove(Node *node)
+{
+    unlink(node);
+
+    if (node->indexPrev) {
+        node->indexPrev->indexNext = node->indexNext;
+    } else {
+        m_index[toIndex(node->event.pitch, node->event.channel)] =
+                node->indexNext;
+    }
+    if (node->indexNext)
+        node->indexNext->indexPrev = node->indexPrev;
+
+    node->next = m_free;
+    m_free = node;
+
+    --m_size;
+}
+
+NoteOffQueue::Node *
+NoteOffQueue::detachAll()
+{
+    Node *list = nullptr;
+
+    for (int level = 0; level < Levels; ++level) {
+        for (int slot = findOccupied(level, 0);
+             slot < Slots;
+             slot = findOccupied(level, slot + 1)) {
+            Node *node = m_slots[level][slot];
+            while (node) {
+                Node *next = node->next;
+                node->next = list;
+                list = node;
+                node = next;
+            }
+            m_slots[level][slot] = nullptr;
+        }
+        std::fill(m_occupied[level], m_occupied[level] + BitmapWords,
+                  uint64_t(0));
+    }
+
+    return list;
+}
+
+int
+NoteOffQueue::findOccupied(int level, int slot) const
+{
+    while (slot < Slots) {
+        const int word = slot / 64;
+        const uint64_t bits = m_occupied[level][word] >> (slot % 64);
+        if (bits)
+            return slot + __builtin_ctzll(bits);
+        slot = (word + 1) * 64;
+    }
+
+    return Slots;
+}
+
+void
+NoteOffQueue::cascade()
+{
+    // The highest level whose slot starts now.  Higher levels first,
+    // though as everything is relinked relative to m_now it makes no
+    // difference.
+    int top = 0;
+    while (top + 1 < Levels  &&
+           (m_now & ((int64_t(1) << ((top + 1) * SlotBits)) - 1)) == 0)
+        ++top;
+
+    for (int level = top; level > 0; --level) {
+        const int slot = int((m_now >> (level * SlotBits)) & SlotMask);
+
+        Node *node = m_slots[level][slot];
+        m_slots[level][slot] = nullptr;
+        m_occupied[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+
+        while (node) {
+            Node *next = node->next;
+            link(node);
+            node = next;
+        }
+    }
+}
+
+void
+NoteOffQueue::advance(int64_t target)
+{
+    const int slot = int(m_now & SlotMask);
+    const int next = findOccupied(0, slot + 1);
+
+    // Slots before this one are for the next time round, so with nothing
+    // after it, go to the next cascade.
+    int64_t to = (next < Slots) ? m_now - slot + next : (m_now | SlotMask) + 1;
+    if (to > target)
+        to = target;
+
+    m_now = to;
+
+    if ((m_now & SlotMask) == 0)
+        cascade();
+}
+
+NoteOffQueue::Node *
+NoteOffQueue::popDueNode(const RealTime &time, bool inclusive)
+{
+    const int64_t target = toTick(time);
+
+    // Nothing to move, so just catch up.
+    if (m_size == 0) {
+        m_now = target;
+        return nullptr;
+    }
+
+    while (true) {
+        Node *node = m_slots[0][m_now & SlotMask];
+
+        // Everything in the slots before target is due.
+        if (m_now < target) {
+            if (node)
+                return node;
+            advance(target);
+            continue;
+        }
+
+        // This slot may also have some that aren't.
+        for (; node; node = node->next) {
+            if (node->event.realTime < time  ||
+                (inclusive  &&  node->event.realTime == time))
+                return node;
+        }
+
+        return nullptr;
+    }
+}
+
+bool
+NoteOffQueue::popDue(const RealTime &time, NoteOffEvent &noteOff)
+{
+    Node *node = popDueNode(time, true);
+    if (!node)
+        return false;
+
+    noteOff = node->event;
+    remove(node);
+
+    return true;
+}
+
+bool
+NoteOffQueue::pop(NoteOffEvent &noteOff)
+{
+    if (m_size == 0)
+        return false;
+
+    // Roughly earliest first.
+    int slot = findOccupied(0, int(m_now & SlotMask));
+    if (slot == Slots)
+        slot = findOccupied(0, 0);
+
+    int level = 0;
+    while (slot == Slots) {
+        ++level;
+        slot = findOccupied(level, 0);
+    }
+
+    Node *node = m_slots[level][slot];
+    noteOff = node->event;
+    remove(node);
+
+    return true;
+}
+
+void
+NoteOffQueue::dropBefore(const RealTime &time)
+{
+    while (Node *node = popDueNode(time, false)) {
+        remove(node);
+    }
+}
+
+bool
+NoteOffQueue::drop(MidiByte pitch, MidiByte channel, InstrumentId instrumentId)
+{
+    Node *earliest = nullptr;
+
+    for (Node *node = m_index[toIndex(pitch, channel)];
+         node;
+         node = node->indexNext) {
+        if (node->event.pitch != pitch  ||
+            node->event.channel != channel  ||
+            node->event.instrumentId != instrumentId)
+            continue;
+
+        if (!earliest  ||  node->event.realTime < earliest->event.realTime)
+            earliest = node;
+    }
+
+    if (!earliest)
+        return false;
+
+    remove(earliest);
+
+    return true;
+}
+
+void
+NoteOffQueue::clear()
+{
+    Node *node = detachAll();
+    while (node) {
+        Node *next = node->next;
+        node->next = m_free;
+        m_free = node;
+        node = next;
+    }
+
+    std::fill(m_index, m_index + IndexSize, nullptr);
+    m_size = 0;
+}
+
+
+}
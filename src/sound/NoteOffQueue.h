@@ -0,0 +1,198 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+/*
+  Rosegarden
+  A sequencer and musical notation editor.
+  Copyright 2020-2023 the Rosegarden development team.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or (at your option) any later version.  See the file
+  COPYING included with this distribution for more information.
+*/
+
+#pragma once
+
+#include "NoteOffEvent.h"
+
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Rosegarden
+{
+
+
+/// Pending MIDI note-offs, by time and by (channel, pitch).
+/**
+ * A hierarchical timer wheel with millisecond ticks.  There are four
+ * levels of 256 slots, each slot a list of note-offs.  Level 0 holds
+ * note-offs due in the next 256ms, one slot per tick, level 1 those due
+ * in the next 65s, 256ms per slot, and so on.  As the wheel turns, a
+ * higher level slot is moved down a level when its time comes
+ * ("cascading").  So insert() and popping the next due note-off are
+ * O(1), however many note-offs are pending.
+ *
+ * Each note-off is also on a list per (channel, pitch) so that drop()
+ * only looks at note-offs for the same note.
+ *
+ * Note-offs live in a pool that only grows, so once it is big enough
+ * there is no allocation per note.
+ *
+ * Note-offs due in the same millisecond come out in no particular order.
+ * Note-offs more than about 49 days away go round the top level again.
+ *
+ * Not thread-safe.
+ */
+class NoteOffQueue
+{
+public:
+    NoteOffQueue();
+    ~NoteOffQueue();
+
+    bool empty() const  { return m_size == 0; }
+    size_t size() const  { return m_size; }
+
+    void insert(const NoteOffEvent &noteOff);
+
+    /// Remove the next note-off with realTime <= time.
+    /**
+     * Returns false if there isn't one.
+     */
+    bool popDue(const RealTime &time, NoteOffEvent &noteOff);
+
+    /// Remove any note-off, due or not.
+    /**
+     * Returns false if empty.
+     */
+    bool pop(NoteOffEvent &noteOff);
+
+    /// Remove all note-offs with realTime < time.
+    void dropBefore(const RealTime &time);
+
+    /// Remove the earliest note-off for this note.
+    /**
+     * Returns false if there isn't one.
+     */
+    bool drop(MidiByte pitch, MidiByte channel, InstrumentId instrumentId);
+
+    /// Remove all note-offs.
+    void clear();
+
+    /// Change the time of every note-off.
+    /**
+     * fn is called with each NoteOffEvent and may change its realTime.
+     * Rebuilds the wheel, so this is O(n).
+     */
+    template <typename Fn>
+    void retime(Fn fn);
+
+private:
+    // Not provided.
+    NoteOffQueue(const NoteOffQueue &);
+    NoteOffQueue &operator=(const NoteOffQueue &);
+
+    static constexpr int Levels = 4;
+    static constexpr int SlotBits = 8;
+    static constexpr int Slots = 1 << SlotBits;
+    static constexpr int64_t SlotMask = Slots - 1;
+    static constexpr int BitmapWords = Slots / 64;
+    /// One more than the furthest ahead the wheel can hold, in ticks.
+    static constexpr int64_t Horizon = int64_t(1) << (Levels * SlotBits);
+    /// Channel and pitch, 4 + 7 bits.
+    static constexpr int IndexSize = 16 * 128;
+    static constexpr int ChunkSize = 1024;
+
+    struct Node
+    {
+        NoteOffEvent event;
+        /// Which slot it is in.
+        int level;
+        int slot;
+
+        /// Slot list.  Also the free list.
+        Node *prev;
+        Node *next;
+
+        /// (channel, pitch) list.
+        Node *indexPrev;
+        Node *indexNext;
+    };
+
+    /// Ticks are milliseconds.  Negative times are tick 0.
+    static int64_t toTick(const RealTime &time);
+    static int toIndex(MidiByte pitch, MidiByte channel)
+            { return (channel & 0x0f) << 7 | (pitch & 0x7f); }
+
+    /// Where the wheel has got to.
+    /**
+     * The level 0 slot for m_now also holds anything that was already
+     * overdue when it was inserted.
+     */
+    int64_t m_now;
+
+    Node *m_slots[Levels][Slots];
+    /// Which slots are non-empty.
+    uint64_t m_occupied[Levels][BitmapWords];
+
+    Node *m_index[IndexSize];
+
+    size_t m_size;
+
+    Node *m_free;
+    std::vector<std::unique_ptr<Node[]>> m_chunks;
+    void grow();
+
+    /// Put node in the right slot for its time, relative to m_now.
+    void link(Node *node);
+    void unlink(Node *node);
+    /// Take a node off its slot and index lists and free it.
+    void remove(Node *node);
+
+    /// Take every node off the wheel, as a list through next.
+    Node *detachAll();
+
+    /// First occupied slot in level, from slot on, or Slots if none.
+    int findOccupied(int level, int slot) const;
+
+    /// Turn the wheel towards target, stopping at anything to do.
+    /**
+     * Stops at the next non-empty level 0 slot, or the next cascade,
+     * or target, whichever is first.
+     */
+    void advance(int64_t target);
+    /// Move the slots for m_now down from the higher levels.
+    void cascade();
+
+    /// Remove the next note-off before (or at, if inclusive) time.
+    Node *popDueNode(const RealTime &time, bool inclusive);
+};
+
+template <typename Fn>
+void
+NoteOffQueue::retime(Fn fn)
+{
+    Node *first = detachAll();
+    if (!first)
+        return;
+
+    // The wheel is empty, so it can restart from the earliest.
+    m_now = INT64_MAX;
+    for (Node *node = first; node; node = node->next) {
+        fn(node->event);
+        const int64_t tick = toTick(node->event.realTime);
+        if (tick < m_now)
+            m_now = tick;
+    }
+
+    Node *node = first;
+    while (node) {
+        Node *next = node->next;
+        link(node);
+        node = next;
+    }
+}
+
+
+}
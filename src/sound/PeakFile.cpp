@@ -14,7 +14,7 @@
 
 #define RG_MODULE_STRING "[PeakFile]"
 
-#include <algorithm>  // std::max()
+#include <algorithm>  // std::min(), std::max()
 #include <cmath>  // std::fabs()
 #include <unistd.h>  // usleep()
 #include <iostream>
@@ -25,9 +25,11 @@
 #include <QDateTime>
 #include <QProgressDialog>
 #include <QStringList>
+#include <QThread>
 
 #include "PeakFile.h"
 #include "AudioFile.h"
+#include "AudioKernels.h"
 //#include "base/Profiler.h"
 #include "misc/Debug.h"
 #include "misc/Strings.h"
@@ -51,6 +53,12 @@ static const float SAMPLE_MAX_16BIT = (float)(0xffff/2);
 static const float SAMPLE_MAX_24BIT = (float)(0xffffff/2);
 static const char AUDIO_BWF_PEAK_ID[] = "levl";  // BWF peak chunk id
 
+// Each level of the peak pyramid has a peak frame for every
+// PEAK_DECIMATION of the level below.  Levels stop once they are down to
+// MIN_LEVEL_PEAKS, which is cheap enough to read at any zoom.
+static const int PEAK_DECIMATION = 4;
+static const int MIN_LEVEL_PEAKS = 128;
+
 namespace Rosegarden
 {
 
@@ -66,12 +74,14 @@ PeakFile::PeakFile(AudioFile *audioFile) :
         m_positionPeakOfPeaks(0),
         m_offsetToPeaks(0),
         m_bodyBytes(0),
+        m_decimation(PEAK_DECIMATION),
         m_modificationTime(QDate(1970, 1, 1), QTime(0, 0, 0)),
         m_chunkStartPosition(0),
         m_lastPreviewStartTime(0, 0),
         m_lastPreviewEndTime(0, 0),
         m_lastPreviewWidth( -1),
-        m_lastPreviewShowMinima(false)
+        m_lastPreviewShowMinima(false),
+        m_cancelled(false)
 {
 }
 
@@ -167,6 +177,30 @@ PeakFile::parseHeader()
                                      dateTime[5].toInt(),
                                      dateTime[6].toInt()));
 
+    // The peak pyramid, in what BWF calls reserved space.  Older peak
+    // files have zeros here and so just the one level.
+    int extraLevels = getIntegerFromLittleEndian(header.substr(68, 4));
+    m_decimation = getIntegerFromLittleEndian(header.substr(72, 4));
+    if (m_decimation < 2)
+        extraLevels = 0;
+
+    m_levels.clear();
+    m_levels.push_back(Level{m_numberOfPeaks, 128});
+
+    for (int i = 0; i < extraLevels; ++i) {
+        const Level &below = m_levels.back();
+        const Level level{(below.peaks + m_decimation - 1) / m_decimation,
+                          below.offset +
+                              std::streamoff(below.peaks) * getPeakFrameSize()};
+
+        // Ignore levels that would run off the end of a truncated file.
+        if (level.offset + std::streamoff(level.peaks) * getPeakFrameSize() >
+                std::streamoff(m_fileSize))
+            break;
+
+        m_levels.push_back(level);
+    }
+
     //printStats();
 }
 
@@ -185,6 +219,7 @@ PeakFile::printStats()
     RG_DEBUG << "    CHANNELS    =" << m_channels;
     RG_DEBUG << "    PEAK FRAMES =" << m_numberOfPeaks;
     RG_DEBUG << "    PEAK OF PKS =" << m_positionPeakOfPeaks;
+    RG_DEBUG << "    LEVELS      =" << m_levels.size();
     RG_DEBUG << "";
 
     RG_DEBUG << "  DATE";
@@ -208,10 +243,11 @@ PeakFile::write()
     }
 
     // Attempt to open AudioFile so that we can extract sample data
-    // for preview file generation
+    // for preview file generation.  If it is already mapped, we won't
+    // be using its stream.
     //
     try {
-        if (!m_audioFile->open())
+        if (!m_audioFile->mapSampleData()  &&  !m_audioFile->open())
             return false;
     } catch (const BadSoundFileException &e) {
 #ifdef DEBUG_PEAKFILE
@@ -227,6 +263,11 @@ PeakFile::write()
     if (!(*m_outFile))
         return false;
 
+    // Whatever we had read from the old file no longer applies.
+    m_levels.clear();
+    m_peakCache.clear();
+    m_lastPreviewWidth = -1;
+
     // write out the header
     writeHeader(m_outFile);
 
@@ -301,6 +342,13 @@ PeakFile::close()
     dateString += "     ";
     putBytes(m_outFile, dateString);
 
+    // Number of levels in the peak pyramid after the peaks themselves,
+    // and the decimation between them.
+    //
+    const int extraLevels = m_levels.empty() ? 0 : int(m_levels.size()) - 1;
+    putBytes(m_outFile, getLittleEndianFromInteger(extraLevels, 4));
+    putBytes(m_outFile, getLittleEndianFromInteger(m_decimation, 4));
+
     // Ok, now close and tidy up
     //
     m_outFile->close();
@@ -314,6 +362,11 @@ PeakFile::isValid()
     if (m_audioFile->getModificationDateTime() > m_modificationTime)
         return false;
 
+    // A peak file from before we had the peak pyramid, and big enough to
+    // need one, is worth regenerating.
+    if (m_levels.size() == 1  &&  m_numberOfPeaks > MIN_LEVEL_PEAKS)
+        return false;
+
     return true;
 }
 
@@ -394,7 +447,8 @@ PeakFile::writeHeader(std::ofstream *file)
     //
     header += getLittleEndianFromInteger(0, 28);
 
-    // reserved space - 60 bytes
+    // reserved space - 60 bytes.  The first 8 are the peak pyramid's
+    // level count and decimation, written at close().
     header += getLittleEndianFromInteger(0, 60);
 
     //RG_DEBUG << "writeHeader(): HEADER LENGTH =" << header.length();
@@ -405,7 +459,7 @@ PeakFile::writeHeader(std::ofstream *file)
 }
 
 bool
-PeakFile::scanToPeak(int peak)
+PeakFile::scanToPeak(int peak, int level)
 {
     if (!m_inFile)
         return false;
@@ -413,10 +467,13 @@ PeakFile::scanToPeak(int peak)
     if (!m_inFile->is_open())
         return false;
 
+    if (level >= int(m_levels.size()))
+        return false;
+
     // Scan to start of chunk and then seek to peak number
     //
-    ssize_t pos = (ssize_t)m_chunkStartPosition + 128 +
-                  peak * m_format * m_channels * m_pointsPerValue;
+    ssize_t pos = (ssize_t)m_chunkStartPosition + m_levels[level].offset +
+                  ssize_t(peak) * getPeakFrameSize();
 
     ssize_t off = pos - m_inFile->tellg();
 
@@ -479,14 +536,11 @@ PeakFile::writePeaks(std::ofstream *file)
     RG_DEBUG << "writePeaks() - calculating peaks";
 #endif
 
-    // Scan to beginning of audio data
-    m_audioFile->scanTo(RealTime(0, 0));
-
     // Store our samples
     //
     std::vector<std::pair<int, int> > channelPeaks;
     std::string samples;
-    unsigned char *samplePtr;
+    const unsigned char *samplePtr;
 
     int sampleValue;
     int sampleMax = 0 ;
@@ -510,30 +564,77 @@ PeakFile::writePeaks(std::ofstream *file)
     m_numberOfPeaks = 0;
     m_bodyBytes = 0;
     m_positionPeakOfPeaks = 0;
+    m_decimation = PEAK_DECIMATION;
+
+    // The first level of the peak pyramid, reduced as we go so that
+    // writeLevels() needn't read the peaks back.
+    std::vector<int> firstLevel;
+    std::vector<std::pair<int, int> > groupPeaks(channels);
+    int groupCount = 0;
 
     // ??? Block count?  How does this differ from m_numberOfPeaks?
     int ct = 0;
 
+    // If we can map the file, decode whole blocks from the mapping to
+    // floats and find their extremes with AudioKernels, rather than
+    // copying each block out through getBytes() and going through it a
+    // sample at a time.  This also leaves the AudioFile's stream alone,
+    // so that PeakFileManager can do this on a worker thread.
+    const bool mapped = m_audioFile->mapSampleData();
+    size_t frame = 0;
+    const size_t blockBytes = m_blockSize * channels * bytes;
+
+    std::vector<std::vector<float> > channelSamples;
+    std::vector<float *> channelBuffers;
+
+    // Scale from decoded floats to peak values, matching the conversions
+    // in the loop below.
+    double scale = 32768.0;
+    if (bytes == 1)
+        scale = 128.0;
+    else if (bytes == 4)
+        scale = 32767.0;
+
+    if (mapped) {
+        channelSamples.resize(channels, std::vector<float>(m_blockSize));
+        for (int ch = 0; ch < channels; ++ch) {
+            channelBuffers.push_back(channelSamples[ch].data());
+        }
+    } else {
+        // Scan to beginning of audio data
+        m_audioFile->scanTo(RealTime(0, 0));
+    }
+
     // ??? for each block...?
     while (true) {
-        try {
-            // Read a block
-            samples = m_audioFile->
-                      getBytes(m_blockSize * channels * bytes);
-        } catch (const BadSoundFileException &e) {
-            RG_WARNING << "writePeaks():" << e.getMessage();
-            break;
-        }
+        if (mapped) {
+            const size_t frames = m_audioFile->getMappedSampleFrames(
+                    frame, channelBuffers.data(), m_blockSize);
+            frame += frames;
 
-        // If no bytes or less than the total number of bytes are returned
-        // then break out
-        //
-        if (samples.length() == 0 ||
-            samples.length() < (m_blockSize * m_audioFile->getChannels()
-                                * bytes))
-            break;
+            // Less than a whole block, break out
+            if (frames < size_t(m_blockSize))
+                break;
+        } else {
+            try {
+                // Read a block
+                samples = m_audioFile->getBytes(blockBytes);
+            } catch (const BadSoundFileException &e) {
+                RG_WARNING << "writePeaks():" << e.getMessage();
+                break;
+            }
+
+            // If no bytes or less than the total number of bytes are
+            // returned then break out
+            //
+            if (samples.length() == 0 ||
+                samples.length() < blockBytes)
+                break;
+
+            samplePtr = (const unsigned char *)samples.c_str();
+        }
 
-        byteCount += samples.length();
+        byteCount += blockBytes;
 
 #if !TEST_PROGRESS_DIALOG
         // ??? Every 2000 blocks?  That's around 2Mbytes?
@@ -551,6 +652,9 @@ PeakFile::writePeaks(std::ofstream *file)
 
             //RG_DEBUG << "writePeaks(): progress" << progress;
 
+            if (m_cancelled)
+                break;
+
             if (m_progressDialog) {
                 if (m_progressDialog->wasCanceled())
                     break;
@@ -558,74 +662,112 @@ PeakFile::writePeaks(std::ofstream *file)
                 m_progressDialog->setValue(progress);
             }
 
-            qApp->processEvents(QEventLoop::AllEvents);
+            // Only the GUI thread has events to process.
+            if (QThread::currentThread() == qApp->thread())
+                qApp->processEvents(QEventLoop::AllEvents);
         }
         ++ct;
 
-        samplePtr = (unsigned char *)samples.c_str();
-
-        for (int i = 0; i < m_blockSize; i++) {
-            for (unsigned int ch = 0; ch < m_audioFile->getChannels(); ch++) {
-                // Single byte format values range from 0-255 and then
-                // shifted down about the x-axis.  Double byte and above
-                // are already centred about x-axis.
-                //
-                if (bytes == 1) {
-                    // get value
-                    sampleValue = int(*samplePtr) - 128;
-                    samplePtr++;
-                } else if (bytes == 2) {
-                    unsigned char b2 = samplePtr[0];
-                    unsigned char b1 = samplePtr[1];
-                    unsigned int bits = (b1 << 8) + b2;
-                    sampleValue = (short)bits;
-                    samplePtr += 2;
-                } else if (bytes == 3) {
-                    unsigned char b3 = samplePtr[0];
-                    unsigned char b2 = samplePtr[1];
-                    unsigned char b1 = samplePtr[2];
-                    unsigned int bits = (b1 << 24) + (b2 << 16) + (b3 << 8);
-
-                    // write out as 16-bit (m_format == 2)
-                    sampleValue = int(bits) / 65536;
-
-                    samplePtr += 3;
-                } else if (bytes == 4)  // IEEE float (enforced by RIFFAudioFile)
-                {
-                    // write out as 16-bit (m_format == 2)
-                    // cppcheck-suppress invalidPointerCast
-                    float val = *(float *)samplePtr;
-                    sampleValue = (int)(32767.0 * val);
-                    samplePtr += 4;
-                } else {
-                    throw(BadSoundFileException(m_absoluteFilePath, "PeakFile::writePeaks - unsupported bit depth"));
+        if (mapped) {
+            int blockMax = 0;
+
+            for (int ch = 0; ch < channels; ++ch) {
+                float lo, hi;
+                AudioKernels::minMax(channelBuffers[ch], m_blockSize, lo, hi);
+
+                channelPeaks[ch].first = int(scale * double(hi));
+                channelPeaks[ch].second = int(scale * double(lo));
+
+                blockMax = std::max(blockMax,
+                                    std::max(std::abs(channelPeaks[ch].first),
+                                             std::abs(channelPeaks[ch].second)));
+            }
+
+            // Only go looking for the peak of peaks when this block
+            // has a new one.
+            if (blockMax > sampleMax) {
+                sampleMax = blockMax;
+
+                bool found = false;
+                for (int i = 0; i < m_blockSize  &&  !found; ++i) {
+                    for (int ch = 0; ch < channels  &&  !found; ++ch) {
+                        if (std::abs(int(scale *
+                                         double(channelBuffers[ch][i]))) ==
+                                blockMax) {
+                            m_positionPeakOfPeaks = sampleFrameCount + i;
+                            found = true;
+                        }
+                    }
                 }
+            }
 
-                // First time for each channel
-                //
-                if (i == 0) {
-                    channelPeaks[ch].first = sampleValue;
-                    channelPeaks[ch].second = sampleValue;
-                } else {
-                    // Compare and store
+            sampleFrameCount += m_blockSize;
+
+        } else {
+
+            for (int i = 0; i < m_blockSize; i++) {
+                for (unsigned int ch = 0; ch < m_audioFile->getChannels(); ch++) {
+                    // Single byte format values range from 0-255 and then
+                    // shifted down about the x-axis.  Double byte and above
+                    // are already centred about x-axis.
                     //
-                    if (sampleValue > channelPeaks[ch].first)
-                        channelPeaks[ch].first = sampleValue;
+                    if (bytes == 1) {
+                        // get value
+                        sampleValue = int(*samplePtr) - 128;
+                        samplePtr++;
+                    } else if (bytes == 2) {
+                        unsigned char b2 = samplePtr[0];
+                        unsigned char b1 = samplePtr[1];
+                        unsigned int bits = (b1 << 8) + b2;
+                        sampleValue = (short)bits;
+                        samplePtr += 2;
+                    } else if (bytes == 3) {
+                        unsigned char b3 = samplePtr[0];
+                        unsigned char b2 = samplePtr[1];
+                        unsigned char b1 = samplePtr[2];
+                        unsigned int bits = (b1 << 24) + (b2 << 16) + (b3 << 8);
+
+                        // write out as 16-bit (m_format == 2)
+                        sampleValue = int(bits) / 65536;
+
+                        samplePtr += 3;
+                    } else if (bytes == 4)  // IEEE float (enforced by RIFFAudioFile)
+                    {
+                        // write out as 16-bit (m_format == 2)
+                        // cppcheck-suppress invalidPointerCast
+                        float val = *(const float *)samplePtr;
+                        sampleValue = (int)(32767.0 * val);
+                        samplePtr += 4;
+                    } else {
+                        throw(BadSoundFileException(m_absoluteFilePath, "PeakFile::writePeaks - unsupported bit depth"));
+                    }
 
-                    if (sampleValue < channelPeaks[ch].second)
+                    // First time for each channel
+                    //
+                    if (i == 0) {
+                        channelPeaks[ch].first = sampleValue;
                         channelPeaks[ch].second = sampleValue;
-                }
+                    } else {
+                        // Compare and store
+                        //
+                        if (sampleValue > channelPeaks[ch].first)
+                            channelPeaks[ch].first = sampleValue;
+
+                        if (sampleValue < channelPeaks[ch].second)
+                            channelPeaks[ch].second = sampleValue;
+                    }
 
-                // Store peak of peaks if it fits
-                //
-                if (std::abs(sampleValue) > sampleMax) {
-                    sampleMax = std::abs(sampleValue);
-                    m_positionPeakOfPeaks = sampleFrameCount;
+                    // Store peak of peaks if it fits
+                    //
+                    if (std::abs(sampleValue) > sampleMax) {
+                        sampleMax = std::abs(sampleValue);
+                        m_positionPeakOfPeaks = sampleFrameCount;
+                    }
                 }
-            }
 
-            // for peak of peaks as well as frame count
-            sampleFrameCount++;
+                // for peak of peaks as well as frame count
+                sampleFrameCount++;
+            }
         }
 
         // Write absolute peak data in channel order
@@ -638,16 +780,109 @@ PeakFile::writePeaks(std::ofstream *file)
             m_bodyBytes += m_format * 2;
         }
 
+        for (int ch = 0; ch < channels; ++ch) {
+            if (groupCount == 0) {
+                groupPeaks[ch] = channelPeaks[ch];
+            } else {
+                groupPeaks[ch].first =
+                        std::max(groupPeaks[ch].first, channelPeaks[ch].first);
+                groupPeaks[ch].second =
+                        std::min(groupPeaks[ch].second, channelPeaks[ch].second);
+            }
+        }
+
+        if (++groupCount == m_decimation) {
+            for (int ch = 0; ch < channels; ++ch) {
+                firstLevel.push_back(groupPeaks[ch].first);
+                firstLevel.push_back(groupPeaks[ch].second);
+            }
+            groupCount = 0;
+        }
+
         // increment number of peak frames
         m_numberOfPeaks++;
     }
 
+    // Any peaks left over make a short last group.
+    if (groupCount > 0) {
+        for (int ch = 0; ch < channels; ++ch) {
+            firstLevel.push_back(groupPeaks[ch].first);
+            firstLevel.push_back(groupPeaks[ch].second);
+        }
+    }
+
+    writeLevels(file, firstLevel);
+
 #ifdef DEBUG_PEAKFILE
     RG_DEBUG << "writePeaks() - completed peaks";
 #endif
 
 }
 
+void
+PeakFile::writeLevels(std::ofstream *file, std::vector<int> &firstLevel)
+{
+    m_levels.clear();
+    m_levels.push_back(Level{m_numberOfPeaks, 128});
+
+    // hi and lo for each channel
+    const size_t frameValues = m_channels * 2;
+
+    std::vector<int> values;
+    values.swap(firstLevel);
+    std::vector<int> nextValues;
+    std::string bytes;
+
+    // Once a level is small enough, there's no point going further.
+    while (m_levels.back().peaks > MIN_LEVEL_PEAKS) {
+
+        const Level &below = m_levels.back();
+        const Level level{int(values.size() / frameValues),
+                          below.offset +
+                              std::streamoff(below.peaks) * getPeakFrameSize()};
+
+        bytes.clear();
+        bytes.reserve(values.size() * m_format);
+        for (const int value : values) {
+            bytes += getLittleEndianFromInteger(value, m_format);
+        }
+        putBytes(file, bytes);
+        m_bodyBytes += int(bytes.size());
+
+        m_levels.push_back(level);
+
+        // Reduce this level to get the next one up.
+        //
+        nextValues.clear();
+        const size_t groupValues = frameValues * m_decimation;
+
+        for (size_t group = 0; group < values.size(); group += groupValues) {
+            const size_t groupEnd = std::min(values.size(), group + groupValues);
+
+            for (size_t v = 0; v < frameValues; v += 2) {
+                int hi = values[group + v];
+                int lo = values[group + v + 1];
+
+                for (size_t frame = group + frameValues;
+                     frame < groupEnd;
+                     frame += frameValues) {
+                    hi = std::max(hi, values[frame + v]);
+                    lo = std::min(lo, values[frame + v + 1]);
+                }
+
+                nextValues.push_back(hi);
+                nextValues.push_back(lo);
+            }
+        }
+
+        values.swap(nextValues);
+    }
+
+#ifdef DEBUG_PEAKFILE
+    RG_DEBUG << "writeLevels() - wrote" << m_levels.size() - 1 << "levels";
+#endif
+}
+
 std::vector<float>
 PeakFile::getPreview(const RealTime &startTime,
                      const RealTime &endTime,
@@ -661,7 +896,7 @@ PeakFile::getPreview(const RealTime &startTime,
              << ", showMinima = " << showMinima;
 #endif
 
-    if (getSize() == 0) {
+    if (getSize() == 0  ||  m_levels.empty()) {
         RG_DEBUG << "getPreview() - PeakFile size == 0";
         return std::vector<float>();
     }
@@ -725,6 +960,24 @@ PeakFile::getPreview(const RealTime &startTime,
     if (startPeak > endPeak)
         return m_lastPreviewCache;
 
+    // Go up the peak pyramid to the coarsest level that still has at
+    // least one peak frame for each pixel.
+    //
+    int level = 0;
+    qint64 scale = 1;
+    while (level + 1 < int(m_levels.size())  &&
+           double(endPeak - startPeak) / double(width) >=
+               double(scale * m_decimation)) {
+        ++level;
+        scale *= m_decimation;
+    }
+    startPeak = int(startPeak / scale);
+    endPeak = int(endPeak / scale);
+
+    const int levelPeaks = m_levels[level].peaks;
+    const int levelCacheOffset =
+            int(m_levels[level].offset - m_levels[0].offset);
+
     // Actual possible sample length in RealTime
     //
     double step = double(endPeak - startPeak) / double(width);
@@ -767,7 +1020,7 @@ PeakFile::getPreview(const RealTime &startTime,
         //
         if (!m_peakCache.length()) {
 
-            if (scanToPeak(peakNumber) == false) {
+            if (scanToPeak(peakNumber, level) == false) {
 #ifdef DEBUG_PEAKFILE
                 RG_DEBUG << "getPreview(): scanToPeak(" << peakNumber << ") failed";
 #endif
@@ -789,6 +1042,10 @@ PeakFile::getPreview(const RealTime &startTime,
         //
         for (int k = 0; peakNumber < nextPeakNumber; ++k) {
 
+            // Past the end of this level, which is followed by the next.
+            if (peakNumber >= levelPeaks)
+                goto done;
+
             for (int ch = 0; ch < m_channels; ch++) {
 
                 if (!m_peakCache.length()) {
@@ -812,7 +1069,8 @@ PeakFile::getPreview(const RealTime &startTime,
                 } else {
 
                     int valueNum = peakNumber * m_channels + ch;
-                    int charNum = valueNum * m_format * m_pointsPerValue;
+                    int charNum = levelCacheOffset +
+                                  valueNum * m_format * m_pointsPerValue;
                     int charLength = m_format * m_pointsPerValue;
 
                     // Get peak value from the cached string if
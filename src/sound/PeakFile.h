@@ -12,6 +12,7 @@
     COPYING included with this distribution for more information.
 */
 
+#include <atomic>
 #include <vector>
 
 #include <QObject>
@@ -45,6 +46,15 @@ typedef std::pair<RealTime, RealTime> SplitPointPair;
  * the sample file itself (writeToHandle()) or used to generate an
  * external peak file (write()).  At the moment the only type of file
  * with an embedded peak chunk is the BWF file itself.
+ *
+ * After the peaks proper, we also write a pyramid of coarser levels, each
+ * holding one peak frame for every four of the level below (see
+ * writeLevels()).  The number of extra levels and the decimation factor
+ * go in the header's reserved space, which is zero in older peak files,
+ * so those just have the one level.  getPreview() reads whichever level
+ * is closest to one peak frame per pixel, so drawing an hour-long
+ * recording zoomed out reads a few hundred peak frames instead of the
+ * whole file.
  */
 class PeakFile : public QObject, public SoundFile
 {
@@ -62,8 +72,17 @@ public:
             { m_progressDialog = progressDialog; }
 
     /// Write to standard peak file
+    /**
+     * If the audio file can be mapped (AudioFile::mapSampleData()), this
+     * only reads the mapping and so is safe to call on a thread other
+     * than the GUI thread, as long as there is no progress dialog.
+     */
     bool write() override;
 
+    /// Stop write() at the next progress check.  Thread-safe.
+    void cancel()  { m_cancelled = true; }
+    bool wasCancelled() const  { return m_cancelled; }
+
     /// Is the peak file valid and up to date?
     /**
      * If the audio file is more recently modified than the modification time
@@ -115,6 +134,13 @@ protected:
     void writeHeader(std::ofstream *file);
     void writePeaks(std::ofstream *file);
 
+    /// Write the coarser levels of the peak pyramid after the peaks.
+    /**
+     * firstLevel is level 1, already reduced from the peaks by
+     * writePeaks(), as interleaved hi/lo values for each channel.
+     */
+    void writeLevels(std::ofstream *file, std::vector<int> &firstLevel);
+
     /// Convert time to block.
     /**
      * rename: getBlock()
@@ -140,6 +166,22 @@ protected:
     int m_offsetToPeaks;
     int m_bodyBytes;
 
+    /// One level of the peak pyramid.  Level 0 is the peaks proper.
+    struct Level
+    {
+        /// Number of peak frames in this level.
+        int peaks;
+        /// Offset of the level's first peak frame from the chunk start.
+        std::streamoff offset;
+    };
+    std::vector<Level> m_levels;
+    /// Peak frames in each level for one in the next level up.
+    int m_decimation;
+
+    /// Size in bytes of one peak frame, all channels.
+    int getPeakFrameSize() const
+            { return m_format * m_pointsPerValue * m_channels; }
+
     /// Used to determine whether the peak file is out of sync with the audio file.
     QDateTime m_modificationTime;
 
@@ -161,7 +203,10 @@ protected:
     /// Cached in-memory copy of the peak file for getPreview().
     std::string        m_peakCache;
 
-    bool scanToPeak(int peak);
+    /// Set by cancel().
+    std::atomic<bool>  m_cancelled;
+
+    bool scanToPeak(int peak, int level = 0);
     //bool scanForward(int numberOfPeaks);
 };
 
@@ -17,10 +17,14 @@
 
 #include "PeakFileManager.h"
 
+#include <algorithm>
+#include <cstdio>  // std::rename()
 #include <vector>
 
 #include <QFile>
+#include <QMutexLocker>
 #include <QProgressDialog>
+#include <QThread>
 
 #include "AudioFile.h"
 #include "base/RealTime.h"
@@ -32,6 +36,54 @@ namespace Rosegarden
 {
 
 
+class PeakFileManager::WorkerThread : public QThread
+{
+public:
+    explicit WorkerThread(PeakFileManager *manager) :
+        m_manager(manager)
+    { }
+
+protected:
+    void run() override
+    {
+        while (Job *job = m_manager->takeJob()) {
+            runJob(*job);
+
+            {
+                QMutexLocker locker(&m_manager->m_mutex);
+                job->done = true;
+                m_manager->m_jobDone.wakeAll();
+            }
+
+            emit m_manager->jobsDone();
+        }
+    }
+
+private:
+    PeakFileManager *m_manager;
+};
+
+PeakFileManager::PeakFileManager() :
+    m_exiting(false)
+{
+}
+
+PeakFileManager::~PeakFileManager()
+{
+    clear();
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_exiting = true;
+        m_jobQueued.wakeAll();
+    }
+
+    for (WorkerThread *thread : m_threads) {
+        thread->wait();
+        delete thread;
+    }
+}
+
 bool
 PeakFileManager::insertAudioFile(AudioFile *audioFile)
 {
@@ -54,6 +106,9 @@ PeakFileManager::insertAudioFile(AudioFile *audioFile)
 bool
 PeakFileManager::removeAudioFile(AudioFile *audioFile)
 {
+    // The workers mustn't be left reading from a deleted AudioFile.
+    cancelPeaks(audioFile);
+
     // For each PeakFile
     for (std::vector<PeakFile *>::iterator it = m_peakFiles.begin();
          it != m_peakFiles.end();
@@ -76,6 +131,8 @@ PeakFileManager::deletePeakFile(AudioFile *audioFile)
         if (!peakFile)
             return;
 
+        cancelPeaks(audioFile);
+
         peakFile->close();
         QFile::remove(peakFile->getAbsoluteFilePath());
         removeAudioFile(audioFile);
@@ -155,6 +212,9 @@ PeakFileManager::generatePeaks(AudioFile *audioFile)
 #endif
 
     if (audioFile->getType() == WAV) {
+        // We're doing it now, so any queued job for it is moot.
+        cancelPeaks(audioFile);
+
         PeakFile *currentPeakFile = getPeakFile(audioFile);
 
         currentPeakFile->setProgressDialog(m_progressDialog);
@@ -186,6 +246,172 @@ PeakFileManager::generatePeaks(AudioFile *audioFile)
     }
 }
 
+void
+PeakFileManager::queuePeaks(AudioFile *audioFile)
+{
+    // Only mapped files can be read off the GUI thread.  See
+    // PeakFile::write().
+    if (audioFile->getType() != WAV  ||  !audioFile->mapSampleData()) {
+        generatePeaks(audioFile);
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    // Already queued or being worked on?
+    for (const Job *job : m_jobs) {
+        if (job->audioFile == audioFile  &&  !job->done)
+            return;
+    }
+
+#ifdef DEBUG_PEAKFILEMANAGER
+    RG_DEBUG << "queuePeaks() - queueing peaks for \"" << audioFile->getAbsoluteFilePath() << "\"";
+#endif
+
+    // Start the workers the first time they're needed.  Peak generation
+    // is mostly reading and reducing samples, so one per core.
+    if (m_threads.empty()) {
+        const int threadCount = std::max(1, QThread::idealThreadCount());
+
+        for (int i = 0; i < threadCount; ++i) {
+            WorkerThread *thread = new WorkerThread(this);
+            thread->start(QThread::LowPriority);
+            m_threads.push_back(thread);
+        }
+    }
+
+    Job *job = new Job;
+    job->audioFile = audioFile;
+    job->peakFile = new PeakFile(audioFile);
+    job->started = false;
+    job->done = false;
+    job->succeeded = false;
+
+    m_jobs.push_back(job);
+    m_queue.push_back(job);
+    m_jobQueued.wakeOne();
+}
+
+PeakFileManager::Job *
+PeakFileManager::takeJob()
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (m_queue.empty()  &&  !m_exiting) {
+        m_jobQueued.wait(&m_mutex);
+    }
+
+    if (m_exiting)
+        return nullptr;
+
+    Job *job = m_queue.front();
+    m_queue.pop_front();
+    job->started = true;
+
+    return job;
+}
+
+void
+PeakFileManager::runJob(Job &job)
+{
+    PeakFile *peakFile = job.peakFile;
+
+    // Write to the side, so that the old peak file can still be read
+    // until the new one is complete.
+    const QString fileName = peakFile->getAbsoluteFilePath();
+    const QString tempFileName = fileName + ".part";
+    peakFile->setAbsoluteFilePath(tempFileName);
+
+    bool written = false;
+
+    try {
+        written = peakFile->write();
+    } catch (const SoundFile::BadSoundFileException &e) {
+        RG_WARNING << "runJob():" << e.getMessage();
+    }
+
+    // close writes out important things
+    peakFile->close();
+
+    if (written  &&  !peakFile->wasCancelled()) {
+        job.succeeded = (std::rename(tempFileName.toLocal8Bit().constData(),
+                                     fileName.toLocal8Bit().constData()) == 0);
+    }
+
+    if (!job.succeeded) {
+        if (!peakFile->wasCancelled())
+            RG_WARNING << "runJob() - Can't write peak file for " << job.audioFile->getAbsoluteFilePath() << " - no preview generated";
+
+        QFile::remove(tempFileName);
+    }
+
+    peakFile->setAbsoluteFilePath(fileName);
+}
+
+std::vector<AudioFileId>
+PeakFileManager::collectFinishedPeaks()
+{
+    std::vector<AudioFileId> ids;
+
+    QMutexLocker locker(&m_mutex);
+
+    for (std::vector<Job *>::iterator it = m_jobs.begin();
+         it != m_jobs.end(); ) {
+        Job *job = *it;
+
+        if (!job->done) {
+            ++it;
+            continue;
+        }
+
+        if (job->succeeded) {
+            // Make the PeakFile we read previews from re-read the
+            // new peak file.
+            PeakFile *peakFile = getPeakFile(job->audioFile);
+            if (peakFile)
+                peakFile->close();
+
+            ids.push_back(job->audioFile->getId());
+        }
+
+        delete job->peakFile;
+        delete job;
+        it = m_jobs.erase(it);
+    }
+
+    return ids;
+}
+
+void
+PeakFileManager::cancelPeaks(AudioFile *audioFile)
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (std::vector<Job *>::iterator it = m_jobs.begin();
+         it != m_jobs.end(); ) {
+        Job *job = *it;
+
+        if (audioFile  &&  job->audioFile != audioFile) {
+            ++it;
+            continue;
+        }
+
+        if (!job->started) {
+            m_queue.erase(std::find(m_queue.begin(), m_queue.end(), job));
+        } else {
+            job->peakFile->cancel();
+
+            while (!job->done) {
+                m_jobDone.wait(&m_mutex);
+            }
+        }
+
+        delete job->peakFile;
+        delete job;
+        it = m_jobs.erase(it);
+    }
+}
+
 std::vector<float>
 PeakFileManager::getPreview(AudioFile *audioFile,
                             const RealTime &startTime,
@@ -233,6 +459,8 @@ PeakFileManager::getPreview(AudioFile *audioFile,
 void
 PeakFileManager::clear()
 {
+    cancelPeaks(nullptr);
+
     // Delete the PeakFile objects.
     for (std::vector<PeakFile *>::iterator it = m_peakFiles.begin();
          it != m_peakFiles.end();
@@ -16,15 +16,19 @@
 #ifndef RG_PEAKFILEMANAGER_H
 #define RG_PEAKFILEMANAGER_H
 
+#include <deque>
 #include <vector>
 
+#include <QMutex>
 #include <QObject>
 #include <QString>
 #include <QPointer>
+#include <QWaitCondition>
 
 class QProgressDialog;
 
 #include "sound/SoundFile.h"
+#include "AudioFile.h"  // for AudioFileId
 #include "PeakFile.h"  // for SplitPointPair
 
 namespace Rosegarden
@@ -39,12 +43,20 @@ class RealTime;
 /**
  * Accepts an AudioFIle and turns the sample data into peak data for
  * storage in a peak file or a BWF format peak chunk.
+ *
+ * Peak files can be made either right away with generatePeaks(), or
+ * in the background with queuePeaks().  Queued files are shared out
+ * among a pool of worker threads, so several are done at once, and each
+ * is written to a temporary file that replaces the peak file when it is
+ * complete.  The owner is told through jobsDone() and then calls
+ * collectFinishedPeaks() to pick up the new peak files.
  */
 class PeakFileManager : public QObject
 {
     Q_OBJECT
 public:
-    PeakFileManager()  { }
+    PeakFileManager();
+    ~PeakFileManager() override;
 
     /**
      * Check that a given audio file has a valid and up to date
@@ -67,6 +79,24 @@ public:
      */
     void generatePeaks(AudioFile *audioFile);
 
+    /// Generate a peak file on a worker thread.
+    /**
+     * Audio files that can't be mapped (AudioFile::mapSampleData()) are
+     * done right away by generatePeaks() instead.  Until a queued file
+     * is done, hasValidPeaks() will still say no.
+     *
+     * throw BadSoundFileException, BadPeakFileException
+     */
+    void queuePeaks(AudioFile *audioFile);
+
+    /// Pick up the peak files that the workers have finished.
+    /**
+     * Call this on the GUI thread after jobsDone(), with whatever lock
+     * guards getPreview() held.  Returns the IDs of the audio files that
+     * now have new peaks.
+     */
+    std::vector<AudioFileId> collectFinishedPeaks();
+
     /**
      * throws BadSoundFileException, BadPeakFileException
      */
@@ -112,10 +142,46 @@ public:
         QString m_path;
     };
 
+signals:
+    /// Emitted on a worker thread when a queuePeaks() job finishes.
+    void jobsDone();
+
 private:
     PeakFileManager(const PeakFileManager &pFM);
     PeakFileManager& operator=(const PeakFileManager &);
 
+    /// A queuePeaks() request.
+    struct Job
+    {
+        AudioFile *audioFile;
+        /// Our own PeakFile, writing to a temporary file.
+        PeakFile *peakFile;
+        bool started;
+        bool done;
+        bool succeeded;
+    };
+
+    /// Every job not yet collected, in the order queued.
+    std::vector<Job *> m_jobs;
+
+    class WorkerThread;
+    std::vector<WorkerThread *> m_threads;
+
+    /// Guards m_jobs, m_queue, m_exiting and the Job flags.
+    QMutex m_mutex;
+    QWaitCondition m_jobQueued;
+    QWaitCondition m_jobDone;
+    /// Jobs that no worker has taken yet.
+    std::deque<Job *> m_queue;
+    bool m_exiting;
+
+    /// Called by the workers.  Returns nullptr when it is time to exit.
+    Job *takeJob();
+    static void runJob(Job &job);
+
+    /// Cancel the jobs for audioFile, or all jobs, and wait for them.
+    void cancelPeaks(AudioFile *audioFile);
+
     /// Insert PeakFile based on AudioFile if it doesn't already exist.
     bool insertAudioFile(AudioFile *audioFile);
     /// Auto-inserts PeakFile into manager if it doesn't already exist.
@@ -17,6 +17,7 @@
 
 #include "RingBufferPool.h"
 
+#include <algorithm>
 #include <utility>
 
 #include <pthread.h>
@@ -42,6 +43,9 @@ RingBufferPool *PlayableAudioFile::m_ringBufferPool = nullptr;
 
 static constexpr size_t a_xfadeFrames = 30;
 
+// How far ahead of the playback position to page in mapped files.
+static constexpr int a_readAheadSeconds = 2;
+
 PlayableAudioFile::PlayableAudioFile(InstrumentId instrumentId,
                                      AudioFile *audioFile,
                                      const RealTime &startTime,
@@ -62,7 +66,10 @@ PlayableAudioFile::PlayableAudioFile(InstrumentId instrumentId,
     m_fileEnded(false),
     m_firstRead(true),
     m_isSmallFile(false),
-    m_smallFileScanFrame(0)
+    m_smallFileScanFrame(0),
+    m_mapped(false),
+    m_mappedScanFrame(0),
+    m_mappedPrefetchFrame(0)
 {
 #ifdef DEBUG_PLAYABLE
     std::cerr << "PlayableAudioFile::PlayableAudioFile - creating " << this << " for instrument " << instrumentId << " with file " << (m_audioFile ? m_audioFile->getShortFilename() : "(none)") << std::endl;
@@ -106,6 +113,8 @@ PlayableAudioFile::initialise(size_t bufferSize, size_t smallFileSize)
 
     if (!m_isSmallFile) {
 
+        m_mapped = m_audioFile->mapSampleData();
+
         m_file = new std::ifstream(m_audioFile->getAbsoluteFilePath().toLocal8Bit(),
                                    std::ios::in | std::ios::binary);
 
@@ -206,6 +215,22 @@ PlayableAudioFile::scanTo(const RealTime &time)
 #endif
         ok = true;
 
+    } else if (m_mapped) {
+
+        const size_t frame = (size_t)RealTime::realTime2Frame
+            (time, m_audioFile->getSampleRate());
+        size_t frames = 1;
+        // Like AudioFile::scanTo(), fail if we're past the end.
+        ok = (m_audioFile->getMappedSampleData(frame, frames) != nullptr);
+        if (ok) {
+            m_currentScanPoint = time;
+            m_mappedScanFrame = frame;
+
+            // We've jumped, so start reading ahead from here.
+            m_mappedPrefetchFrame = frame;
+            prefetch();
+        }
+
     } else {
 
         ok = m_audioFile->scanTo(m_file, time);
@@ -224,6 +249,23 @@ PlayableAudioFile::scanTo(const RealTime &time)
 }
 
 
+void
+PlayableAudioFile::prefetch()
+{
+    const size_t readAhead = a_readAheadSeconds * getSourceSampleRate();
+
+    // Only once we've used up half of what was asked for last time, so
+    // that we aren't making a system call for every block.
+    if (m_mappedScanFrame + readAhead / 2 < m_mappedPrefetchFrame)
+        return;
+
+    const size_t from = std::max(m_mappedScanFrame, m_mappedPrefetchFrame);
+    const size_t to = m_mappedScanFrame + readAhead;
+
+    m_audioFile->prefetchMappedSampleData(from, to - from);
+    m_mappedPrefetchFrame = to;
+}
+
 size_t
 PlayableAudioFile::getSampleFramesAvailable()
 {
@@ -385,6 +427,17 @@ PlayableAudioFile::checkSmallFileCache(size_t smallFileSize)
         m_smallFileCache.incrementReference(m_audioFile);
         m_isSmallFile = true;
 
+    } else if (m_audioFile->getSize() <= smallFileSize  &&
+               m_audioFile->mapSampleData()  &&
+               m_audioFile->isMappedSampleDataResident()) {
+
+        // Already in the page cache, so reading it from the mapping is
+        // as quick as reading a decoded copy, and saves making one.
+
+#ifdef DEBUG_PLAYABLE
+        std::cerr << "PlayableAudioFile::checkSmallFileCache: File is resident, not caching" << std::endl;
+#endif
+
     } else if (m_audioFile->getSize() <= smallFileSize) {
 
         std::ifstream file(m_audioFile->getAbsoluteFilePath().toLocal8Bit(),
@@ -624,23 +677,44 @@ PlayableAudioFile::updateBuffers()
     std::cerr << "Want " << fileFrames << " (" << block << ") from file (" << (m_duration + m_startIndex - m_currentScanPoint - block) << " to go)" << std::endl;
 #endif
 
-    // !!! need to be doing this in initialise, want to avoid allocations here
-    if ((getBytesPerFrame() * fileFrames) > m_rawFileBufferSize) {
-        delete[] m_rawFileBuffer;
-        m_rawFileBufferSize = getBytesPerFrame() * fileFrames;
+    const unsigned char *fileData = nullptr;
+    size_t obtained = 0;
+
+    if (m_mapped) {
+
+        // Decode straight from the mapping, no copying.
+        obtained = fileFrames;
+        fileData = m_audioFile->getMappedSampleData(m_mappedScanFrame,
+                                                    obtained);
+        m_mappedScanFrame += obtained;
+
+        if (obtained < fileFrames) {
+            m_fileEnded = true;
+        } else {
+            prefetch();
+        }
+
+    } else {
+
+        // !!! need to be doing this in initialise, want to avoid allocations here
+        if ((getBytesPerFrame() * fileFrames) > m_rawFileBufferSize) {
+            delete[] m_rawFileBuffer;
+            m_rawFileBufferSize = getBytesPerFrame() * fileFrames;
 #ifdef DEBUG_PLAYABLE_READ
 
-        std::cerr << "Expanding raw file buffer to " << m_rawFileBufferSize << " chars" << std::endl;
+            std::cerr << "Expanding raw file buffer to " << m_rawFileBufferSize << " chars" << std::endl;
 #endif
 
-        m_rawFileBuffer = new char[m_rawFileBufferSize];
-    }
+            m_rawFileBuffer = new char[m_rawFileBufferSize];
+        }
 
-    size_t obtained =
-        m_audioFile->getSampleFrames(m_file, m_rawFileBuffer, fileFrames);
+        obtained =
+            m_audioFile->getSampleFrames(m_file, m_rawFileBuffer, fileFrames);
+        fileData = (const unsigned char *)m_rawFileBuffer;
 
-    if (obtained < fileFrames || m_file->eof()) {
-        m_fileEnded = true;
+        if (obtained < fileFrames || m_file->eof()) {
+            m_fileEnded = true;
+        }
     }
 
     {
@@ -672,7 +746,9 @@ PlayableAudioFile::updateBuffers()
             }
         }
 
-        if (m_audioFile->decode((const unsigned char *)m_rawFileBuffer,
+        // fileData is nullptr if the mapping had nothing left.
+        if (fileData  &&
+            m_audioFile->decode(fileData,
                                 obtained * getBytesPerFrame(),
                                 m_targetSampleRate,
                                 m_targetChannels,
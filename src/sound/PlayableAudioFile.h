@@ -177,6 +177,8 @@ private:
     void initialise(size_t bufferSize, size_t smallFileSize);
     void checkSmallFileCache(size_t smallFileSize);
     bool scanTo(const RealTime &time);
+    // Read ahead in the mapping from m_mappedScanFrame.
+    void prefetch();
     void returnRingBuffers();
 
     RealTime              m_startTime;
@@ -230,6 +232,16 @@ private:
     RealTime              m_currentScanPoint;
     size_t                m_smallFileScanFrame;
 
+    // If the AudioFile could be memory mapped, we decode straight from
+    // the mapping at this frame rather than reading through m_file.
+    //
+    bool                  m_mapped;
+    size_t                m_mappedScanFrame;
+
+    // Frames up to here have been passed to prefetchMappedSampleData().
+    //
+    size_t                m_mappedPrefetchFrame;
+
     bool m_autoFade = false;
     RealTime m_fadeInTime;
     RealTime m_fadeOutTime;
@@ -16,10 +16,19 @@
 #define RG_MODULE_STRING "[RIFFAudioFile]"
 
 #include "RIFFAudioFile.h"
+#include "AudioKernels.h"
 #include "base/RealTime.h"
 #include "misc/Strings.h"
 #include "misc/Debug.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
 //#define DEBUG_RIFF
 
 // Constants related to RIFF/WAV files
@@ -38,7 +47,10 @@ RIFFAudioFile::RIFFAudioFile(unsigned int id,
     AudioFile(id, name, absoluteFilePath),
     m_subFormat(PCM),
     m_bytesPerSecond(0),
-    m_bytesPerFrame(0)
+    m_bytesPerFrame(0),
+    m_mappedData(nullptr),
+    m_mappedFrames(0),
+    m_mapFailed(false)
 {}
 
 RIFFAudioFile::RIFFAudioFile(const QString &absoluteFilePath,
@@ -47,7 +59,10 @@ RIFFAudioFile::RIFFAudioFile(const QString &absoluteFilePath,
                              unsigned int bytesPerSecond = 6000,
                              unsigned int bytesPerFrame = 2,
                              unsigned int bitsPerSample = 16):
-        AudioFile(0, "", absoluteFilePath)
+        AudioFile(0, "", absoluteFilePath),
+        m_mappedData(nullptr),
+        m_mappedFrames(0),
+        m_mapFailed(false)
 {
     m_bitsPerSample = bitsPerSample;
     m_sampleRate = sampleRate;
@@ -311,6 +326,269 @@ RIFFAudioFile::getSampleFrameSlice(const RealTime &time)
     }
 }
 
+size_t
+RIFFAudioFile::getSampleFrames(std::ifstream *file,
+                               float **channels,
+                               size_t frames)
+{
+    if (file == nullptr  ||  m_bytesPerFrame == 0)
+        return 0;
+
+    // Read through a small fixed buffer rather than allocating one big
+    // enough for the whole request.  This is called from the disk
+    // thread, potentially for many files at a time.
+    constexpr size_t bufferBytes = 16384;
+    char buffer[bufferBytes];
+
+    const size_t framesPerRead = bufferBytes / m_bytesPerFrame;
+    size_t obtained = 0;
+
+    while (obtained < frames) {
+        const size_t request = std::min(framesPerRead, frames - obtained);
+        const size_t got =
+            getBytes(file, buffer, request * m_bytesPerFrame) /
+                m_bytesPerFrame;
+
+        deinterleave(reinterpret_cast<const unsigned char *>(buffer),
+                     got, channels, obtained);
+        obtained += got;
+
+        if (got < request)
+            break;
+    }
+
+    return obtained;
+}
+
+bool
+RIFFAudioFile::mapSampleData()
+{
+    QMutexLocker locker(&m_mapMutex);
+
+    if (m_mappedData)
+        return true;
+
+    // Already tried and failed.  Stick with buffered reads.
+    if (m_mapFailed)
+        return false;
+
+    m_mapFailed = true;
+
+    if (m_bytesPerFrame == 0)
+        return false;
+
+    m_mapFile.setFileName(m_absoluteFilePath);
+    if (!m_mapFile.open(QIODevice::ReadOnly)) {
+        RG_WARNING << "mapSampleData(): failed to open" << m_absoluteFilePath;
+        return false;
+    }
+
+    const qint64 fileSize = m_mapFile.size();
+
+    // Walk the chunks to find "data", as scanTo() does.
+    qint64 offset = 12;
+    while (offset + 8 <= fileSize) {
+        char header[8];
+        if (!m_mapFile.seek(offset)  ||  m_mapFile.read(header, 8) != 8)
+            break;
+
+        const std::string chunkName(header, 4);
+        const qint64 chunkLength = qint64(getIntegerFromLittleEndian(
+                std::string(header + 4, 4)));
+        offset += 8;
+
+        if (chunkName == "data") {
+            // Touching a mapped page past the end of the file is a
+            // SIGBUS.  A data chunk that doesn't fit, or whose length
+            // was never filled in, means the file is short or still
+            // being written, so leave it to the buffered reads.
+            if (chunkLength <= 0  ||  offset + chunkLength > fileSize) {
+                RG_WARNING << "mapSampleData(): data chunk doesn't match the file size in" << m_absoluteFilePath;
+                m_mapFile.close();
+                return false;
+            }
+
+            const unsigned char *data = m_mapFile.map(offset, chunkLength);
+            if (!data) {
+                RG_WARNING << "mapSampleData(): failed to map" << m_absoluteFilePath;
+                m_mapFile.close();
+                return false;
+            }
+
+            m_mappedData = data;
+            m_mappedFrames = size_t(chunkLength) / m_bytesPerFrame;
+            m_mapFailed = false;
+            return true;
+        }
+
+        if (chunkLength < 0)
+            break;
+        offset += chunkLength;
+    }
+
+    RG_WARNING << "mapSampleData(): failed to find data in" << m_absoluteFilePath;
+    m_mapFile.close();
+    return false;
+}
+
+const unsigned char *
+RIFFAudioFile::getMappedSampleData(size_t frame, size_t &frames) const
+{
+    if (!m_mappedData  ||  frame >= m_mappedFrames) {
+        frames = 0;
+        return nullptr;
+    }
+
+    frames = std::min(frames, m_mappedFrames - frame);
+
+    return m_mappedData + frame * m_bytesPerFrame;
+}
+
+size_t
+RIFFAudioFile::getMappedSampleFrames(size_t frame,
+                                     float **channels,
+                                     size_t frames) const
+{
+    const unsigned char *data = getMappedSampleData(frame, frames);
+    if (!data)
+        return 0;
+
+    deinterleave(data, frames, channels, 0);
+
+    return frames;
+}
+
+namespace
+{
+    // Round a range within a mapping out to whole pages, as madvise()
+    // and mincore() require.
+    void pageAlign(const unsigned char *start, size_t bytes,
+                   unsigned char *&alignedStart, size_t &alignedBytes)
+    {
+        static const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+
+        const uintptr_t begin = uintptr_t(start) / pageSize * pageSize;
+        const uintptr_t end = uintptr_t(start) + bytes;
+
+        alignedStart = reinterpret_cast<unsigned char *>(begin);
+        alignedBytes = end - begin;
+    }
+}
+
+void
+RIFFAudioFile::prefetchMappedSampleData(size_t frame, size_t frames) const
+{
+    const unsigned char *data = getMappedSampleData(frame, frames);
+    if (!data)
+        return;
+
+    unsigned char *start;
+    size_t bytes;
+    pageAlign(data, frames * m_bytesPerFrame, start, bytes);
+
+    madvise(start, bytes, MADV_WILLNEED);
+}
+
+bool
+RIFFAudioFile::isMappedSampleDataResident() const
+{
+    if (!m_mappedData)
+        return false;
+
+    unsigned char *start;
+    size_t bytes;
+    pageAlign(m_mappedData, m_mappedFrames * m_bytesPerFrame, start, bytes);
+
+    static const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> pages((bytes + pageSize - 1) / pageSize);
+
+    if (mincore(start, bytes, pages.data()) != 0)
+        return false;
+
+    for (unsigned char page : pages) {
+        if (!(page & 1))
+            return false;
+    }
+
+    return true;
+}
+
+void
+RIFFAudioFile::deinterleave(const unsigned char *source,
+                            size_t frames,
+                            float **channels,
+                            size_t offset) const
+{
+    const size_t channelCount = m_channels;
+
+    // Switch on the sample format once rather than per sample as
+    // convertBytesToSample() does.
+    switch (m_bitsPerSample) {
+
+    case 8:
+        for (size_t i = 0; i < frames; ++i) {
+            for (size_t ch = 0; ch < channelCount; ++ch) {
+                channels[ch][offset + i] = (float(*source) - 128.0f) / 128.0f;
+                ++source;
+            }
+        }
+        break;
+
+    case 16:
+        for (size_t i = 0; i < frames; ++i) {
+            for (size_t ch = 0; ch < channelCount; ++ch) {
+                const short value = short(source[0] | (source[1] << 8));
+                channels[ch][offset + i] = float(value) / 32768.0f;
+                source += 2;
+            }
+        }
+        break;
+
+    case 24:
+        for (size_t i = 0; i < frames; ++i) {
+            for (size_t ch = 0; ch < channelCount; ++ch) {
+                const int value = int((unsigned(source[2]) << 24) |
+                                      (unsigned(source[1]) << 16) |
+                                      (unsigned(source[0]) << 8));
+                channels[ch][offset + i] = float(value) / 2147483648.0f;
+                source += 3;
+            }
+        }
+        break;
+
+    case 32:
+        // IEEE floating point.  readFormatChunk() only allows one or
+        // two channels.
+        if (reinterpret_cast<uintptr_t>(source) % alignof(float) == 0  &&
+            channelCount <= 2) {
+            float *destinations[2] = {
+                channels[0] + offset,
+                channelCount == 2 ? channels[1] + offset : nullptr
+            };
+            AudioKernels::deinterleave(
+                    destinations, reinterpret_cast<const float *>(source),
+                    channelCount, frames);
+            break;
+        }
+
+        // Otherwise memcpy(), as the source may be unaligned.
+        for (size_t i = 0; i < frames; ++i) {
+            for (size_t ch = 0; ch < channelCount; ++ch) {
+                memcpy(&channels[ch][offset + i], source, sizeof(float));
+                source += 4;
+            }
+        }
+        break;
+
+    default:
+        for (size_t ch = 0; ch < channelCount; ++ch) {
+            std::fill(channels[ch] + offset, channels[ch] + offset + frames,
+                      0.0f);
+        }
+        break;
+    }
+}
+
 RealTime
 RIFFAudioFile::getLength()
 {
@@ -31,6 +31,8 @@
 #include "base/RealTime.h"
 
 #include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
 
 namespace Rosegarden
 {
@@ -105,6 +107,22 @@ public:
                                             const RealTime &time) override;
     virtual std::string getSampleFrameSlice(const RealTime &time);
 
+    // Read samples straight into per-channel float buffers, either
+    // from a stream or from the memory mapped data chunk.
+    //
+    size_t getSampleFrames(std::ifstream *file,
+                           float **channels,
+                           size_t frames) override;
+    bool mapSampleData() override;
+    const unsigned char *getMappedSampleData(size_t frame,
+                                             size_t &frames) const override;
+    size_t getMappedSampleFrames(size_t frame,
+                                 float **channels,
+                                 size_t frames) const override;
+    void prefetchMappedSampleData(size_t frame,
+                                  size_t frames) const override;
+    bool isMappedSampleDataResident() const override;
+
     // Append a string of samples to an already open (for writing)
     // audio file.
     //
@@ -154,9 +172,26 @@ protected:
     //
     void writeFormatChunk();
 
+    // Convert interleaved frames in our format into per-channel floats.
+    //
+    void deinterleave(const unsigned char *source,
+                      size_t frames,
+                      float **channels,
+                      size_t offset) const;
+
     SubFormat m_subFormat;
     unsigned int   m_bytesPerSecond;
     unsigned int   m_bytesPerFrame;
+
+    // Read-only mapping for mapSampleData().  m_mappedData points to
+    // the start of the data chunk within it.
+    //
+    QMutex         m_mapMutex;
+    QFile          m_mapFile;
+    const unsigned char *m_mappedData;
+    size_t         m_mappedFrames;
+    // Set once mapping has failed, so we don't keep trying.
+    bool           m_mapFailed;
 };
 
 }
@@ -14,6 +14,7 @@
 */
 
 #include "RecordableAudioFile.h"
+#include "AudioKernels.h"
 
 #include <cstdlib>
 
@@ -139,6 +140,11 @@ RecordableAudioFile::write()
 		encodeBuffer[index++] = b1;
 	    }
 	}
+    } else if (channels <= 2) {
+        const sample_t *channelBuffers[2] = { buffer, buffer + s };
+        // cppcheck-suppress invalidPointerCast
+        AudioKernels::interleave((float *)encodeBuffer, channelBuffers,
+                                 channels, s);
     } else {
 	char *encodePointer = encodeBuffer;
 	for (size_t i = 0; i < s; ++i) {
@@ -89,6 +89,13 @@ public:
     virtual void discardEvents() { }
     virtual void setIdealChannelCount(size_t channels) = 0; // must also silence(); may also re-instantiate
 
+    /**
+     * True if this instance is run together with other instances of
+     * the same plugin (DSSI run_multiple_synths).  Grouped instances
+     * share state, so they must all be run from the same thread.
+     */
+    virtual bool isInGroup() const { return false; }
+
     void setFactory(PluginFactory *f) { m_factory = f; } // ew
 
 protected:
@@ -68,8 +68,8 @@ private:
      */
     void insertCopy(const MappedEvent &evt) override;
 
-    // NB, this is not the same as MappedEventList which is actually a
-    // std::multiset.
+    // NB, this is not the same as MappedEventList which sorts by time
+    // as it goes.
     std::list<MappedEvent> m_list;
 };
 
@@ -65,6 +65,19 @@ void TestConvert::test1()
     ok = midiFile.convertToMidi(&doc, outFilename);
     QVERIFY(ok);
 
+    // And back again.
+    RosegardenDocument imported(
+            nullptr,  // parent
+            {},  // audioPluginManager
+            true,  // skipAutoload
+            true,  // clearCommandHistory
+            false);  // m_useSequencer
+
+    MidiFile midiFile2;
+    ok = midiFile2.convertToRosegarden(outFilename, &imported);
+    QVERIFY2(ok, midiFile2.getError().c_str());
+    QVERIFY(!imported.getComposition().getSegments().empty());
+
     // Clean up.
     QFile::remove(outFilename);
 }
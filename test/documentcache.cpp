@@ -0,0 +1,271 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/Segment.h"
+#include "document/DocumentCache.h"
+#include "document/RosegardenDocument.h"
+#include "misc/Preferences.h"
+
+#include <QFile>
+#include <QScopedPointer>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Unit test for the fast-load cache (DocumentCache).
+class TestDocumentCache : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testRoundTrip();
+    void testStale();
+    void testCorrupt();
+    void testMissing();
+
+private:
+    QTemporaryDir m_dir;
+    QString m_file;
+    bool m_oldUseLoadCache;
+
+    /// Save the example to m_file, with or without a cache.
+    void save(bool withCache, const std::string &copyright = "");
+
+    static RosegardenDocument *newDocument();
+    /// Load file with or without the cache.
+    static RosegardenDocument *load(const QString &file, bool withCache);
+
+    /// Check that two documents have the same segments and events.
+    static void compare(const RosegardenDocument &doc1,
+                        const RosegardenDocument &doc2);
+};
+
+RosegardenDocument *
+TestDocumentCache::newDocument()
+{
+    return new RosegardenDocument(
+            nullptr,  // parent
+            {},  // audioPluginManager
+            true,  // skipAutoload
+            true,  // clearCommandHistory
+            false);  // m_useSequencer
+}
+
+RosegardenDocument *
+TestDocumentCache::load(const QString &file, bool withCache)
+{
+    Preferences::setUseLoadCache(withCache);
+
+    RosegardenDocument *doc = newDocument();
+    RosegardenDocument::currentDocument = doc;
+
+    const bool ok = doc->openDocument(
+            file,
+            false,  // permanent
+            true,  // squelchProgressDialog
+            false);  // enableLock
+    if (!ok) {
+        delete doc;
+        return nullptr;
+    }
+
+    return doc;
+}
+
+void
+TestDocumentCache::save(bool withCache, const std::string &copyright)
+{
+    RosegardenDocument *doc = load(
+            QFINDTESTDATA("../data/examples/vivaldi_op44_11_1.rg"), false);
+    QVERIFY(doc);
+
+    if (!copyright.empty())
+        doc->getComposition().setCopyrightNote(copyright);
+
+    Preferences::setUseLoadCache(withCache);
+
+    QString errMsg;
+    QVERIFY2(doc->saveDocument(m_file, errMsg), qPrintable(errMsg));
+
+    delete doc;
+}
+
+void
+TestDocumentCache::compare(const RosegardenDocument &doc1,
+                           const RosegardenDocument &doc2)
+{
+    const SegmentMultiSet &segments1 = doc1.getComposition().getSegments();
+    const SegmentMultiSet &segments2 = doc2.getComposition().getSegments();
+    QCOMPARE(segments1.size(), segments2.size());
+    QVERIFY(!segments1.empty());
+
+    SegmentMultiSet::const_iterator segment2 = segments2.begin();
+    for (const Segment *segment1 : segments1) {
+        QCOMPARE((*segment2)->getTrack(), segment1->getTrack());
+        QCOMPARE((*segment2)->getStartTime(), segment1->getStartTime());
+        QCOMPARE((*segment2)->size(), segment1->size());
+
+        // toXmlString() covers the time, duration, suborder and the
+        // persistent properties, including the beamed group IDs.
+        Segment::const_iterator event2 = (*segment2)->begin();
+        for (const Event *event1 : *segment1) {
+            QCOMPARE((*event2)->toXmlString(0), event1->toXmlString(0));
+            ++event2;
+        }
+
+        ++segment2;
+    }
+}
+
+void
+TestDocumentCache::initTestCase()
+{
+    // Make sure settings end up in the right place.
+    QCoreApplication::setOrganizationName("rosegardenmusic");
+
+    QSettings settings;
+    settings.beginGroup("Sequencer_Options");
+    // Don't start JACK.
+    settings.setValue("autostartjack", false);
+    settings.endGroup();
+
+    m_oldUseLoadCache = Preferences::getUseLoadCache();
+
+    QVERIFY(m_dir.isValid());
+    m_file = m_dir.filePath("documentcache.rg");
+}
+
+void
+TestDocumentCache::cleanupTestCase()
+{
+    Preferences::setUseLoadCache(m_oldUseLoadCache);
+    RosegardenDocument::currentDocument = nullptr;
+}
+
+void
+TestDocumentCache::testRoundTrip()
+{
+    save(true);
+    if (QTest::currentTestFailed())
+        return;
+    QVERIFY(QFile::exists(DocumentCache::getCacheFileName(m_file)));
+
+    DocumentCache cache;
+    QVERIFY(cache.open(m_file));
+    QVERIFY(cache.getSegmentCount() > 0);
+
+    QScopedPointer<RosegardenDocument> fromXml(load(m_file, false));
+    QVERIFY(fromXml);
+    QScopedPointer<RosegardenDocument> fromCache(load(m_file, true));
+    QVERIFY(fromCache);
+
+    compare(*fromXml, *fromCache);
+}
+
+void
+TestDocumentCache::testStale()
+{
+    save(true);
+    if (QTest::currentTestFailed())
+        return;
+
+    // Change the document without updating the cache.
+    save(false, "Stale cache test");
+    if (QTest::currentTestFailed())
+        return;
+
+    DocumentCache cache;
+    QVERIFY(!cache.open(m_file));
+
+    QScopedPointer<RosegardenDocument> fromXml(load(m_file, false));
+    QVERIFY(fromXml);
+    QScopedPointer<RosegardenDocument> withStaleCache(load(m_file, true));
+    QVERIFY(withStaleCache);
+
+    compare(*fromXml, *withStaleCache);
+    QCOMPARE(withStaleCache->getComposition().getCopyrightNote(),
+             std::string("Stale cache test"));
+}
+
+void
+TestDocumentCache::testCorrupt()
+{
+    save(true);
+    if (QTest::currentTestFailed())
+        return;
+
+    const QString cacheFile = DocumentCache::getCacheFileName(m_file);
+
+    // Flip some bytes in the middle of the events.
+    {
+        QFile file(cacheFile);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        const qint64 size = file.size();
+        QVERIFY(size > 64);
+        QVERIFY(file.seek(size / 2));
+        QByteArray bytes = file.read(16);
+        for (int i = 0; i < bytes.size(); ++i) {
+            bytes[i] = ~bytes[i];
+        }
+        QVERIFY(file.seek(size / 2));
+        QCOMPARE(file.write(bytes), qint64(bytes.size()));
+    }
+
+    DocumentCache cache;
+    QVERIFY(!cache.open(m_file));
+
+    QScopedPointer<RosegardenDocument> fromXml(load(m_file, false));
+    QVERIFY(fromXml);
+    QScopedPointer<RosegardenDocument> withBadCache(load(m_file, true));
+    QVERIFY(withBadCache);
+
+    compare(*fromXml, *withBadCache);
+
+    // A truncated cache, too.
+    QVERIFY(QFile::resize(cacheFile, QFile(cacheFile).size() / 3));
+    QVERIFY(!cache.open(m_file));
+
+    QScopedPointer<RosegardenDocument> withShortCache(load(m_file, true));
+    QVERIFY(withShortCache);
+
+    compare(*fromXml, *withShortCache);
+}
+
+void
+TestDocumentCache::testMissing()
+{
+    save(false);
+    if (QTest::currentTestFailed())
+        return;
+    QFile::remove(DocumentCache::getCacheFileName(m_file));
+
+    DocumentCache cache;
+    QVERIFY(!cache.open(m_file));
+
+    QScopedPointer<RosegardenDocument> doc(load(m_file, true));
+    QVERIFY(doc);
+    QVERIFY(!doc->getComposition().getSegments().empty());
+}
+
+QTEST_MAIN(TestDocumentCache)
+
+#include "documentcache.moc"
@@ -0,0 +1,122 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"  // For EventContainer
+
+#include <QElapsedTimer>
+#include <QTest>
+
+#include <vector>
+
+using namespace Rosegarden;
+
+/// Benchmarks EventContainer, the std::multiset behind Segment.
+/**
+ * A baseline for anything proposed to replace it.
+ */
+class TestEventContainer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void benchmark();
+};
+
+void TestEventContainer::benchmark()
+{
+    // 100k events with distinct times, inserted out of order.
+    constexpr int eventCount = 100000;
+
+    std::vector<Event *> events;
+    events.reserve(eventCount);
+    for (int i = 0; i < eventCount; ++i) {
+        events.push_back(new Event(Note::EventType,
+                                   timeT(i) * 7919 % eventCount * 10,
+                                   10));
+    }
+
+    EventContainer multiset;
+    QElapsedTimer timer;
+
+    timer.start();
+    for (Event *event : events) {
+        multiset.insert(event);
+    }
+    const qint64 insert = timer.nsecsElapsed();
+
+    QCOMPARE(multiset.size(), size_t(eventCount));
+
+    timeT previous = -1;
+    for (const Event *event : multiset) {
+        QVERIFY(event->getAbsoluteTime() > previous);
+        previous = event->getAbsoluteTime();
+    }
+
+    constexpr int scanPasses = 20;
+    timeT total = 0;
+
+    timer.start();
+    for (int pass = 0; pass < scanPasses; ++pass) {
+        for (EventContainer::const_iterator i = multiset.begin();
+             i != multiset.end(); ++i) {
+            total += (*i)->getAbsoluteTime();
+        }
+    }
+    const qint64 scan = timer.nsecsElapsed();
+
+    QVERIFY(total > 0);
+
+    // Like Segment::findTime().
+    std::vector<Event> probes;
+    probes.reserve(eventCount);
+    for (int i = 0; i < eventCount; ++i) {
+        probes.push_back(Event("dummy", timeT(i) * 31 % eventCount * 10, 0,
+                               MIN_SUBORDERING));
+    }
+
+    size_t found = 0;
+
+    timer.start();
+    for (const Event &probe : probes) {
+        EventContainer::const_iterator i = multiset.lower_bound(&probe);
+        found += (i != multiset.end());
+    }
+    const qint64 find = timer.nsecsElapsed();
+
+    QCOMPARE(found, size_t(eventCount));
+
+    timer.start();
+    for (EventContainer::iterator i = multiset.begin(); i != multiset.end(); )
+        i = multiset.erase(i);
+    const qint64 erase = timer.nsecsElapsed();
+
+    QVERIFY(multiset.empty());
+
+    qDebug() << "100k events in EventContainer, msecs";
+    qDebug() << "  insert:" << insert / 1000000.0;
+    qDebug() << "  scan x" << scanPasses << ":" << scan / 1000000.0;
+    qDebug() << "  findTime:" << find / 1000000.0;
+    qDebug() << "  erase:" << erase / 1000000.0;
+
+    for (Event *event : events) {
+        delete event;
+    }
+}
+
+QTEST_MAIN(TestEventContainer)
+
+#include "eventcontainer.moc"
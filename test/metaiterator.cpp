@@ -0,0 +1,244 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2023 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "gui/seqmanager/MappedEventBuffer.h"
+#include "sound/MappedBufMetaIterator.h"
+#include "sound/MappedEvent.h"
+#include "sound/MappedInserterBase.h"
+
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QTest>
+
+#include <random>
+#include <vector>
+
+using namespace Rosegarden;
+
+namespace
+{
+
+/// A buffer that plays a fixed list of notes.
+class TestBuffer : public MappedEventBuffer
+{
+public:
+    explicit TestBuffer(const std::vector<MappedEvent> &events) :
+        MappedEventBuffer(nullptr),
+        m_events(events)
+    {
+    }
+
+protected:
+    int calculateSize() override  { return int(m_events.size()); }
+
+    void fillBuffer() override
+    {
+        for (size_t i = 0; i < m_events.size(); ++i) {
+            getBuffer()[i] = m_events[i];
+        }
+        resize(int(m_events.size()));
+
+        if (m_events.empty())
+            return;
+
+        const MappedEvent &last = m_events.back();
+        setStartEnd(m_events.front().getEventTime(),
+                    last.getEventTime() + last.getDuration());
+    }
+
+    bool shouldPlay(MappedEvent *, RealTime) override  { return true; }
+
+private:
+    std::vector<MappedEvent> m_events;
+};
+
+/// Collects everything fetched.
+class TestInserter : public MappedInserterBase
+{
+public:
+    void insertCopy(const MappedEvent &evt) override
+            { m_events.push_back(evt); }
+
+    std::vector<MappedEvent> m_events;
+};
+
+}
+
+/// Tests MappedBufMetaIterator's merge of many buffers.
+class TestMetaIterator : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testFetch();
+    void testJump();
+    void benchmark();
+
+private:
+    /// Fill meta with segmentCount buffers of notes over [0, seconds).
+    /**
+     * The first denseCount buffers get a note every 50ms, the rest one
+     * every ten seconds or so, like a big arrangement with mostly
+     * sparse controller and pad tracks.
+     */
+    static size_t addBuffers(MappedBufMetaIterator &meta,
+                             int segmentCount,
+                             int denseCount,
+                             int seconds);
+
+    /// Play from start to end in slices like the sequencer does.
+    static void play(MappedBufMetaIterator &meta,
+                     TestInserter &inserter,
+                     RealTime start,
+                     RealTime end);
+};
+
+size_t
+TestMetaIterator::addBuffers(MappedBufMetaIterator &meta,
+                             int segmentCount,
+                             int denseCount,
+                             int seconds)
+{
+    std::mt19937 random(1);
+    size_t total = 0;
+
+    for (int segment = 0; segment < segmentCount; ++segment) {
+        const bool dense = (segment < denseCount);
+        std::vector<MappedEvent> events;
+
+        // Pitch and instrument identify the note for the checks.
+        for (double time = random() % 10000 / 1000.0;
+             time < seconds;
+             time += dense ? 0.05 : 10.0 + random() % 100 / 1000.0) {
+            MappedEvent event(segment, MappedEvent::MidiNote,
+                              events.size() % 128, 100);
+            event.setEventTime(RealTime::fromSeconds(time));
+            event.setDuration(RealTime::fromSeconds(0.1));
+            events.push_back(event);
+        }
+
+        total += events.size();
+
+        QSharedPointer<TestBuffer> buffer(new TestBuffer(events));
+        buffer->init();
+        meta.addBuffer(buffer);
+    }
+
+    return total;
+}
+
+void
+TestMetaIterator::play(MappedBufMetaIterator &meta,
+                       TestInserter &inserter,
+                       RealTime start,
+                       RealTime end)
+{
+    // The sequencer's usual slice.
+    const RealTime slice(0, 160000000);
+
+    meta.jumpToTime(start);
+
+    for (RealTime time = start; time < end; time = time + slice) {
+        meta.fetchEvents(inserter, time, time + slice);
+    }
+}
+
+static void checkOrder(const std::vector<MappedEvent> &events,
+                       int segmentCount)
+{
+    // Within each buffer, notes come out in order, once each.
+    std::vector<int> nextPitch(segmentCount, 0);
+    std::vector<RealTime> lastTime(segmentCount, RealTime(-1, 0));
+
+    for (const MappedEvent &event : events) {
+        const int segment = int(event.getInstrument());
+        QVERIFY(segment < segmentCount);
+        QCOMPARE(int(event.getPitch()), nextPitch[segment] % 128);
+        QVERIFY(event.getEventTime() >= lastTime[segment]);
+
+        ++nextPitch[segment];
+        lastTime[segment] = event.getEventTime();
+    }
+}
+
+void TestMetaIterator::testFetch()
+{
+    constexpr int segmentCount = 50;
+
+    MappedBufMetaIterator meta;
+    const size_t total = addBuffers(meta, segmentCount, 5, 120);
+
+    TestInserter inserter;
+    play(meta, inserter, RealTime::zero(), RealTime(121, 0));
+
+    QCOMPARE(inserter.m_events.size(), total);
+    checkOrder(inserter.m_events, segmentCount);
+}
+
+void TestMetaIterator::testJump()
+{
+    constexpr int segmentCount = 50;
+
+    MappedBufMetaIterator meta;
+    addBuffers(meta, segmentCount, 5, 120);
+
+    // Play the first half, then jump back and play it all.
+    TestInserter inserter;
+    play(meta, inserter, RealTime::zero(), RealTime(60, 0));
+    const size_t firstHalf = inserter.m_events.size();
+
+    TestInserter everything;
+    play(meta, everything, RealTime::zero(), RealTime(121, 0));
+
+    QVERIFY(firstHalf < everything.m_events.size());
+    checkOrder(everything.m_events, segmentCount);
+
+    // Jumping forward skips what is before the jump.
+    TestInserter secondHalf;
+    play(meta, secondHalf, RealTime(60, 0), RealTime(121, 0));
+
+    for (const MappedEvent &event : secondHalf.m_events) {
+        QVERIFY(event.getEventTime() + event.getDuration() >=
+                RealTime(60, 0));
+    }
+    QVERIFY(firstHalf + secondHalf.m_events.size() >=
+            everything.m_events.size());
+}
+
+void TestMetaIterator::benchmark()
+{
+    constexpr int segmentCount = 1000;
+
+    MappedBufMetaIterator meta;
+    const size_t total = addBuffers(meta, segmentCount, 10, 600);
+
+    TestInserter inserter;
+    inserter.m_events.reserve(total);
+
+    QElapsedTimer timer;
+    timer.start();
+    play(meta, inserter, RealTime::zero(), RealTime(601, 0));
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    QCOMPARE(inserter.m_events.size(), total);
+
+    qDebug() << segmentCount << "segments," << total
+             << "events, 10 minutes in 160ms slices, msecs:"
+             << elapsed / 1000000.0;
+}
+
+QTEST_MAIN(TestMetaIterator)
+
+#include "metaiterator.moc"
@@ -0,0 +1,214 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Composition.h"
+#include "base/NotationTypes.h"
+#include "base/RealTime.h"
+#include "base/TimeSignature.h"
+
+#include <QElapsedTimer>
+#include <QTest>
+
+#include <cstdlib>
+
+using namespace Rosegarden;
+
+/// Tests the Composition's tempo and bar maps.
+class TestTempoMap : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testDefaultTempo();
+    void testTempoChanges();
+    void testRamp();
+    void testBars();
+    void testNegativeTime();
+    void benchmark();
+};
+
+static const timeT crotchet = Note(Note::Crotchet).getDuration();
+static const timeT bar = crotchet * 4;
+
+static bool near(const RealTime &a, const RealTime &b)
+{
+    RealTime difference = a - b;
+    if (difference < RealTime::zero())
+        difference = RealTime::zero() - difference;
+    return difference < RealTime(0, 1000);
+}
+
+void TestTempoMap::testDefaultTempo()
+{
+    Composition composition;
+
+    // 120 qpm
+    QVERIFY(near(composition.getElapsedRealTime(bar), RealTime(2, 0)));
+    QCOMPARE(composition.getElapsedTimeForRealTime(RealTime(2, 0)), bar);
+
+    // The map has to follow the default tempo.
+    composition.setCompositionDefaultTempo(Composition::getTempoForQpm(60));
+    QVERIFY(near(composition.getElapsedRealTime(bar), RealTime(4, 0)));
+    QCOMPARE(composition.getTempoAtTime(bar),
+             Composition::getTempoForQpm(60));
+}
+
+void TestTempoMap::testTempoChanges()
+{
+    Composition composition;
+
+    const int n = composition.addTempoAtTime(bar,
+                                             Composition::getTempoForQpm(60));
+    QCOMPARE(n, 0);
+    QCOMPARE(composition.getTempoChangeCount(), 1);
+    QCOMPARE(composition.getTempoChangeNumberAt(bar - 1), -1);
+    QCOMPARE(composition.getTempoChangeNumberAt(bar), 0);
+    QCOMPARE(composition.getTempoChange(0).first, bar);
+
+    QVERIFY(near(composition.getElapsedRealTime(bar * 2), RealTime(6, 0)));
+    QCOMPARE(composition.getElapsedTimeForRealTime(RealTime(6, 0)), bar * 2);
+    QCOMPARE(composition.getTempoAtTime(bar + 1),
+             Composition::getTempoForQpm(60));
+    QCOMPARE(composition.getTempoAtTime(bar - 1),
+             Composition::getTempoForQpm(120));
+
+    composition.removeTempoChange(0);
+    QVERIFY(near(composition.getElapsedRealTime(bar * 2), RealTime(4, 0)));
+}
+
+void TestTempoMap::testRamp()
+{
+    Composition composition;
+
+    // 60 qpm ramping to 120 qpm over bar 2, then 120 qpm.
+    composition.addTempoAtTime(bar, Composition::getTempoForQpm(60));
+    composition.addTempoAtTime(bar * 2, Composition::getTempoForQpm(60), 0);
+    composition.addTempoAtTime(bar * 3, Composition::getTempoForQpm(120));
+
+    // Ramps are linear in 1/tempo, so halfway is 80 qpm.
+    const tempoT halfway = composition.getTempoAtTime(bar * 2 + bar / 2);
+    QVERIFY(std::abs(halfway - Composition::getTempoForQpm(80)) <= 1);
+
+    // 2s + 4s + (1s + 0.5s) / 2 * 4 + 1s
+    QVERIFY(near(composition.getElapsedRealTime(bar * 3), RealTime(9, 0)));
+    QVERIFY(near(composition.getElapsedRealTime(bar * 3 + crotchet * 2),
+                 RealTime(10, 0)));
+
+    for (timeT t = 0; t < bar * 4; t += 97) {
+        const timeT roundTrip = composition.getElapsedTimeForRealTime
+            (composition.getElapsedRealTime(t));
+        QVERIFY(std::abs(roundTrip - t) <= 1);
+    }
+}
+
+void TestTempoMap::testBars()
+{
+    Composition composition;
+
+    composition.addTimeSignature(bar * 2, TimeSignature(3, 4));
+    const timeT threeFour = crotchet * 3;
+
+    QCOMPARE(composition.getBarNumber(bar * 2 - 1), 1);
+    QCOMPARE(composition.getBarNumber(bar * 2), 2);
+    QCOMPARE(composition.getBarNumber(bar * 2 + threeFour), 3);
+    QCOMPARE(composition.getBarRange(3),
+             std::make_pair(bar * 2 + threeFour, bar * 2 + threeFour * 2));
+    QCOMPARE(composition.getTimeSignatureAt(bar * 2 + 1).getNumerator(), 3);
+    QCOMPARE(composition.getTimeSignatureAt(bar * 2 - 1).getNumerator(), 4);
+
+    // 6/8 part way through bar 2 cuts it short.
+    const timeT sixEight = bar * 2 + crotchet * 2;
+    composition.addTimeSignature(sixEight, TimeSignature(6, 8));
+
+    QCOMPARE(composition.getBarRange(2), std::make_pair(bar * 2, sixEight));
+    QCOMPARE(composition.getBarNumber(sixEight - 1), 2);
+    QCOMPARE(composition.getBarNumber(sixEight), 3);
+    QCOMPARE(composition.getBarStart(4), sixEight + crotchet * 3);
+
+    bool isNew = false;
+    QCOMPARE(composition.getTimeSignatureInBar(3, isNew).getNumerator(), 6);
+    QVERIFY(isNew);
+    QCOMPARE(composition.getTimeSignatureInBar(4, isNew).getNumerator(), 6);
+    QVERIFY(!isNew);
+
+    QCOMPARE(composition.getTimeSignatureCount(), 2);
+    QCOMPARE(composition.getTimeSignatureNumberAt(sixEight), 1);
+    QCOMPARE(composition.getTimeSignatureChange(1).first, sixEight);
+
+    composition.removeTimeSignature(1);
+    QCOMPARE(composition.getBarNumber(sixEight), 2);
+}
+
+void TestTempoMap::testNegativeTime()
+{
+    Composition composition;
+
+    // A time signature at zero also applies to a count-in.
+    composition.addTimeSignature(0, TimeSignature(3, 4));
+    const timeT threeFour = crotchet * 3;
+
+    QCOMPARE(composition.getBarNumber(-1), -1);
+    QCOMPARE(composition.getBarNumber(-threeFour), -1);
+    QCOMPARE(composition.getBarRange(-1), std::make_pair(-threeFour, timeT(0)));
+    QCOMPARE(composition.getTimeSignatureAt(-1).getNumerator(), 3);
+
+    composition.addTempoAtTime(0, Composition::getTempoForQpm(60));
+    QCOMPARE(composition.getTempoAtTime(-1), Composition::getTempoForQpm(60));
+}
+
+void TestTempoMap::benchmark()
+{
+    // A long film score with a tempo or time signature change in most bars.
+    Composition composition;
+
+    constexpr int bars = 2000;
+    for (int i = 0; i < bars; ++i) {
+        if (i % 3 == 0)
+            composition.addTimeSignature(bar * i, TimeSignature(3 + i % 4, 4));
+        composition.addTempoAtTime(bar * i,
+                                   Composition::getTempoForQpm(60 + i % 90),
+                                   (i % 5 == 0) ? 0 : -1);
+    }
+    composition.setEndMarker(bar * bars);
+
+    constexpr int lookups = 1000000;
+    const timeT end = composition.getBarStart(bars);
+
+    QElapsedTimer timer;
+    RealTime total;
+
+    timer.start();
+    for (int i = 0; i < lookups; ++i) {
+        total = total + composition.getElapsedRealTime(timeT(i) * 7919 % end);
+    }
+    const qint64 toRealTime = timer.nsecsElapsed();
+
+    timeT totalTime = 0;
+
+    timer.start();
+    for (int i = 0; i < lookups; ++i) {
+        totalTime += composition.getElapsedTimeForRealTime
+            (RealTime::fromSeconds(double(i % 10000)));
+    }
+    const qint64 fromRealTime = timer.nsecsElapsed();
+
+    int totalBars = 0;
+
+    timer.start();
+    for (int i = 0; i < lookups; ++i) {
+        totalBars += composition.getBarNumber(timeT(i) * 7919 % end);
+    }
+    const qint64 barNumber = timer.nsecsElapsed();
+
+    QVERIFY(total > RealTime::zero());
+    QVERIFY(totalTime > 0);
+    QVERIFY(totalBars > 0);
+
+    qDebug() << lookups << "lookups, msecs";
+    qDebug() << "  getElapsedRealTime:" << toRealTime / 1000000.0;
+    qDebug() << "  getElapsedTimeForRealTime:" << fromRealTime / 1000000.0;
+    qDebug() << "  getBarNumber:" << barNumber / 1000000.0;
+}
+
+QTEST_MAIN(TestTempoMap)
+
+#include "tempomap.moc"
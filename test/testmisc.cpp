@@ -6,6 +6,10 @@
 #include "base/NotationTypes.h"
 #include "base/SegmentNotationHelper.h"
 #include "base/SegmentPerformanceHelper.h"
+#include "sound/MappedEvent.h"
+#include "sound/MappedEventList.h"
+#include "sound/Midi.h"
+#include "sound/NoteOffQueue.h"
 
 #include <QtGlobal>
 #include <QDebug>
@@ -26,6 +30,9 @@ private Q_SLOTS:
     void testEvent();
     void testEventPerformance();
     void testNotationTypes();
+    void testMappedEvent();
+    void testMappedEventList();
+    void testNoteOffQueue();
 };
 
 void TestMisc::testEvent() try
@@ -100,6 +107,15 @@ void TestMisc::testEvent() try
     e.setMaybe<Int>(SOME_INT_PROPERTY, 5);
     QCOMPARE(e.get<Int>(SOME_INT_PROPERTY), 4l);
 
+    qDebug() << "Testing event type interning...";
+
+    QVERIFY(&Event::internType("note") == &Note::EventType);
+    QVERIFY(&e.getType() == &Note::EventType);
+    QVERIFY(e.isa(Note::EventType));
+    QVERIFY(e.isa(std::string("note")));
+    QVERIFY(!e.isa(Note::EventRestType));
+    QVERIFY(!e.isa(std::string("rest")));
+
     qDebug() << "Testing debug dump : ";
     qDebug() << e;
     qDebug() << "dump finished";
@@ -441,6 +457,156 @@ void TestMisc::testNotationTypes() {
     // ??? Do we need to test something here?
 }
 
+void TestMisc::testMappedEvent()
+{
+    // SysEx data blocks.
+    MappedEvent sysEx(0, MappedEvent::MidiSystemMessage,
+                      MIDI_SYSTEM_EXCLUSIVE);
+    sysEx.addDataString("abc");
+    sysEx.addDataString("def");
+    QCOMPARE(DataBlockRepository::getDataBlockForEvent(&sysEx),
+             std::string("abcdef"));
+
+    std::string out("F0");
+    DataBlockRepository::appendDataBlockForEvent(&sysEx, out);
+    QCOMPARE(out, std::string("F0abcdef"));
+
+    // Copies share the block.
+    MappedEvent copy(sysEx);
+    DataBlockRepository::setDataBlockForEvent(&copy, "xyz");
+    QCOMPARE(DataBlockRepository::getDataBlockForEvent(&sysEx),
+             std::string("xyz"));
+
+    // Audio fields live out of line.
+    MappedEvent audio(0, 1, RealTime(1, 0), RealTime(2, 0),
+                      RealTime(0, 500));
+    QCOMPARE(audio.getAudioStartMarker(), RealTime(0, 500));
+    QCOMPARE(audio.getRuntimeSegmentId(), -1);
+    QVERIFY(!audio.isAutoFading());
+
+    audio.setRuntimeSegmentId(7);
+    audio.setAutoFade(true);
+    audio.setFadeInTime(RealTime(0, 10));
+    audio.setFadeOutTime(RealTime(0, 20));
+
+    MappedEvent audioCopy;
+    audioCopy = audio;
+    QCOMPARE(audioCopy.getAudioStartMarker(), RealTime(0, 500));
+    QCOMPARE(audioCopy.getRuntimeSegmentId(), 7);
+    QVERIFY(audioCopy.isAutoFading());
+    QCOMPARE(audioCopy.getFadeInTime(), RealTime(0, 10));
+    QCOMPARE(audioCopy.getFadeOutTime(), RealTime(0, 20));
+
+    // Changing one doesn't change the other.
+    audioCopy.setRuntimeSegmentId(8);
+    QCOMPARE(audio.getRuntimeSegmentId(), 7);
+
+    // MIDI events don't pay for them.
+    MappedEvent note(0, MappedEvent::MidiNote, 60, 100);
+    QCOMPARE(note.getRuntimeSegmentId(), -1);
+    QCOMPARE(note.getAudioStartMarker(), RealTime::zero());
+    QVERIFY(sizeof(MappedEvent) <= 48);
+
+    // Clearing the SysEx blocks leaves the audio fields alone.
+    DataBlockRepository::clear();
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&sysEx).empty());
+    QCOMPARE(audio.getAudioStartMarker(), RealTime(0, 500));
+    QCOMPARE(audio.getRuntimeSegmentId(), 7);
+    QVERIFY(audio.isAutoFading());
+    QCOMPARE(audio.getFadeOutTime(), RealTime(0, 20));
+
+    // Equal audio fields share a record.
+    MappedEvent audio2(0, 2, RealTime(5, 0), RealTime(2, 0),
+                       RealTime(0, 500));
+    audio2.setAudioData(audio.getAudioData());
+    QCOMPARE(audio2.getRuntimeSegmentId(), 7);
+    QCOMPARE(audio2.getFadeInTime(), RealTime(0, 10));
+}
+
+void TestMisc::testMappedEventList()
+{
+    MappedEventList list;
+
+    // Out of order, with ties.  Ties keep the order they went in.
+    const int times[] = { 3, 1, 2, 1, 3, 0 };
+    for (int i = 0; i < 6; ++i) {
+        MappedEvent event(0, MappedEvent::MidiNote, i, 100);
+        event.setEventTime(RealTime(times[i], 0));
+        list.insertCopy(event);
+    }
+
+    const int expected[] = { 5, 1, 3, 2, 0, 4 };
+    int n = 0;
+    for (const MappedEvent *event : list) {
+        QCOMPARE(int(event->getPitch()), expected[n]);
+        ++n;
+    }
+    QCOMPARE(n, 6);
+
+    for (MappedEventList::iterator i = list.begin(); i != list.end(); ) {
+        if ((*i)->getEventTime() == RealTime(1, 0))
+            i = list.erase(i);
+        else
+            ++i;
+    }
+    QCOMPARE(list.size(), size_t(4));
+
+    MappedEventList copy(list);
+    copy.merge(list);
+    QCOMPARE(copy.size(), size_t(8));
+    QCOMPARE(int((*copy.begin())->getPitch()), 5);
+
+    list.clear();
+    QVERIFY(list.empty());
+}
+
+void TestMisc::testNoteOffQueue()
+{
+    NoteOffQueue queue;
+
+    // Spread across the levels of the wheel, and one far beyond them.
+    const int msecs[] = { 5, 300, 2, 70000, 5, 20000000 };
+    for (int i = 0; i < 6; ++i) {
+        queue.insert(NoteOffEvent(RealTime(msecs[i] / 1000,
+                                           msecs[i] % 1000 * 1000000),
+                                  60 + i, 0, 0));
+    }
+    queue.insert(NoteOffEvent(RealTime(0, 300000000), 60, 1, 0));
+    QCOMPARE(queue.size(), size_t(7));
+
+    NoteOffEvent noteOff;
+
+    // Nothing due yet.
+    QVERIFY(!queue.popDue(RealTime(0, 1000000), noteOff));
+
+    QVERIFY(queue.popDue(RealTime(0, 2000000), noteOff));
+    QCOMPARE(int(noteOff.pitch), 62);
+    QVERIFY(!queue.popDue(RealTime(0, 2000000), noteOff));
+
+    // Same note, different channel.
+    QVERIFY(queue.drop(60, 1, 0));
+    QVERIFY(!queue.drop(60, 1, 0));
+
+    // Due in the same millisecond as the time, but not yet.
+    QVERIFY(!queue.popDue(RealTime(0, 4999999), noteOff));
+
+    int count = 0;
+    while (queue.popDue(RealTime(10, 0), noteOff)) {
+        QVERIFY(noteOff.realTime <= RealTime(10, 0));
+        ++count;
+    }
+    QCOMPARE(count, 3);
+
+    queue.dropBefore(RealTime(70, 0));
+    QCOMPARE(queue.size(), size_t(2));
+
+    // Rewind, like AlsaDriver::resetPlayback().
+    queue.retime([](NoteOffEvent &event) { event.realTime = RealTime::zero(); });
+    QVERIFY(queue.popDue(RealTime::zero(), noteOff));
+    QVERIFY(queue.pop(noteOff));
+    QVERIFY(queue.empty());
+}
+
 QTEST_MAIN(TestMisc)
 
 #include "testmisc.moc"